@@ -195,7 +195,7 @@ typedef struct
 }
 TLN_SpriteInfo;
 
-/*! Tile information returned by TLN_GetLayerTile() */
+/*! Tile information returned by TLN_GetLayerTile(), TLN_GetLayerTilesInRect() and TLN_GetSpriteLayerTiles() */
 typedef struct
 {
 	uint16_t index;	/*!< tile index */
@@ -268,6 +268,9 @@ typedef struct Sequence*	 TLN_Sequence;			/*!< Opaque sequence reference */
 typedef struct SequencePack* TLN_SequencePack;		/*!< Opaque sequence pack reference */
 typedef struct Bitmap*		 TLN_Bitmap;			/*!< Opaque bitmap reference */
 typedef struct ObjectList*	 TLN_ObjectList;		/*!< Opaque object list reference */
+typedef struct SpriteGroup*	 TLN_SpriteGroup;		/*!< Opaque sprite group reference */
+typedef struct PaletteRamp*	 TLN_PaletteRamp;		/*!< Opaque palette fade ramp reference */
+typedef struct LoadRequest*	 TLN_LoadRequest;		/*!< Opaque asynchronous load request */
 
 /*! Image Tile items for TLN_CreateImageTileset() */
 typedef struct
@@ -294,6 +297,26 @@ typedef struct
 }
 TLN_SpriteState;
 
+/*! Sprite group instance, see TLN_GetSpriteGroupInstances() */
+typedef struct
+{
+	int x;				/*!< Screen position x of the frame */
+	int y;				/*!< Screen position y of the frame */
+	uint16_t index;		/*!< graphic index inside spriteset */
+	uint16_t flags;		/*!< FLAG_FLIPX and/or FLAG_FLIPY, combined with the group flags */
+}
+TLN_SpriteInstance;
+
+/*! per-scanline palette change for TLN_SetLayerPaletteTable() */
+typedef struct
+{
+	int line;				/*!< scanline where the change takes effect */
+	TLN_Palette palette;	/*!< palette to use from this line on, or NULL to replace a single color */
+	uint8_t index;			/*!< color index to replace when palette is NULL */
+	uint8_t r, g, b;		/*!< new color when palette is NULL */
+}
+TLN_PaletteLine;
+
 /* callbacks */
 typedef union SDL_Event SDL_Event;
 typedef void(*TLN_VideoCallback)(int scanline);
@@ -382,10 +405,22 @@ typedef enum
 	TLN_ERR_UNSUPPORTED,	/*!< Unsupported function */
 	TLN_ERR_REF_LIST,		/*!< Invalid TLN_ObjectList reference */
 	TLN_ERR_IDX_PALETTE,	/*!< Palette index out of range */
+	TLN_ERR_REF_SPRITEGROUP,/*!< Invalid TLN_SpriteGroup reference */
+	TLN_ERR_REF_PALETTERAMP,/*!< Invalid TLN_PaletteRamp reference */
+	TLN_ERR_REF_LOADREQUEST,/*!< Invalid TLN_LoadRequest reference */
 	TLN_MAX_ERR,
 }
 TLN_Error;
 
+/*! State of an asynchronous load, see TLN_GetLoadState() */
+typedef enum
+{
+	TLN_LOAD_PENDING,	/*!< Queued or being loaded */
+	TLN_LOAD_READY,		/*!< Loaded, waiting for TLN_CommitLoad() */
+	TLN_LOAD_FAILED,	/*!< Failed, TLN_CommitLoad() sets the error */
+}
+TLN_LoadState;
+
 /*! Debug level */
 typedef enum
 {
@@ -429,6 +464,9 @@ TLNAPI void TLN_SetRasterCallback (TLN_VideoCallback);
 TLNAPI void TLN_SetFrameCallback (TLN_VideoCallback);
 TLNAPI void TLN_SetRenderTarget (uint8_t* data, int pitch);
 TLNAPI void TLN_UpdateFrame (int frame);
+TLNAPI void TLN_SimulateFrame (int frame);
+TLNAPI void TLN_AdvanceTime (int usec);
+TLNAPI void TLN_EnableManualTime (bool enable);
 TLNAPI void TLN_SetLoadPath (const char* path);
 TLNAPI void TLN_SetCustomBlendFunction (TLN_BlendFunction);
 TLNAPI void TLN_SetLogLevel(TLN_LogLevel log_level);
@@ -483,11 +521,14 @@ TLNAPI void TLN_SetWindowScaleFactor(int);
 * @{ */
 TLNAPI TLN_Spriteset TLN_CreateSpriteset (TLN_Bitmap bitmap, TLN_SpriteData* data, int num_entries);
 TLNAPI TLN_Spriteset TLN_LoadSpriteset (const char* name);
+TLNAPI TLN_Spriteset TLN_LoadBakedSpriteset (const char* filename);
+TLNAPI bool TLN_SaveBakedSpriteset (TLN_Spriteset spriteset, const char* filename);
 TLNAPI TLN_Spriteset TLN_CloneSpriteset (TLN_Spriteset src);
 TLNAPI bool TLN_GetSpriteInfo (TLN_Spriteset spriteset, int entry, TLN_SpriteInfo* info);
 TLNAPI TLN_Palette TLN_GetSpritesetPalette (TLN_Spriteset spriteset);
 TLNAPI int TLN_FindSpritesetSprite (TLN_Spriteset spriteset, const char* name);
 TLNAPI bool TLN_SetSpritesetData (TLN_Spriteset spriteset, int entry, TLN_SpriteData* data, void* pixels, int pitch);
+TLNAPI bool TLN_EnableSpritesetSpans (TLN_Spriteset spriteset, bool enable);
 TLNAPI bool TLN_DeleteSpriteset (TLN_Spriteset Spriteset);
 /**@}*/
 
@@ -500,6 +541,7 @@ TLNAPI TLN_Tileset TLN_CreateImageTileset(int numtiles, TLN_TileImage* images);
 TLNAPI TLN_Tileset TLN_LoadTileset (const char* filename);
 TLNAPI TLN_Tileset TLN_CloneTileset (TLN_Tileset src);
 TLNAPI bool TLN_SetTilesetPixels (TLN_Tileset tileset, int entry, uint8_t* srcdata, int srcpitch);
+TLNAPI bool TLN_SetTilesetCache (TLN_Tileset tileset, bool enable);
 TLNAPI int TLN_GetTileWidth (TLN_Tileset tileset);
 TLNAPI int TLN_GetTileHeight (TLN_Tileset tileset);
 TLNAPI int TLN_GetTilesetNumTiles(TLN_Tileset tileset);
@@ -514,6 +556,8 @@ TLNAPI bool TLN_DeleteTileset (TLN_Tileset tileset);
 * @{ */
 TLNAPI TLN_Tilemap TLN_CreateTilemap (int rows, int cols, TLN_Tile tiles, uint32_t bgcolor, TLN_Tileset tileset);
 TLNAPI TLN_Tilemap TLN_LoadTilemap (const char* filename, const char* layername);
+TLNAPI TLN_Tilemap TLN_LoadBakedTilemap (const char* filename);
+TLNAPI bool TLN_SaveBakedTilemap (TLN_Tilemap tilemap, const char* filename);
 TLNAPI TLN_Tilemap TLN_CloneTilemap (TLN_Tilemap src);
 TLNAPI int TLN_GetTilemapRows (TLN_Tilemap tilemap);
 TLNAPI int TLN_GetTilemapCols (TLN_Tilemap tilemap);
@@ -525,6 +569,7 @@ TLNAPI bool TLN_GetTilemapTile (TLN_Tilemap tilemap, int row, int col, TLN_Tile
 TLNAPI bool TLN_SetTilemapTile (TLN_Tilemap tilemap, int row, int col, TLN_Tile tile);
 TLNAPI bool TLN_CopyTiles (TLN_Tilemap src, int srcrow, int srccol, int rows, int cols, TLN_Tilemap dst, int dstrow, int dstcol);
 TLNAPI TLN_Tile TLN_GetTilemapTiles(TLN_Tilemap tilemap, int row, int col);
+TLNAPI bool TLN_SetTilemapMaxChunks(TLN_Tilemap tilemap, int num_chunks);
 TLNAPI bool TLN_DeleteTilemap (TLN_Tilemap tilemap);
 /**@}*/
 
@@ -540,6 +585,11 @@ TLNAPI bool TLN_MixPalettes (TLN_Palette src1, TLN_Palette src2, TLN_Palette dst
 TLNAPI bool TLN_AddPaletteColor (TLN_Palette palette, uint8_t r, uint8_t g, uint8_t b, uint8_t start, uint8_t num);
 TLNAPI bool TLN_SubPaletteColor (TLN_Palette palette, uint8_t r, uint8_t g, uint8_t b, uint8_t start, uint8_t num);
 TLNAPI bool TLN_ModPaletteColor (TLN_Palette palette, uint8_t r, uint8_t g, uint8_t b, uint8_t start, uint8_t num);
+TLNAPI bool TLN_FadePalettes (TLN_Palette* src, TLN_Palette* dst, int count, uint8_t r, uint8_t g, uint8_t b, uint8_t factor);
+TLNAPI TLN_PaletteRamp TLN_CreatePaletteRamp (TLN_Palette src, uint8_t r, uint8_t g, uint8_t b, int steps);
+TLNAPI bool TLN_SetPaletteRampStep (TLN_PaletteRamp ramp, TLN_Palette dst, int step);
+TLNAPI int TLN_GetPaletteRampSteps (TLN_PaletteRamp ramp);
+TLNAPI bool TLN_DeletePaletteRamp (TLN_PaletteRamp ramp);
 TLNAPI uint8_t* TLN_GetPaletteData (TLN_Palette palette, int index);
 TLNAPI int TLN_GetPaletteNumColors(TLN_Palette palette);
 TLNAPI bool TLN_DeletePalette (TLN_Palette palette);
@@ -551,6 +601,7 @@ TLNAPI bool TLN_DeletePalette (TLN_Palette palette);
 * @{ */
 TLNAPI TLN_Bitmap TLN_CreateBitmap (int width, int height, int bpp);
 TLNAPI TLN_Bitmap TLN_LoadBitmap (const char* filename);
+TLNAPI TLN_Bitmap TLN_LoadDirectBitmap (const char* filename);
 TLNAPI TLN_Bitmap TLN_CloneBitmap (TLN_Bitmap src);
 TLNAPI uint8_t* TLN_GetBitmapPtr (TLN_Bitmap bitmap, int x, int y);
 TLNAPI int TLN_GetBitmapWidth (TLN_Bitmap bitmap);
@@ -590,6 +641,7 @@ TLNAPI bool TLN_SetLayerTransform (int layer, float angle, float dx, float dy, f
 TLNAPI bool TLN_SetLayerPixelMapping (int nlayer, TLN_PixelMap* table);
 TLNAPI bool TLN_SetLayerBlendMode (int nlayer, TLN_Blend mode, uint8_t factor);
 TLNAPI bool TLN_SetLayerColumnOffset (int nlayer, int* offset);
+TLNAPI bool TLN_SetLayerPaletteTable (int nlayer, const TLN_PaletteLine* table, int count);
 TLNAPI bool TLN_SetLayerClip (int nlayer, int x1, int y1, int x2, int y2);
 TLNAPI bool TLN_DisableLayerClip (int nlayer);
 TLNAPI bool TLN_SetLayerWindow(int nlayer, int x1, int y1, int x2, int y2, bool invert);
@@ -612,6 +664,8 @@ TLNAPI TLN_Tilemap TLN_GetLayerTilemap(int nlayer);
 TLNAPI TLN_Bitmap TLN_GetLayerBitmap(int nlayer);
 TLNAPI TLN_ObjectList TLN_GetLayerObjects(int nlayer);
 TLNAPI bool TLN_GetLayerTile (int nlayer, int x, int y, TLN_TileInfo* info);
+TLNAPI int TLN_GetLayerTilesInRect (int nlayer, int x, int y, int w, int h, TLN_TileInfo* info, int max_tiles, bool pixel_test);
+TLNAPI int TLN_GetSpriteLayerTiles (int nsprite, int nlayer, TLN_TileInfo* info, int max_tiles, bool pixel_test);
 TLNAPI int TLN_GetLayerWidth (int nlayer);
 TLNAPI int TLN_GetLayerHeight (int nlayer);
 TLNAPI int TLN_GetLayerX(int nlayer);
@@ -656,6 +710,22 @@ TLNAPI bool TLN_DisableSprite (int nsprite);
 TLNAPI TLN_Palette TLN_GetSpritePalette (int nsprite);
 /**@}*/
 
+/**
+ * \defgroup spritegroup
+ * \brief Instanced sprite groups management
+* @{ */
+TLNAPI TLN_SpriteGroup TLN_CreateSpriteGroup (TLN_Spriteset spriteset, int max_instances);
+TLNAPI TLN_SpriteInstance* TLN_GetSpriteGroupInstances (TLN_SpriteGroup group);
+TLNAPI bool TLN_SetSpriteGroupCount (TLN_SpriteGroup group, int count);
+TLNAPI int  TLN_GetSpriteGroupCount (TLN_SpriteGroup group);
+TLNAPI bool TLN_SetSpriteGroupSpriteset (TLN_SpriteGroup group, TLN_Spriteset spriteset);
+TLNAPI bool TLN_SetSpriteGroupPalette (TLN_SpriteGroup group, TLN_Palette palette);
+TLNAPI bool TLN_SetSpriteGroupBlendMode (TLN_SpriteGroup group, TLN_Blend mode, uint8_t factor);
+TLNAPI bool TLN_SetSpriteGroupFlags (TLN_SpriteGroup group, uint32_t flags);
+TLNAPI bool TLN_EnableSpriteGroup (TLN_SpriteGroup group, bool enable);
+TLNAPI bool TLN_DeleteSpriteGroup (TLN_SpriteGroup group);
+/**@}*/
+
 /**
  * \defgroup sequence
  * \brief Sequence resources management for layer, sprite and palette animations
@@ -704,6 +774,27 @@ TLNAPI bool TLN_SetSpriteWorldPosition(int nsprite, int x, int y);
 TLNAPI void TLN_ReleaseWorld(void);
 /**@}*/
 
+/**
+ * \defgroup loading
+ * \brief Asynchronous resource loading
+* @{ */
+TLNAPI TLN_LoadRequest TLN_LoadBitmapAsync(const char* filename);
+TLNAPI TLN_LoadRequest TLN_LoadTilesetAsync(const char* filename);
+TLNAPI TLN_LoadRequest TLN_LoadTilemapAsync(const char* filename, const char* layername);
+TLNAPI TLN_LoadRequest TLN_LoadSpritesetAsync(const char* name);
+TLNAPI TLN_LoadRequest TLN_LoadWorldAsync(const char* tmxfile, int first_layer);
+TLNAPI TLN_LoadState TLN_GetLoadState(TLN_LoadRequest request);
+TLNAPI bool TLN_CommitLoad(TLN_LoadRequest request, void* object);
+/**@}*/
+
+/**
+ * \defgroup cache
+ * \brief Cache of loaded resources
+* @{ */
+TLNAPI int TLN_EvictCache(void);
+TLNAPI uint32_t TLN_GetCacheMemory(int* num_resources);
+/**@}*/
+
 #ifdef __cplusplus
 }
 #endif
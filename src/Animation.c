@@ -25,46 +25,72 @@
 /* linear interploation */
 static int lerp (int x, int x0, int x1, int fx0, int fx1)
 {
+	if (x1 == x0)
+		return fx1;
 	return fx0 + (fx1 - fx0)*(x - x0)/(x1 - x0);
 }
 
-static inline void blendColors (uint8_t* srcptr0, uint8_t* srcptr1, uint8_t* dstptr, uint8_t f0, uint8_t f1)
-{
-	dstptr[0] = blendfunc(engine->blend_table, srcptr0[0], f0) + blendfunc(engine->blend_table, srcptr1[0], f1);
-	dstptr[1] = blendfunc(engine->blend_table, srcptr0[1], f0) + blendfunc(engine->blend_table, srcptr1[1], f1);
-	dstptr[2] = blendfunc(engine->blend_table, srcptr0[2], f0) + blendfunc(engine->blend_table, srcptr1[2], f1);
-}
-
 static void SetAnimation (Animation* animation, TLN_Sequence sequence, animation_t type);
 static void ColorCycle (TLN_Palette srcpalette, TLN_Palette dstpalette, struct Strip* strip);
-static void ColorCycleBlend (TLN_Palette srcpalette, TLN_Palette dstpalette, struct Strip* strip, int t);
+static void ColorCycleBlend (TLN_Palette srcpalette, TLN_Palette dstpalette, struct Strip* strip, int64_t t);
+
+/* clock units of a frame delay. Zero delay lasts one frame */
+static inline int get_delay(int delay)
+{
+	return (delay > 0 ? delay : 1) << TIME_BITS;
+}
 
-/* updates animation state */
-void UpdateAnimation(Animation* animation, int time)
+/* updates animation state, stepping all the frames elapsed until given time */
+void UpdateAnimation(Animation* animation, int64_t time)
 {
 	TLN_Sequence sequence = animation->sequence;
 	TLN_SequenceFrame* frames = NULL;
+	int64_t duration = 0;	/* of a whole loop, computed on demand */
+	int index = -1;
 
 	if (animation->type == TYPE_PALETTE)
 	{
 		int i;
+		bool changed = animation->blend;
 		struct Strip* strips = (struct Strip*)&sequence->data;
+
+		/* strip state lives in the sequence: evaluate other animations sharing it before it changes */
+		for (i = 0; i < engine->numanimations; i++)
+		{
+			Animation* other = &engine->animations[i];
+			if (other != animation && other->sequence == sequence && other->palette != NULL && other->palette->cycle == other)
+				UpdatePaletteCycle(other->palette);
+		}
+
 		for (i = 0; i < sequence->count; i++)
 		{
 			struct Strip* strip = &strips[i];
-			/* next frame */
+			/* next frames */
 			if (time >= strip->timer)
 			{
-				strip->timer = time + strip->delay;
-				strip->pos = (strip->pos + 1) % strip->count;
-				strip->t0 = time;
-				if (!animation->blend)
-					ColorCycle(animation->srcpalette, animation->palette, strip);
+				const int delay = get_delay(strip->delay);
+				const int64_t steps = (time - strip->timer) / delay + 1;
+				strip->pos = (strip->pos + steps % strip->count) % strip->count;
+				strip->t0 = strip->timer + (steps - 1)*delay;
+				strip->timer = strip->t0 + delay;
+				if (i < MAX_COLOR_STRIPS)
+					animation->fired |= (uint64_t)1 << i;
+				changed = true;
 			}
+		}
 
-			/* interpolate */
-			if (animation->blend)
-				ColorCycleBlend(animation->srcpalette, animation->palette, strip, time);
+		/* colors are computed when the palette is about to be used, see UpdatePaletteCycle() */
+		animation->time = time;
+		if (changed)
+		{
+			TLN_Palette palette = animation->palette;
+			if (palette->cycle != NULL && palette->cycle != animation)
+				UpdatePaletteCycle(palette);
+			if (palette->cycle == NULL)
+			{
+				palette->cycle = animation;
+				engine->pending_palettes += 1;
+			}
 		}
 		return;
 	}
@@ -72,16 +98,58 @@ void UpdateAnimation(Animation* animation, int time)
 	if (time < animation->timer)
 		return;
 
+	/* step elapsed frames, only the last one is shown */
 	frames = (TLN_SequenceFrame*)&sequence->data;
-	animation->timer = time + frames[animation->pos].delay;
+	while (animation->enabled && time >= animation->timer)
+	{
+		/* fast-forward: skips whole loops at once, only the remainder is stepped frame by frame */
+		if (animation->pos == 0 && animation->loop != 1 && sequence->count > 0)
+		{
+			int64_t loops;
+			if (duration == 0)
+			{
+				int c;
+				for (c = 0; c < sequence->count; c++)
+					duration += get_delay(frames[c].delay);
+			}
+			loops = (time - animation->timer) / duration;
+			if (animation->loop > 1 && loops > animation->loop - 1)
+				loops = animation->loop - 1;
+			animation->timer += loops*duration;
+			if (animation->loop > 1)
+				animation->loop -= (int)loops;
+		}
+
+		animation->timer += get_delay(frames[animation->pos].delay);
+		index = frames[animation->pos].index;
+
+		/* next frame */
+		animation->pos++;
+		if (animation->pos == sequence->count)
+		{
+			if (animation->loop > 1)
+			{
+				animation->loop--;
+				animation->pos = 0;
+			}
+			else if (animation->loop == 1)
+				animation->enabled = false;
+			else if (animation->loop == 0)
+				animation->pos = 0;
+		}
+	}
+
+	if (index == -1)
+		return;
+
 	switch (animation->type)
 	{
 	case TYPE_SPRITE:
-		TLN_SetSpritePicture(animation->nsprite, frames[animation->pos].index);
+		TLN_SetSpritePicture(animation->nsprite, index);
 		break;
 
 	case TYPE_TILESET:
-		animation->tileset->tiles[sequence->target] = frames[animation->pos].index;
+		animation->tileset->tiles[sequence->target] = index;
 		break;
 
 		/* Fall through */
@@ -90,20 +158,175 @@ void UpdateAnimation(Animation* animation, int time)
 	case TYPE_PALETTE:
 		break;
 	}
+}
+
+/* evaluates pending color cycle of a palette, once per frame at most */
+void UpdatePaletteCycle(TLN_Palette palette)
+{
+	Animation* animation = (Animation*)palette->cycle;
+	struct Strip* strips;
+	int i;
+
+	if (animation == NULL)
+		return;
+
+	palette->cycle = NULL;
+	if (engine->pending_palettes > 0)
+		engine->pending_palettes -= 1;
+
+	strips = (struct Strip*)&animation->sequence->data;
+	for (i = 0; i < animation->sequence->count; i++)
+	{
+		if (animation->blend)
+			ColorCycleBlend(animation->srcpalette, palette, &strips[i], animation->time);
+		else if (i >= MAX_COLOR_STRIPS || (animation->fired & ((uint64_t)1 << i)))
+			ColorCycle(animation->srcpalette, palette, &strips[i]);
+	}
+	animation->fired = 0;
+	TouchPalette (palette);
+}
+
+/* scheduler: binary min-heap of animations ordered by due time */
+
+/* ties keep the order of the old polling: palette animations by index, then sprites */
+static bool is_before(const Animation* a, const Animation* b)
+{
+	if (a->due != b->due)
+		return a->due < b->due;
+	if (a->type != b->type)
+		return a->type == TYPE_PALETTE;
+	return a < b;
+}
+
+static void place_animation(int pos, Animation* animation)
+{
+	engine->schedule[pos] = animation;
+	animation->slot = pos + 1;
+}
+
+static void sift_up(int pos)
+{
+	Animation* animation = engine->schedule[pos];
+	while (pos > 0)
+	{
+		const int parent = (pos - 1) >> 1;
+		if (!is_before(animation, engine->schedule[parent]))
+			break;
+		place_animation(pos, engine->schedule[parent]);
+		pos = parent;
+	}
+	place_animation(pos, animation);
+}
+
+static void sift_down(int pos)
+{
+	Animation* animation = engine->schedule[pos];
+	const int count = engine->num_scheduled;
+	while (true)
+	{
+		int child = (pos << 1) + 1;
+		if (child >= count)
+			break;
+		if (child + 1 < count && is_before(engine->schedule[child + 1], engine->schedule[child]))
+			child += 1;
+		if (!is_before(engine->schedule[child], animation))
+			break;
+		place_animation(pos, engine->schedule[child]);
+		pos = child;
+	}
+	place_animation(pos, animation);
+}
+
+/* removes animation from schedule */
+static void unschedule_animation(Animation* animation)
+{
+	const int pos = animation->slot - 1;
+	Animation* last;
+
+	if (animation->slot == 0)
+		return;
+
+	animation->slot = 0;
+	engine->num_scheduled -= 1;
+	if (pos == engine->num_scheduled)
+		return;
+
+	/* fill gap with last item */
+	last = engine->schedule[engine->num_scheduled];
+	place_animation(pos, last);
+	sift_up(pos);
+	sift_down(last->slot - 1);
+}
+
+/* (re)schedules a sprite or palette animation to be updated at given time */
+void ScheduleAnimation(Animation* animation, int64_t time)
+{
+	if (engine->schedule == NULL)
+		return;
+
+	animation->due = time;
+	if (animation->slot == 0)
+	{
+		place_animation(engine->num_scheduled, animation);
+		engine->num_scheduled += 1;
+	}
+	sift_up(animation->slot - 1);
+	sift_down(animation->slot - 1);
+}
 
-	/* next frame */
-	animation->pos++;
-	if (animation->pos == sequence->count)
+/* time when animation must be updated again */
+static int64_t get_next_time(Animation* animation, int64_t time)
+{
+	int64_t next = animation->timer;
+
+	if (animation->type == TYPE_PALETTE)
 	{
-		if (animation->loop > 1)
+		struct Strip* strips = (struct Strip*)&animation->sequence->data;
+		int i;
+
+		/* blended cycles interpolate every frame */
+		if (animation->blend)
+			return time + 1;
+
+		next = strips[0].timer;
+		for (i = 1; i < animation->sequence->count; i++)
 		{
-			animation->loop--;
-			animation->pos = 0;
+			if (strips[i].timer < next)
+				next = strips[i].timer;
 		}
-		else if (animation->loop == 1)
-			animation->enabled = false;
-		else if (animation->loop == 0)
-			animation->pos = 0;
+	}
+
+	/* at most once per update */
+	if (next <= time)
+		next = time + 1;
+	return next;
+}
+
+/* reschedules a paused or hidden animation, without catching up the frames it missed */
+void ResumeAnimation(Animation* animation)
+{
+	if (animation->timer < engine->time)
+		animation->timer = engine->time;
+	ScheduleAnimation(animation, animation->timer);
+}
+
+/* updates scheduled animations that are due at given time */
+void UpdateAnimations(int64_t time)
+{
+	while (engine->num_scheduled > 0 && engine->schedule[0]->due <= time)
+	{
+		Animation* animation = engine->schedule[0];
+		unschedule_animation(animation);
+
+		/* stopped, paused or hidden ones get rescheduled when restarted */
+		if (!animation->enabled || animation->sequence == NULL)
+			continue;
+		if (animation->type == TYPE_SPRITE && (animation->paused || !engine->sprites[animation->nsprite].ok))
+			continue;
+
+		UpdateAnimation(animation, time);
+		if (animation->enabled)
+			ScheduleAnimation(animation, get_next_time(animation, time));
 	}
 }
 
@@ -144,6 +367,10 @@ bool TLN_GetAnimationState (int index)
  * 
  * \param blend
  * true for smooth frame interpolation, false for classic, discrete mode
+ *
+ * \remarks
+ * Colors of the target palette are recomputed at most once per frame, and only when it's
+ * going to be used by a layer, sprite or background bitmap, or queried with TLN_GetPaletteData()
  */
 bool TLN_SetPaletteAnimation (int index, TLN_Palette palette, TLN_Sequence sequence, bool blend)
 {
@@ -169,23 +396,28 @@ bool TLN_SetPaletteAnimation (int index, TLN_Palette palette, TLN_Sequence seque
 	animation = &engine->animations[index];
 	if (!animation->enabled)
 		ListAppendNode(&engine->list_animations, index);
+	else if (animation->palette != NULL && animation->palette->cycle == animation)
+		UpdatePaletteCycle (animation->palette);
 	SetAnimation (animation, sequence, TYPE_PALETTE);
 	animation->palette = palette;
 	animation->blend = blend;
+	animation->fired = 0;
 
 	/* start timers */
 	strips = (struct Strip*)&sequence->data;
 	for (c=0; c<sequence->count; c++)
 	{
-		strips[c].timer = 0;
+		strips[c].timer = engine->time;
 		strips[c].t0 = 0;
 	}
 
 	/* create auxiliary palette */
 	if (animation->srcpalette == NULL)
 		animation->srcpalette = TLN_CreatePalette (256);
-	CopyBaseObject (animation->srcpalette, palette);
+	UpdatePaletteCycle (palette);
+	CopyPalette (animation->srcpalette, palette);
 
+	ScheduleAnimation (animation, 0);
 	return true;
 }
 
@@ -217,8 +449,15 @@ bool TLN_SetPaletteAnimationSource (int index, TLN_Palette palette)
 		return false;
 
 	animation = &engine->animations[index];
-	CopyBaseObject (animation->srcpalette, palette);
-	CopyBaseObject (animation->palette, palette);
+	if (animation->palette == NULL || animation->srcpalette == NULL)
+	{
+		TLN_SetLastError (TLN_ERR_IDX_ANIMATION);
+		return false;
+	}
+	UpdatePaletteCycle (animation->palette);
+	UpdatePaletteCycle (palette);
+	CopyPalette (animation->srcpalette, palette);
+	CopyPalette (animation->palette, palette);
 
 	TLN_SetLastError (TLN_ERR_OK);
 	return true;
@@ -241,6 +480,7 @@ bool SetTilesetAnimation(TLN_Tileset tileset, int index, TLN_Sequence sequence)
 	animation = &tileset->animations[index];
 	SetAnimation(animation, sequence, TYPE_TILESET);
 	animation->tileset = tileset;
+	tileset->next_animation = 0;
 
 	TLN_SetLastError (TLN_ERR_OK);
 	return true;
@@ -282,6 +522,7 @@ bool TLN_SetSpriteAnimation (int nsprite, TLN_Sequence sequence, int loop)
 	SetAnimation (animation, sequence, TYPE_SPRITE);
 	animation->nsprite = nsprite;
 	animation->loop = loop;
+	ScheduleAnimation (animation, 0);
 
 	TLN_SetLastError (TLN_ERR_OK);
 	return true;
@@ -373,11 +614,14 @@ bool TLN_DisablePaletteAnimation (int index)
 	animation = &engine->animations[index];
 	if (animation->enabled)
 		ListUnlinkNode(&engine->list_animations, index);
+
+	/* leave colors as they were last updated */
+	if (animation->palette != NULL && animation->palette->cycle == animation)
+		UpdatePaletteCycle (animation->palette);
 	
 	animation->enabled = false;
 	animation->type = TYPE_NONE;
 	animation->sequence = NULL;
-	ListUnlinkNode(&engine->list_animations, index);
 	TLN_SetLastError (TLN_ERR_OK);
 	return true;
 }
@@ -426,6 +670,8 @@ bool TLN_ResumeSpriteAnimation(int index)
 	sprite = &engine->sprites[index];
 	animation = &sprite->animation;
 	animation->paused = false;
+	if (animation->enabled)
+		ResumeAnimation (animation);
 	TLN_SetLastError(TLN_ERR_OK);
 	return true;
 }
@@ -469,7 +715,7 @@ bool TLN_DisableAnimation(int index)
 /* animation commons */
 static void SetAnimation (Animation* animation, TLN_Sequence sequence, animation_t type)
 {
-	animation->timer = 0;
+	animation->timer = engine != NULL ? engine->time : 0;
 	animation->enabled = true;
 	animation->sequence = sequence;
 	animation->type = type;
@@ -477,59 +723,45 @@ static void SetAnimation (Animation* animation, TLN_Sequence sequence, animation
 	animation->pos = 0;
 }
 
+/* copies count colors rotated by steps: dst[c] = src[(c + steps) % count] */
+static void RotateColors (uint32_t* dst, const uint32_t* src, int count, int steps)
+{
+	steps %= count;
+	if (steps < 0)
+		steps += count;
+	memcpy (dst, src + steps, (count - steps) * sizeof(uint32_t));
+	memcpy (dst + count - steps, src, steps * sizeof(uint32_t));
+}
+
 /* regular color cycle */
 static void ColorCycle (TLN_Palette srcpalette, TLN_Palette dstpalette, struct Strip* strip)
 {
-	int c;
 	uint32_t* srcptr = (uint32_t*)GetPaletteData (srcpalette, strip->first);
 	uint32_t* dstptr = (uint32_t*)GetPaletteData (dstpalette, strip->first);
-	int count = strip->count;
-	int steps = strip->pos;
+	const int steps = strip->dir ? -strip->pos : strip->pos;
 
-	if (strip->dir)
-	{
-		for (c=0; c<count; c++)
-			dstptr[c] = srcptr[(c - steps + count) % count];
-	}
-	else
-	{
-		for (c=0; c<count; c++)
-			dstptr[c] = srcptr[(c + steps) % count];
-	}
+	if (strip->count > 0)
+		RotateColors (dstptr, srcptr, strip->count, steps);
 }
 
 /* blended color cycle */
-static void ColorCycleBlend (TLN_Palette srcpalette, TLN_Palette dstpalette, struct Strip* strip, int t)
+static void ColorCycleBlend (TLN_Palette srcpalette, TLN_Palette dstpalette, struct Strip* strip, int64_t t)
 {
-	int c;
-	int idx0, idx1;
-	uint8_t *srcptr0, *srcptr1, *dstptr;
-
-	int t0 = strip->t0;
-	int t1 = strip->timer;
-	int count = strip->count;
-	int steps = strip->pos;
+	uint32_t colors0[256];
+	uint32_t colors1[256];
+	uint32_t* srcptr = (uint32_t*)GetPaletteData (srcpalette, strip->first);
+	uint32_t* dstptr = (uint32_t*)GetPaletteData (dstpalette, strip->first);
+	const int count = strip->count;
+	const int steps = strip->dir ? -strip->pos : strip->pos;
+	const int next = strip->dir ? steps - 1 : steps + 1;
 
 	/* map [t0 - t1] to [0 - 255] */
-	int f1 = lerp (t, t0,t1, 0,255);
-	int f0 = 255 - f1;
+	const int f1 = lerp ((int)(t - strip->t0), 0, (int)(strip->timer - strip->t0), 0,255);
 
-	for (c=0; c<count; c++)
-	{
-		if (strip->dir)
-		{
-			idx0 = (c - steps + count) % count;
-			idx1 = (c - steps - 1 + count) % count;
-		}
-		else
-		{
-			idx0 = (c + steps) % count;
-			idx1 = (c + steps + 1) % count;
-		}
+	if (count == 0)
+		return;
 
-		srcptr0 = (uint8_t*)GetPaletteData (srcpalette, strip->first + idx0);
-		srcptr1 = (uint8_t*)GetPaletteData (srcpalette, strip->first + idx1);
-		dstptr  = (uint8_t*)GetPaletteData (dstpalette, strip->first + c);
-		blendColors (srcptr0, srcptr1, dstptr, f0, f1);
-	}
+	RotateColors (colors0, srcptr, count, steps);
+	RotateColors (colors1, srcptr, count, next);
+	BlendColors (dstptr, colors0, colors1, count, (uint8_t)f1);
 }
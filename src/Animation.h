@@ -36,16 +36,24 @@ typedef struct
 	bool paused;			/* animation paused */
 	int loop;
 	int pos;
-	int timer;
+	int64_t timer;			/* clock time of next frame */
 	int nsprite;			/* sprite number for sprite animation */
 	bool blend;
 	TLN_Palette palette;
 	TLN_Palette srcpalette;
 	ListNode list_node;
+	int64_t due;			/* time when scheduled animation must be updated */
+	int slot;				/* position inside engine schedule + 1, 0 if not scheduled */
+	int64_t time;			/* time of last color cycle update */
+	uint64_t fired;			/* color strips that advanced since palette was last evaluated */
 }
 Animation;
 
 bool SetTilesetAnimation(TLN_Tileset tileset, int index, TLN_Sequence sequence);
-void UpdateAnimation(Animation* animation, int time);
+void UpdateAnimation(Animation* animation, int64_t time);
+void ScheduleAnimation(Animation* animation, int64_t time);
+void UpdateAnimations(int64_t time);
+void UpdatePaletteCycle(TLN_Palette palette);
+void ResumeAnimation(Animation* animation);
 
 #endif
@@ -0,0 +1,856 @@
+/*
+* Tilengine - The 2D retro graphics engine with raster effects
+* Copyright (C) 2015-2019 Marc Palacios Domenech <mailto:megamarc@hotmail.com>
+* All rights reserved
+*
+* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/.
+* */
+
+/* Baked assets: binary files holding engine objects in their in-memory layout, so loading
+ * is a single copy of each data block from the mapped file, without parsing nor decoding.
+ * Files use the byte order and struct layout of the engine build that wrote them */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "Tilengine.h"
+#include "LoadFile.h"
+#include "Palette.h"
+#include "Bitmap.h"
+#include "Tileset.h"
+#include "Tilemap.h"
+#include "Spriteset.h"
+#include "Sequence.h"
+#include "SequencePack.h"
+
+#define BAKED_ID		"TLNBAKE"
+#define BAKED_VERSION	2
+#define MAX_RECORDS		64
+
+/* file header */
+typedef struct
+{
+	char id[8];				/* "TLNBAKE" null-terminated */
+	uint32_t version;		/* BAKED_VERSION */
+	uint32_t num_records;	/* number of records, the last one is the root object */
+}
+BakedHeader;
+
+/* record header, followed by size bytes padded to 4 bytes. Records reference previous ones by index */
+typedef struct
+{
+	uint32_t type;			/* ObjectType */
+	uint32_t size;
+}
+BakedRecord;
+
+typedef struct
+{
+	int32_t entries;
+}
+BakedPalette;
+
+typedef struct
+{
+	int32_t num_sequences;
+}
+BakedSequencePack;
+
+typedef struct
+{
+	char name[32];
+	int32_t target;
+	int32_t count;			/* followed by count TLN_SequenceFrame */
+}
+BakedSequence;
+
+typedef struct
+{
+	int32_t numtiles;
+	int32_t width;
+	int32_t height;
+	int32_t tiles_per_row;
+	int32_t palette;		/* record index or -1 */
+	int32_t sp;				/* record index or -1 */
+}
+BakedTileset;				/* followed by pixels, color_key and attributes */
+
+typedef struct
+{
+	int32_t rows;
+	int32_t cols;
+	int32_t bgcolor;
+	int32_t id;
+	int32_t visible;
+	int32_t num_tilesets;
+	int32_t tilesets[MAX_TILESETS];
+}
+BakedTilemap;				/* followed by rows*cols Tile */
+
+typedef struct
+{
+	int32_t width;
+	int32_t height;
+	int32_t bpp;
+	int32_t pitch;
+	int32_t palette;
+}
+BakedBitmap;				/* followed by pitch*height pixels */
+
+typedef struct
+{
+	int32_t entries;
+	int32_t bitmap;
+	int32_t num_rows;		/* 0 if spans aren't stored */
+	int32_t num_words;
+}
+BakedSpriteset;				/* followed by SpriteEntry array, and span_rows + spans if present */
+
+/* writer ------------------------------------------------------------------- */
+
+typedef struct
+{
+	uint8_t* data;
+	int size;
+	int capacity;
+	int num_records;
+	int record;				/* offset of current record header */
+	bool error;
+}
+Baker;
+
+static void put(Baker* baker, const void* data, int size)
+{
+	if (baker->error)
+		return;
+
+	if (baker->size + size > baker->capacity)
+	{
+		int capacity = baker->capacity ? baker->capacity : 65536;
+		uint8_t* buffer;
+		while (baker->size + size > capacity)
+			capacity *= 2;
+		buffer = (uint8_t*)realloc(baker->data, capacity);
+		if (buffer == NULL)
+		{
+			baker->error = true;
+			return;
+		}
+		baker->data = buffer;
+		baker->capacity = capacity;
+	}
+	if (data != NULL)
+		memcpy(baker->data + baker->size, data, size);
+	else
+		memset(baker->data + baker->size, 0, size);
+	baker->size += size;
+}
+
+static void begin_record(Baker* baker, ObjectType type)
+{
+	BakedRecord record = { type, 0 };
+	baker->record = baker->size;
+	put(baker, &record, sizeof(record));
+}
+
+/* closes current record and returns its index */
+static int end_record(Baker* baker)
+{
+	const int size = baker->size - baker->record - (int)sizeof(BakedRecord);
+	const int padding = (4 - (size & 3)) & 3;
+
+	put(baker, NULL, padding);
+	if (!baker->error)
+		((BakedRecord*)(baker->data + baker->record))->size = size;
+	baker->num_records += 1;
+	return baker->num_records - 1;
+}
+
+static int bake_palette(Baker* baker, TLN_Palette palette)
+{
+	BakedPalette header;
+
+	if (palette == NULL)
+		return -1;
+
+	header.entries = palette->entries;
+	begin_record(baker, OT_PALETTE);
+	put(baker, &header, sizeof(header));
+	put(baker, palette->data, palette->entries * sizeof(uint32_t));
+	return end_record(baker);
+}
+
+static int bake_sequencepack(Baker* baker, TLN_SequencePack sp)
+{
+	BakedSequencePack header;
+	TLN_Sequence sequence;
+
+	if (sp == NULL)
+		return -1;
+
+	header.num_sequences = sp->num_sequences;
+	begin_record(baker, OT_SEQPACK);
+	put(baker, &header, sizeof(header));
+	for (sequence = sp->sequences; sequence != NULL; sequence = sequence->next)
+	{
+		BakedSequence item;
+		memcpy(item.name, sequence->name, sizeof(item.name));
+		item.target = sequence->target;
+		item.count = sequence->count;
+		put(baker, &item, sizeof(item));
+		put(baker, sequence->data, sequence->count * sizeof(TLN_SequenceFrame));
+	}
+	return end_record(baker);
+}
+
+static int bake_tileset(Baker* baker, TLN_Tileset tileset)
+{
+	BakedTileset header;
+
+	header.numtiles = tileset->numtiles;
+	header.width = tileset->width;
+	header.height = tileset->height;
+	header.tiles_per_row = tileset->tiles_per_row;
+	header.palette = bake_palette(baker, tileset->palette);
+	header.sp = bake_sequencepack(baker, tileset->sp);
+
+	begin_record(baker, OT_TILESET);
+	put(baker, &header, sizeof(header));
+	put(baker, tileset->data, tileset->numtiles * tileset->width * tileset->height);
+	put(baker, tileset->color_key, tileset->numtiles * tileset->height * sizeof(bool));
+	put(baker, tileset->attributes, tileset->numtiles * sizeof(TLN_TileAttributes));
+	return end_record(baker);
+}
+
+static int bake_tilemap(Baker* baker, TLN_Tilemap tilemap)
+{
+	BakedTilemap header = { 0 };
+	int c;
+
+	header.rows = tilemap->rows;
+	header.cols = tilemap->cols;
+	header.bgcolor = tilemap->bgcolor;
+	header.id = tilemap->id;
+	header.visible = tilemap->visible;
+	header.num_tilesets = tilemap->num_tilesets;
+	for (c = 0; c < MAX_TILESETS; c += 1)
+		header.tilesets[c] = -1;
+	for (c = 0; c < tilemap->num_tilesets; c += 1)
+	{
+		if (tilemap->tilesets[c] != NULL)
+			header.tilesets[c] = bake_tileset(baker, tilemap->tilesets[c]);
+	}
+
+	begin_record(baker, OT_TILEMAP);
+	put(baker, &header, sizeof(header));
+	put(baker, tilemap->tiles, tilemap->rows * tilemap->cols * sizeof(Tile));
+	return end_record(baker);
+}
+
+static int bake_bitmap(Baker* baker, TLN_Bitmap bitmap)
+{
+	BakedBitmap header;
+
+	header.width = bitmap->width;
+	header.height = bitmap->height;
+	header.bpp = bitmap->bpp;
+	header.pitch = bitmap->pitch;
+	header.palette = bake_palette(baker, bitmap->palette);
+
+	begin_record(baker, OT_BITMAP);
+	put(baker, &header, sizeof(header));
+	put(baker, bitmap->data, bitmap->pitch * bitmap->height);
+	return end_record(baker);
+}
+
+/* number of words in spans[] */
+static int count_span_words(TLN_Spriteset spriteset, int num_rows)
+{
+	const uint16_t* span;
+	int words;
+
+	if (num_rows == 0)
+		return 0;
+
+	/* last row holds two lists: count followed by count pairs */
+	words = spriteset->span_rows[num_rows - 1];
+	span = spriteset->spans + words;
+	words += 1 + span[0] * 2;
+	span = spriteset->spans + words;
+	words += 1 + span[0] * 2;
+	return words;
+}
+
+static int bake_spriteset(Baker* baker, TLN_Spriteset spriteset)
+{
+	BakedSpriteset header = { 0 };
+	int c;
+
+	header.entries = spriteset->entries;
+	header.bitmap = bake_bitmap(baker, spriteset->bitmap);
+	if (spriteset->spans != NULL)
+	{
+		for (c = 0; c < spriteset->entries; c += 1)
+			header.num_rows += spriteset->data[c].h;
+		header.num_words = count_span_words(spriteset, header.num_rows);
+	}
+
+	begin_record(baker, OT_SPRITESET);
+	put(baker, &header, sizeof(header));
+	put(baker, spriteset->data, spriteset->entries * sizeof(SpriteEntry));
+	if (header.num_rows > 0)
+	{
+		put(baker, spriteset->span_rows, (header.num_rows + 1) * sizeof(uint32_t));
+		put(baker, spriteset->spans, (header.num_words + 1) * sizeof(uint16_t));
+	}
+	return end_record(baker);
+}
+
+/* writes baked records to file */
+static bool save(Baker* baker, const char* filename)
+{
+	BakedHeader header = { BAKED_ID, BAKED_VERSION, 0 };
+	FILE* pf;
+	bool ok;
+
+	if (baker->error)
+	{
+		free(baker->data);
+		TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+		return false;
+	}
+
+	pf = FileCreate(filename);
+	if (pf == NULL)
+	{
+		free(baker->data);
+		TLN_SetLastError(TLN_ERR_FILE_NOT_FOUND);
+		return false;
+	}
+
+	header.num_records = baker->num_records;
+	ok = fwrite(&header, sizeof(header), 1, pf) == 1;
+	ok &= fwrite(baker->data, baker->size, 1, pf) == 1;
+	fclose(pf);
+	free(baker->data);
+
+	TLN_SetLastError(ok ? TLN_ERR_OK : TLN_ERR_FILE_NOT_FOUND);
+	return ok;
+}
+
+/* reader ------------------------------------------------------------------- */
+
+typedef struct
+{
+	const uint8_t* data[MAX_RECORDS];	/* start of record content */
+	uint32_t size[MAX_RECORDS];
+	ObjectType type[MAX_RECORDS];
+	bool used[MAX_RECORDS];
+	int num_records;
+}
+Unbaker;
+
+/* validates header and indexes records */
+static bool index_records(Unbaker* unbaker, const uint8_t* data, ssize_t size)
+{
+	const BakedHeader* header = (const BakedHeader*)data;
+	ssize_t offset = sizeof(BakedHeader);
+	uint32_t c;
+
+	if (size < (ssize_t)sizeof(BakedHeader) || memcmp(header->id, BAKED_ID, sizeof(header->id)) != 0)
+		return false;
+	if (header->version != BAKED_VERSION || header->num_records == 0 || header->num_records > MAX_RECORDS)
+		return false;
+
+	for (c = 0; c < header->num_records; c += 1)
+	{
+		const BakedRecord* record = (const BakedRecord*)(data + offset);
+		if (offset + (ssize_t)sizeof(BakedRecord) > size)
+			return false;
+		offset += sizeof(BakedRecord);
+		if (record->size > (uint32_t)(size - offset))
+			return false;
+		unbaker->data[c] = data + offset;
+		unbaker->size[c] = record->size;
+		unbaker->type[c] = (ObjectType)record->type;
+		offset += (record->size + 3) & ~3;
+	}
+	unbaker->num_records = header->num_records;
+	return true;
+}
+
+/* gets content of a record referenced once by a later record, NULL if invalid */
+static const uint8_t* get_record(Unbaker* unbaker, int index, int parent, ObjectType type, uint32_t size)
+{
+	if (index < 0 || index >= parent || unbaker->type[index] != type || unbaker->used[index])
+		return NULL;
+	if (unbaker->size[index] < size)
+		return NULL;
+	unbaker->used[index] = true;
+	return unbaker->data[index];
+}
+
+/* adds count items of given size to a size read from file, false if count is negative or the result
+ * overflows the int sizes engine objects use */
+static bool add_size(size_t* size, int32_t count, size_t item)
+{
+	if (count < 0 || (item != 0 && (size_t)count > (INT_MAX - *size) / item))
+		return false;
+	*size += count*item;
+	return true;
+}
+
+static TLN_Palette unbake_palette(Unbaker* unbaker, int index, int parent)
+{
+	const uint8_t* data = get_record(unbaker, index, parent, OT_PALETTE, sizeof(BakedPalette));
+	const BakedPalette* header = (const BakedPalette*)data;
+	TLN_Palette palette;
+
+	if (data == NULL || header->entries < 0 || header->entries > 256)
+		return NULL;
+	if (unbaker->size[index] < sizeof(BakedPalette) + header->entries * sizeof(uint32_t))
+		return NULL;
+
+	palette = TLN_CreatePalette(header->entries);
+	if (palette != NULL)
+		memcpy(palette->data, data + sizeof(BakedPalette), header->entries * sizeof(uint32_t));
+	return palette;
+}
+
+static TLN_SequencePack unbake_sequencepack(Unbaker* unbaker, int index, int parent)
+{
+	const uint8_t* data = get_record(unbaker, index, parent, OT_SEQPACK, sizeof(BakedSequencePack));
+	const BakedSequencePack* header = (const BakedSequencePack*)data;
+	const uint8_t* end;
+	TLN_SequencePack sp;
+	int c;
+
+	if (data == NULL)
+		return NULL;
+
+	end = data + unbaker->size[index];
+	data += sizeof(BakedSequencePack);
+	sp = TLN_CreateSequencePack();
+	for (c = 0; sp != NULL && c < header->num_sequences; c += 1)
+	{
+		const BakedSequence* item = (const BakedSequence*)data;
+		char name[sizeof(item->name) + 1] = { 0 };
+		TLN_Sequence sequence;
+
+		if (end - data < (ssize_t)sizeof(BakedSequence) || item->count < 0 ||
+			(size_t)(end - data - sizeof(BakedSequence)) / sizeof(TLN_SequenceFrame) < (size_t)item->count)
+		{
+			TLN_DeleteSequencePack(sp);
+			return NULL;
+		}
+
+		memcpy(name, item->name, sizeof(item->name));
+		sequence = TLN_CreateSequence(name, item->target, item->count, (TLN_SequenceFrame*)(data + sizeof(BakedSequence)));
+		TLN_AddSequenceToPack(sp, sequence);
+		data += sizeof(BakedSequence) + item->count * sizeof(TLN_SequenceFrame);
+	}
+	return sp;
+}
+
+static TLN_Tileset unbake_tileset(Unbaker* unbaker, int index, int parent)
+{
+	const uint8_t* data = get_record(unbaker, index, parent, OT_TILESET, sizeof(BakedTileset));
+	const BakedTileset* header = (const BakedTileset*)data;
+	TLN_Tileset tileset;
+	TLN_Palette palette;
+	TLN_SequencePack sp = NULL;
+	size_t tile_size = 0, size_tiles = 0, size_keys = 0, size_attributes = 0;
+
+	if (data == NULL || header->numtiles <= 0 || header->width <= 0 || header->height <= 0)
+		return NULL;
+
+	if (!add_size(&tile_size, header->width, header->height) ||
+		!add_size(&size_tiles, header->numtiles, tile_size) ||
+		!add_size(&size_keys, header->numtiles, header->height * sizeof(bool)) ||
+		!add_size(&size_attributes, header->numtiles, sizeof(TLN_TileAttributes)))
+		return NULL;
+	if ((unbaker->size[index] - sizeof(BakedTileset)) < size_tiles ||
+		(unbaker->size[index] - sizeof(BakedTileset) - size_tiles) < size_keys ||
+		(unbaker->size[index] - sizeof(BakedTileset) - size_tiles - size_keys) < size_attributes)
+		return NULL;
+
+	palette = unbake_palette(unbaker, header->palette, index);
+	if (header->sp != -1)
+		sp = unbake_sequencepack(unbaker, header->sp, index);
+	if ((header->palette != -1 && palette == NULL) || (header->sp != -1 && sp == NULL))
+	{
+		TLN_DeletePalette(palette);
+		TLN_DeleteSequencePack(sp);
+		return NULL;
+	}
+
+	data += sizeof(BakedTileset);
+	tileset = TLN_CreateTileset(header->numtiles, header->width, header->height, palette, sp,
+		(TLN_TileAttributes*)(data + size_tiles + size_keys));
+	if (tileset == NULL)
+	{
+		TLN_DeletePalette(palette);
+		TLN_DeleteSequencePack(sp);
+		return NULL;
+	}
+
+	memcpy(tileset->data, data, size_tiles);
+	memcpy(tileset->color_key, data + size_tiles, size_keys);
+	tileset->tiles_per_row = header->tiles_per_row;
+	return tileset;
+}
+
+static TLN_Tilemap unbake_tilemap(Unbaker* unbaker, int index)
+{
+	const uint8_t* data = get_record(unbaker, index, index + 1, OT_TILEMAP, sizeof(BakedTilemap));
+	const BakedTilemap* header = (const BakedTilemap*)data;
+	TLN_Tilemap tilemap;
+	size_t size_row = 0, size_tiles = 0;
+	int c;
+
+	if (data == NULL || header->rows <= 0 || header->cols <= 0)
+		return NULL;
+	if (header->num_tilesets < 0 || header->num_tilesets > MAX_TILESETS)
+		return NULL;
+	if (!add_size(&size_row, header->cols, sizeof(Tile)) || !add_size(&size_tiles, header->rows, size_row))
+		return NULL;
+	if (unbaker->size[index] - sizeof(BakedTilemap) < size_tiles)
+		return NULL;
+
+	tilemap = TLN_CreateTilemap(header->rows, header->cols, (TLN_Tile)(data + sizeof(BakedTilemap)), header->bgcolor, NULL);
+	if (tilemap == NULL)
+		return NULL;
+
+	tilemap->id = header->id;
+	tilemap->visible = header->visible != 0;
+	tilemap->num_tilesets = header->num_tilesets;
+	for (c = 0; c < header->num_tilesets; c += 1)
+	{
+		if (header->tilesets[c] != -1)
+		{
+			tilemap->tilesets[c] = unbake_tileset(unbaker, header->tilesets[c], index);
+			tilemap->owned_tilesets |= 1u << c;
+			if (tilemap->tilesets[c] == NULL)
+			{
+				TLN_DeleteTilemap(tilemap);
+				return NULL;
+			}
+		}
+	}
+	return tilemap;
+}
+
+static TLN_Bitmap unbake_bitmap(Unbaker* unbaker, int index, int parent)
+{
+	const uint8_t* data = get_record(unbaker, index, parent, OT_BITMAP, sizeof(BakedBitmap));
+	const BakedBitmap* header = (const BakedBitmap*)data;
+	TLN_Bitmap bitmap;
+	size_t size_pixels = 0;
+
+	if (data == NULL || header->width <= 0 || header->height <= 0)
+		return NULL;
+	if (header->bpp != 8 && header->bpp != 16 && header->bpp != 24 && header->bpp != 32)
+		return NULL;
+	if (header->pitch != (((((int64_t)header->width * header->bpp) >> 3) + 3) & ~0x03))
+		return NULL;
+	if (!add_size(&size_pixels, header->height, header->pitch) || unbaker->size[index] - sizeof(BakedBitmap) < size_pixels)
+		return NULL;
+
+	bitmap = TLN_CreateBitmap(header->width, header->height, header->bpp);
+	if (bitmap == NULL)
+		return NULL;
+
+	memcpy(bitmap->data, data + sizeof(BakedBitmap), size_pixels);
+	if (header->palette != -1)
+	{
+		bitmap->palette = unbake_palette(unbaker, header->palette, index);
+		if (bitmap->palette == NULL)
+		{
+			TLN_DeleteBitmap(bitmap);
+			return NULL;
+		}
+	}
+	return bitmap;
+}
+
+/* checks that a list of spans stays inside the words of spans[] and the width of its row.
+ * Returns position of next list, or -1 if invalid */
+static int64_t check_span_list(const uint16_t* spans, int64_t pos, int64_t num_words, int width)
+{
+	int count, c;
+	int x = 0;
+
+	if (pos >= num_words)
+		return -1;
+	count = spans[pos];
+	if (count > (num_words - pos - 1) / 2)
+		return -1;
+	for (c = 0; c < count; c++)
+	{
+		x += spans[pos + 1 + c*2] + spans[pos + 2 + c*2];
+		if (x > width)
+			return -1;
+	}
+	return pos + 1 + count*2;
+}
+
+/* checks entries against the bitmap, and spans against the entries */
+static bool check_sprite_entries(TLN_Spriteset spriteset, int num_rows, int num_words)
+{
+	const TLN_Bitmap bitmap = spriteset->bitmap;
+	int row = 0;
+	int c, y;
+
+	for (c = 0; c < spriteset->entries; c++)
+	{
+		const SpriteEntry* entry = &spriteset->data[c];
+		int x0, y0;
+
+		if (entry->w < 0 || entry->h < 0 || entry->offset < 0)
+			return false;
+		x0 = entry->offset % bitmap->pitch;
+		y0 = entry->offset / bitmap->pitch;
+		if (entry->w > bitmap->width - x0 || entry->h > bitmap->height - y0)
+			return false;
+		if (entry->xoffset < 0 || entry->yoffset < 0 || entry->frame_w < 0 || entry->frame_h < 0 ||
+			entry->w > entry->frame_w - entry->xoffset || entry->h > entry->frame_h - entry->yoffset)
+			return false;
+
+		if (num_rows == 0)
+			continue;
+
+		/* rows are stored in entry order, each one with left to right and right to left lists */
+		if (entry->span_row != row || entry->h > num_rows - row)
+			return false;
+		for (y = 0; y < entry->h; y++, row++)
+		{
+			int64_t pos = check_span_list(spriteset->spans, spriteset->span_rows[row], num_words, entry->w);
+			if (pos == -1 || check_span_list(spriteset->spans, pos, num_words, entry->w) == -1)
+				return false;
+		}
+	}
+	return row == num_rows;
+}
+
+static TLN_Spriteset unbake_spriteset(Unbaker* unbaker, int index)
+{
+	const uint8_t* data = get_record(unbaker, index, index + 1, OT_SPRITESET, sizeof(BakedSpriteset));
+	const BakedSpriteset* header = (const BakedSpriteset*)data;
+	TLN_Spriteset spriteset;
+	TLN_Bitmap bitmap;
+	size_t size_entries = 0, size_rows = 0, size_words = 0;
+
+	if (data == NULL || header->entries <= 0 || header->num_rows < 0 || header->num_words < 0)
+		return NULL;
+
+	if (!add_size(&size_entries, header->entries, sizeof(SpriteEntry)))
+		return NULL;
+	if (header->num_rows > 0 &&
+		(!add_size(&size_rows, header->num_rows, sizeof(uint32_t)) || !add_size(&size_rows, 1, sizeof(uint32_t)) ||
+		!add_size(&size_words, header->num_words, sizeof(uint16_t)) || !add_size(&size_words, 1, sizeof(uint16_t))))
+		return NULL;
+	if (unbaker->size[index] - sizeof(BakedSpriteset) < size_entries ||
+		unbaker->size[index] - sizeof(BakedSpriteset) - size_entries < size_rows ||
+		unbaker->size[index] - sizeof(BakedSpriteset) - size_entries - size_rows < size_words)
+		return NULL;
+
+	bitmap = unbake_bitmap(unbaker, header->bitmap, index);
+	if (bitmap == NULL)
+		return NULL;
+	spriteset = TLN_CreateSpriteset(bitmap, NULL, header->entries);
+	if (spriteset == NULL)
+	{
+		TLN_DeleteBitmap(bitmap);
+		return NULL;
+	}
+
+	data += sizeof(BakedSpriteset);
+	memcpy(spriteset->data, data, size_entries);
+	data += size_entries;
+	if (header->num_rows > 0)
+	{
+		spriteset->span_rows = (uint32_t*)malloc(size_rows);
+		spriteset->spans = (uint16_t*)malloc(size_words);
+		if (spriteset->span_rows == NULL || spriteset->spans == NULL)
+		{
+			TLN_DeleteSpriteset(spriteset);
+			TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+			return NULL;
+		}
+		memcpy(spriteset->span_rows, data, size_rows);
+		memcpy(spriteset->spans, data + size_rows, size_words);
+	}
+
+	if (!check_sprite_entries(spriteset, header->num_rows, header->num_words))
+	{
+		TLN_DeleteSpriteset(spriteset);
+		return NULL;
+	}
+	return spriteset;
+}
+
+/* maps baked file and indexes its records */
+static void* open_baked(const char* filename, Unbaker* unbaker, ssize_t* size, MapMode* mode)
+{
+	void* data = MapFile(filename, size, mode);
+	if (data == NULL)
+	{
+		TLN_SetLastError(*size == -1 ? TLN_ERR_OUT_OF_MEMORY : TLN_ERR_FILE_NOT_FOUND);
+		return NULL;
+	}
+
+	memset(unbaker, 0, sizeof(Unbaker));
+	if (!index_records(unbaker, (const uint8_t*)data, *size))
+	{
+		UnmapFile(data, *size, *mode);
+		TLN_SetLastError(TLN_ERR_WRONG_FORMAT);
+		return NULL;
+	}
+	return data;
+}
+
+/*!
+ * \brief
+ * Saves a tilemap in baked binary format, together with its tilesets, palettes and tileset animations
+ *
+ * \param tilemap
+ * Reference to the tilemap to save
+ *
+ * \param filename
+ * File to create, relative to the load path
+ *
+ * \returns
+ * true if success or false if error
+ *
+ * \remarks
+ * Baked files are a snapshot of the engine objects, intended to be built offline from the
+ * source assets and loaded at runtime with TLN_LoadBakedTilemap(). They aren't portable
+ * between engine versions or platforms with different byte order. Tilemaps of infinite maps
+ * can't be baked
+ *
+ * \see
+ * TLN_LoadBakedTilemap()
+ */
+bool TLN_SaveBakedTilemap (TLN_Tilemap tilemap, const char* filename)
+{
+	Baker baker = { 0 };
+	int c;
+
+	if (!CheckBaseObject(tilemap, OT_TILEMAP))
+		return false;
+
+	/* tiles of infinite maps aren't all decoded */
+	if (tilemap->chunks != NULL)
+	{
+		TLN_SetLastError(TLN_ERR_UNSUPPORTED);
+		return false;
+	}
+
+	for (c = 0; c < tilemap->num_tilesets; c += 1)
+	{
+		if (tilemap->tilesets[c] != NULL && tilemap->tilesets[c]->tstype != TILESET_TILES)
+		{
+			TLN_SetLastError(TLN_ERR_UNSUPPORTED);
+			return false;
+		}
+	}
+
+	bake_tilemap(&baker, tilemap);
+	return save(&baker, filename);
+}
+
+/*!
+ * \brief
+ * Loads a tilemap saved with TLN_SaveBakedTilemap()
+ *
+ * \param filename
+ * Baked file to load
+ *
+ * \returns
+ * Reference to the loaded tilemap with its tilesets, or NULL if error
+ *
+ * \remarks
+ * The file is memory mapped when possible and each data block is copied straight into the
+ * engine objects, so it's much faster than loading the source tmx, tsx and png files
+ *
+ * \see
+ * TLN_SaveBakedTilemap()
+ */
+TLN_Tilemap TLN_LoadBakedTilemap (const char* filename)
+{
+	Unbaker unbaker;
+	TLN_Tilemap tilemap;
+	ssize_t size;
+	MapMode mode;
+	void* data = open_baked(filename, &unbaker, &size, &mode);
+	if (data == NULL)
+		return NULL;
+
+	tilemap = unbake_tilemap(&unbaker, unbaker.num_records - 1);
+	UnmapFile(data, size, mode);
+	TLN_SetLastError(tilemap != NULL ? TLN_ERR_OK : TLN_ERR_WRONG_FORMAT);
+	return tilemap;
+}
+
+/*!
+ * \brief
+ * Saves a spriteset in baked binary format, together with its bitmap and palette
+ *
+ * \param spriteset
+ * Reference to the spriteset to save
+ *
+ * \param filename
+ * File to create, relative to the load path
+ *
+ * \returns
+ * true if success or false if error
+ *
+ * \see
+ * TLN_LoadBakedSpriteset(), TLN_SaveBakedTilemap()
+ */
+bool TLN_SaveBakedSpriteset (TLN_Spriteset spriteset, const char* filename)
+{
+	Baker baker = { 0 };
+
+	if (!CheckBaseObject(spriteset, OT_SPRITESET))
+		return false;
+	if (spriteset->bitmap == NULL)
+	{
+		TLN_SetLastError(TLN_ERR_REF_BITMAP);
+		return false;
+	}
+
+	bake_spriteset(&baker, spriteset);
+	return save(&baker, filename);
+}
+
+/*!
+ * \brief
+ * Loads a spriteset saved with TLN_SaveBakedSpriteset()
+ *
+ * \param filename
+ * Baked file to load
+ *
+ * \returns
+ * Reference to the loaded spriteset, or NULL if error
+ *
+ * \see
+ * TLN_SaveBakedSpriteset(), TLN_LoadBakedTilemap()
+ */
+TLN_Spriteset TLN_LoadBakedSpriteset (const char* filename)
+{
+	Unbaker unbaker;
+	TLN_Spriteset spriteset;
+	ssize_t size;
+	MapMode mode;
+	void* data = open_baked(filename, &unbaker, &size, &mode);
+	if (data == NULL)
+		return NULL;
+
+	spriteset = unbake_spriteset(&unbaker, unbaker.num_records - 1);
+	UnmapFile(data, size, mode);
+	TLN_SetLastError(spriteset != NULL ? TLN_ERR_OK : TLN_ERR_WRONG_FORMAT);
+	return spriteset;
+}
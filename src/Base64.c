@@ -1,13 +1,19 @@
 #include "Base64.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE2
+#endif
+
 #define WHITESPACE 64
 #define EQUALS     65
 #define INVALID    66
 
+/* sextet of each character, values >= WHITESPACE aren't part of the data */
 static const unsigned char d[] =
 {
-	66,66,66,66,66,66,66,66,66,64,66,66,66,66,66,66,66,66,66,66,66,66,66,66,66,
-	66,66,66,66,66,66,66,66,66,66,66,66,66,66,66,66,66,66,62,66,66,66,63,52,53,
+	66,66,66,66,66,66,66,66,66,64,64,66,66,64,66,66,66,66,66,66,66,66,66,66,66,
+	66,66,66,66,66,66,66,64,66,66,66,66,66,66,66,66,66,66,62,66,66,66,63,52,53,
 	54,55,56,57,58,59,60,61,66,66,66,65,66,66,66, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
 	10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,66,66,66,66,66,66,26,27,28,
 	29,30,31,32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47,48,49,50,51,66,66,
@@ -19,54 +25,160 @@ static const unsigned char d[] =
 	66,66,66,66,66,66
 };
 
-int base64decode (const unsigned char* in, int inLen, unsigned char *out, int *outLen)
+#ifdef USE_SSE2
+/* mask of bytes inside [first, last], compared as signed chars */
+static inline __m128i in_range (__m128i c, char first, char last)
 {
-	const unsigned char* end = in + inLen;
-	int buf = 1, len = 0;
+	return _mm_and_si128 (_mm_cmpgt_epi8 (c, _mm_set1_epi8 (first - 1)), _mm_cmplt_epi8 (c, _mm_set1_epi8 (last + 1)));
+}
+
+/* decodes 16 characters into 12 bytes, writing 16 (last 4 are zero). Returns 0 without writing if any
+ * of them isn't a data character (whitespace, padding or invalid), so the caller takes the scalar path */
+static int decode16 (const unsigned char* in, unsigned char* out)
+{
+	const __m128i c = _mm_loadu_si128 ((const __m128i*)in);
+	const __m128i upper = in_range (c, 'A', 'Z');
+	const __m128i lower = in_range (c, 'a', 'z');
+	const __m128i digit = in_range (c, '0', '9');
+	const __m128i plus  = _mm_cmpeq_epi8 (c, _mm_set1_epi8 ('+'));
+	const __m128i slash = _mm_cmpeq_epi8 (c, _mm_set1_epi8 ('/'));
+	const __m128i mask_lo = _mm_set_epi32 (0, 0x00FFFFFF, 0, 0x00FFFFFF);
+	__m128i shift, sextets, bytes, packed;
+
+	if (_mm_movemask_epi8 (_mm_or_si128 (_mm_or_si128 (upper, lower), _mm_or_si128 (_mm_or_si128 (digit, plus), slash))) != 0xFFFF)
+		return 0;
 
-	while (*in < 'A')
-		in++;
+	/* character to sextet: add a per-class offset */
+	shift = _mm_and_si128 (upper, _mm_set1_epi8 (-'A'));
+	shift = _mm_or_si128 (shift, _mm_and_si128 (lower, _mm_set1_epi8 (26 - 'a')));
+	shift = _mm_or_si128 (shift, _mm_and_si128 (digit, _mm_set1_epi8 (52 - '0')));
+	shift = _mm_or_si128 (shift, _mm_and_si128 (plus,  _mm_set1_epi8 (62 - '+')));
+	shift = _mm_or_si128 (shift, _mm_and_si128 (slash, _mm_set1_epi8 (63 - '/')));
+	sextets = _mm_add_epi8 (c, shift);
+
+	/* each group of 4 sextets s0..s3 in a 32-bit lane becomes 3 bytes in output order:
+	 * s0 << 2 | s1 >> 4, s1 << 4 | s2 >> 2, s2 << 6 | s3 */
+	bytes = _mm_or_si128 (
+		_mm_or_si128 (
+			_mm_and_si128 (_mm_slli_epi32 (sextets, 2), _mm_set1_epi32 (0x000000FC)),
+			_mm_and_si128 (_mm_srli_epi32 (sextets, 12), _mm_set1_epi32 (0x00000003))),
+		_mm_or_si128 (
+			_mm_or_si128 (
+				_mm_and_si128 (_mm_slli_epi32 (sextets, 4), _mm_set1_epi32 (0x0000F000)),
+				_mm_and_si128 (_mm_srli_epi32 (sextets, 10), _mm_set1_epi32 (0x00000F00))),
+			_mm_or_si128 (
+				_mm_and_si128 (_mm_slli_epi32 (sextets, 6), _mm_set1_epi32 (0x00C00000)),
+				_mm_and_si128 (_mm_srli_epi32 (sextets, 8), _mm_set1_epi32 (0x003F0000)))));
+
+	/* remove the empty 4th byte of each lane: 6 bytes per 64-bit half, then 12 contiguous bytes */
+	packed = _mm_or_si128 (_mm_and_si128 (bytes, mask_lo), _mm_srli_epi64 (_mm_andnot_si128 (mask_lo, bytes), 8));
+	packed = _mm_or_si128 (_mm_move_epi64 (packed), _mm_slli_si128 (_mm_srli_si128 (packed, 8), 6));
+	_mm_storeu_si128 ((__m128i*)out, packed);
+	return 1;
+}
+#endif
+
+void base64init (Base64Stream* stream, const char* in, int inLen)
+{
+	stream->in = (const unsigned char*)in;
+	stream->end = stream->in + inLen;
+	stream->bits = 1;
+	stream->error = 0;
+}
+
+/* decodes up to outLen bytes, stopping early when they don't fit a whole group of 3.
+ * Returns number of bytes decoded, 0 when input is exhausted */
+int base64read (Base64Stream* stream, unsigned char* out, int outLen)
+{
+	const unsigned char* in = stream->in;
+	const unsigned char* end = stream->end;
+	unsigned int buf = stream->bits;
+	int len = 0;
 
 	while (in < end)
 	{
-		unsigned char c = d[*in++];
+		unsigned char c;
 
-		switch (c)
+#ifdef USE_SSE2
+		/* 16 characters at once without whitespace nor padding */
+		if (buf == 1 && end - in >= 16 && outLen - len >= 16 && decode16 (in, out + len))
 		{
-		case WHITESPACE:
-			continue;   /* skip whitespace */
-		case INVALID:
-			return 1;   /* invalid input, return error */
-		case EQUALS:                 /* pad character, end of data */
-			in = end;
+			len += 12;
+			in += 16;
 			continue;
-		default:
-			buf = buf << 6 | c;
+		}
+#endif
 
-			/* If the buffer is full, split it into bytes */
+		/* fast path: whole group of 4 characters without whitespace nor padding */
+		if (buf == 1 && end - in >= 4 && outLen - len >= 3)
+		{
+			const unsigned char c0 = d[in[0]];
+			const unsigned char c1 = d[in[1]];
+			const unsigned char c2 = d[in[2]];
+			const unsigned char c3 = d[in[3]];
+			if ((c0 | c1 | c2 | c3) < WHITESPACE)
+			{
+				const unsigned int group = c0 << 18 | c1 << 12 | c2 << 6 | c3;
+				out[len + 0] = (unsigned char)(group >> 16);
+				out[len + 1] = (unsigned char)(group >> 8);
+				out[len + 2] = (unsigned char)(group);
+				len += 3;
+				in += 4;
+				continue;
+			}
+		}
+
+		c = d[*in];
+		if (c == WHITESPACE)
+		{
+			in += 1;
+			continue;
+		}
+		else if (c == EQUALS)	/* pad character, end of data */
+			in = end;
+		else if (c == INVALID)
+		{
+			stream->error = 1;
+			in = end;
+		}
+		else
+		{
+			/* last character of a group needs room for it */
+			if ((buf & 0x40000) && outLen - len < 3)
+				break;
+
+			buf = buf << 6 | c;
+			in += 1;
 			if (buf & 0x1000000)
 			{
-				if ((len += 3) > *outLen) return 1; /* buffer overflow */
-				*out++ = (unsigned char)(buf >> 16);
-				*out++ = (unsigned char)(buf >> 8);
-				*out++ = (unsigned char)(buf);
+				out[len + 0] = (unsigned char)(buf >> 16);
+				out[len + 1] = (unsigned char)(buf >> 8);
+				out[len + 2] = (unsigned char)(buf);
+				len += 3;
 				buf = 1;
 			}
 		}
 	}
 
-	if (buf & 0x40000)
-	{
-		if ((len += 2) > *outLen) return 1; /* buffer overflow */
-		*out++ = (unsigned char)(buf >> 10);
-		*out++ = (unsigned char)(buf >> 2);
-	}
-	else if (buf & 0x1000)
+	/* incomplete last group */
+	if (in == end)
 	{
-		if (++len > *outLen) return 1; /* buffer overflow */
-		*out++ = (unsigned char)(buf >> 4);
+		if ((buf & 0x40000) && outLen - len >= 2)
+		{
+			out[len + 0] = (unsigned char)(buf >> 10);
+			out[len + 1] = (unsigned char)(buf >> 2);
+			len += 2;
+			buf = 1;
+		}
+		else if ((buf & 0x1000) && outLen - len >= 1)
+		{
+			out[len + 0] = (unsigned char)(buf >> 4);
+			len += 1;
+			buf = 1;
+		}
 	}
 
-	*outLen = len; /* modify to reflect the actual output size */
-	return 0;
+	stream->in = in;
+	stream->bits = buf;
+	return len;
 }
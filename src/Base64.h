@@ -5,7 +5,18 @@
 extern "C" {
 #endif
 
-	int base64decode(const unsigned char* in, int inLen, unsigned char *out, int *outLen);
+	/* decoder of base64 text that can be read in several parts */
+	typedef struct
+	{
+		const unsigned char* in;	/* next character to decode */
+		const unsigned char* end;	/* end of text */
+		unsigned int bits;			/* sextets of incomplete group, after a marker bit */
+		int error;					/* invalid character found */
+	}
+	Base64Stream;
+
+	void base64init(Base64Stream* stream, const char* in, int inLen);
+	int base64read(Base64Stream* stream, unsigned char* out, int outLen);
 
 #ifdef __cplusplus
 }
@@ -17,6 +17,7 @@
 #include "Object.h"
 #include "Palette.h"
 #include "Bitmap.h"
+#include "Cache.h"
 
 /*!
  * \brief
@@ -102,6 +103,13 @@ bool TLN_DeleteBitmap (TLN_Bitmap bitmap)
 {
 	if (CheckBaseObject (bitmap, OT_BITMAP))
 	{
+		/* loaded ones are kept until evicted */
+		if (ReleaseCached (bitmap))
+		{
+			TLN_SetLastError (TLN_ERR_OK);
+			return true;
+		}
+
 		if (ObjectOwner (bitmap) && bitmap->palette)
 			TLN_DeletePalette (bitmap->palette);
 		DeleteBaseObject (bitmap);
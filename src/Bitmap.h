@@ -26,6 +26,9 @@ struct Bitmap
 };
 
 #define get_bitmap_ptr(bitmap, x, y) \
-	(bitmap->data + (y) * bitmap->pitch + (x))
+	(bitmap->data + (y) * bitmap->pitch + (x) * (bitmap->bpp >> 3))
+
+TLN_Bitmap LoadIndexedBitmap(const char* filename);
+void LoadBitmaps(int count, const char* const* filenames, TLN_Bitmap* bitmaps);
 
 #endif
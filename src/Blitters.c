@@ -14,6 +14,11 @@
 #include "Tables.h"
 #include "Engine.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE2
+#endif
+
 /* indexes for blitter array table */
 #define BLIT_BLEND		0
 #define BLIT_SCALING	1
@@ -160,6 +165,247 @@ static void blitKeyBlendScaling_8_32 (uint8_t *srcpixel, TLN_Palette palette, vo
 	}
 }
 
+/* paints scanline skipping empty pixels with exact 2x magnification (dx = +/-0.5) */
+static void blitKeyScaling2x_8_32 (uint8_t *srcpixel, TLN_Palette palette, void* dstptr, int width, int dx, int offset, uint8_t* blend)
+{
+	uint32_t* dstpixel = (uint32_t*)dstptr;
+	uint32_t* color = (uint32_t*)palette->data;
+	const int step = dx > 0 ? 1 : -1;
+	uint32_t src;
+
+	srcpixel += fix2int(offset);
+
+	/* starts at second half of source pixel */
+	if (width && fix2int(offset) != fix2int(offset + dx))
+	{
+		src = *srcpixel;
+		if (src)
+			*dstpixel = color[src];
+		srcpixel += step;
+		dstpixel++;
+		width--;
+	}
+
+	/* each source pixel covers two target pixels */
+	while (width > 1)
+	{
+		src = *srcpixel;
+		if (src)
+			dstpixel[0] = dstpixel[1] = color[src];
+		srcpixel += step;
+		dstpixel += 2;
+		width -= 2;
+	}
+
+	if (width)
+	{
+		src = *srcpixel;
+		if (src)
+			*dstpixel = color[src];
+	}
+}
+
+/* paints scanline skipping empty pixels with exact 2x magnification and blending */
+static void blitKeyBlendScaling2x_8_32 (uint8_t *srcpixel, TLN_Palette palette, void* dstptr, int width, int dx, int offset, uint8_t* blend)
+{
+	uint8_t *src, *dst;
+	uint32_t* color = (uint32_t*)palette->data;
+	const int step = dx > 0 ? 1 : -1;
+	int repeat;
+
+	dst = (uint8_t*)dstptr;
+	srcpixel += fix2int(offset);
+
+	/* starts at second half of source pixel */
+	repeat = fix2int(offset) != fix2int(offset + dx) ? 1 : 2;
+	while (width)
+	{
+		if (repeat > width)
+			repeat = width;
+		width -= repeat;
+		if (*srcpixel)
+		{
+			src = (uint8_t*)&color[*srcpixel];
+			while (repeat)
+			{
+				dst[0] = blendfunc(blend, src[0], dst[0]);
+				dst[1] = blendfunc(blend, src[1], dst[1]);
+				dst[2] = blendfunc(blend, src[2], dst[2]);
+				dst += sizeof(uint32_t);
+				repeat--;
+			}
+		}
+		else
+			dst += repeat*sizeof(uint32_t);
+		srcpixel += step;
+		repeat = 2;
+	}
+}
+
+/* paints scanline skipping empty pixels with exact 0.5x reduction (dx = +/-2) */
+static void blitKeyScalingHalf_8_32 (uint8_t *srcpixel, TLN_Palette palette, void* dstptr, int width, int dx, int offset, uint8_t* blend)
+{
+	uint32_t* dstpixel = (uint32_t*)dstptr;
+	uint32_t* color = (uint32_t*)palette->data;
+	const int step = dx > 0 ? 2 : -2;
+
+	srcpixel += fix2int(offset);
+	while (width)
+	{
+		uint32_t src = *srcpixel;
+		if (src)
+			*dstpixel = color[src];
+		srcpixel += step;
+		dstpixel++;
+		width--;
+	}
+}
+
+/* paints scanline skipping empty pixels with exact 0.5x reduction and blending */
+static void blitKeyBlendScalingHalf_8_32 (uint8_t *srcpixel, TLN_Palette palette, void* dstptr, int width, int dx, int offset, uint8_t* blend)
+{
+	uint8_t *src, *dst;
+	uint32_t* color = (uint32_t*)palette->data;
+	const int step = dx > 0 ? 2 : -2;
+
+	dst = (uint8_t*)dstptr;
+	srcpixel += fix2int(offset);
+	while (width)
+	{
+		if (*srcpixel)
+		{
+			src = (uint8_t*)&color[*srcpixel];
+			dst[0] = blendfunc(blend, src[0], dst[0]);
+			dst[1] = blendfunc(blend, src[1], dst[1]);
+			dst[2] = blendfunc(blend, src[2], dst[2]);
+		}
+		srcpixel += step;
+		dst += sizeof(uint32_t);
+		width--;
+	}
+}
+
+/* 32 to 32 BPP blitters (direct color) ------------------------------------- */
+
+/* source is RGBA8888 in native Color order, palette is ignored. Color key
+ * variants use the alpha channel: 0 is skipped, 255 is solid and other values
+ * are composited over the target */
+
+/* composites one pixel with optional blend table */
+static inline void put_pixel_32 (uint8_t* dst, const uint8_t* src, uint8_t* blend)
+{
+	const int a = src[3];
+	int c;
+
+	if (a == 255 && blend == NULL)
+	{
+		*(uint32_t*)dst = *(const uint32_t*)src;
+		return;
+	}
+
+	for (c = 0; c < 3; c++)
+	{
+		int value = blend != NULL ? blendfunc(blend, src[c], dst[c]) : src[c];
+		if (a != 255)
+			value = div255(value*a + dst[c]*(255 - a));
+		dst[c] = (uint8_t)value;
+	}
+
+	/* keeps coverage for targets composited later, like the mosaic line buffer */
+	dst[3] = (uint8_t)(a + div255(dst[3]*(255 - a)));
+}
+
+/* paints scanline without checking alpha (always solid) */
+static void blitFast_32_32 (uint8_t *srcpixel, TLN_Palette palette, void* dstptr, int width, int dx, int offset, uint8_t* blend)
+{
+	uint32_t* dstpixel = (uint32_t*)dstptr;
+	uint32_t* src = (uint32_t*)srcpixel;
+	while (width)
+	{
+		*dstpixel++ = *src | 0xFF000000;
+		src += dx;
+		width--;
+	}
+}
+
+/* paints scanline without checking alpha (always solid) with blending */
+static void blitFastBlend_32_32 (uint8_t *srcpixel, TLN_Palette palette, void* dstptr, int width, int dx, int offset, uint8_t* blend)
+{
+	uint8_t* dst = (uint8_t*)dstptr;
+	uint32_t* src = (uint32_t*)srcpixel;
+	while (width)
+	{
+		const uint8_t* color = (const uint8_t*)src;
+		dst[0] = blendfunc(blend, color[0], dst[0]);
+		dst[1] = blendfunc(blend, color[1], dst[1]);
+		dst[2] = blendfunc(blend, color[2], dst[2]);
+		src += dx;
+		dst += sizeof(uint32_t);
+		width--;
+	}
+}
+
+/* paints scanline without checking alpha (always solid) with scaling */
+static void blitFastScaling_32_32 (uint8_t *srcpixel, TLN_Palette palette, void* dstptr, int width, int dx, int offset, uint8_t* blend)
+{
+	uint32_t* dstpixel = (uint32_t*)dstptr;
+	uint32_t* src = (uint32_t*)srcpixel;
+	while (width)
+	{
+		*dstpixel++ = src[offset/(1 << FIXED_BITS)] | 0xFF000000;
+		offset += dx;
+		width--;
+	}
+}
+
+/* paints scanline without checking alpha (always solid) with scaling and blending */
+static void blitFastBlendScaling_32_32 (uint8_t *srcpixel, TLN_Palette palette, void* dstptr, int width, int dx, int offset, uint8_t* blend)
+{
+	uint8_t* dst = (uint8_t*)dstptr;
+	uint32_t* src = (uint32_t*)srcpixel;
+	while (width)
+	{
+		const uint8_t* color = (const uint8_t*)&src[offset/(1 << FIXED_BITS)];
+		dst[0] = blendfunc(blend, color[0], dst[0]);
+		dst[1] = blendfunc(blend, color[1], dst[1]);
+		dst[2] = blendfunc(blend, color[2], dst[2]);
+		offset += dx;
+		dst += sizeof(uint32_t);
+		width--;
+	}
+}
+
+/* paints scanline compositing by alpha, with optional blending */
+static void blitKey_32_32 (uint8_t *srcpixel, TLN_Palette palette, void* dstptr, int width, int dx, int offset, uint8_t* blend)
+{
+	uint8_t* dst = (uint8_t*)dstptr;
+	uint32_t* src = (uint32_t*)srcpixel;
+	while (width)
+	{
+		if (*src & 0xFF000000)
+			put_pixel_32 (dst, (const uint8_t*)src, blend);
+		src += dx;
+		dst += sizeof(uint32_t);
+		width--;
+	}
+}
+
+/* paints scanline compositing by alpha with scaling, with optional blending */
+static void blitKeyScaling_32_32 (uint8_t *srcpixel, TLN_Palette palette, void* dstptr, int width, int dx, int offset, uint8_t* blend)
+{
+	uint8_t* dst = (uint8_t*)dstptr;
+	uint32_t* src = (uint32_t*)srcpixel;
+	while (width)
+	{
+		const uint32_t* color = &src[offset/(1 << FIXED_BITS)];
+		if (*color & 0xFF000000)
+			put_pixel_32 (dst, (const uint8_t*)color, blend);
+		offset += dx;
+		dst += sizeof(uint32_t);
+		width--;
+	}
+}
+
 /* blitter table selector */
 static const ScanBlitPtr blitters[]=
 {
@@ -173,13 +419,37 @@ static const ScanBlitPtr blitters[]=
 	blitKeyBlendScaling_8_32
 };
 
-/* returns suitable blitter for specified conditions */
-ScanBlitPtr SelectBlitter (bool key, bool scaling, bool blend)
+static const ScanBlitPtr blitters_32[]=
+{
+	blitFast_32_32,
+	blitFastBlend_32_32,
+	blitFastScaling_32_32,
+	blitFastBlendScaling_32_32,
+	blitKey_32_32,
+	blitKey_32_32,
+	blitKeyScaling_32_32,
+	blitKeyScaling_32_32
+};
+
+/* returns suitable blitter for specified conditions and source bits per pixel */
+ScanBlitPtr SelectBlitter (int bpp, bool key, bool scaling, bool blend)
 {
 	int index = (key << BLIT_KEY) + (scaling << BLIT_SCALING) + (blend << BLIT_BLEND);
+	if (bpp == 32)
+		return blitters_32[index];
 	return blitters[index];
 }
 
+/* returns suitable blitter for a scaled sprite, with fast paths for exact 2x and 0.5x ratios */
+ScanBlitPtr SelectSpriteScalingBlitter (int dx, bool blend)
+{
+	if (dx == int2fix(1)/2)
+		return blend ? blitKeyBlendScaling2x_8_32 : blitKeyScaling2x_8_32;
+	if (dx == int2fix(2))
+		return blend ? blitKeyBlendScalingHalf_8_32 : blitKeyScalingHalf_8_32;
+	return SelectBlitter (8, true, true, blend);
+}
+
 /* paints constant color */
 void BlitColor(void* dstptr, uint32_t color, int width, uint8_t* blend)
 {
@@ -233,13 +503,20 @@ void Blit32_32(uint32_t *src, uint32_t* dst, int width, uint8_t* blend)
 		}
 	}
 
-	/* regular */
+	/* regular: partial alpha comes from direct color pixels composited over the empty buffer */
 	else
 	{
 		while (width > 0)
 		{
-			if (srcpixel->a != 0)
+			const int a = srcpixel->a;
+			if (a == 255)
 				dstpixel->value = srcpixel->value;
+			else if (a != 0)
+			{
+				dstpixel->r = srcpixel->r + div255(dstpixel->r*(255 - a));
+				dstpixel->g = srcpixel->g + div255(dstpixel->g*(255 - a));
+				dstpixel->b = srcpixel->b + div255(dstpixel->b*(255 - a));
+			}
 			srcpixel += 1;
 			dstpixel += 1;
 			width -= 1;
@@ -247,6 +524,33 @@ void Blit32_32(uint32_t *src, uint32_t* dst, int width, uint8_t* blend)
 	}
 }
 
+/* copies line of a pre-expanded tile, skipping pixels with value 0 if key is set */
+void BlitCachedTile(const uint32_t* src, uint32_t* dst, int width, bool key)
+{
+	int c = 0;
+
+#ifdef USE_SSE2
+	const __m128i zero = _mm_setzero_si128 ();
+	for (; c + 4 <= width; c += 4)
+	{
+		__m128i color = _mm_loadu_si128 ((const __m128i*)(src + c));
+		if (key)
+		{
+			const __m128i mask = _mm_cmpeq_epi32 (color, zero);
+			const __m128i prev = _mm_loadu_si128 ((const __m128i*)(dst + c));
+			color = _mm_or_si128 (_mm_andnot_si128 (mask, color), _mm_and_si128 (mask, prev));
+		}
+		_mm_storeu_si128 ((__m128i*)(dst + c), color);
+	}
+#endif
+
+	for (; c < width; c++)
+	{
+		if (!key || src[c] != 0)
+			dst[c] = src[c];
+	}
+}
+
 /* performs mosaic effect with optional blend */
 void BlitMosaic(uint32_t *src, uint32_t* dst, int width, int size, uint8_t* blend)
 {
@@ -21,8 +21,11 @@ typedef void(*ScanBlitPtr) \
 extern "C" {
 #endif
 
-	/* returns suitable blitter for specified conditions */
-	ScanBlitPtr SelectBlitter(bool key, bool scaling, bool blend);
+	/* returns suitable blitter for specified conditions and source bits per pixel (8 or 32) */
+	ScanBlitPtr SelectBlitter(int bpp, bool key, bool scaling, bool blend);
+
+	/* returns suitable blitter for scaled sprites given its 16.16 horizontal step */
+	ScanBlitPtr SelectSpriteScalingBlitter(int dx, bool blend);
 
 	/* solid color with opcional blend */
 	void BlitColor(void* dstptr, uint32_t color, int width, uint8_t* blend);
@@ -30,6 +33,9 @@ extern "C" {
 	/* perfoms direct 32 -> 32 bpp blit with opcional blend */
 	void Blit32_32(uint32_t *src, uint32_t* dst, int width, uint8_t* blend);
 
+	/* copies line of a pre-expanded tile, skipping transparent pixels if key is set */
+	void BlitCachedTile(const uint32_t* src, uint32_t* dst, int width, bool key);
+
 	/* performs mosaic blit */
 	void BlitMosaic(uint32_t *src, uint32_t* dst, int width, int size, uint8_t* blend);
 
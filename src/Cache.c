@@ -0,0 +1,434 @@
+/*
+* Tilengine - The 2D retro graphics engine with raster effects
+* Copyright (C) 2015-2019 Marc Palacios Domenech <mailto:megamarc@hotmail.com>
+* All rights reserved
+*
+* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/.
+* */
+
+#include <string.h>
+#include <stdlib.h>
+#include "SDL2/SDL.h"
+#include "Tilengine.h"
+#include "Cache.h"
+#include "LoadFile.h"
+#include "Tileset.h"
+#include "Spriteset.h"
+#include "Bitmap.h"
+#include "Palette.h"
+#include "crc32.h"
+
+#define MAX_KEY			400
+#define MIN_BUCKETS		64
+
+/* loaded asset shared by all loads of the same file */
+typedef struct CacheEntry
+{
+	struct CacheEntry* next_key;	/* next entry in same bucket of by_key[] */
+	struct CacheEntry* next_object;	/* next entry in same bucket of by_object[] */
+	void* object;
+	CacheKind kind;
+	uint32_t hash;		/* hash of kind and key */
+	int refs;			/* references handed out and not released yet */
+	int bytes;			/* memory used by object and the ones it owns */
+	char key[];			/* absolute path, or path inside resource pack */
+}
+CacheEntry;
+
+/* hash map indexed both by file and by object, shared by all contexts and loading threads */
+static SDL_mutex* lock;
+static CacheEntry** by_key;
+static CacheEntry** by_object;
+static int num_buckets;
+static int num_entries;
+static uint32_t num_bytes;
+
+static uint32_t hash_key(CacheKind kind, const char* key)
+{
+	return _crc32((unsigned int)kind, key, strlen(key));
+}
+
+static int object_slot(void* object)
+{
+	const uintptr_t value = (uintptr_t)object;
+	return (int)((value >> 4) ^ (value >> 16)) & (num_buckets - 1);
+}
+
+static int bitmap_bytes(TLN_Bitmap bitmap)
+{
+	int bytes = 0;
+	if (bitmap != NULL)
+	{
+		bytes += ObjectSize(bitmap);
+		if (bitmap->palette != NULL)
+			bytes += ObjectSize(bitmap->palette);
+	}
+	return bytes;
+}
+
+/* memory held by a cached object, including the ones it owns */
+static int object_bytes(void* object)
+{
+	int bytes = ObjectSize(object);
+	int c;
+
+	switch (ObjectType(object))
+	{
+	case OT_TILESET:
+	{
+		TLN_Tileset tileset = (TLN_Tileset)object;
+		if (tileset->palette != NULL)
+			bytes += ObjectSize(tileset->palette);
+		if (tileset->tstype == TILESET_IMAGES && tileset->owns_images)
+		{
+			for (c = 0; c < tileset->numtiles; c += 1)
+				bytes += bitmap_bytes(tileset->images[c].bitmap);
+		}
+		break;
+	}
+
+	case OT_SPRITESET:
+		bytes += bitmap_bytes(((TLN_Spriteset)object)->bitmap);
+		break;
+
+	case OT_BITMAP:
+		bytes = bitmap_bytes((TLN_Bitmap)object);
+		break;
+
+	default:
+		break;
+	}
+	return bytes;
+}
+
+/* doubles buckets when there are more entries than buckets */
+static void grow_buckets(void)
+{
+	CacheEntry** new_key;
+	CacheEntry** new_object;
+	int old_buckets = num_buckets;
+	int c;
+
+	if (num_entries < num_buckets)
+		return;
+
+	num_buckets = old_buckets != 0 ? old_buckets * 2 : MIN_BUCKETS;
+	new_key = (CacheEntry**)calloc(num_buckets, sizeof(CacheEntry*));
+	new_object = (CacheEntry**)calloc(num_buckets, sizeof(CacheEntry*));
+	if (new_key == NULL || new_object == NULL)
+	{
+		/* keep longer chains */
+		free(new_key);
+		free(new_object);
+		num_buckets = old_buckets;
+		return;
+	}
+
+	for (c = 0; c < old_buckets; c += 1)
+	{
+		CacheEntry* entry = by_key[c];
+		while (entry != NULL)
+		{
+			CacheEntry* next = entry->next_key;
+			const int slot = entry->hash & (num_buckets - 1);
+			entry->next_key = new_key[slot];
+			new_key[slot] = entry;
+			entry = next;
+		}
+
+		entry = by_object[c];
+		while (entry != NULL)
+		{
+			CacheEntry* next = entry->next_object;
+			const int slot = object_slot(entry->object);
+			entry->next_object = new_object[slot];
+			new_object[slot] = entry;
+			entry = next;
+		}
+	}
+
+	free(by_key);
+	free(by_object);
+	by_key = new_key;
+	by_object = new_object;
+}
+
+static CacheEntry* find_key(CacheKind kind, const char* key, uint32_t hash)
+{
+	CacheEntry* entry;
+
+	if (num_buckets == 0)
+		return NULL;
+
+	entry = by_key[hash & (num_buckets - 1)];
+	while (entry != NULL)
+	{
+		if (entry->hash == hash && entry->kind == kind && !strcmp(entry->key, key))
+			return entry;
+		entry = entry->next_key;
+	}
+	return NULL;
+}
+
+static CacheEntry* find_object(void* object)
+{
+	CacheEntry* entry;
+
+	if (num_buckets == 0 || object == NULL)
+		return NULL;
+
+	entry = by_object[object_slot(object)];
+	while (entry != NULL && entry->object != object)
+		entry = entry->next_object;
+	return entry;
+}
+
+/* unlinks entry from both buckets, doesn't delete the object */
+static void remove_entry(CacheEntry* entry)
+{
+	CacheEntry** link = &by_key[entry->hash & (num_buckets - 1)];
+	while (*link != entry)
+		link = &(*link)->next_key;
+	*link = entry->next_key;
+
+	link = &by_object[object_slot(entry->object)];
+	while (*link != entry)
+		link = &(*link)->next_object;
+	*link = entry->next_object;
+
+	num_entries -= 1;
+	num_bytes -= entry->bytes;
+	free(entry);
+}
+
+static void delete_object(void* object)
+{
+	switch (ObjectType(object))
+	{
+	case OT_TILESET:
+		TLN_DeleteTileset((TLN_Tileset)object);
+		break;
+
+	case OT_SPRITESET:
+		TLN_DeleteSpriteset((TLN_Spriteset)object);
+		break;
+
+	case OT_BITMAP:
+		TLN_DeleteBitmap((TLN_Bitmap)object);
+		break;
+
+	case OT_PALETTE:
+		TLN_DeletePalette((TLN_Palette)object);
+		break;
+
+	default:
+		break;
+	}
+}
+
+/* creates lock shared by loading threads, must be called before they start */
+void InitCache(void)
+{
+	if (lock == NULL)
+		lock = SDL_CreateMutex();
+}
+
+/* returns a new reference to an already loaded file, or NULL if it isn't cached */
+void* FindCached(CacheKind kind, const char* filename)
+{
+	char key[MAX_KEY];
+	CacheEntry* entry;
+	void* object = NULL;
+
+	InitCache();
+	BuildFileKey(key, sizeof(key), filename);
+
+	SDL_LockMutex(lock);
+	entry = find_key(kind, key, hash_key(kind, key));
+	if (entry != NULL)
+	{
+		entry->refs += 1;
+		object = entry->object;
+	}
+	SDL_UnlockMutex(lock);
+	return object;
+}
+
+/* caches a just loaded object with one reference, NULL objects are ignored. If another thread
+ * cached the same file meanwhile, the given one is deleted and a reference to that one returned */
+void* AddCached(CacheKind kind, const char* filename, void* object)
+{
+	char key[MAX_KEY];
+	CacheEntry* entry;
+	uint32_t hash;
+	size_t key_size;
+	void* duplicate = NULL;
+
+	if (object == NULL)
+		return NULL;
+
+	InitCache();
+	BuildFileKey(key, sizeof(key), filename);
+	hash = hash_key(kind, key);
+	key_size = strlen(key) + 1;
+
+	SDL_LockMutex(lock);
+	entry = find_key(kind, key, hash);
+	if (entry != NULL)
+	{
+		entry->refs += 1;
+		duplicate = object;
+		object = entry->object;
+	}
+	else
+	{
+		entry = (CacheEntry*)malloc(sizeof(CacheEntry) + key_size);
+		if (entry != NULL)
+		{
+			grow_buckets();
+			if (num_buckets != 0)
+			{
+				entry->object = object;
+				entry->kind = kind;
+				entry->hash = hash;
+				entry->refs = 1;
+				entry->bytes = object_bytes(object);
+				memcpy(entry->key, key, key_size);
+
+				entry->next_key = by_key[hash & (num_buckets - 1)];
+				by_key[hash & (num_buckets - 1)] = entry;
+				entry->next_object = by_object[object_slot(object)];
+				by_object[object_slot(object)] = entry;
+				num_entries += 1;
+				num_bytes += entry->bytes;
+			}
+			else
+				free(entry);
+		}
+	}
+	SDL_UnlockMutex(lock);
+
+	if (duplicate != NULL)
+		delete_object(duplicate);
+	return object;
+}
+
+/* adds a reference for another holder of the same object, ignored if not cached */
+void RetainCached(void* object)
+{
+	CacheEntry* entry;
+
+	if (lock == NULL)
+		return;
+
+	SDL_LockMutex(lock);
+	entry = find_object(object);
+	if (entry != NULL)
+		entry->refs += 1;
+	SDL_UnlockMutex(lock);
+}
+
+/* releases a reference. Returns true if the object is cached, so it must be kept
+ * until evicted. Not cached objects return false and can be deleted */
+bool ReleaseCached(void* object)
+{
+	CacheEntry* entry;
+
+	if (lock == NULL)
+		return false;
+
+	SDL_LockMutex(lock);
+	entry = find_object(object);
+	if (entry != NULL && entry->refs > 0)
+		entry->refs -= 1;
+	SDL_UnlockMutex(lock);
+	return entry != NULL;
+}
+
+/*!
+ * \brief
+ * Deletes cached resources that aren't used anymore
+ *
+ * \returns
+ * Number of resources deleted
+ *
+ * \remarks
+ * Tilesets, spritesets, bitmaps and palettes loaded from files are cached by their absolute
+ * path, so loading the same file again returns the same instance. Each load takes a reference
+ * that is released when the resource is deleted, but the resource stays cached until this
+ * function is called and all its references have been released. Tilemaps release their
+ * tilesets when deleted
+ *
+ * \see
+ * TLN_GetCacheMemory()
+ */
+int TLN_EvictCache(void)
+{
+	void** unused = NULL;
+	int num_unused = 0;
+	int c;
+
+	if (lock == NULL)
+	{
+		TLN_SetLastError(TLN_ERR_OK);
+		return 0;
+	}
+
+	/* unlink unused ones */
+	SDL_LockMutex(lock);
+	if (num_entries > 0)
+		unused = (void**)malloc(num_entries * sizeof(void*));
+	for (c = 0; c < num_buckets && unused != NULL; c += 1)
+	{
+		CacheEntry* entry = by_key[c];
+		while (entry != NULL)
+		{
+			CacheEntry* next = entry->next_key;
+			if (entry->refs == 0)
+			{
+				unused[num_unused++] = entry->object;
+				remove_entry(entry);
+			}
+			entry = next;
+		}
+	}
+	SDL_UnlockMutex(lock);
+
+	/* not cached anymore, so they're really deleted */
+	for (c = 0; c < num_unused; c += 1)
+		delete_object(unused[c]);
+	free(unused);
+
+	TLN_SetLastError(TLN_ERR_OK);
+	return num_unused;
+}
+
+/*!
+ * \brief
+ * Returns the memory used by cached resources, both used and pending of eviction
+ *
+ * \param num_resources
+ * Optional pointer to variable that receives the number of cached resources, can be NULL
+ *
+ * \returns
+ * Total size in bytes
+ *
+ * \see
+ * TLN_EvictCache()
+ */
+uint32_t TLN_GetCacheMemory(int* num_resources)
+{
+	uint32_t bytes;
+
+	InitCache();
+	SDL_LockMutex(lock);
+	bytes = num_bytes;
+	if (num_resources != NULL)
+		*num_resources = num_entries;
+	SDL_UnlockMutex(lock);
+
+	TLN_SetLastError(TLN_ERR_OK);
+	return bytes;
+}
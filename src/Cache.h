@@ -0,0 +1,33 @@
+/*
+* Tilengine - The 2D retro graphics engine with raster effects
+* Copyright (C) 2015-2019 Marc Palacios Domenech <mailto:megamarc@hotmail.com>
+* All rights reserved
+*
+* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/.
+* */
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include "Object.h"
+
+/* kind of loaded asset, the same file can be cached as different kinds */
+typedef enum
+{
+	CACHE_TILESET,
+	CACHE_SPRITESET,
+	CACHE_BITMAP,
+	CACHE_DIRECT_BITMAP,
+	CACHE_PALETTE,
+}
+CacheKind;
+
+void InitCache(void);
+void* FindCached(CacheKind kind, const char* filename);
+void* AddCached(CacheKind kind, const char* filename, void* object);
+void RetainCached(void* object);
+bool ReleaseCached(void* object);
+
+#endif
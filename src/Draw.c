@@ -17,23 +17,150 @@
 #include "Tilemap.h"
 #include "ObjectList.h"
 #include "Sprite.h"
+#include "SpriteGroup.h"
 
 /* private prototypes */
 static void DrawSpriteCollision(int nsprite, uint8_t *srcpixel, uint16_t *dstpixel, int width, int dx);
 static void DrawSpriteCollisionScaling(int nsprite, uint8_t *srcpixel, uint16_t *dstpixel, int width, int dx, int srcx);
+static void DrawSpriteGroupScanline(TLN_SpriteGroup group, uint32_t* dstscan, int nscan);
 
 static bool check_sprite_coverage(Sprite* sprite, int nscan)
 {
 	/* check sprite coverage */
 	if (nscan < sprite->dstrect.y1 || nscan >= sprite->dstrect.y2)
 		return false;
-	if (sprite->dstrect.x2 < 0 || sprite->srcrect.x2 < 0)
+	if (sprite->dstrect.x2 <= sprite->dstrect.x1)
 		return false;
 	if ((sprite->flags & FLAG_MASKED) && nscan >= engine->sprite_mask_top && nscan <= engine->sprite_mask_bottom)
 		return false;
 	return true;
 }
 
+/* evaluates pending color cycle of a palette about to be used */
+static inline void refresh_palette(TLN_Palette palette)
+{
+	if (palette != NULL && palette->cycle != NULL)
+		UpdatePaletteCycle(palette);
+}
+
+/* evaluates pending color cycles of all the palettes a layer can use */
+static void refresh_layer_palettes(Layer* layer)
+{
+	int c;
+
+	if (layer->palette != NULL)
+	{
+		refresh_palette(layer->palette);
+		return;
+	}
+
+	if (layer->type == LAYER_TILE)
+	{
+		for (c = 0; c < MAX_TILESETS && layer->tilemap->tilesets[c] != NULL; c++)
+			refresh_palette(layer->tilemap->tilesets[c]->palette);
+		for (c = 0; c < NUM_PALETTES; c++)
+			refresh_palette(engine->palettes[c]);
+	}
+	else if (layer->type == LAYER_BITMAP)
+		refresh_palette(layer->bitmap->palette);
+}
+
+/* builds a private copy of the given palette with the single color entries in effect, in a free
+ * scratch slot or replacing them in turn when all are taken */
+static TLN_Palette build_scratch_palette(Layer* layer, TLN_Palette base)
+{
+	const TLN_PaletteLine* entries = layer->palette_table.entries;
+	TLN_Palette scratch;
+	int slot;
+	int c;
+
+	for (slot = 0; slot < PALETTE_SCRATCH_SLOTS; slot++)
+	{
+		if (layer->palette_table.scratch[slot].base == NULL)
+			break;
+	}
+	if (slot == PALETTE_SCRATCH_SLOTS)
+	{
+		slot = layer->palette_table.next;
+		layer->palette_table.next = (slot + 1) % PALETTE_SCRATCH_SLOTS;
+	}
+	scratch = layer->palette_table.scratch[slot].palette;
+
+	refresh_palette(base);
+	CopyPalette(scratch, base);
+	for (c = layer->palette_table.first; c < layer->palette_table.pos; c++)
+	{
+		if (entries[c].palette == NULL)
+			scratch->data[entries[c].index] = PackRGB32(entries[c].r, entries[c].g, entries[c].b);
+	}
+	layer->palette_table.scratch[slot].base = base;
+	return scratch;
+}
+
+/* marks all scratch copies as outdated */
+static void invalidate_scratch_palettes(Layer* layer)
+{
+	int c;
+	for (c = 0; c < PALETTE_SCRATCH_SLOTS; c++)
+		layer->palette_table.scratch[c].base = NULL;
+}
+
+/* palette in effect for pixels that would regularly use the given palette. Scratch copies are
+ * a cache rebuilt on demand, so drawing functions can still take a const layer */
+static inline TLN_Palette get_layer_palette(const Layer* layer, TLN_Palette regular)
+{
+	TLN_Palette base = layer->palette != NULL ? layer->palette : regular;
+	int c;
+
+	if (layer->palette_table.entries == NULL)
+		return base;
+
+	if (layer->palette_table.current != NULL)
+		base = layer->palette_table.current;
+	if (!layer->palette_table.colors || base == NULL)
+		return base;
+	for (c = 0; c < PALETTE_SCRATCH_SLOTS; c++)
+	{
+		if (layer->palette_table.scratch[c].base == base)
+			return layer->palette_table.scratch[c].palette;
+	}
+	return build_scratch_palette((Layer*)layer, base);
+}
+
+/* applies entries of the per-scanline palette table up to given line */
+static void update_palette_table(Layer* layer, int line)
+{
+	const TLN_PaletteLine* entries = layer->palette_table.entries;
+	const int count = layer->palette_table.count;
+
+	/* restart on new frame */
+	if (line != layer->palette_table.line)
+	{
+		layer->palette_table.pos = 0;
+		layer->palette_table.first = 0;
+		layer->palette_table.current = NULL;
+		layer->palette_table.colors = false;
+		invalidate_scratch_palettes(layer);
+	}
+	layer->palette_table.line = line + 1;
+
+	while (layer->palette_table.pos < count && entries[layer->palette_table.pos].line <= line)
+	{
+		const TLN_PaletteLine* entry = &entries[layer->palette_table.pos++];
+		if (entry->palette != NULL)
+		{
+			/* discards single colors set before */
+			refresh_palette(entry->palette);
+			layer->palette_table.current = entry->palette;
+			layer->palette_table.first = layer->palette_table.pos;
+			layer->palette_table.colors = false;
+		}
+		else
+			layer->palette_table.colors = true;
+		invalidate_scratch_palettes(layer);
+	}
+}
+
 /* draw background scanline taking into account mosaic and windowing effects */
 static bool draw_background_scanline(int nlayer, int line)
 {
@@ -137,6 +264,31 @@ static bool draw_background_scanline(int nlayer, int line)
 	return priority;
 }
 
+/* applies pending world position to a layer */
+static inline void update_layer_position(int nlayer)
+{
+	Layer* layer = &engine->layers[nlayer];
+	if (engine->dirty || layer->dirty)
+	{
+		const int lx = (int)(engine->xworld * layer->world.xfactor) - layer->world.offsetx;
+		const int ly = (int)(engine->yworld * layer->world.yfactor) - layer->world.offsety;
+		TLN_SetLayerPosition(nlayer, lx, ly);
+		layer->dirty = false;
+	}
+}
+
+/* applies pending world position to a sprite */
+static inline void update_sprite_position(Sprite* sprite)
+{
+	if (sprite->world_space && (sprite->dirty || engine->dirty))
+	{
+		sprite->x = sprite->xworld - engine->xworld;
+		sprite->y = sprite->yworld - engine->yworld;
+		UpdateSprite(sprite);
+		sprite->dirty = false;
+	}
+}
+
 /* Draws the next scanline of the frame started with TLN_BeginFrame() or TLN_BeginWindowFrame() */
 bool DrawScanline(void)
 {
@@ -147,15 +299,16 @@ bool DrawScanline(void)
 	int index;
 	bool background_priority = false;	/* at least one tile in priority layer */
 	bool sprite_priority = false;		/* at least one sprite in priority layer */
-	List* list;
 
 	/* call raster effect callback */
 	if (engine->cb_raster)
 		engine->cb_raster(line);
 
 	/* background is bitmap */
-	if (engine->bgbitmap && engine->bgpalette)
+	if (engine->bgbitmap && (engine->bgpalette || engine->bgbitmap->bpp == 32))
 	{
+		if (engine->pending_palettes > 0)
+			refresh_palette(engine->bgpalette);
 		if (size > engine->bgbitmap->width)
 			size = engine->bgbitmap->width;
 		if (line < engine->bgbitmap->height)
@@ -176,13 +329,13 @@ bool DrawScanline(void)
 			Layer* layer = &engine->layers[c];
 	
 			/* update if dirty */
-			if (engine->dirty || layer->dirty)
-			{
-				const int lx = (int)(engine->xworld * layer->world.xfactor) - layer->world.offsetx;
-				const int ly = (int)(engine->yworld * layer->world.yfactor) - layer->world.offsety;
-				TLN_SetLayerPosition(c, lx, ly);
-				layer->dirty = false;
-			}
+			update_layer_position(c);
+
+			/* color cycles are evaluated lazily, only for palettes in use */
+			if (layer->ok && engine->pending_palettes > 0)
+				refresh_layer_palettes(layer);
+			if (layer->ok && layer->palette_table.entries != NULL)
+				update_palette_table(layer, line);
 
 			/* draw */
 			if (layer->ok && !layer->priority)
@@ -194,23 +347,18 @@ bool DrawScanline(void)
 	if (engine->numsprites > 0)
 	{
 		memset(engine->collision, -1, engine->framebuffer.width * sizeof(uint16_t));
-		list = &engine->list_sprites;
-		index = list->first;
+		index = engine->list_sprites.first;
 		while (index != -1)
 		{
 			Sprite* sprite = &engine->sprites[index];
 
 			/* update if dirty */
-			if (sprite->world_space && (sprite->dirty || engine->dirty))
-			{
-				sprite->x = sprite->xworld - engine->xworld;
-				sprite->y = sprite->yworld - engine->yworld;
-				UpdateSprite(sprite);
-				sprite->dirty = false;
-			}
+			update_sprite_position(sprite);
 
 			if (check_sprite_coverage(sprite, line))
 			{
+				if (engine->pending_palettes > 0)
+					refresh_palette(sprite->palette);
 				if (!(sprite->flags & FLAG_PRIORITY))
 					sprite->draw(index, scan, line, 0, 0);
 				else
@@ -220,6 +368,16 @@ bool DrawScanline(void)
 		}
 	}
 
+	/* draw sprite groups */
+	for (c = 0; c < engine->num_groups; c++)
+	{
+		const TLN_SpriteGroup group = engine->groups[c];
+		if (!(group->flags & FLAG_PRIORITY))
+			DrawSpriteGroupScanline(group, scan, line);
+		else
+			sprite_priority = true;
+	}
+
 	/* draw background layers with priority */
 	if (engine->numlayers > 0)
 	{
@@ -248,7 +406,7 @@ bool DrawScanline(void)
 	/* draw sprites with priority */
 	if (sprite_priority == true)
 	{
-		index = list->first;
+		index = engine->numsprites > 0 ? engine->list_sprites.first : -1;
 		while (index != -1)
 		{
 			Sprite* sprite = &engine->sprites[index];
@@ -256,6 +414,12 @@ bool DrawScanline(void)
 				sprite->draw(index, scan, line, 0, 0);
 			index = sprite->list_node.next;
 		}
+		for (c = 0; c < engine->num_groups; c++)
+		{
+			const TLN_SpriteGroup group = engine->groups[c];
+			if (group->flags & FLAG_PRIORITY)
+				DrawSpriteGroupScanline(group, scan, line);
+		}
 	}
 
 	/* next scanline */
@@ -354,7 +518,7 @@ static bool DrawTiledScanline(int nlayer, uint32_t* dstpixel, int nscan, int tx1
 		int ytile = ypos >> tileset->vshift;
 		scan.srcy = ypos & tileset->vmask;
 
-		TLN_Tile tile = &tilemap->tiles[ytile*tilemap->cols + xtile];
+		TLN_Tile tile = GetTilemapCell(tilemap, ytile, xtile);
 
 		/* get effective tile width */
 		int tilewidth = tileset->width - scan.srcx;
@@ -370,11 +534,8 @@ static bool DrawTiledScanline(int nlayer, uint32_t* dstpixel, int nscan, int tx1
 			const uint16_t tile_index = tileset->tiles[tile->index] - 1;
 
 			/* selects suitable palette */
-			TLN_Palette palette = tileset->palette;
-			if (layer->palette != NULL)
-				palette = layer->palette;
-			else if (engine->palettes[tile->palette] != NULL)
-				palette = engine->palettes[tile->palette];
+			TLN_Palette palette = engine->palettes[tile->palette] != NULL ? engine->palettes[tile->palette] : tileset->palette;
+			palette = get_layer_palette(layer, palette);
 
 			/* process rotate & flip flags */
 			scan.dx = 1;
@@ -392,7 +553,21 @@ static bool DrawTiledScanline(int nlayer, uint32_t* dstpixel, int nscan, int tx1
 
 			int line = GetTilesetLine(tileset, tile_index, scan.srcy);
 			bool color_key = *(tileset->color_key + line);
-			layer->blitters[1](srcpixel, palette, dst + x, width, scan.dx, 0, layer->blend);
+			uint32_t* cached = NULL;
+			if (tileset->cache != NULL && layer->palette_table.count == 0)
+				cached = GetCachedTile(tileset, palette, tile_index, engine->frame);
+
+			/* pre-expanded colors: solid lines are plain copies */
+			if (cached != NULL)
+			{
+				uint32_t* srccolor = &cached[(scan.srcy << tileset->hshift) + scan.srcx];
+				if (scan.dx == 1 && layer->blend == NULL)
+					BlitCachedTile(srccolor, dst + x, width, color_key);
+				else
+					SelectBlitter(32, color_key, false, layer->blend != NULL)((uint8_t*)srccolor, NULL, dst + x, width, scan.dx, 0, layer->blend);
+			}
+			else
+				layer->blitters[1](srcpixel, palette, dst + x, width, scan.dx, 0, layer->blend);
 		}
 
 		/* next tile */
@@ -440,7 +615,7 @@ static bool DrawTiledScanlineScaling(int nlayer, uint32_t* dstpixel, int nscan,
 		int ytile = ypos >> tileset->vshift;
 		scan.srcy = ypos & tileset->vmask;
 
-		TLN_Tile tile = &tilemap->tiles[ytile*tilemap->cols + xtile];
+		TLN_Tile tile = GetTilemapCell(tilemap, ytile, xtile);
 
 		/* get effective tile width */
 		int tilewidth = tileset->width - scan.srcx;
@@ -466,11 +641,8 @@ static bool DrawTiledScanlineScaling(int nlayer, uint32_t* dstpixel, int nscan,
 			const uint16_t tile_index = tileset->tiles[tile->index] - 1;
 
 			/* selects suitable palette */
-			TLN_Palette palette = tileset->palette;
-			if (layer->palette != NULL)
-				palette = layer->palette;
-			else if (engine->palettes[tile->palette] != NULL)
-				palette = engine->palettes[tile->palette];
+			TLN_Palette palette = engine->palettes[tile->palette] != NULL ? engine->palettes[tile->palette] : tileset->palette;
+			palette = get_layer_palette(layer, palette);
 
 			/* process flip flags */
 			scan.dx = dx;
@@ -541,7 +713,7 @@ static bool DrawTiledScanlineAffine(int nlayer, uint32_t* dstpixel, int nscan, i
 
 		scan.srcx = xpos & tileset->hmask;
 		scan.srcy = ypos & tileset->vmask;
-		TLN_Tile tile = &tilemap->tiles[ytile*tilemap->cols + xtile];
+		TLN_Tile tile = GetTilemapCell(tilemap, ytile, xtile);
 
 		/* paint if not empty tile */
 		if (tile->index != 0)
@@ -554,7 +726,7 @@ static bool DrawTiledScanlineAffine(int nlayer, uint32_t* dstpixel, int nscan, i
 				process_flip_rotation(tile->flags, &scan);
 
 			/* paint RGB pixel value */
-			const TLN_Palette palette = layer->palette != NULL ? layer->palette : tileset->palette;
+			const TLN_Palette palette = get_layer_palette(layer, tileset->palette);
 			*dstpixel = palette->data[GetTilesetPixel(tileset, tile_index, scan.srcx, scan.srcy)];
 		}
 
@@ -596,7 +768,7 @@ static bool DrawTiledScanlinePixelMapping(int nlayer, uint32_t* dstpixel, int ns
 
 		scan.srcx = xpos & tileset->hmask;
 		scan.srcy = ypos & tileset->vmask;
-		TLN_Tile tile = &tilemap->tiles[ytile*tilemap->cols + xtile];
+		TLN_Tile tile = GetTilemapCell(tilemap, ytile, xtile);
 
 		/* paint if not empty tile */
 		if (tile->index != 0)
@@ -609,7 +781,7 @@ static bool DrawTiledScanlinePixelMapping(int nlayer, uint32_t* dstpixel, int ns
 				process_flip_rotation(tile->flags, &scan);
 
 			/* paint RGB pixel value */
-			const TLN_Palette palette = layer->palette != NULL ? layer->palette : tileset->palette;
+			const TLN_Palette palette = get_layer_palette(layer, tileset->palette);
 			*dstpixel = palette->data[GetTilesetPixel(tileset, tile_index, scan.srcx, scan.srcy)];
 		}
 
@@ -621,29 +793,109 @@ static bool DrawTiledScanlinePixelMapping(int nlayer, uint32_t* dstpixel, int ns
 	return false;
 }
 
-/* draw sprite scanline */
-static bool DrawSpriteScanline(int nsprite, uint32_t* dstscan, int nscan, int tx1, int tx2)
+/* flip flags to read stored sprite pixels, that may be a mirrored copy of the frame */
+static inline uint16_t get_pixel_flags(const SpriteEntry* info, uint16_t flags)
+{
+	uint16_t mirror = info->flags;
+
+	/* with rotation, horizontal mirror of source acts as vertical flip and viceversa */
+	if ((flags & FLAG_ROTATE) && mirror != 0 && mirror != (FLAG_FLIPX + FLAG_FLIPY))
+		mirror ^= FLAG_FLIPX + FLAG_FLIPY;
+	return flags ^ mirror;
+}
+
+/* blits a row of run-length encoded spans clipped to columns [x1, x2), being dstx the screen position of column 0.
+ * Opaque runs are blitted without color key, transparent runs skipped. Updates collision buffer if nsprite >= 0 */
+static void blit_spans(const uint16_t* span, uint8_t* srcrow, int width, bool flipx, int x1, int x2, int dstx,
+	uint32_t* dstscan, TLN_Palette palette, uint8_t* blend, int nsprite)
+{
+	const ScanBlitPtr blitter = SelectBlitter(8, false, false, blend != NULL);
+	int dx = 1;
+	int pos = 0;
+	int count;
+
+	/* right to left list follows left to right list */
+	if (flipx)
+	{
+		span += 1 + span[0] * 2;
+		srcrow += width - 1;
+		dx = -1;
+	}
+
+	count = *span++;
+	while (count)
+	{
+		int start = pos + span[0];
+		int end = start + span[1];
+		pos = end;
+		span += 2;
+		count--;
+
+		if (end <= x1)
+			continue;
+		if (start >= x2)
+			break;
+		if (start < x1)
+			start = x1;
+		if (end > x2)
+			end = x2;
+
+		uint8_t* srcpixel = srcrow + start*dx;
+		blitter(srcpixel, palette, dstscan + dstx + start, end - start, dx, 0, blend);
+		if (nsprite >= 0)
+			DrawSpriteCollision(nsprite, srcpixel, engine->collision + dstx + start, end - start, dx);
+	}
+}
+
+/* draw sprite scanline from run-length encoded spans */
+static void DrawSpriteSpans(int nsprite, uint32_t* dstscan, int srcy, bool flipx)
 {
 	Sprite* sprite = (Sprite*)&engine->sprites[nsprite];
+	const TLN_Spriteset spriteset = sprite->spriteset;
+	const uint16_t* span = spriteset->spans + spriteset->span_rows[sprite->info->span_row + srcy];
+	const int x1 = sprite->srcrect.x1;
 
-	Tilescan scan = { 0 };
-	scan.srcx = sprite->srcrect.x1;
-	scan.srcy = sprite->srcrect.y1 + (nscan - sprite->dstrect.y1);
-	scan.width = sprite->info->w;
-	scan.height = sprite->info->h;
-	scan.stride = sprite->pitch;
+	/* positions are relative to the unclipped sprite */
+	blit_spans(span, sprite->pixels + srcy*sprite->pitch, sprite->info->w, flipx, x1, sprite->srcrect.x2,
+		sprite->dstrect.x1 - x1, dstscan, sprite->palette, sprite->blend, sprite->do_collision ? nsprite : -1);
+}
+
+/* sets up source position and step of a sprite scanline, returns effective flip flags */
+static uint16_t setup_sprite_scan(const Sprite* sprite, int nscan, Tilescan* scan)
+{
+	scan->srcx = sprite->srcrect.x1;
+	scan->srcy = sprite->srcrect.y1 + (nscan - sprite->dstrect.y1);
+	scan->width = sprite->info->w;
+	scan->height = sprite->info->h;
+	scan->stride = sprite->pitch;
 
 	/* disable rotation for non-squared sprites */
 	uint16_t flags = sprite->flags;
-	if ((flags & FLAG_ROTATE) && sprite->info->w != sprite->info->h)
+	if ((flags & FLAG_ROTATE) && sprite->info->frame_w != sprite->info->frame_h)
 		flags &= ~FLAG_ROTATE;
-
-	const int w = sprite->dstrect.x2 - sprite->dstrect.x1;
+	flags = get_pixel_flags(sprite->info, flags);
 
 	/* process rotate & flip flags */
-	scan.dx = 1;
+	scan->dx = 1;
 	if ((flags & (FLAG_FLIPX + FLAG_FLIPY + FLAG_ROTATE)) != 0)
-		process_flip_rotation(flags, &scan);
+		process_flip_rotation(flags, scan);
+	return flags;
+}
+
+/* draw sprite scanline */
+static bool DrawSpriteScanline(int nsprite, uint32_t* dstscan, int nscan, int tx1, int tx2)
+{
+	Sprite* sprite = (Sprite*)&engine->sprites[nsprite];
+	Tilescan scan = { 0 };
+	const uint16_t flags = setup_sprite_scan(sprite, nscan, &scan);
+	const int w = sprite->dstrect.x2 - sprite->dstrect.x1;
+
+	/* run-length encoded spans */
+	if (sprite->spriteset->spans != NULL && !(flags & FLAG_ROTATE))
+	{
+		DrawSpriteSpans(nsprite, dstscan, scan.srcy, (flags & FLAG_FLIPX) != 0);
+		return true;
+	}
 
 	/* blit scanline */
 	uint8_t* srcpixel = sprite->pixels + (scan.srcy*sprite->pitch) + scan.srcx;
@@ -658,33 +910,45 @@ static bool DrawSpriteScanline(int nsprite, uint32_t* dstscan, int nscan, int tx
 	return true;
 }
 
-/* draw sprite scanline with scaling */
-static bool DrawScalingSpriteScanline(int nsprite, uint32_t* dstscan, int nscan, int tx1, int tx2)
+/* advances source line of scaled sprite, returns source row and fixed point start and step */
+static uint8_t* setup_scaling_sprite_scan(Sprite* sprite, int nscan, int* psrcx, int* pdx)
 {
-	Sprite* sprite = (Sprite*)&engine->sprites[nsprite];
+	int srcx, srcy, dx;
 
-	int srcx = sprite->srcrect.x1;
-	int srcy = sprite->srcrect.y1 + (nscan - sprite->dstrect.y1)*sprite->dy;
-	int dstw = sprite->dstrect.x2 - sprite->dstrect.x1;
+	/* advance source line, recompute only on first line or when lines were skipped */
+	if (nscan == sprite->srcline + 1)
+		sprite->srcy += sprite->dy;
+	else
+		sprite->srcy = sprite->srcrect.y1 + (nscan - sprite->dstrect.y1)*sprite->dy;
+	sprite->srcline = nscan;
 
 	/* H/V flip */
-	int dstx, dx;
-	if (sprite->flags & FLAG_FLIPX)
-	{
-		srcx = int2fix(sprite->info->w) - srcx;
-		dstx = sprite->dstrect.x2;
-		dx = -sprite->dx;
-	}
-	else
+	const uint16_t flags = get_pixel_flags(sprite->info, (uint16_t)(sprite->flags & ~FLAG_ROTATE));
+	srcx = sprite->srcrect.x1;
+	srcy = sprite->srcy;
+	dx = sprite->dx;
+	if (flags & FLAG_FLIPX)
 	{
-		dstx = sprite->dstrect.x1;
-		dx = sprite->dx;
+		srcx = int2fix(sprite->info->w) - 1 - srcx;
+		dx = -dx;
 	}
-	if (sprite->flags & FLAG_FLIPY)
-		srcy = int2fix(sprite->info->h) - srcy;
+	if (flags & FLAG_FLIPY)
+		srcy = int2fix(sprite->info->h) - 1 - srcy;
+
+	*psrcx = srcx;
+	*pdx = dx;
+	return sprite->pixels + (fix2int(srcy)*sprite->pitch);
+}
+
+/* draw sprite scanline with scaling */
+static bool DrawScalingSpriteScanline(int nsprite, uint32_t* dstscan, int nscan, int tx1, int tx2)
+{
+	Sprite* sprite = (Sprite*)&engine->sprites[nsprite];
+	const int dstw = sprite->dstrect.x2 - sprite->dstrect.x1;
+	int srcx, dx;
 
 	/* blit scanline */
-	uint8_t* srcpixel = sprite->pixels + (fix2int(srcy)*sprite->pitch);
+	uint8_t* srcpixel = setup_scaling_sprite_scan(sprite, nscan, &srcx, &dx);
 	uint32_t* dstpixel = dstscan + sprite->dstrect.x1;
 	sprite->blitter(srcpixel, sprite->palette, dstpixel, dstw, dx, srcx, sprite->blend);
 
@@ -696,6 +960,65 @@ static bool DrawScalingSpriteScanline(int nsprite, uint32_t* dstscan, int nscan,
 	return true;
 }
 
+/* draw scanline of all instances of a sprite group */
+static void DrawSpriteGroupScanline(TLN_SpriteGroup group, uint32_t* dstscan, int nscan)
+{
+	const TLN_Spriteset spriteset = group->spriteset;
+	const TLN_Palette palette = group->palette != NULL ? group->palette : spriteset->palette;
+	const ScanBlitPtr blitter = SelectBlitter(8, true, false, group->blend != NULL);
+	const int width = engine->framebuffer.width;
+	const uint8_t* pixels = spriteset->bitmap->data;
+	const int pitch = spriteset->bitmap->pitch;
+
+	/* active list must be kept in sync even when not drawing */
+	int index = UpdateSpriteGroupLine(group, nscan);
+	if ((group->flags & FLAG_MASKED) && nscan >= engine->sprite_mask_top && nscan <= engine->sprite_mask_bottom)
+		return;
+	if (palette == NULL || index == -1)
+		return;
+	refresh_palette(palette);
+
+	while (index != -1)
+	{
+		const TLN_SpriteInstance* instance = &group->instances[index];
+		const SpriteEntry* info = &spriteset->data[instance->index];
+		const uint16_t flags = (uint16_t)((group->flags ^ instance->flags) & (FLAG_FLIPX + FLAG_FLIPY));
+		const uint16_t pixel_flags = get_pixel_flags(info, flags);
+		int bx, by, x1, x2, srcx, srcy;
+
+		GetInstanceBox(info, flags, &bx, &by);
+		x1 = instance->x + bx;
+		x2 = x1 + info->w;
+		srcx = 0;
+		srcy = nscan - instance->y - by;
+		if (pixel_flags & FLAG_FLIPY)
+			srcy = info->h - 1 - srcy;
+
+		/* horizontal clipping */
+		if (x1 < 0)
+		{
+			srcx = -x1;
+			x1 = 0;
+		}
+		if (x2 > width)
+			x2 = width;
+
+		uint8_t* srcrow = (uint8_t*)pixels + info->offset + srcy*pitch;
+		if (spriteset->spans != NULL)
+		{
+			const uint16_t* span = spriteset->spans + spriteset->span_rows[info->span_row + srcy];
+			blit_spans(span, srcrow, info->w, (pixel_flags & FLAG_FLIPX) != 0, srcx, srcx + x2 - x1, x1 - srcx,
+				dstscan, palette, group->blend, -1);
+		}
+		else if (pixel_flags & FLAG_FLIPX)
+			blitter(srcrow + info->w - 1 - srcx, palette, dstscan + x1, x2 - x1, -1, 0, group->blend);
+		else
+			blitter(srcrow + srcx, palette, dstscan + x1, x2 - x1, 1, 0, group->blend);
+
+		index = group->links[index];
+	}
+}
+
 /* updates per-pixel sprite collision buffer */
 static void DrawSpriteCollision(int nsprite, uint8_t *srcpixel, uint16_t *dstpixel, int width, int dx)
 {
@@ -739,6 +1062,117 @@ static void DrawSpriteCollisionScaling(int nsprite, uint8_t *srcpixel, uint16_t
 	}
 }
 
+/* updates collision buffer with a sprite scanline, without drawing */
+static void DrawSpriteCollisionScanline(int nsprite, int nscan)
+{
+	Sprite* sprite = &engine->sprites[nsprite];
+	uint16_t* dstpixel = engine->collision + sprite->dstrect.x1;
+	const int w = sprite->dstrect.x2 - sprite->dstrect.x1;
+
+	if (sprite->mode == MODE_SCALING)
+	{
+		int srcx, dx;
+		uint8_t* srcpixel = setup_scaling_sprite_scan(sprite, nscan, &srcx, &dx);
+		DrawSpriteCollisionScaling(nsprite, srcpixel, dstpixel, w, dx, srcx);
+	}
+	else
+	{
+		Tilescan scan = { 0 };
+		setup_sprite_scan(sprite, nscan, &scan);
+		DrawSpriteCollision(nsprite, sprite->pixels + (scan.srcy*sprite->pitch) + scan.srcx, dstpixel, w, scan.dx);
+	}
+}
+
+/* applies pending world positions to all layers and sprites */
+static void update_positions(void)
+{
+	int c;
+
+	for (c = engine->numlayers - 1; c >= 0; c--)
+		update_layer_position(c);
+
+	c = engine->numsprites > 0 ? engine->list_sprites.first : -1;
+	while (c != -1)
+	{
+		update_sprite_position(&engine->sprites[c]);
+		c = engine->sprites[c].list_node.next;
+	}
+	engine->dirty = false;
+}
+
+/* updates collision buffer for one line, cleared only if any sprite checks collision on it */
+static void update_collision_line(int line)
+{
+	int index = engine->numsprites > 0 ? engine->list_sprites.first : -1;
+	bool cleared = false;
+
+	while (index != -1)
+	{
+		Sprite* sprite = &engine->sprites[index];
+		if (sprite->do_collision && check_sprite_coverage(sprite, line))
+		{
+			if (!cleared)
+			{
+				memset(engine->collision, -1, engine->framebuffer.width * sizeof(uint16_t));
+				cleared = true;
+			}
+			DrawSpriteCollisionScanline(index, line);
+		}
+		index = sprite->list_node.next;
+	}
+}
+
+/* Runs the frame started with BeginFrame() without drawing: keeps world positions, raster effects
+ * and per-pixel sprite collisions as TLN_UpdateFrame() does, but doesn't touch the framebuffer */
+void SimulateFrame(void)
+{
+	const int height = engine->framebuffer.height;
+	int line;
+
+	/* raster effects can change anything at any line, must step all of them */
+	if (engine->cb_raster != NULL)
+	{
+		for (line = 0; line < height; line++)
+		{
+			engine->line = line;
+			engine->cb_raster(line);
+			update_positions();
+			update_collision_line(line);
+		}
+	}
+
+	/* otherwise state is constant along the frame: only lines with collision-enabled sprites */
+	else
+	{
+		int top = height;
+		int bottom = 0;
+		int index;
+
+		update_positions();
+		index = engine->numsprites > 0 ? engine->list_sprites.first : -1;
+		while (index != -1)
+		{
+			const Sprite* sprite = &engine->sprites[index];
+			if (sprite->do_collision && sprite->dstrect.x2 > sprite->dstrect.x1)
+			{
+				if (sprite->dstrect.y1 < top)
+					top = sprite->dstrect.y1;
+				if (sprite->dstrect.y2 > bottom)
+					bottom = sprite->dstrect.y2;
+			}
+			index = sprite->list_node.next;
+		}
+		if (top < 0)
+			top = 0;
+		if (bottom > height)
+			bottom = height;
+		for (line = top; line < bottom; line++)
+			update_collision_line(line);
+	}
+
+	engine->line = height;
+}
+
 /* draws regular bitmap scanline for bitmap-based layer */
 static bool DrawBitmapScanline(int nlayer, uint32_t* dstpixel, int nscan, int tx1, int tx2)
 {
@@ -752,7 +1186,7 @@ static bool DrawBitmapScanline(int nlayer, uint32_t* dstpixel, int nscan, int tx
 
 	/* draws bitmap scanline */
 	TLN_Bitmap bitmap = layer->bitmap;
-	TLN_Palette palette = layer->palette != NULL ? layer->palette : bitmap->palette;
+	TLN_Palette palette = get_layer_palette(layer, bitmap->palette);
 	while (x < tx2)
 	{
 		/* get effective width */
@@ -783,7 +1217,7 @@ static bool DrawBitmapScanlineScaling(int nlayer, uint32_t* dstpixel, int nscan,
 
 	/* fill whole scanline */
 	const TLN_Bitmap bitmap = layer->bitmap;
-	const TLN_Palette palette = layer->palette != NULL ? layer->palette : bitmap->palette;
+	const TLN_Palette palette = get_layer_palette(layer, bitmap->palette);
 	fix_t fix_x = int2fix(x);
 	while (x < tx2)
 	{
@@ -822,6 +1256,13 @@ static bool DrawBitmapScanlineScaling(int nlayer, uint32_t* dstpixel, int nscan,
 	return false;
 }
 
+/* transform modes use alpha of direct color pixels as a key only: the line buffer is composited
+ * by Blit32_32() as premultiplied, so partial alpha would overflow there */
+static inline uint32_t key_direct_pixel(uint32_t value)
+{
+	return (value & 0xFF000000) != 0 ? value | 0xFF000000 : 0;
+}
+
 /* draws regular bitmap scanline for bitmap-based layer with affine transform */
 static bool DrawBitmapScanlineAffine(int nlayer, uint32_t* dstpixel, int nscan, int tx1, int tx2)
 {
@@ -847,12 +1288,15 @@ static bool DrawBitmapScanlineAffine(int nlayer, uint32_t* dstpixel, int nscan,
 	const int dy = (y2 - y1) / twidth;
 
 	const TLN_Bitmap bitmap = layer->bitmap;
-	const TLN_Palette palette = layer->palette != NULL ? layer->palette : bitmap->palette;
+	const TLN_Palette palette = get_layer_palette(layer, bitmap->palette);
 	while (tx1 < tx2)
 	{
 		xpos = abs((fix2int(x1) + layer->width)) % layer->width;
 		ypos = abs((fix2int(y1) + layer->height)) % layer->height;
-		*dstpixel = palette->data[*get_bitmap_ptr(bitmap, xpos, ypos)];
+		if (bitmap->bpp == 32)
+			*dstpixel = key_direct_pixel(*(uint32_t*)get_bitmap_ptr(bitmap, xpos, ypos));
+		else
+			*dstpixel = palette->data[*get_bitmap_ptr(bitmap, xpos, ypos)];
 
 		/* next pixel */
 		tx1 += 1;
@@ -876,13 +1320,16 @@ static bool DrawBitmapScanlinePixelMapping(int nlayer, uint32_t* dstpixel, int n
 	const int hstart = layer->hstart + layer->width;
 	const int vstart = layer->vstart + layer->height;
 	const TLN_Bitmap bitmap = layer->bitmap;
-	const TLN_Palette palette = layer->palette != NULL ? layer->palette : bitmap->palette;
+	const TLN_Palette palette = get_layer_palette(layer, bitmap->palette);
 	const TLN_PixelMap* pixel_map = &layer->pixel_map[nscan*engine->framebuffer.width + x];
 	while (x < tx2)
 	{
 		int xpos = abs(hstart + pixel_map->dx) % layer->width;
 		int ypos = abs(vstart + pixel_map->dy) % layer->height;
-		*dstpixel = layer->palette->data[*get_bitmap_ptr(bitmap, xpos, ypos)];
+		if (bitmap->bpp == 32)
+			*dstpixel = key_direct_pixel(*(uint32_t*)get_bitmap_ptr(bitmap, xpos, ypos));
+		else
+			*dstpixel = palette->data[*get_bitmap_ptr(bitmap, xpos, ypos)];
 
 		/* next pixel */
 		x += 1;
@@ -934,6 +1381,8 @@ static bool DrawObjectScanline(int nlayer, uint32_t* dstpixel, int nscan, int tx
 			int w = dstx2 - dstx1;
 
 			TLN_Bitmap bitmap = tmpobject.bitmap;
+			if (engine->pending_palettes > 0)
+				refresh_palette(bitmap->palette);
 			scan.width = bitmap->width;
 			scan.height = bitmap->height;
 			scan.stride = bitmap->pitch;
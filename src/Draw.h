@@ -29,5 +29,6 @@ ScanDrawPtr GetLayerDraw (Layer* layer);
 ScanDrawPtr GetSpriteDraw (draw_t mode);
 
 extern bool DrawScanline(void);
+extern void SimulateFrame(void);
 
 #endif
@@ -13,6 +13,8 @@
 
 #define NUM_PALETTES	8
 #define INTERNAL_FPS	60
+#define TIME_BITS		8					/* sub-frame precision of animation clock */
+#define TIME_FRAME		(1 << TIME_BITS)	/* clock units in one frame at INTERNAL_FPS */
 
 #include "Tilengine.h"
 #include "Sprite.h"
@@ -35,6 +37,9 @@ typedef struct Engine
 	Layer*		layers;			/* pointer to layer buffer */
 	int			numanimations;	/* number of animations */
 	Animation*	animations;		/* pointer to animation buffer */
+	Animation**	schedule;		/* min-heap of running sprite and palette animations, by due time */
+	int			num_scheduled;	/* number of animations inside schedule */
+	int			pending_palettes;	/* palettes with color cycles pending evaluation */
 	bool		dopriority;		/* there is some data in "priority" buffer that need blitting */
 	TLN_Error	error;			/* last error code */
 	TLN_LogLevel log_level;		/* logging level */
@@ -50,9 +55,16 @@ typedef struct Engine
 	int			frame;			/* current frame number */
 	int			line;			/* current scanline */
 	int			target_fps;
+	int64_t		time;			/* animation clock, TIME_FRAME units per frame at INTERNAL_FPS, 64 bits never wrap */
+	int			frame_rem;		/* remainder of per-frame clock advance, in 1/target_fps units */
+	int64_t		usec_rem;		/* remainder of TLN_AdvanceTime() advances, in microseconds */
+	bool		manual_time;	/* clock only advances with TLN_AdvanceTime() */
 
 	List list_sprites;			/* linked list active of sprites */
 	List list_animations;		/* linked list active of animations */
+	struct SpriteGroup** groups;	/* sprite groups enabled in this context, in drawing order */
+	int			num_groups;
+	int			max_groups;		/* capacity of groups[] */
 	int sprite_mask_top;		/* top scanline for sprite masking */
 	int sprite_mask_bottom;		/* bottom scanline for sprite masking */
 	int xworld, yworld;			/* world coordinates with TLN_SetWorldPosition() */
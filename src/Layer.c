@@ -21,6 +21,176 @@
 
 static void SetBlitter (Layer* layer);
 
+/* returns color of tile pixel inside the tile, honoring flip & rotation flags */
+static uint8_t get_tile_pixel (TLN_Tileset tileset, Tile* tile, int x, int y)
+{
+	int srcx = x;
+	int srcy = y;
+	uint16_t tile_index;
+
+	if (tileset->tstype != TILESET_TILES)
+		return 0;
+
+	if (tile->flags & FLAG_ROTATE)
+	{
+		srcx = y;
+		srcy = x;
+		if (tile->flags & FLAG_FLIPX)
+			srcy = tileset->height - srcy - 1;
+		if (tile->flags & FLAG_FLIPY)
+			srcx = tileset->width - srcx - 1;
+	}
+	else
+	{
+		if (tile->flags & FLAG_FLIPX)
+			srcx = tileset->width - srcx - 1;
+		if (tile->flags & FLAG_FLIPY)
+			srcy = tileset->height - srcy - 1;
+	}
+	tile_index = tileset->tiles[tile->index] - 1;
+	return GetTilesetPixel (tileset, tile_index, srcx, srcy);
+}
+
+/* returns column offset for a given position in tilemap space */
+static int get_column_offset (Layer* layer, int x, int xpos)
+{
+	int column;
+
+	if (layer->column == NULL)
+		return 0;
+
+	column = x / layer->tilemap->tilesets[0]->width;
+	if (xpos!=0 && x>xpos)
+		column++;
+	return layer->column[column];
+}
+
+/* fills tile info for a given tilemap cell and position inside it */
+static void fill_tile_info (TLN_Tilemap tilemap, int xtile, int ytile, int srcx, int srcy, TLN_TileInfo* info)
+{
+	Tile* tile = GetTilemapCell (tilemap, ytile, xtile);
+
+	memset (info, 0, sizeof(TLN_TileInfo));
+	info->col = xtile;
+	info->row = ytile;
+	info->xoffset = srcx;
+	info->yoffset = srcy;
+	if (tile->index != 0)
+	{
+		TLN_Tileset tileset = tilemap->tilesets[tile->tileset];
+		info->index = tile->index - 1;
+		info->flags = tile->flags;
+		info->color = get_tile_pixel (tileset, tile, srcx, srcy);
+		if (tileset->attributes != NULL)
+			info->type = tileset->attributes[info->index].type;
+	}
+	else
+		info->empty = true;
+}
+
+/* returns true if sprite has an opaque pixel at given screen-relative position inside its rectangle */
+static bool get_sprite_opaque (Sprite* sprite, int x, int y, int w, int h)
+{
+	const SpriteEntry* info = sprite->info;
+	int srcx = x * info->frame_w / w;
+	int srcy = y * info->frame_h / h;
+
+	if (sprite->flags & FLAG_FLIPX)
+		srcx = info->frame_w - srcx - 1;
+	if (sprite->flags & FLAG_FLIPY)
+		srcy = info->frame_h - srcy - 1;
+
+	/* stored pixels may be trimmed and mirrored */
+	srcx -= info->xoffset;
+	srcy -= info->yoffset;
+	if (srcx < 0 || srcy < 0 || srcx >= info->w || srcy >= info->h)
+		return false;
+	if (info->flags & FLAG_FLIPX)
+		srcx = info->w - srcx - 1;
+	if (info->flags & FLAG_FLIPY)
+		srcy = info->h - srcy - 1;
+	return sprite->pixels[srcy*sprite->pitch + srcx] != 0;
+}
+
+/* scans the area of a tile overlapped by the query rectangle looking for an opaque pixel */
+static bool find_tile_pixel (TLN_Tileset tileset, Tile* tile, int tx1, int ty1, int tx2, int ty2, Sprite* sprite, int sx, int sy, int sw, int sh, TLN_TileInfo* info)
+{
+	int tx, ty;
+
+	for (ty = ty1; ty < ty2; ty++)
+	{
+		for (tx = tx1; tx < tx2; tx++)
+		{
+			const uint8_t color = get_tile_pixel (tileset, tile, tx, ty);
+			if (color == 0)
+				continue;
+			if (sprite != NULL && !get_sprite_opaque (sprite, sx + tx - tx1, sy + ty - ty1, sw, sh))
+				continue;
+			info->xoffset = tx;
+			info->yoffset = ty;
+			info->color = color;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* common rectangle query in tilemap space, optionally testing against sprite pixels */
+static int query_rect (Layer* layer, int x, int y, int w, int h, Sprite* sprite, TLN_TileInfo* info, int max_tiles, bool pixel_test)
+{
+	const TLN_Tilemap tilemap = layer->tilemap;
+	const TLN_Tileset tileset = tilemap->tilesets[0];
+	const int x2 = x + w;
+	const int y2 = y + h;
+	int count = 0;
+	int xcell, ycell;
+
+	if (w <= 0 || h <= 0 || max_tiles <= 0)
+		return 0;
+
+	/* walk tile columns overlapped by the rectangle */
+	xcell = x & ~tileset->hmask;
+	for (; xcell < x2; xcell += tileset->width)
+	{
+		const int cx1 = xcell > x ? xcell : x;
+		const int cx2 = xcell + tileset->width < x2 ? xcell + tileset->width : x2;
+		int xpos = xcell % layer->width;
+		int column_offset;
+
+		if (xpos < 0)
+			xpos += layer->width;
+		column_offset = get_column_offset (layer, cx1, xpos + cx1 - xcell);
+
+		/* walk tile rows of the column */
+		const int cy = y + column_offset;
+		const int cy2 = y2 + column_offset;
+		ycell = cy & ~tileset->vmask;
+		for (; ycell < cy2; ycell += tileset->height)
+		{
+			const int cy1 = ycell > cy ? ycell : cy;
+			const int ry2 = ycell + tileset->height < cy2 ? ycell + tileset->height : cy2;
+			int ypos = ycell % layer->height;
+			Tile* tile;
+
+			if (ypos < 0)
+				ypos += layer->height;
+			tile = GetTilemapCell (tilemap, ypos >> tileset->vshift, xpos >> tileset->hshift);
+			if (tile->index == 0)
+				continue;
+
+			fill_tile_info (tilemap, xpos >> tileset->hshift, ypos >> tileset->vshift, cx1 - xcell, cy1 - ycell, info + count);
+			if (pixel_test && !find_tile_pixel (tilemap->tilesets[tile->tileset], tile,
+				cx1 - xcell, cy1 - ycell, cx2 - xcell, ry2 - ycell, sprite, cx1 - x, cy1 - cy, w, h, info + count))
+				continue;
+
+			count += 1;
+			if (count == max_tiles)
+				return count;
+		}
+	}
+	return count;
+}
+
 /*!
  * \deprecated Use \ref TLN_SetLayerTilemap instead
  * \brief
@@ -78,23 +248,9 @@ bool TLN_SetLayer(int nlayer, TLN_Tileset tileset, TLN_Tilemap tilemap)
 		if (tileset == NULL)
 			break;
 
-		/* apply priority attribute */
-		if (tileset->attributes != NULL)
-		{
-			const int num_tiles = tilemap->rows * tilemap->cols;
-			int c;
-			Tile* tile = tilemap->tiles;
-			for (c = 0; c < num_tiles; c++, tile++)
-			{
-				if (tile->index != 0 && tile->index < tileset->numtiles)
-				{
-					if (tileset->attributes[tile->index - 1].priority == true)
-						tile->flags |= FLAG_PRIORITY;
-					else
-						tile->flags &= ~FLAG_PRIORITY;
-				}
-			}
-		}
+		/* apply priority attribute, chunks get it when decoded */
+		if (tileset->attributes != NULL && tilemap->chunks == NULL)
+			SetTilesPriority (tileset, tilemap->tiles, tilemap->rows * tilemap->cols);
 
 		/* start animations */
 		if (tileset->sp != NULL)
@@ -167,14 +323,20 @@ bool TLN_SetLayerBitmap(int nlayer, TLN_Bitmap bitmap)
 	if (!CheckBaseObject(bitmap, OT_BITMAP))
 		return false;
 
+	if (bitmap->bpp != 8 && bitmap->bpp != 32)
+	{
+		TLN_SetLastError(TLN_ERR_UNSUPPORTED);
+		return false;
+	}
+
 	layer->tilemap = NULL;
 	layer->bitmap = bitmap;
 	layer->objects = NULL;
 	layer->width = bitmap->width;
 	layer->height = bitmap->height;
 
-	/* require palette */
-	if (bitmap->palette != NULL)
+	/* require palette, except direct color */
+	if (bitmap->palette != NULL || bitmap->bpp == 32)
 	{
 		layer->type = LAYER_BITMAP;
 		layer->ok = true;
@@ -640,12 +802,8 @@ bool TLN_GetLayerTile (int nlayer, int x, int y, TLN_TileInfo* info)
 	Layer *layer;
 	TLN_Tileset tileset;
 	TLN_Tilemap tilemap;
-	TLN_Tile tile;
 	int xpos, ypos;
-	int xtile, ytile;
-	int srcx, srcy;
-	int column = 0;
-	int column_offset = 0;
+	int column_offset;
 
 	if (nlayer >= engine->numlayers)
 	{
@@ -668,43 +826,161 @@ bool TLN_GetLayerTile (int nlayer, int x, int y, TLN_TileInfo* info)
 	xpos = x % layer->width;
 	if (xpos < 0)
 		xpos += layer->width;
-	xtile = xpos >> tileset->hshift;
-	srcx  = xpos & tileset->hmask;
-	
-	if (layer->column)
-	{
-		column = x / tileset->width;
-		if (xpos!=0 && x>xpos)
-			column++;
-		column_offset = layer->column[column];
-	}
+	column_offset = get_column_offset(layer, x, xpos);
 
 	ypos  = (y + column_offset) % layer->height;
 	if (ypos < 0)
 		ypos += layer->height;
-	srcy  = ypos & tileset->vmask;
 
-	ytile = ypos >> tileset->vshift;
-	tile = &tilemap->tiles[ytile*tilemap->cols + xtile];
+	fill_tile_info(tilemap, xpos >> tileset->hshift, ypos >> tileset->vshift, xpos & tileset->hmask, ypos & tileset->vmask, info);
+	TLN_SetLastError (TLN_ERR_OK);
+	return true;
+}
 
-	memset (info, 0, sizeof(TLN_TileInfo));
-	info->col = xtile;
-	info->row = ytile;
-	info->xoffset = srcx;
-	info->yoffset = srcy;
-	if (tile->index != 0)
+/*!
+ * \brief
+ * Gets info about all the non-empty tiles overlapped by a rectangle in tilemap space
+ * 
+ * \param nlayer
+ * Id of the layer to query [0, num_layers - 1]
+ * 
+ * \param x
+ * left position of the rectangle
+ * 
+ * \param y
+ * top position of the rectangle
+ * 
+ * \param w
+ * width of the rectangle in pixels
+ * 
+ * \param h
+ * height of the rectangle in pixels
+ * 
+ * \param info
+ * Pointer to an application-allocated array of TLN_TileInfo items that will get the data
+ * 
+ * \param max_tiles
+ * Number of items in the info array
+ * 
+ * \param pixel_test
+ * If true, only tiles that have at least one non-transparent pixel inside the rectangle are reported
+ * 
+ * \returns
+ * number of tiles written to info (up to max_tiles)
+ * 
+ * \remarks
+ * Tiles are reported column by column, from top to bottom. xoffset and yoffset hold the
+ * top-left corner of the overlapped area inside the tile, or the first opaque pixel found
+ * when pixel_test is enabled. Empty cells are not reported.
+ * 
+ * \see
+ * TLN_GetLayerTile(), TLN_GetSpriteLayerTiles()
+ */
+int TLN_GetLayerTilesInRect (int nlayer, int x, int y, int w, int h, TLN_TileInfo* info, int max_tiles, bool pixel_test)
+{
+	Layer *layer;
+
+	if (nlayer >= engine->numlayers)
 	{
-		tileset = tilemap->tilesets[tile->tileset];
-		info->index = tile->index - 1;
-		info->flags = tile->flags;
-		info->color = GetTilesetPixel (tileset, tile->index, srcx, srcy);
-		info->type = tileset->attributes[info->index].type;
+		TLN_SetLastError (TLN_ERR_IDX_LAYER);
+		return 0;
 	}
-	else
-		info->empty = true;
-	
+	if (!info)
+	{
+		TLN_SetLastError (TLN_ERR_NULL_POINTER);
+		return 0;
+	}
+
+	layer = &engine->layers[nlayer];
+	if (!CheckBaseObject(layer->tilemap, OT_TILEMAP) || !CheckBaseObject (layer->tilemap->tilesets[0], OT_TILESET))
+		return 0;
+
 	TLN_SetLastError (TLN_ERR_OK);
-	return true;
+	return query_rect(layer, x, y, w, h, NULL, info, max_tiles, pixel_test);
+}
+
+/*!
+ * \brief
+ * Gets info about all the non-empty tiles of a layer overlapped by a sprite
+ * 
+ * \param nsprite
+ * Id of the sprite to query [0, num_sprites - 1]
+ * 
+ * \param nlayer
+ * Id of the layer to query [0, num_layers - 1]
+ * 
+ * \param info
+ * Pointer to an application-allocated array of TLN_TileInfo items that will get the data
+ * 
+ * \param max_tiles
+ * Number of items in the info array
+ * 
+ * \param pixel_test
+ * If true, only tiles having a non-transparent pixel that overlaps a non-transparent pixel of the sprite are reported
+ * 
+ * \returns
+ * number of tiles written to info (up to max_tiles)
+ * 
+ * \remarks
+ * The sprite screen rectangle (including scaling and pivot) is converted to tilemap space using
+ * the current layer position, so it must be called after positioning both sprite and layer.
+ * 
+ * \see
+ * TLN_GetLayerTilesInRect()
+ */
+int TLN_GetSpriteLayerTiles (int nsprite, int nlayer, TLN_TileInfo* info, int max_tiles, bool pixel_test)
+{
+	Sprite *sprite;
+	Layer *layer;
+	int x, y, w, h;
+
+	if (nsprite >= engine->numsprites)
+	{
+		TLN_SetLastError (TLN_ERR_IDX_SPRITE);
+		return 0;
+	}
+	if (nlayer >= engine->numlayers)
+	{
+		TLN_SetLastError (TLN_ERR_IDX_LAYER);
+		return 0;
+	}
+	if (!info)
+	{
+		TLN_SetLastError (TLN_ERR_NULL_POINTER);
+		return 0;
+	}
+
+	sprite = &engine->sprites[nsprite];
+	layer = &engine->layers[nlayer];
+	if (!CheckBaseObject(layer->tilemap, OT_TILEMAP) || !CheckBaseObject (layer->tilemap->tilesets[0], OT_TILESET))
+		return 0;
+
+	TLN_SetLastError (TLN_ERR_OK);
+	if (!sprite->ok)
+		return 0;
+
+	/* sprite rectangle in screen space */
+	w = sprite->info->frame_w;
+	h = sprite->info->frame_h;
+	if (sprite->mode == MODE_SCALING)
+	{
+		w = (int)(w * sprite->sx);
+		h = (int)(h * sprite->sy);
+	}
+	if (sprite->world_space)
+	{
+		x = sprite->xworld - engine->xworld;
+		y = sprite->yworld - engine->yworld;
+	}
+	else
+	{
+		x = sprite->x;
+		y = sprite->y;
+	}
+	x -= (int)(w * sprite->ptx);
+	y -= (int)(h * sprite->pty);
+
+	return query_rect(layer, x + layer->hstart, y + layer->vstart, w, h, pixel_test ? sprite : NULL, info, max_tiles, pixel_test);
 }
 
 /*!
@@ -740,6 +1016,75 @@ bool TLN_SetLayerColumnOffset (int nlayer, int* offset)
 	return true;
 }
 
+/*!
+ * \brief
+ * Sets a table of palette changes applied while the layer is drawn, scanline by scanline
+ *
+ * \param nlayer
+ * Layer index [0, num_layers - 1]
+ *
+ * \param table
+ * Array of changes sorted by scanline, or NULL to disable the table
+ *
+ * \param count
+ * Number of items in table
+ *
+ * Each frame starts with the regular palettes of the layer. When drawing reaches the line of an
+ * entry, either its palette replaces the palette of the whole layer, or a single color is replaced
+ * in a private copy of the palette in effect. When tiles use different palettes (several tilesets,
+ * or tiles selecting a global palette), each tile gets the single colors applied over its own
+ * palette. Shared palettes are never modified.
+ *
+ * \remarks
+ * This is the preferred way to do color gradients and water splits, instead of modifying palettes
+ * inside a raster callback. Like TLN_SetLayerColumnOffset(), the table is linked and not copied,
+ * so its contents can be updated between frames
+ */
+bool TLN_SetLayerPaletteTable (int nlayer, const TLN_PaletteLine* table, int count)
+{
+	Layer* layer;
+	int c;
+
+	if (nlayer >= engine->numlayers)
+	{
+		TLN_SetLastError (TLN_ERR_IDX_LAYER);
+		return false;
+	}
+
+	layer = &engine->layers[nlayer];
+	if (table == NULL || count <= 0)
+	{
+		layer->palette_table.entries = NULL;
+		layer->palette_table.count = 0;
+		layer->palette_table.current = NULL;
+		TLN_SetLastError (TLN_ERR_OK);
+		return true;
+	}
+
+	for (c = 0; c < count; c++)
+	{
+		if (table[c].palette != NULL && !CheckBaseObject (table[c].palette, OT_PALETTE))
+			return false;
+	}
+
+	for (c = 0; c < PALETTE_SCRATCH_SLOTS; c++)
+	{
+		if (layer->palette_table.scratch[c].palette == NULL)
+		{
+			layer->palette_table.scratch[c].palette = TLN_CreatePalette (256);
+			if (layer->palette_table.scratch[c].palette == NULL)
+				return false;
+		}
+	}
+
+	layer->palette_table.entries = table;
+	layer->palette_table.count = count;
+	layer->palette_table.line = -1;
+	layer->palette_table.current = NULL;
+	TLN_SetLastError (TLN_ERR_OK);
+	return true;
+}
+
 /*! \brief Enables a layer previously disabled with \ref TLN_DisableLayer 
  * \param nlayer Layer index [0, num_layers - 1]
  * \remarks The layer must have been previously configured. A layer without a prior configuration can't be enabled 
@@ -1205,7 +1550,8 @@ static void SetBlitter (Layer* layer)
 {
 	bool scaling = layer->mode == MODE_SCALING;
 	bool blend = layer->blend != NULL && layer->mosaic.h == 0;
+	int bpp = layer->type == LAYER_BITMAP && layer->bitmap != NULL ? layer->bitmap->bpp : 8;
 
-	layer->blitters[0] = SelectBlitter (false, scaling, blend);
-	layer->blitters[1] = SelectBlitter(true, scaling, blend);
+	layer->blitters[0] = SelectBlitter (bpp, false, scaling, blend);
+	layer->blitters[1] = SelectBlitter (bpp, true, scaling, blend);
 }
@@ -16,6 +16,8 @@
 #include "Blitters.h"
 #include "Math2D.h"
 
+#define PALETTE_SCRATCH_SLOTS	8	/* base palettes with single colors applied kept at once */
+
 typedef struct
 {
 	int x1, y1, x2, y2;	/* clip region */
@@ -72,6 +74,26 @@ typedef struct Layer
 		uint32_t* buffer;	/* line buffer */
 	}
 	mosaic;
+
+	/* per-scanline palette changes */
+	struct
+	{
+		const TLN_PaletteLine* entries;	/* user table, sorted by line */
+		int count;
+		int pos;				/* next entry to apply */
+		int line;				/* next scanline expected, other values restart the table */
+		int first;				/* first entry after the last full palette change */
+		bool colors;			/* single colors in effect, from first entry to pos */
+		TLN_Palette current;	/* palette in effect, NULL for the regular ones */
+		struct
+		{
+			TLN_Palette palette;	/* private copy of a palette with the single colors applied */
+			TLN_Palette base;		/* palette it was built from, NULL if outdated */
+		}
+		scratch[PALETTE_SCRATCH_SLOTS];
+		int next;				/* scratch slot to replace when all are in use */
+	}
+	palette_table;
 }
 Layer;
 
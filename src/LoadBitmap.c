@@ -8,202 +8,215 @@
 * file, You can obtain one at http://mozilla.org/MPL/2.0/.
 * */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "SDL2/SDL.h"
 #include "Tilengine.h"
 #include "LoadFile.h"
+#include "Loader.h"
 #include "png.h"
 #include "DIB.h"
 #include "Bitmap.h"
 #include "Palette.h"
+#include "Quantize.h"
+#include "Cache.h"
 
-static TLN_Bitmap LoadPNG (const char* filename);
-static TLN_Bitmap LoadBMP (const char* filename);
-
-typedef struct
+/* pixel format requested to png decoder */
+typedef enum
 {
-	uint32_t items[255];
-	uint16_t count;
+	PNG_NATIVE,		/* as stored */
+	PNG_INDEXED,	/* true color reduced to 8 bpp with exact palette */
+	PNG_DIRECT,		/* 32 bpp direct color */
 }
-Set;
+PNGFormat;
+
+static TLN_Bitmap LoadPNG (const char* filename, PNGFormat format);
+static TLN_Bitmap LoadBMP (const char* filename);
 
-static void set_init(Set* set)
+#define MAX_WORKERS	8
+
+/* images shared by the threads of LoadBitmaps() */
+typedef struct
 {
-	set->count = 0;
+	const char* const* filenames;
+	TLN_Bitmap* bitmaps;
+	int count;
+	SDL_atomic_t next;		/* next image to load */
+	SDL_atomic_t error;		/* error of a failed image */
 }
+BitmapBatch;
 
-static int set_get_index(Set* set, uint32_t value)
+/* reads a 24 or 32 bpp pixel as 0xAARRGGBB. PNG stores RGB, BMP stores BGR */
+static inline uint32_t read_pixel(const uint8_t* pixel, int bpp, bool rgb)
 {
-	int c;
-	for (c = 0; c < set->count; c += 1)
-	{
-		if (set->items[c] == value)
-			return c;
-	}
-	return -1;
+	const uint32_t a = bpp == 32 ? pixel[3] : 255;
+	if (rgb)
+		return (a << 24) | (pixel[0] << 16) | (pixel[1] << 8) | pixel[2];
+	else
+		return (a << 24) | (pixel[2] << 16) | (pixel[1] << 8) | pixel[0];
 }
 
-static bool set_add(Set* set, uint32_t value)
+/* creates palette of a bitmap converted to 8 bpp, with index 0 reserved for transparency */
+static void AttachPalette(TLN_Bitmap bitmap, const uint32_t* colors, int num_colors)
 {
-	int index;
-	if (set->count == 255)
-		return false;
+	uint32_t* dstcolor;
 
-	index = set_get_index(set, value);
-	if (index == -1)
-	{
-		set->items[set->count] = value;
-		set->count += 1;
-	}
-	return true;
+	bitmap->palette = TLN_CreatePalette(num_colors + 1);
+	dstcolor = (uint32_t*)bitmap->palette->data;
+	dstcolor[0] = 0xFFFF00FF;	/* pink */
+	memcpy(&dstcolor[1], colors, num_colors * sizeof(uint32_t));
 }
 
-static TLN_Palette BuildPaletteFromSet(Set* colors)
+/* converts 24 or 32 bpp bitmap to 8 bpp with an attached palette. Index 0 is reserved for
+ * transparent pixels (alpha < 128). Exact palette with up to 255 colors, else median cut */
+static TLN_Bitmap ConvertToIndexed(TLN_Bitmap source, bool rgb, bool* quantized)
 {
-	int c;
-	RGBQUAD srccolor;
-
-	TLN_Palette palette = TLN_CreatePalette(colors->count + 1);
-	uint32_t* dstcolor = (uint32_t*)palette->data;
+	TLN_Bitmap bitmap;
+	ColorSet colors;
+	Quantizer* quantizer = NULL;
+	uint32_t palette[COLORSET_MAX];
+	const int bytes = source->bpp >> 3;
+	int num_colors;
+	int x, y;
 
-	*dstcolor = 0xFFFF00FF;	/* pink */
-	dstcolor += 1;
-	for (c = 0; c < colors->count; c += 1)
+	/* collect unique opaque colors */
+	ColorSetInit(&colors);
+	for (y = 0; y < source->height && quantizer == NULL; y += 1)
 	{
-		srccolor.value = colors->items[c];
-		*dstcolor = PackRGB32(srccolor.b, srccolor.g, srccolor.r);
-		dstcolor += 1;
+		const uint8_t* srcpixel = source->data + y*source->pitch;
+		for (x = 0; x < source->width; x += 1, srcpixel += bytes)
+		{
+			const uint32_t color = read_pixel(srcpixel, source->bpp, rgb);
+			if ((color >> 24) >= 128 && ColorSetAdd(&colors, color | 0xFF000000) < 0)
+			{
+				quantizer = CreateQuantizer();
+				if (quantizer == NULL)
+					return NULL;
+				break;
+			}
+		}
 	}
-	return palette;
-}
 
-static TLN_Bitmap Convert24ToIndexed(TLN_Bitmap source)
-{
-	TLN_Bitmap bitmap = NULL;
-	Set colors;
-	int x, y;
-	uint8_t* srcscan;
-	uint8_t* dstscan;
-
-	/* count unique colors up to 255 */
-	set_init(&colors);
-	srcscan = source->data;
-	for (y = 0; y < source->height; y += 1)
+	/* too many colors: build reduced palette from full histogram */
+	if (quantizer != NULL)
 	{
-		RGBTRIPLE* color = (RGBTRIPLE*)srcscan;
-		for (x = 0; x < source->width; x += 1)
+		for (y = 0; y < source->height; y += 1)
 		{
-			uint32_t value = PackRGB32(color->r, color->g, color->b);
-			if (!set_add(&colors, value))
-				return NULL;
-			color += 1;
+			const uint8_t* srcpixel = source->data + y*source->pitch;
+			for (x = 0; x < source->width; x += 1, srcpixel += bytes)
+			{
+				const uint32_t color = read_pixel(srcpixel, source->bpp, rgb);
+				if ((color >> 24) >= 128)
+					QuantizerAddColor(quantizer, color);
+			}
 		}
-		srcscan += source->pitch;
+		num_colors = QuantizerBuild(quantizer, palette, COLORSET_MAX);
+	}
+	else
+	{
+		num_colors = colors.count;
+		memcpy(palette, colors.items, num_colors * sizeof(uint32_t));
 	}
 
-	/* create new bitmap at 8 bpp */
+	/* create new bitmap at 8 bpp and set palette indexes */
 	bitmap = TLN_CreateBitmap(source->width, source->height, 8);
-	srcscan = source->data;
-	dstscan = bitmap->data;
+	if (bitmap == NULL)
+	{
+		DeleteQuantizer(quantizer);
+		return NULL;
+	}
 
-	/* set colors with palette indexes */
 	for (y = 0; y < source->height; y += 1)
 	{
-		RGBTRIPLE* srccolor = (RGBTRIPLE*)srcscan;
-		uint8_t* dstcolor = dstscan;
-		for (x = 0; x < source->width; x += 1)
+		const uint8_t* srcpixel = source->data + y*source->pitch;
+		uint8_t* dstpixel = bitmap->data + y*bitmap->pitch;
+		for (x = 0; x < source->width; x += 1, srcpixel += bytes)
 		{
-			uint32_t value = PackRGB32(srccolor->r, srccolor->g, srccolor->b);
-			*dstcolor = set_get_index(&colors, value) + 1;
-			srccolor += 1;
-			dstcolor += 1;
+			const uint32_t color = read_pixel(srcpixel, source->bpp, rgb);
+			if ((color >> 24) < 128)
+				*dstpixel = 0;
+			else if (quantizer != NULL)
+				*dstpixel = (uint8_t)(QuantizerGetIndex(quantizer, color) + 1);
+			else
+				*dstpixel = (uint8_t)(ColorSetFind(&colors, color | 0xFF000000) + 1);
+			dstpixel += 1;
 		}
-
-		srcscan += source->pitch;
-		dstscan += bitmap->pitch;
 	}
 
-	/* create attached palette and set actual colors */
-	bitmap->palette = BuildPaletteFromSet(&colors);
-
+	AttachPalette(bitmap, palette, num_colors);
+	*quantized = quantizer != NULL;
+	DeleteQuantizer(quantizer);
 	return bitmap;
 }
 
-static TLN_Bitmap Convert32ToIndexed(TLN_Bitmap source)
+/* name of the quantized copy of a true color image */
+static void get_cache_name(char* cachename, int len, const char* filename)
 {
-	TLN_Bitmap bitmap = NULL;
-	Set colors;
-	int x,y;
-	uint8_t* srcscan;
-	uint8_t* dstscan;
-
-	/* count unique colors up to 255 */
-	set_init(&colors);
-	srcscan = source->data;
-	for (y = 0; y < source->height; y += 1)
-	{
-		RGBQUAD* color = (RGBQUAD*)srcscan;
-		for (x = 0; x < source->width; x += 1)
-		{
-			if (color->a >= 128)
-			{
-				color->a = 255;
-				if (!set_add(&colors, color->value))
-					return NULL;
-			}
-			else
-				color->a = 0;
-			color += 1;
-		}
-		srcscan += source->pitch;
-	}
+	snprintf(cachename, len, "%s.idx.bmp", filename);
+}
 
-	/* create new bitmap at 8 bpp */
-	bitmap = TLN_CreateBitmap(source->width, source->height, 8);
-	srcscan = source->data;
-	dstscan = bitmap->data;
-	
-	/* set colors with palette indexes */
-	for (y = 0; y < source->height; y += 1)
-	{
-		RGBQUAD* srccolor = (RGBQUAD*)srcscan;
-		uint8_t* dstcolor = dstscan;
-		for (x = 0; x < source->width; x += 1)
-		{
-			if (srccolor->a == 0)
-				*dstcolor = 0;
-			else
-				*dstcolor = set_get_index(&colors, srccolor->value) + 1;
-			srccolor += 1;
-			dstcolor += 1;
-		}
+/* quantized copy exists and isn't older than the source */
+static bool check_cache(const char* filename, const char* cachename)
+{
+	time_t source_time, cache_time;
+	return FileTime(filename, &source_time) && FileTime(cachename, &cache_time) && cache_time >= source_time;
+}
+
+/* saves 8 bpp bitmap with palette as uncompressed BMP */
+static bool SaveBMP(const char* filename, TLN_Bitmap bitmap)
+{
+	BITMAPFILEHEADER bfh;
+	BITMAPV5HEADER bih;
+	const int entries = bitmap->palette->entries;
+	const uint32_t* colors = (uint32_t*)bitmap->palette->data;
+	const uint32_t header_size = 40;
+	FILE* pf;
+	int c;
 
-		srcscan += source->pitch;
-		dstscan += bitmap->pitch;
+	pf = FileCreate(filename);
+	if (pf == NULL)
+		return false;
+
+	bfh.Type = 0x4D42;
+	bfh.OffsetData = sizeof(bfh) + header_size + entries * sizeof(RGBQUAD);
+	bfh.Size = bfh.OffsetData + bitmap->pitch * bitmap->height;
+	bfh.Reserved = 0;
+	fwrite(&bfh, sizeof(bfh), 1, pf);
+
+	/* BITMAPINFOHEADER is the leading part of BITMAPV5HEADER */
+	memset(&bih, 0, sizeof(bih));
+	bih.bV5Size = header_size;
+	bih.bV5Width = bitmap->width;
+	bih.bV5Height = bitmap->height;
+	bih.bV5Planes = 1;
+	bih.bV5BitCount = 8;
+	bih.bV5SizeImage = bitmap->pitch * bitmap->height;
+	bih.bV5ClrUsed = entries;
+	fwrite(&bih, header_size, 1, pf);
+
+	for (c = 0; c < entries; c += 1)
+	{
+		RGBQUAD color;
+		color.value = colors[c];
+		color.a = 0;
+		fwrite(&color, sizeof(color), 1, pf);
 	}
 
-	/* create attached palette and set actual colors */
-	bitmap->palette = BuildPaletteFromSet(&colors);
+	/* bottom-up scanlines */
+	for (c = bitmap->height - 1; c >= 0; c -= 1)
+		fwrite(bitmap->data + c*bitmap->pitch, bitmap->pitch, 1, pf);
 
-	return bitmap;
+	fclose(pf);
+	return true;
 }
 
-/*!
- * \brief
- * Load image file (8-bit BMP or PNG)
- * 
- * \param filename
- * File name with the image
- * 
- * \returns
- * Handler to the loaded image or NULL if error
- * 
- * \see
- * TLN_DeleteBitmap()
- */
-TLN_Bitmap TLN_LoadBitmap (const char* filename)
+/* loads image as 8 bpp without asset cache, for loaders that own or discard the bitmap */
+TLN_Bitmap LoadIndexedBitmap (const char* filename)
 {
 	TLN_Bitmap bitmap;
+	char cachename[256];
+	bool rgb = true;
 
 	if (!CheckFile (filename))
 	{
@@ -211,34 +224,44 @@ TLN_Bitmap TLN_LoadBitmap (const char* filename)
 		return NULL;
 	}
 
+	/* reuse previous quantization */
+	get_cache_name (cachename, sizeof(cachename), filename);
+	if (check_cache (filename, cachename))
+	{
+		bitmap = LoadBMP (cachename);
+		if (bitmap != NULL && bitmap->bpp == 8)
+		{
+			TLN_SetLastError (TLN_ERR_OK);
+			return bitmap;
+		}
+		if (bitmap != NULL)
+			TLN_DeleteBitmap (bitmap);
+	}
+
 	/* try png, else bmp*/
-	bitmap = LoadPNG (filename);
+	bitmap = LoadPNG (filename, PNG_INDEXED);
 	if (bitmap == NULL)
+	{
 		bitmap = LoadBMP (filename);
+		rgb = false;
+	}
 
 	/* bitmap loaded */
 	if (bitmap)
 	{
 		/* accept only 8 bpp */
 		int bpp = TLN_GetBitmapDepth (bitmap);
-		if (bpp == 24)
+		if (bpp == 24 || bpp == 32)
 		{
-			TLN_Bitmap indexed = Convert24ToIndexed(bitmap);
-			if (indexed != NULL)
-			{
-				TLN_DeleteBitmap(bitmap);
-				bitmap = indexed;
-				bpp = 8;
-			}
-		}
-		else if (bpp == 32)
-		{
-			TLN_Bitmap indexed = Convert32ToIndexed(bitmap);
+			bool quantized = false;
+			TLN_Bitmap indexed = ConvertToIndexed(bitmap, rgb, &quantized);
 			if (indexed != NULL)
 			{
 				TLN_DeleteBitmap(bitmap);
 				bitmap = indexed;
 				bpp = 8;
+				if (quantized)
+					SaveBMP(cachename, bitmap);
 			}
 		}
 
@@ -257,150 +280,517 @@ TLN_Bitmap TLN_LoadBitmap (const char* filename)
 	return bitmap;
 }
 
-/* Loads PNG using libpng 1.2 */
-static TLN_Bitmap LoadPNG (const char* filename)
+/*!
+ * \brief
+ * Load image file (8-bit BMP or PNG)
+ * 
+ * \param filename
+ * File name with the image
+ * 
+ * \returns
+ * Handler to the loaded image or NULL if error
+ * 
+ * \remarks
+ * True color images are converted to 8 bpp. When they have more than 255 colors, a
+ * reduced palette is built and the result is cached next to the source file as
+ * filename.idx.bmp, reused while it's newer than the source. Loading the same file again
+ * returns the same bitmap until it's evicted with TLN_EvictCache()
+ *
+ * \see
+ * TLN_DeleteBitmap()
+ */
+TLN_Bitmap TLN_LoadBitmap (const char* filename)
 {
-	TLN_Bitmap bitmap = NULL;
-	FILE* fp;
+	TLN_Bitmap bitmap = (TLN_Bitmap)FindCached (CACHE_BITMAP, filename);
+	if (bitmap != NULL)
+	{
+		TLN_SetLastError (TLN_ERR_OK);
+		return bitmap;
+	}
+	return (TLN_Bitmap)AddCached (CACHE_BITMAP, filename, LoadIndexedBitmap (filename));
+}
+
+/* takes images of a batch until all are taken */
+static int BitmapWorker(void* data)
+{
+	BitmapBatch* batch = (BitmapBatch*)data;
+	TLN_Error error = TLN_ERR_OK;
+	TLN_Error* previous;
+	int c;
+
+	previous = RedirectErrors(&error);
+	while ((c = SDL_AtomicAdd(&batch->next, 1)) < batch->count)
+	{
+		batch->bitmaps[c] = LoadIndexedBitmap(batch->filenames[c]);
+		if (batch->bitmaps[c] == NULL)
+			SDL_AtomicSet(&batch->error, error);
+	}
+	RedirectErrors(previous);
+	return 0;
+}
+
+/* loads several images with LoadIndexedBitmap(), decoding them in parallel on worker threads
+ * together with the calling one. Images that can't be loaded are NULL, and the error of one
+ * of them is set */
+void LoadBitmaps(int count, const char* const* filenames, TLN_Bitmap* bitmaps)
+{
+	SDL_Thread* threads[MAX_WORKERS];
+	BitmapBatch batch;
+	int max_threads = SDL_GetCPUCount();
+	int num_threads = 0;
+	int c;
+
+	InitCache();
+	batch.filenames = filenames;
+	batch.bitmaps = bitmaps;
+	batch.count = count;
+	SDL_AtomicSet(&batch.next, 0);
+	SDL_AtomicSet(&batch.error, TLN_ERR_OK);
+
+	/* calling thread is one of the workers */
+	if (max_threads > count)
+		max_threads = count;
+	if (max_threads > MAX_WORKERS)
+		max_threads = MAX_WORKERS;
+	while (num_threads < max_threads - 1)
+	{
+		threads[num_threads] = SDL_CreateThread(BitmapWorker, "BitmapWorker", &batch);
+		if (threads[num_threads] == NULL)
+			break;
+		num_threads += 1;
+	}
+	BitmapWorker(&batch);
+
+	for (c = 0; c < num_threads; c += 1)
+		SDL_WaitThread(threads[c], NULL);
+	TLN_SetLastError((TLN_Error)SDL_AtomicGet(&batch.error));
+}
+
+/* expands a loaded 8, 24 or 32 bpp bitmap to 32 bpp direct color. PNG stores RGB, BMP stores BGR */
+static TLN_Bitmap ConvertToDirect(TLN_Bitmap source, bool rgb)
+{
+	TLN_Bitmap bitmap;
+	const uint32_t* palette = source->palette != NULL ? source->palette->data : NULL;
+	int x, y;
+
+	if (source->bpp == 8 && palette == NULL)
+		return NULL;
+	if (source->bpp != 8 && source->bpp != 24 && source->bpp != 32)
+		return NULL;
+
+	bitmap = TLN_CreateBitmap(source->width, source->height, 32);
+	if (bitmap == NULL)
+		return NULL;
+
+	for (y = 0; y < source->height; y += 1)
+	{
+		const uint8_t* srcpixel = source->data + y*source->pitch;
+		uint32_t* dstpixel = (uint32_t*)(bitmap->data + y*bitmap->pitch);
+		for (x = 0; x < source->width; x += 1)
+		{
+			/* color 0 stays transparent, as in indexed bitmaps */
+			if (source->bpp == 8)
+			{
+				*dstpixel = srcpixel[0] != 0 ? palette[srcpixel[0]] : 0;
+				srcpixel += 1;
+			}
+			else
+			{
+				const uint8_t a = source->bpp == 32 ? srcpixel[3] : 255;
+				if (rgb)
+					*dstpixel = ((uint32_t)a << 24) | (srcpixel[0] << 16) | (srcpixel[1] << 8) | srcpixel[2];
+				else
+					*dstpixel = ((uint32_t)a << 24) | (srcpixel[2] << 16) | (srcpixel[1] << 8) | srcpixel[0];
+				srcpixel += source->bpp >> 3;
+			}
+			dstpixel += 1;
+		}
+	}
+	return bitmap;
+}
+
+/* loads image as 32 bpp without asset cache */
+static TLN_Bitmap LoadDirectBitmap (const char* filename)
+{
+	TLN_Bitmap bitmap;
+	TLN_Bitmap direct;
+	bool rgb = true;
+
+	if (!CheckFile (filename))
+	{
+		TLN_SetLastError (TLN_ERR_FILE_NOT_FOUND);
+		return NULL;
+	}
+
+	/* try png, else bmp*/
+	bitmap = LoadPNG (filename, PNG_DIRECT);
+	if (bitmap == NULL)
+	{
+		bitmap = LoadBMP (filename);
+		rgb = false;
+	}
+	if (bitmap == NULL)
+	{
+		TLN_SetLastError (TLN_ERR_WRONG_FORMAT);
+		return NULL;
+	}
+
+	/* png is usually decoded as direct color already */
+	if (rgb && bitmap->bpp == 32)
+		direct = bitmap;
+	else
+	{
+		direct = ConvertToDirect (bitmap, rgb);
+		TLN_DeleteBitmap (bitmap);
+	}
+	if (direct == NULL)
+	{
+		TLN_SetLastError (TLN_ERR_WRONG_FORMAT);
+		return NULL;
+	}
+
+	TLN_SetLastError (TLN_ERR_OK);
+	return direct;
+}
+
+/*!
+ * \brief
+ * Loads image file (BMP or PNG) as a 32 bpp direct color bitmap
+ *
+ * \param filename
+ * File name with the image
+ *
+ * \returns
+ * Handler to the loaded image or NULL if error
+ *
+ * \remarks
+ * Unlike TLN_LoadBitmap(), true color images aren't converted to indexed color, so there's
+ * no limit in the number of colors and alpha channel is preserved. Direct color bitmaps can be
+ * used in bitmap layers and as background bitmap, but not in tilesets or spritesets. Loading the
+ * same file again returns the same bitmap until it's evicted with TLN_EvictCache()
+ *
+ * \see
+ * TLN_LoadBitmap(), TLN_DeleteBitmap()
+ */
+TLN_Bitmap TLN_LoadDirectBitmap (const char* filename)
+{
+	TLN_Bitmap bitmap = (TLN_Bitmap)FindCached (CACHE_DIRECT_BITMAP, filename);
+	if (bitmap != NULL)
+	{
+		TLN_SetLastError (TLN_ERR_OK);
+		return bitmap;
+	}
+	return (TLN_Bitmap)AddCached (CACHE_DIRECT_BITMAP, filename, LoadDirectBitmap (filename));
+}
+
+/* memory source for libpng */
+typedef struct
+{
+	const uint8_t* data;
+	size_t size;
+	size_t pos;
+}
+PNGSource;
+
+static void read_png_data (png_structp png, png_bytep dst, png_size_t length)
+{
+	PNGSource* source = (PNGSource*)png_get_io_ptr (png);
+	if (length > source->size - source->pos)
+		png_error (png, "read past end of data");
+	memcpy (dst, source->data + source->pos, length);
+	source->pos += length;
+}
+
+/* decodes PNG from memory straight into the bitmap. True color and indexed rows are converted
+ * to the requested format one by one as they're decoded, without a full size intermediate image.
+ * Sets overflow when a true color image has more than 255 colors for PNG_INDEXED */
+static TLN_Bitmap DecodePNG (const uint8_t* data, size_t size, PNGFormat format, bool* overflow)
+{
+	PNGSource source;
 	png_struct* png;
 	png_info* info;
-	int width, height;
+	TLN_Bitmap volatile bitmap = NULL;
+	png_bytep* volatile row_pointers = NULL;
+	uint8_t* volatile row = NULL;
+	ColorSet colors;
 	png_byte color_type;
-	png_byte bit_depth;
-	png_bytep *row_pointers;
-	png_byte header[8];
-	int channels;
-	int y;
-
-	fp = FileOpen (filename);
-	if (!fp)
+	int width, height, bpp;
+	bool truecolor, interlaced;
+	int x, y;
+
+	*overflow = false;
+	png = png_create_read_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (png == NULL)
 		return NULL;
+	info = png_create_info_struct (png);
+	if (info == NULL)
+	{
+		png_destroy_read_struct (&png, NULL, NULL);
+		return NULL;
+	}
 
-	fread (header, 8, 1, fp);
-	if (png_sig_cmp(header, 0, 8))
+	/* libpng errors jump here */
+	if (setjmp (png_jmpbuf(png)))
 	{
-		FileClose (fp);
+		if (bitmap != NULL)
+			TLN_DeleteBitmap (bitmap);
+		free (row_pointers);
+		free (row);
+		png_destroy_read_struct (&png, &info, NULL);
 		return NULL;
 	}
 
-	png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-	info = png_create_info_struct(png);
-	
-	setjmp(png_jmpbuf(png));
-	png_init_io(png, fp);
-	png_set_sig_bytes(png, 8);
-	png_read_info(png, info);
-
-	width      = png_get_image_width(png, info);
-	height     = png_get_image_height(png, info);
-	color_type = png_get_color_type(png, info);
-	bit_depth  = png_get_bit_depth(png, info);
-	channels   = png_get_channels(png, info);
-    
-    png_read_update_info(png, info);
-
-	/* adjust actual bit depth */
-	bit_depth *= channels;
-
-	setjmp(png_jmpbuf(png));
-	row_pointers = (png_bytep*) malloc(sizeof(png_bytep) * height);
-	bitmap = TLN_CreateBitmap (width, height, bit_depth);
-	for (y=0; y<height; y++)
-		row_pointers[y] = (png_byte*) TLN_GetBitmapPtr (bitmap, 0,y);
-	png_read_image(png, row_pointers);
-	free (row_pointers);
+	source.data = data;
+	source.size = size;
+	source.pos = 8;
+	png_set_read_fn (png, &source, read_png_data);
+	png_set_sig_bytes (png, 8);
+	png_read_info (png, info);
+
+	width      = png_get_image_width (png, info);
+	height     = png_get_image_height (png, info);
+	color_type = png_get_color_type (png, info);
+	bpp        = png_get_bit_depth (png, info) * png_get_channels (png, info);
+	truecolor  = png_get_bit_depth (png, info) == 8 && (color_type == PNG_COLOR_TYPE_RGB || color_type == PNG_COLOR_TYPE_RGB_ALPHA);
+	interlaced = png_get_interlace_type (png, info) != PNG_INTERLACE_NONE;
+
+	/* true color to 8 bpp with exact palette, index 0 for transparent pixels (alpha < 128) */
+	if (format == PNG_INDEXED && truecolor && !interlaced)
+	{
+		const int bytes = bpp >> 3;
+
+		row = (uint8_t*)malloc (png_get_rowbytes (png, info));
+		bitmap = TLN_CreateBitmap (width, height, 8);
+		if (row == NULL || bitmap == NULL)
+			png_error (png, "out of memory");
 
-	/* 8 bpp indexed palette */
-	if (color_type == PNG_COLOR_TYPE_PALETTE)
+		ColorSetInit (&colors);
+		for (y = 0; y < height && !*overflow; y += 1)
+		{
+			const uint8_t* srcpixel = row;
+			uint8_t* dstpixel = bitmap->data + y*bitmap->pitch;
+			png_read_row (png, row, NULL);
+			for (x = 0; x < width; x += 1, srcpixel += bytes, dstpixel += 1)
+			{
+				const uint32_t color = read_pixel (srcpixel, bpp, true);
+				int index = -1;
+				if ((color >> 24) >= 128)
+				{
+					index = ColorSetAdd (&colors, color | 0xFF000000);
+					if (index < 0)
+					{
+						*overflow = true;
+						break;
+					}
+				}
+				*dstpixel = (uint8_t)(index + 1);
+			}
+		}
+
+		if (*overflow)
+		{
+			TLN_DeleteBitmap (bitmap);
+			bitmap = NULL;
+		}
+		else
+			AttachPalette (bitmap, colors.items, colors.count);
+	}
+
+	/* true color to direct color, libpng swaps to BGRA as stored by the engine */
+	else if (format == PNG_DIRECT && truecolor)
+	{
+		png_set_bgr (png);
+		if (bpp == 24)
+			png_set_filler (png, 0xFF, PNG_FILLER_AFTER);
+		png_set_interlace_handling (png);
+		png_read_update_info (png, info);
+
+		row_pointers = (png_bytep*)malloc (sizeof(png_bytep) * height);
+		bitmap = TLN_CreateBitmap (width, height, 32);
+		if (row_pointers == NULL || bitmap == NULL)
+			png_error (png, "out of memory");
+		for (y = 0; y < height; y += 1)
+			row_pointers[y] = (png_byte*)TLN_GetBitmapPtr (bitmap, 0, y);
+		png_read_image (png, row_pointers);
+	}
+
+	/* indexed to direct color, color 0 stays transparent */
+	else if (format == PNG_DIRECT && color_type == PNG_COLOR_TYPE_PALETTE && bpp == 8 && !interlaced)
 	{
 		png_colorp png_palette = NULL;
 		int palette_entries = 0;
-		TLN_Palette palette;
-		int c;
+		uint32_t palette[256] = { 0 };
 
-		png_get_PLTE(png,info, &png_palette, &palette_entries);
+		png_get_PLTE (png, info, &png_palette, &palette_entries);
+		for (x = 1; x < palette_entries; x += 1)
+			palette[x] = PackRGB32 (png_palette[x].red, png_palette[x].green, png_palette[x].blue);
 
-		palette = TLN_CreatePalette (palette_entries);
-		for (c=0; c<palette_entries; c++)
+		row = (uint8_t*)malloc (width);
+		bitmap = TLN_CreateBitmap (width, height, 32);
+		if (row == NULL || bitmap == NULL)
+			png_error (png, "out of memory");
+		for (y = 0; y < height; y += 1)
 		{
-			TLN_SetPaletteColor (palette, c, 
-				png_palette[c].red, png_palette[c].green, png_palette[c].blue);
+			uint32_t* dstpixel = (uint32_t*)(bitmap->data + y*bitmap->pitch);
+			png_read_row (png, row, NULL);
+			for (x = 0; x < width; x += 1)
+				dstpixel[x] = palette[row[x]];
 		}
-		TLN_SetBitmapPalette (bitmap, palette);
 	}
 
-	FileClose(fp);
+	/* as stored */
+	else
+	{
+		png_read_update_info (png, info);
+		row_pointers = (png_bytep*)malloc (sizeof(png_bytep) * height);
+		bitmap = TLN_CreateBitmap (width, height, bpp);
+		if (row_pointers == NULL || bitmap == NULL)
+			png_error (png, "out of memory");
+		for (y = 0; y < height; y += 1)
+			row_pointers[y] = (png_byte*)TLN_GetBitmapPtr (bitmap, 0, y);
+		png_read_image (png, row_pointers);
+
+		/* 8 bpp indexed palette */
+		if (color_type == PNG_COLOR_TYPE_PALETTE)
+		{
+			png_colorp png_palette = NULL;
+			int palette_entries = 0;
+			TLN_Palette palette;
+			int c;
+
+			png_get_PLTE (png, info, &png_palette, &palette_entries);
+
+			palette = TLN_CreatePalette (palette_entries);
+			for (c = 0; c < palette_entries; c++)
+			{
+				TLN_SetPaletteColor (palette, c, 
+					png_palette[c].red, png_palette[c].green, png_palette[c].blue);
+			}
+			TLN_SetBitmapPalette (bitmap, palette);
+		}
+	}
+
+	free (row_pointers);
+	free (row);
 	png_destroy_read_struct (&png, &info, NULL);
 	return bitmap;
 }
 
+/* Loads PNG using libpng, converted to the requested format when possible */
+static TLN_Bitmap LoadPNG (const char* filename, PNGFormat format)
+{
+	TLN_Bitmap bitmap;
+	uint8_t* data;
+	ssize_t size;
+	MapMode mode;
+	bool overflow;
+
+	data = (uint8_t*)MapFile (filename, &size, &mode);
+	if (!data)
+		return NULL;
+
+	if (size < 8 || png_sig_cmp(data, 0, 8))
+	{
+		UnmapFile (data, size, mode);
+		return NULL;
+	}
+
+	/* too many colors for exact palette, caller quantizes */
+	bitmap = DecodePNG (data, size, format, &overflow);
+	if (overflow)
+		bitmap = DecodePNG (data, size, PNG_NATIVE, &overflow);
+
+	UnmapFile (data, size, mode);
+	return bitmap;
+}
+
 /* loads BMP */
 static TLN_Bitmap LoadBMP (const char* filename)
 {
 	BITMAPFILEHEADER bfh;
 	BITMAPV5HEADER bv5;
 	uint32_t StructSize;
-	FILE* pf;
+	uint8_t* data;
+	ssize_t size;
+	MapMode mode;
 	TLN_Bitmap bitmap = NULL;
 	unsigned int c;
 	int pitch;
 
-	/* open file */
-	pf = FileOpen (filename);
-	if (!pf)
+	/* load file */
+	data = (uint8_t*)MapFile (filename, &size, &mode);
+	if (!data)
 		return NULL;
 
 	/* read BMP header */
-	fread (&bfh, sizeof(bfh), 1, pf);
+	if (size < (ssize_t)(sizeof(bfh) + sizeof(StructSize)))
+	{
+		UnmapFile (data, size, mode);
+		return NULL;
+	}
+	memcpy (&bfh, data, sizeof(bfh));
 	if (bfh.Type != 0x4D42)
 	{
-		FileClose (pf);
+		UnmapFile (data, size, mode);
 		return NULL;
 	}
 
 	/* load info structure */
 	memset (&bv5, 0, sizeof(bv5));
-	fread (&StructSize, 4, 1, pf);
-	fseek (pf, sizeof(bfh), SEEK_SET);
-	fread (&bv5, StructSize, 1, pf);
+	memcpy (&StructSize, data + sizeof(bfh), sizeof(StructSize));
+	if (StructSize > sizeof(bv5))
+		StructSize = sizeof(bv5);
+	if (sizeof(bfh) + StructSize > (size_t)size)
+	{
+		UnmapFile (data, size, mode);
+		return NULL;
+	}
+	memcpy (&bv5, data + sizeof(bfh), StructSize);
 
 	/* create */
 	bitmap = TLN_CreateBitmap (bv5.bV5Width, bv5.bV5Height, bv5.bV5BitCount);
 	if (!bitmap)
 	{
-		FileClose (pf);
+		UnmapFile (data, size, mode);
 		return NULL;
 	}
 
 	/* load scanlines */
 	pitch = TLN_GetBitmapPitch (bitmap);
-	fseek (pf, bfh.OffsetData, SEEK_SET);
+	if (bfh.OffsetData + (size_t)pitch*bv5.bV5Height > (size_t)size)
+	{
+		TLN_DeleteBitmap (bitmap);
+		UnmapFile (data, size, mode);
+		return NULL;
+	}
 	for (c=0; c<bv5.bV5Height; c++)
 	{
 		uint8_t* line = TLN_GetBitmapPtr (bitmap, 0, bv5.bV5Height - c - 1);
-		fread (line, pitch, 1, pf);
+		memcpy (line, data + bfh.OffsetData + c*pitch, pitch);
 	}
 
 	/* load palette */
 	if (bv5.bV5BitCount == 8)
 	{
 		TLN_Palette palette;
+		const size_t offset = sizeof(BITMAPFILEHEADER) + bv5.bV5Size;
 
 		/* HACK: some editors don't set the bV5ClrUsed field, compute from size */
 		if (bv5.bV5ClrUsed == 0)
 			bv5.bV5ClrUsed = (bfh.OffsetData - sizeof(bfh) - bv5.bV5Size) / sizeof(RGBQUAD);
+		if (offset + bv5.bV5ClrUsed*sizeof(RGBQUAD) > (size_t)size)
+			bv5.bV5ClrUsed = 0;
 
-		fseek (pf, sizeof(BITMAPFILEHEADER) + bv5.bV5Size, SEEK_SET);
 		palette = TLN_CreatePalette (bv5.bV5ClrUsed);
 		for (c=0; c<(int)bv5.bV5ClrUsed; c++)
 		{
 			RGBQUAD color;
-			fread (&color, sizeof(RGBQUAD), 1, pf);
+			memcpy (&color, data + offset + c*sizeof(RGBQUAD), sizeof(RGBQUAD));
 			TLN_SetPaletteColor (palette, c, color.r, color.g, color.b);
 		}
 		TLN_SetBitmapPalette (bitmap, palette);
 	}
 
-	FileClose (pf);
+	UnmapFile (data, size, mode);
 	return bitmap;
 }
@@ -8,25 +8,36 @@
 * file, You can obtain one at http://mozilla.org/MPL/2.0/.
 * */
 
+#ifdef __STRICT_ANSI__
+#undef __STRICT_ANSI__
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include "SDL2/SDL.h"
 #include "LoadFile.h"
 #include "ResPack.h"
 
+#if defined (_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <limits.h>
+#endif
+
 #define SLASH	  '/'
 #define BACKSLASH '\\'
 #define MAX_PATH	300
-#define MAX_ASSETS	8
 
 static char localpath[MAX_PATH] = ".";
 static ResPack respack = NULL;
-struct
-{
-	ResAsset asset;
-	FILE* pf;
-}
-static assets[MAX_ASSETS] = { 0 };
+static int respack_id = 0;		/* tells apart assets of different packs with same path */
+static SDL_mutex* respack_lock = NULL;	/* pack file is shared by loading threads */
 
 /*!
  * \brief
@@ -63,11 +74,17 @@ void TLN_SetLoadPath (const char* path)
  * they were plain files. As long as the structure used to build the package
  * matches the original structure of the assets, the TLN_SetLoadPath() and the TLN_LoadXXX
  * functions will work transparently, easing the migration with minimal changes.
+ * Packed assets are read and decrypted straight to memory, without temporary files.
+ * Both original packages and version 2 ones, with zlib compressed assets, are supported.
+ * Packages without key are memory mapped, and their uncompressed assets are read in place.
  * \sa TLN_CloseResourcePack
  */
 bool TLN_OpenResourcePack(const char* filename, const char* key)
 {
+	if (respack_lock == NULL)
+		respack_lock = SDL_CreateMutex();
 	respack = ResPack_Open(filename, key);
+	respack_id += 1;
 	return respack != NULL;
 }
 
@@ -82,19 +99,16 @@ void TLN_CloseResourcePack(void)
 	respack = NULL;
 }
 
-/* open file/packed asset */
-FILE* FileOpen (const char* filename)
+/* builds full path of a file relative to load path */
+static void build_path (char* path, int len, const char* filename)
 {
-	FILE* pf;
-	char path[MAX_PATH + 1];
 	char oldchar, newchar;
 	char* p;
-	ResAsset asset;
 
 #if (_MSC_VER) && (_MSC_VER < 1900)
 	sprintf (path, "%s/%s", localpath, filename);
 #else
-	snprintf (path, sizeof(path), "%s/%s", localpath, filename);
+	snprintf (path, len, "%s/%s", localpath, filename);
 #endif
 
 	/* replace correct path separator */
@@ -112,69 +126,61 @@ FILE* FileOpen (const char* filename)
 			*p = newchar;
 		p++;
 	}
+}
 
-	/* asset pack active? */
-	if (respack != NULL)
-	{
-		/* search free slot */
-		int c;
-		for (c = 0; c < MAX_ASSETS; c++)
-		{
-			if (assets[c].asset == NULL)
-				break;
-		}
-		if (c == MAX_ASSETS)
-			return NULL;
+/* creates file for writing next to loaded assets, not available with resource packs */
+FILE* FileCreate (const char* filename)
+{
+	char path[MAX_PATH + 1];
 
-		/* open */
-		asset = ResPack_OpenAsset(respack, path);
-		pf = ResPack_GetAssetFile(asset);
-		if (pf != NULL)
-		{
-			assets[c].asset = asset;
-			assets[c].pf = pf;
-		}
-	}
-	else
-		pf = fopen (path, "rb");
+	if (respack != NULL)
+		return NULL;
 
-	return pf;
+	build_path (path, sizeof(path), filename);
+	return fopen (path, "wb");
 }
 
-/* closes file/packed asset */
-void FileClose(FILE* pf)
+/* gets modification time of a plain file, false if not found or inside a resource pack */
+bool FileTime (const char* filename, time_t* time)
 {
-	if (pf == NULL)
-		return;
+	char path[MAX_PATH + 1];
+	struct stat info;
 
-	/* asset pack active? */
 	if (respack != NULL)
-	{
-		int c;
-		for (c = 0; c < MAX_ASSETS; c++)
-		{
-			if (assets[c].pf == pf)
-			{
-				ResPack_CloseAsset(assets[c].asset);
-				assets[c].asset = NULL;
-				assets[c].pf = NULL;
-				return;
-			}
-		}
-	}
-	else
-		fclose(pf);
+		return false;
+
+	build_path (path, sizeof(path), filename);
+	if (stat (path, &info) != 0)
+		return false;
+
+	*time = info.st_mtime;
+	return true;
 }
 
-/* generic load file into RAM buffer */
+/* generic load file into RAM buffer, null-terminated. Packed assets are decoded straight
+ * to memory */
 void* LoadFile (const char* filename, ssize_t* out_size)
 {
+	char path[MAX_PATH + 1];
 	size_t size;
 	FILE* pf;
 	uint8_t* data;
 
+	build_path (path, sizeof(path), filename);
+
+	/* asset pack active? */
+	if (respack != NULL)
+	{
+		uint32_t asset_size = 0;
+		SDL_LockMutex (respack_lock);
+		data = (uint8_t*)ResPack_LoadAsset (respack, path, &asset_size);
+		SDL_UnlockMutex (respack_lock);
+		*out_size = data != NULL ? (ssize_t)asset_size : 0;
+		return (void*)data;
+	}
+
 	/* abre */
-	pf = FileOpen (filename);
+	pf = fopen (path, "rb");
 	if (!pf)
 	{
 		*out_size = 0;
@@ -195,20 +201,145 @@ void* LoadFile (const char* filename, ssize_t* out_size)
 	else
 		*out_size = -1;
 
-	FileClose (pf);
+	fclose (pf);
 	return (void*)data;
 }
 
+/* maps a file read-only in memory. Assets stored plain inside unencrypted resource packs
+ * are used in place, other ones are loaded with LoadFile(). mode tells how it was obtained,
+ * release with UnmapFile(). Content isn't null-terminated */
+void* MapFile (const char* filename, ssize_t* out_size, MapMode* mode)
+{
+	char path[MAX_PATH + 1];
+	void* data = NULL;
+
+	*mode = MAPPED_BUFFER;
+	build_path (path, sizeof(path), filename);
+	if (respack != NULL)
+	{
+		uint32_t asset_size = 0;
+		data = (void*)ResPack_MapAsset (respack, path, &asset_size);
+
+		/* misaligned assets from old packs are loaded, baked records are read in place */
+		if (data == NULL || ((uintptr_t)data % sizeof(uint64_t)) != 0)
+			return LoadFile (filename, out_size);
+
+		*out_size = (ssize_t)asset_size;
+		*mode = MAPPED_PACK;
+		return data;
+	}
+
+	*out_size = 0;
+
+#if defined (_WIN32)
+	{
+		HANDLE file, mapping;
+		LARGE_INTEGER size;
+		file = CreateFileA (path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return NULL;
+		if (GetFileSizeEx (file, &size) && size.QuadPart > 0)
+		{
+			mapping = CreateFileMappingA (file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping != NULL)
+			{
+				data = MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, 0);
+				CloseHandle (mapping);
+			}
+		}
+		CloseHandle (file);
+		if (data != NULL)
+			*out_size = (ssize_t)size.QuadPart;
+	}
+#else
+	{
+		struct stat info;
+		int fd = open (path, O_RDONLY);
+		if (fd == -1)
+			return NULL;
+		if (fstat (fd, &info) == 0 && info.st_size > 0)
+		{
+			data = mmap (NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data == MAP_FAILED)
+				data = NULL;
+		}
+		close (fd);
+		if (data != NULL)
+			*out_size = info.st_size;
+	}
+#endif
+
+	/* not mappable, read it */
+	if (data == NULL)
+		return LoadFile (filename, out_size);
+
+	*mode = MAPPED_FILE;
+	return data;
+}
+
+/* releases file obtained with MapFile() */
+void UnmapFile (void* data, ssize_t size, MapMode mode)
+{
+	if (data == NULL)
+		return;
+
+	if (mode == MAPPED_BUFFER)
+		free (data);
+	else if (mode == MAPPED_FILE)
+	{
+#if defined (_WIN32)
+		UnmapViewOfFile (data);
+#else
+		munmap (data, size);
+#endif
+	}
+}
+
+/* builds identifier of a file for the asset cache: absolute path of plain files, or path
+ * inside current resource pack */
+void BuildFileKey (char* key, int len, const char* filename)
+{
+	char path[MAX_PATH + 1];
+
+	build_path (path, sizeof(path), filename);
+	if (respack != NULL)
+	{
+		snprintf (key, len, "%d:%s", respack_id, path);
+		return;
+	}
+
+#if defined (_WIN32)
+	if (_fullpath (key, path, len) == NULL)
+		snprintf (key, len, "%s", path);
+#else
+	{
+		/* resolve folder only, file may not exist (base name of spritesets) */
+		char folder[PATH_MAX];
+		char* name = strrchr (path, SLASH);
+		*name = 0;
+		if (realpath (path, folder) != NULL)
+			snprintf (key, len, "%s/%s", folder, name + 1);
+		else
+			snprintf (key, len, "%s/%s", path, name + 1);
+	}
+#endif
+}
+
 /* check if file exists */
 bool CheckFile (const char* filename)
 {
+	char path[MAX_PATH + 1];
 	FILE* pf;
 
-	pf = FileOpen (filename);
+	build_path (path, sizeof(path), filename);
+	if (respack != NULL)
+		return ResPack_FindAsset (respack, path);
+
+	pf = fopen (path, "rb");
 	if (!pf)
 		return false;
 
-	FileClose (pf);
+	fclose (pf);
 	return true;
 }
 
@@ -9,6 +9,7 @@
 * */
 
 #include <stdio.h>
+#include <time.h>
 #include "Tilengine.h"
 
 #ifndef _LOAD_FILE_H
@@ -26,6 +27,15 @@ typedef SSIZE_T ssize_t;
 #endif
 #endif
 
+/* how MapFile() got the content */
+typedef enum
+{
+	MAPPED_BUFFER,	/* loaded to memory buffer */
+	MAPPED_FILE,	/* plain file mapped */
+	MAPPED_PACK,	/* inside mapped resource pack, owned by the pack */
+}
+MapMode;
+
 typedef struct
 {
 	char path[200];
@@ -39,11 +49,14 @@ extern "C" {
 #endif
 
 	void* LoadFile(const char* filename, ssize_t* out_size);
-	void FileClose(FILE* pf);
-	FILE* FileOpen(const char* filename);
+	void* MapFile(const char* filename, ssize_t* out_size, MapMode* mode);
+	void UnmapFile(void* data, ssize_t size, MapMode mode);
+	FILE* FileCreate(const char* filename);
+	bool FileTime(const char* filename, time_t* time);
 	bool CheckFile(const char* filename);
 	void SplitFilename(const char* filename, FileInfo* fileinfo);
 	void BuildFilePath(char* full_path, int len, const char* path, const char* name, const char* ext);
+	void BuildFileKey(char* key, int len, const char* filename);
 
 #ifdef __cplusplus
 }
@@ -9,10 +9,12 @@
 * */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "Tilengine.h"
 #include "LoadFile.h"
 #include "Palette.h"
+#include "Cache.h"
 
 #define SWAP(w) ((w)&0xFF)<<8 | ((w)>>8)
 
@@ -27,64 +29,73 @@ struct
 }
 trailing;
 
-/*!
- * \brief
- * Loads a palette from a standard .act file
- * 
- * \param filename
- * ACT file containing the palette to load
- * 
- * \returns
- * A reference to the newly loaded palette, or NULL if error
- * 
- * \remarks
- * Palettes are also automatically created when loading tilesets and spritesets.
- * Use the functions TLN_GetTilesetPalette() and TLN_GetSpritesetPalette() to retrieve them.
- * 
- * \see
- * TLN_GetTilesetPalette(), TLN_GetSpritesetPalette()
- */
-TLN_Palette TLN_LoadPalette (const char* filename)
+/* loads palette without asset cache */
+static TLN_Palette LoadACT (const char* filename)
 {
-	FILE *pf;
+	uint8_t* data;
 	TLN_Palette palette = NULL;
-	int size;
+	ssize_t size;
+	MapMode mode;
 	int c;
 
-	/* open file */
-	pf = FileOpen (filename);
-	if (!pf)
+	/* load file */
+	data = (uint8_t*)MapFile (filename, &size, &mode);
+	if (!data)
 	{
 		TLN_SetLastError (TLN_ERR_FILE_NOT_FOUND);
 		return NULL;
 	}
 
-	/* check size */
-	fseek (pf, 0, SEEK_END);
-	size = ftell (pf);
-
 	/* load trailing and get number of entries */
 	if (size == ACT_SIZE)
 	{
-		fseek (pf, - (int)sizeof(trailing), SEEK_END);
-		fread (&trailing, sizeof(trailing), 1, pf);
+		memcpy (&trailing, data + size - sizeof(trailing), sizeof(trailing));
 		trailing.entries = SWAP(trailing.entries);
 		trailing.transparent = SWAP(trailing.transparent);
+		if (trailing.entries < 0 || trailing.entries > ACT_ENTRIES)
+			trailing.entries = ACT_ENTRIES;
 	}
 	else
-		trailing.entries = size/3;
+		trailing.entries = (short)(size/3);
 
 	/* create palette and load from file */
 	palette = TLN_CreatePalette (trailing.entries);
-	fseek (pf, 0, SEEK_SET);
 	for (c=0; c<trailing.entries; c++)
 	{
-		uint8_t src[3];
-		fread (src, sizeof(src), 1, pf);
+		const uint8_t* src = data + c*3;
 		TLN_SetPaletteColor (palette, c, src[0], src[1], src[2]);
 	}
 
-	FileClose (pf);
+	UnmapFile (data, size, mode);
 	TLN_SetLastError (TLN_ERR_OK);
 	return palette;
 }
+
+/*!
+ * \brief
+ * Loads a palette from a standard .act file
+ * 
+ * \param filename
+ * ACT file containing the palette to load
+ * 
+ * \returns
+ * A reference to the newly loaded palette, or NULL if error
+ * 
+ * \remarks
+ * Palettes are also automatically created when loading tilesets and spritesets.
+ * Use the functions TLN_GetTilesetPalette() and TLN_GetSpritesetPalette() to retrieve them.
+ * Loading the same file again returns the same palette until it's evicted with TLN_EvictCache()
+ * 
+ * \see
+ * TLN_GetTilesetPalette(), TLN_GetSpritesetPalette()
+ */
+TLN_Palette TLN_LoadPalette (const char* filename)
+{
+	TLN_Palette palette = (TLN_Palette)FindCached (CACHE_PALETTE, filename);
+	if (palette != NULL)
+	{
+		TLN_SetLastError (TLN_ERR_OK);
+		return palette;
+	}
+	return (TLN_Palette)AddCached (CACHE_PALETTE, filename, LoadACT (filename));
+}
@@ -157,10 +157,11 @@ TLN_SequencePack TLN_LoadSequencePack (const char* filename)
 {
 	SimpleXmlParser parser;
 	ssize_t size;
+	MapMode mode;
 	uint8_t *data;
 
 	/* load file */
-	data = (uint8_t*)LoadFile (filename, &size);
+	data = (uint8_t*)MapFile (filename, &size, &mode);
 	if (!data)
 	{
 		if (size == 0)
@@ -174,7 +175,7 @@ TLN_SequencePack TLN_LoadSequencePack (const char* filename)
 	loader.sp = TLN_CreateSequencePack ();
 	if (!loader.sp)
 	{
-		free (data);
+		UnmapFile (data, size, mode);
 		return NULL;
 	}
 
@@ -187,7 +188,7 @@ TLN_SequencePack TLN_LoadSequencePack (const char* filename)
 			printf("parse error on line %li:\n%s\n", 
 				simpleXmlGetLineNumber(parser), simpleXmlGetErrorDescription(parser));
 			simpleXmlDestroyParser(parser);
-			free (data);
+			UnmapFile (data, size, mode);
 			TLN_SetLastError (TLN_ERR_WRONG_FORMAT);
 			return NULL;
 		}
@@ -198,7 +199,7 @@ TLN_SequencePack TLN_LoadSequencePack (const char* filename)
 		TLN_SetLastError (TLN_ERR_OUT_OF_MEMORY);
 
 	simpleXmlDestroyParser(parser); 
-	free (data);
+	UnmapFile (data, size, mode);
 	return loader.sp;
 }
 
@@ -11,38 +11,70 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include "Tilengine.h"
 #include "LoadFile.h"
+#include "Bitmap.h"
+#include "Spriteset.h"
+#include "Cache.h"
+#include "crc32.h"
 #include "cJSON.h"
 
+/* frame of the source image for atlas packing */
+typedef struct
+{
+	int x, y, w, h;			/* trimmed rectangle inside source bitmap */
+	int xoffset, yoffset;	/* trimmed rectangle inside original frame */
+	int frame_w, frame_h;	/* original frame size */
+	uint32_t hash;			/* crc of trimmed pixels */
+	int source;				/* frame holding the same pixels, or -1 if unique */
+	uint16_t flags;			/* mirroring relative to source frame */
+	int ax, ay;				/* position inside packed atlas */
+}
+AtlasFrame;
+
 /* loads txt format: name = x y w h */
 /* loads csv format: name,x,y,w,h */
 static TLN_SpriteData* load_txt_csv(const char* filename, int* num_entries)
 {
 	TLN_SpriteData* data = NULL;
 	TLN_SpriteData* entry;
-	char line[200];
-	FILE* pf = FileOpen(filename);
-	if (!pf)
+	ssize_t size;
+	char* text;
+	char* line;
+	char* next;
+
+	text = (char*)LoadFile(filename, &size);
+	if (!text)
 		return NULL;
 
 	/* count lines */
 	*num_entries = 0;
-	while (fgets(line, sizeof(line), pf))
+	for (line = text; *line != 0; line = next)
+	{
+		next = strchr(line, '\n');
+		next = next != NULL ? next + 1 : line + strlen(line);
 		*num_entries += 1;
-	fseek(pf, 0, SEEK_SET);
+	}
 
 	data = (TLN_SpriteData*)calloc(*num_entries, sizeof(TLN_SpriteData));
 	entry = data;
-	while (fgets(line, sizeof(line), pf))
+	for (line = text; *line != 0 && entry != NULL; line = next)
 	{
+		/* terminate line in place */
+		next = strchr(line, '\n');
+		if (next != NULL)
+			*next++ = 0;
+		else
+			next = line + strlen(line);
+
 		if (strchr(line, '='))
 			sscanf(line, "%s = %d %d %d %d", entry->name, &entry->x, &entry->y, &entry->w, &entry->h);
 		else if (strchr(line, ','))
 			sscanf(line, "%64[^,],%d,%d,%d,%d", entry->name, &entry->x, &entry->y, &entry->w, &entry->h);
 		entry += 1;
 	}
-	FileClose(pf);
+	free(text);
 	return data;
 }
 
@@ -105,20 +137,278 @@ static TLN_SpriteData* load_json(const char* filename, int* num_entries)
 		}
 		*num_entries = (int)array_size;
 	}
-	cJSON_free(root);
+	cJSON_Delete(root);
 	return data;
 }
 
-/*!
- * \brief Loads a spriteset from an image png and its associated atlas descriptor
- * \param name Base name of the files containing the spriteset, with or without .png extension
- * \returns Reference to the newly loaded spriteset or NULL if error
- * 
- * \remarks
- * The spriteset comes in a pair of files: an image file (bmp or png) and a standarized atlas descriptor (json, csv or txt)
- * The supported json format is the array.
- */
-TLN_Spriteset TLN_LoadSpriteset (const char* name)
+/* gets pixel of a frame as seen with the given mirroring flags */
+static inline uint8_t get_frame_pixel(TLN_Bitmap bitmap, AtlasFrame* frame, int x, int y, uint16_t flags)
+{
+	if (flags & FLAG_FLIPX)
+		x = frame->w - x - 1;
+	if (flags & FLAG_FLIPY)
+		y = frame->h - y - 1;
+	return *get_bitmap_ptr(bitmap, frame->x + x, frame->y + y);
+}
+
+/* shrinks frame rectangle to its non-transparent area */
+static void trim_frame(TLN_Bitmap bitmap, TLN_SpriteData* data, AtlasFrame* frame)
+{
+	int x1, y1, x2, y2;
+	int x, y;
+
+	frame->frame_w = data->w;
+	frame->frame_h = data->h;
+
+	/* clip to bitmap */
+	x1 = data->x < 0 ? 0 : data->x;
+	y1 = data->y < 0 ? 0 : data->y;
+	x2 = data->x + data->w > bitmap->width ? bitmap->width : data->x + data->w;
+	y2 = data->y + data->h > bitmap->height ? bitmap->height : data->y + data->h;
+
+	/* bounding box of opaque pixels */
+	frame->x = x2;
+	frame->y = y2;
+	frame->w = x1;
+	frame->h = y1;
+	for (y = y1; y < y2; y++)
+	{
+		uint8_t* pixel = get_bitmap_ptr(bitmap, x1, y);
+		for (x = x1; x < x2; x++, pixel++)
+		{
+			if (*pixel == 0)
+				continue;
+			if (x < frame->x) frame->x = x;
+			if (y < frame->y) frame->y = y;
+			if (x >= frame->w) frame->w = x + 1;
+			if (y >= frame->h) frame->h = y + 1;
+		}
+	}
+
+	/* fully transparent: keep a single empty pixel */
+	if (frame->x >= frame->w || frame->y >= frame->h || x1 >= x2 || y1 >= y2)
+	{
+		frame->x = x1 < x2 ? x1 : 0;
+		frame->y = y1 < y2 ? y1 : 0;
+		frame->w = frame->h = 1;
+		if (*get_bitmap_ptr(bitmap, frame->x, frame->y) != 0)
+		{
+			/* not transparent (invalid rectangle): point to first pixel of the image, assumed empty */
+			frame->x = frame->y = 0;
+		}
+	}
+	else
+	{
+		frame->w -= frame->x;
+		frame->h -= frame->y;
+	}
+	frame->xoffset = frame->x - data->x;
+	frame->yoffset = frame->y - data->y;
+}
+
+/* crc of frame contents as seen with the given mirroring flags */
+static uint32_t hash_frame(TLN_Bitmap bitmap, AtlasFrame* frame, uint16_t flags, uint8_t* row)
+{
+	uint32_t hash;
+	int x, y;
+
+	hash = _crc32(0, &frame->w, sizeof(frame->w));
+	hash = _crc32(hash, &frame->h, sizeof(frame->h));
+	for (y = 0; y < frame->h; y++)
+	{
+		for (x = 0; x < frame->w; x++)
+			row[x] = get_frame_pixel(bitmap, frame, x, y, flags);
+		hash = _crc32(hash, row, frame->w);
+	}
+	return hash;
+}
+
+/* true if frame contents seen with mirroring flags equal those of source frame */
+static bool compare_frames(TLN_Bitmap bitmap, AtlasFrame* source, AtlasFrame* frame, uint16_t flags)
+{
+	int x, y;
+
+	if (source->w != frame->w || source->h != frame->h)
+		return false;
+	for (y = 0; y < frame->h; y++)
+	{
+		for (x = 0; x < frame->w; x++)
+		{
+			if (get_frame_pixel(bitmap, source, x, y, 0) != get_frame_pixel(bitmap, frame, x, y, flags))
+				return false;
+		}
+	}
+	return true;
+}
+
+/* finds a previous unique frame with the same pixels, optionally mirrored */
+static void find_duplicate(TLN_Bitmap bitmap, AtlasFrame* frames, int index, uint8_t* row)
+{
+	static const uint16_t mirrors[] = { 0, FLAG_FLIPX, FLAG_FLIPY, FLAG_FLIPX + FLAG_FLIPY };
+	AtlasFrame* frame = &frames[index];
+	int c, m;
+
+	frame->source = -1;
+	frame->flags = 0;
+	for (m = 0; m < 4; m++)
+	{
+		const uint32_t hash = m == 0 ? frame->hash : hash_frame(bitmap, frame, mirrors[m], row);
+		for (c = 0; c < index; c++)
+		{
+			AtlasFrame* source = &frames[c];
+			if (source->source == -1 && source->hash == hash && compare_frames(bitmap, source, frame, mirrors[m]))
+			{
+				frame->source = c;
+				frame->flags = mirrors[m];
+				return;
+			}
+		}
+	}
+}
+
+/* unique frame to pack, with its sort key */
+typedef struct
+{
+	int index;				/* frame index */
+	int h;					/* trimmed height */
+}
+PackOrder;
+
+/* sorts frames by descending height for shelf packing */
+static int compare_height(const void* a, const void* b)
+{
+	const PackOrder* order1 = (const PackOrder*)a;
+	const PackOrder* order2 = (const PackOrder*)b;
+	if (order1->h != order2->h)
+		return order2->h - order1->h;
+	return order1->index - order2->index;
+}
+
+/* trims transparent borders, merges identical or mirrored frames and repacks them in a tight atlas */
+static TLN_Spriteset pack_spriteset(TLN_Bitmap bitmap, TLN_SpriteData* data, int entries)
+{
+	TLN_Spriteset spriteset = NULL;
+	TLN_Bitmap atlas = NULL;
+	TLN_SpriteData* packed = NULL;
+	AtlasFrame* frames = NULL;
+	uint8_t* row = NULL;
+	PackOrder* order = NULL;
+	int num_unique = 0;
+	int max_w = 0;
+	int area = 0;
+	int width, height;
+	int x, y, shelf_h;
+	int c, line;
+
+	frames = (AtlasFrame*)calloc(entries, sizeof(AtlasFrame));
+	order = (PackOrder*)calloc(entries, sizeof(PackOrder));
+	packed = (TLN_SpriteData*)calloc(entries, sizeof(TLN_SpriteData));
+	row = (uint8_t*)malloc(bitmap->width);
+	if (!frames || !order || !packed || !row)
+		goto cleanup;
+
+	/* trim & deduplicate */
+	for (c = 0; c < entries; c++)
+	{
+		AtlasFrame* frame = &frames[c];
+		trim_frame(bitmap, &data[c], frame);
+		frame->hash = hash_frame(bitmap, frame, 0, row);
+		find_duplicate(bitmap, frames, c, row);
+		if (frame->source == -1)
+		{
+			order[num_unique].index = c;
+			order[num_unique].h = frame->h;
+			num_unique++;
+			area += frame->w * frame->h;
+			if (frame->w > max_w)
+				max_w = frame->w;
+		}
+	}
+
+	/* shelf packing by descending height inside a roughly square area */
+	qsort(order, num_unique, sizeof(PackOrder), compare_height);
+	width = (int)ceil(sqrt(area * 1.1));
+	if (width < max_w)
+		width = max_w;
+	x = y = shelf_h = 0;
+	for (c = 0; c < num_unique; c++)
+	{
+		AtlasFrame* frame = &frames[order[c].index];
+		if (x + frame->w > width)
+		{
+			x = 0;
+			y += shelf_h;
+			shelf_h = 0;
+		}
+		frame->ax = x;
+		frame->ay = y;
+		x += frame->w;
+		if (frame->h > shelf_h)
+			shelf_h = frame->h;
+	}
+	height = y + shelf_h;
+
+	/* build atlas, palette is transferred from source bitmap */
+	atlas = TLN_CreateBitmap(width, height, 8);
+	if (!atlas)
+		goto cleanup;
+	for (c = 0; c < num_unique; c++)
+	{
+		AtlasFrame* frame = &frames[order[c].index];
+		for (line = 0; line < frame->h; line++)
+			memcpy(get_bitmap_ptr(atlas, frame->ax, frame->ay + line), get_bitmap_ptr(bitmap, frame->x, frame->y + line), frame->w);
+	}
+	atlas->palette = bitmap->palette;
+	bitmap->palette = NULL;
+
+	/* create spriteset with packed entries, keeping original frame geometry */
+	for (c = 0; c < entries; c++)
+	{
+		AtlasFrame* frame = &frames[c];
+		AtlasFrame* source = frame->source != -1 ? &frames[frame->source] : frame;
+		memcpy(packed[c].name, data[c].name, sizeof(packed[c].name));
+		packed[c].x = source->ax;
+		packed[c].y = source->ay;
+		packed[c].w = source->w;
+		packed[c].h = source->h;
+	}
+	spriteset = TLN_CreateSpriteset(atlas, packed, entries);
+	if (!spriteset)
+	{
+		bitmap->palette = atlas->palette;
+		atlas->palette = NULL;
+		TLN_DeleteBitmap(atlas);
+		goto cleanup;
+	}
+	for (c = 0; c < entries; c++)
+	{
+		SpriteEntry* entry = &spriteset->data[c];
+		AtlasFrame* frame = &frames[c];
+		entry->frame_w = frame->frame_w;
+		entry->frame_h = frame->frame_h;
+		entry->xoffset = frame->xoffset;
+		entry->yoffset = frame->yoffset;
+		entry->flags = frame->flags;
+	}
+
+	/* flag pixels shared between frames, so they aren't overwritten by TLN_SetSpritesetData() */
+	for (c = 0; c < entries; c++)
+	{
+		if (frames[c].source != -1)
+			spriteset->data[c].shared = spriteset->data[frames[c].source].shared = true;
+	}
+	TLN_DeleteBitmap(bitmap);
+
+cleanup:
+	free(frames);
+	free(order);
+	free(packed);
+	free(row);
+	return spriteset;
+}
+
+/* loads spriteset without asset cache */
+static TLN_Spriteset LoadSpriteset (const char* name)
 {
 	FileInfo fileinfo = { 0 };
 	char filename[200] = { 0 };
@@ -135,7 +425,7 @@ TLN_Spriteset TLN_LoadSpriteset (const char* name)
 		sprintf(filename, "%s", name);
 	else
 		BuildFilePath(filename, sizeof(filename), fileinfo.path, fileinfo.name, "png");
-	bitmap = TLN_LoadBitmap (filename);
+	bitmap = LoadIndexedBitmap (filename);
 	if (!bitmap)
 		return NULL;
 
@@ -161,8 +451,12 @@ TLN_Spriteset TLN_LoadSpriteset (const char* name)
 		return NULL;
 	}
 
-	/* create */
-	spriteset = TLN_CreateSpriteset (bitmap, sprite_data, entries);
+	/* create: 8-bit images are repacked, other formats keep source layout */
+	spriteset = NULL;
+	if (bitmap->bpp == 8)
+		spriteset = pack_spriteset (bitmap, sprite_data, entries);
+	if (spriteset == NULL)
+		spriteset = TLN_CreateSpriteset (bitmap, sprite_data, entries);
 	
 	if (spriteset)
 		TLN_SetLastError (TLN_ERR_OK);
@@ -172,3 +466,26 @@ TLN_Spriteset TLN_LoadSpriteset (const char* name)
 	free(sprite_data);
 	return spriteset;
 }
+
+/*!
+ * \brief Loads a spriteset from an image png and its associated atlas descriptor
+ * \param name Base name of the files containing the spriteset, with or without .png extension
+ * \returns Reference to the newly loaded spriteset or NULL if error
+ * 
+ * \remarks
+ * The spriteset comes in a pair of files: an image file (bmp or png) and a standarized atlas descriptor (json, csv or txt)
+ * The supported json format is the array.
+ * At load time each frame is trimmed to its non-transparent area, identical or mirrored frames share
+ * the same pixels and the result is repacked into a tight atlas. Size and pivot of sprites are kept.
+ * Loading the same spriteset again returns the same instance until it's evicted with TLN_EvictCache()
+ */
+TLN_Spriteset TLN_LoadSpriteset (const char* name)
+{
+	TLN_Spriteset spriteset = (TLN_Spriteset)FindCached (CACHE_SPRITESET, name);
+	if (spriteset != NULL)
+	{
+		TLN_SetLastError (TLN_ERR_OK);
+		return spriteset;
+	}
+	return (TLN_Spriteset)AddCached (CACHE_SPRITESET, name, LoadSpriteset (name));
+}
@@ -4,13 +4,36 @@
 #include "LoadTMX.h"
 #include "LoadFile.h"
 #include "simplexml.h"
+#include "zlib.h"
+#include "Base64.h"
 #include "Layer.h"
+#include "Tileset.h"
 
 static TMXInfo tmxinfo;
+static bool content;	/* layer content is being loaded */
+
+static void release_layer_content(TMXLayer* layer)
+{
+	int c;
+
+	free(layer->data);
+	if (layer->objects != NULL)
+		TLN_DeleteObjectList(layer->objects);
+	for (c = 0; c < layer->num_chunks; c += 1)
+		free(layer->chunks[c].text);
+	free(layer->chunks);
+	layer->data = NULL;
+	layer->objects = NULL;
+	layer->chunks = NULL;
+	layer->num_chunks = 0;
+}
 
 static void init_current_layer(TLN_LayerType type)
 {
 	TMXLayer* layer = &tmxinfo.layers[tmxinfo.num_layers];
+
+	/* layers past TMX_MAX_LAYER reuse the last slot */
+	release_layer_content(layer);
 	memset(layer, 0, sizeof(TMXLayer));
 	layer->type = type;
 	layer->visible = true;
@@ -109,6 +132,12 @@ static void* handler(SimpleXmlParser parser, SimpleXmlEvent evt,
 		break;
 
 	case FINISH_ATTRIBUTES:
+		/* skip tile data without copying it, unless content is being loaded */
+		if (!content && (!strcasecmp(szName, "data") || !strcasecmp(szName, "chunk")))
+		{
+			long length;
+			simpleXmlTakeRawContent(parser, &length);
+		}
 		break;
 
 	case ADD_CONTENT:
@@ -130,6 +159,20 @@ static void* handler(SimpleXmlParser parser, SimpleXmlEvent evt,
 	return handler;
 }
 
+/* XML parser callback for TMXLoadContent(), layer content goes to the loader of each type */
+static void* content_handler(SimpleXmlParser parser, SimpleXmlEvent evt,
+	const char* szName, const char* szAttribute, const char* szValue)
+{
+	/* layer info handler goes last on FINISH_TAG, as it moves to next layer */
+	if (evt != FINISH_TAG)
+		handler(parser, evt, szName, szAttribute, szValue);
+	TMXTileContentHandler(parser, evt, szName, szAttribute, szValue);
+	TMXObjectContentHandler(parser, evt, szName, szAttribute, szValue);
+	if (evt == FINISH_TAG)
+		handler(parser, evt, szName, szAttribute, szValue);
+	return content_handler;
+}
+
 static int compare(void const* d1, void const* d2)
 {
 	TMXTileset* t1 = (TMXTileset*)d1;
@@ -137,24 +180,17 @@ static int compare(void const* d1, void const* d2)
 	return t1->firstgid > t2->firstgid;
 }
 
-/* loads common info about a .tmx file */
-bool TMXLoad(const char* filename, TMXInfo* info)
+/* parses a .tmx file with given handler into tmxinfo */
+static bool parse(const char* filename, SimpleXmlTagHandler callback)
 {
 	SimpleXmlParser parser;
 	ssize_t size;
+	MapMode mode;
 	uint8_t *data;
-	TLN_Tilemap tilemap = NULL;
 	bool retval = false;
 
-	/* already cached: return as is */
-	if (!strcasecmp(filename, tmxinfo.filename))
-	{
-		memcpy(info, &tmxinfo, sizeof(TMXInfo));
-		return true;
-	}
-
 	/* load file */
-	data = (uint8_t*)LoadFile(filename, &size);
+	data = (uint8_t*)MapFile(filename, &size, &mode);
 	if (!data)
 	{
 		if (size == 0)
@@ -169,7 +205,7 @@ bool TMXLoad(const char* filename, TMXInfo* info)
 	parser = simpleXmlCreateParser((char*)data, (long)size);
 	if (parser != NULL)
 	{
-		if (simpleXmlParse(parser, handler) != 0)
+		if (simpleXmlParse(parser, callback) != 0)
 		{
 			printf("parse error on line %li:\n%s\n",
 				simpleXmlGetLineNumber(parser), simpleXmlGetErrorDescription(parser));
@@ -188,12 +224,90 @@ bool TMXLoad(const char* filename, TMXInfo* info)
 	qsort(&tmxinfo.tilesets, tmxinfo.num_tilesets, sizeof(TMXTileset), compare);
 
 	simpleXmlDestroyParser(parser);
-	free(data);
+	UnmapFile(data, size, mode);
+	return retval;
+}
+
+/* loads common info about a .tmx file */
+bool TMXLoad(const char* filename, TMXInfo* info)
+{
+	/* already cached: return as is */
+	if (!strcasecmp(filename, tmxinfo.filename))
+	{
+		memcpy(info, &tmxinfo, sizeof(TMXInfo));
+		return true;
+	}
+
+	if (!parse(filename, handler))
+		return false;
+	memcpy(info, &tmxinfo, sizeof(TMXInfo));
+	return true;
+}
+
+/* loads common info and the content of all layers of a .tmx file in a single pass.
+ * Caller owns the content of the layers, to be released with TMXReleaseContent() */
+bool TMXLoadContent(const char* filename, TMXInfo* info)
+{
+	bool retval;
+	int c;
+
+	content = true;
+	retval = parse(filename, content_handler);
+	content = false;
+
 	if (retval)
 		memcpy(info, &tmxinfo, sizeof(TMXInfo));
+	else
+		TMXReleaseContent(&tmxinfo);
+
+	/* cached info doesn't own content */
+	for (c = 0; c < TMX_MAX_LAYER; c += 1)
+	{
+		tmxinfo.layers[c].data = NULL;
+		tmxinfo.layers[c].objects = NULL;
+		tmxinfo.layers[c].chunks = NULL;
+		tmxinfo.layers[c].num_chunks = 0;
+	}
+	if (!retval)
+		tmxinfo.filename[0] = 0;
 	return retval;
 }
 
+/* releases layer content not taken from info loaded with TMXLoadContent() */
+void TMXReleaseContent(TMXInfo* info)
+{
+	int c;
+	for (c = 0; c < TMX_MAX_LAYER; c += 1)
+		release_layer_content(&info->layers[c]);
+}
+
+/* appends an empty chunk to a tile layer, NULL if out of memory */
+TMXChunk* TMXAddChunk(TMXLayer* layer)
+{
+	const int count = layer->num_chunks;
+	TMXChunk* chunks = layer->chunks;
+
+	/* capacity doubles each time count reaches a power of two */
+	if (count == 0 || (count >= 16 && (count & (count - 1)) == 0))
+	{
+		chunks = (TMXChunk*)realloc(chunks, (count != 0 ? count * 2 : 16) * sizeof(TMXChunk));
+		if (chunks == NULL)
+			return NULL;
+		layer->chunks = chunks;
+	}
+
+	chunks += count;
+	layer->num_chunks += 1;
+	memset(chunks, 0, sizeof(TMXChunk));
+	return chunks;
+}
+
+/* layer being parsed by TMXLoadContent(), NULL if not loading content */
+TMXLayer* TMXGetContentLayer(void)
+{
+	return content ? &tmxinfo.layers[tmxinfo.num_layers] : NULL;
+}
+
 /* returns index of suitable tileset acoording to gid range, -1 if not valid tileset found */
 int TMXGetSuitableTileset(TMXInfo* info, int gid, TLN_Tileset* tilesets)
 {
@@ -201,7 +315,7 @@ int TMXGetSuitableTileset(TMXInfo* info, int gid, TLN_Tileset* tilesets)
 	for (c = 0; c < info->num_tilesets; c += 1)
 	{
 		const int first = info->tilesets[c].firstgid;
-		if (gid >= first && gid < first + tilesets[c]->numtiles)
+		if (tilesets[c] != NULL && gid >= first && gid < first + tilesets[c]->numtiles)
 			return c;
 	}
 	return -1;
@@ -229,4 +343,110 @@ TMXLayer* TMXGetLayer(TMXInfo* info, const char* name)
 			return &info->layers[c];
 	}
 	return NULL;
-}
\ No newline at end of file
+}
+/* loads all tilesets referenced by a .tmx file, relative to its path. Their images are decoded together */
+void TMXLoadTilesets(TMXInfo* info, const char* filename, TLN_Tileset* tilesets)
+{
+	FileInfo fi = { 0 };
+	char tsxpath[TMX_MAX_TILESET][200];
+	const char* tsxfiles[TMX_MAX_TILESET];
+	int c;
+
+	/* composite tsx filenames with relative path of parent tmx */
+	SplitFilename(filename, &fi);
+	for (c = 0; c < info->num_tilesets; c += 1)
+	{
+		TMXTileset* tmxtileset = &info->tilesets[c];
+		if (fi.path[0] != 0)
+			snprintf(tsxpath[c], sizeof(tsxpath[c]), "%s/%s", fi.path, tmxtileset->source);
+		else
+			strncpy(tsxpath[c], tmxtileset->source, sizeof(tsxpath[c]));
+		tsxfiles[c] = tsxpath[c];
+	}
+	if (info->num_tilesets > 0)
+		LoadTilesets(info->num_tilesets, tsxfiles, tilesets);
+}
+
+/* reads comma separated gids, any character other than a digit is a separator */
+static void csvdecode(const char* text, const char* end, uint32_t* data, int numtiles)
+{
+	int c = 0;
+	while (c < numtiles)
+	{
+		uint32_t value = 0;
+
+		while (text < end && (unsigned)(*text - '0') > 9)
+			text += 1;
+		if (text == end)
+			break;
+
+		while (text < end && (unsigned)(*text - '0') <= 9)
+		{
+			value = value * 10 + (*text - '0');
+			text += 1;
+		}
+		data[c++] = value;
+	}
+}
+
+/* inflates zlib or gzip data as it's decoded from base64, stops when output is full */
+static void decompress(Base64Stream* stream, uint8_t* out, int out_size)
+{
+	uint8_t chunk[3072];	/* whole base64 groups */
+	z_stream strm = { 0 };
+	int ret = Z_OK;
+
+	/* window size + 32 detects zlib or gzip header */
+	if (inflateInit2(&strm, MAX_WBITS + 32) != Z_OK)
+		return;
+
+	strm.next_out = out;
+	strm.avail_out = out_size;
+	while (ret == Z_OK)
+	{
+		if (strm.avail_in == 0)
+		{
+			strm.avail_in = base64read(stream, chunk, sizeof(chunk));
+			strm.next_in = chunk;
+			if (strm.avail_in == 0)
+				break;
+		}
+		ret = inflate(&strm, Z_NO_FLUSH);
+	}
+	inflateEnd(&strm);
+}
+
+/* decodes content of a <data> element into a new array of numtiles gids, NULL if error.
+ * Content doesn't need to be zero terminated */
+uint32_t* TMXDecodeData(const char* text, int length, encoding_t encoding, compression_t compression, int numtiles)
+{
+	const int size = numtiles * sizeof(uint32_t);
+	uint32_t* data = (uint32_t*)calloc(numtiles, sizeof(uint32_t));
+	if (data == NULL)
+		return NULL;
+
+	if (encoding == ENCODING_CSV)
+		csvdecode(text, text + length, data, numtiles);
+
+	else if (encoding == ENCODING_BASE64)
+	{
+		Base64Stream stream;
+		base64init(&stream, text, length);
+		if (compression == COMPRESSION_NONE)
+		{
+			/* gids straight to output, last bytes may not fill a whole base64 group */
+			int decoded = base64read(&stream, (uint8_t*)data, size);
+			if (decoded < size)
+			{
+				uint8_t tail[3];
+				int remaining = base64read(&stream, tail, sizeof(tail));
+				if (remaining > size - decoded)
+					remaining = size - decoded;
+				memcpy((uint8_t*)data + decoded, tail, remaining);
+			}
+		}
+		else
+			decompress(&stream, (uint8_t*)data, size);
+	}
+	return data;
+}
@@ -4,10 +4,22 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "Tileset.h"
+#include "simplexml.h"
+#include "TileEncoding.h"
 
 #define TMX_MAX_LAYER		32
 #define TMX_MAX_TILESET		32
 
+/* encoded tiles of a <chunk> element in infinite maps */
+typedef struct
+{
+	int x, y;			/* position in tiles, can be negative */
+	int width, height;	/* size in tiles */
+	int length;			/* size of text */
+	char* text;			/* copy of encoded content, not zero terminated */
+}
+TMXChunk;
+
 typedef struct
 {
 	TLN_LayerType type;
@@ -25,6 +37,12 @@ typedef struct
 	float offsety;
 	float opacity;
 	uint32_t tintcolor;
+	uint32_t* data;			/* raw gids of tile layers, only with TMXLoadContent() */
+	TMXChunk* chunks;		/* encoded chunks of infinite tile layers instead of data */
+	int num_chunks;
+	encoding_t encoding;	/* encoding of chunks */
+	compression_t compression;	/* compression of chunks */
+	TLN_ObjectList objects;	/* objects of object layers, only with TMXLoadContent() */
 }
 TMXLayer;
 
@@ -52,8 +70,20 @@ typedef struct
 TMXInfo;
 
 bool TMXLoad(const char* filename, TMXInfo* info);
+bool TMXLoadContent(const char* filename, TMXInfo* info);
+TMXChunk* TMXAddChunk(TMXLayer* layer);
+void TMXReleaseContent(TMXInfo* info);
+TMXLayer* TMXGetContentLayer(void);
 int TMXGetSuitableTileset(TMXInfo* info, int gid, TLN_Tileset* tilesets);
 TMXLayer* TMXGetFirstLayer(TMXInfo* info, TLN_LayerType type);
 TMXLayer* TMXGetLayer(TMXInfo* info, const char* name);
+void TMXLoadTilesets(TMXInfo* info, const char* filename, TLN_Tileset* tilesets);
+uint32_t* TMXDecodeData(const char* text, int length, encoding_t encoding, compression_t compression, int numtiles);
+
+/* single pass loading of layer content, in LoadTilemap.c and ObjectList.c */
+void* TMXTileContentHandler(SimpleXmlParser parser, SimpleXmlEvent evt, const char* szName, const char* szAttribute, const char* szValue);
+void* TMXObjectContentHandler(SimpleXmlParser parser, SimpleXmlEvent evt, const char* szName, const char* szAttribute, const char* szValue);
+TLN_Tilemap TMXCreateTilemap(TMXInfo* info, TMXLayer* layer, uint32_t* data, TLN_Tileset* tilesets);
+int TMXSetupObjectList(TMXInfo* info, TLN_ObjectList list, TLN_Tileset* tilesets);
 
 #endif
@@ -11,36 +11,12 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <assert.h>
 #include "Tilengine.h"
 #include "simplexml.h"
-#include "zlib.h"
 #include "LoadFile.h"
-#include "Base64.h"
 #include "LoadTMX.h"
 #include "Tilemap.h"
 
-static int csvdecode (const char* in, int numtiles, uint32_t* data);
-static int decompress (uint8_t* in, int in_size, uint8_t* out, int out_size);
-
-/* encoding */
-typedef enum
-{
-	ENCODING_XML,
-	ENCODING_BASE64,
-	ENCODING_CSV,
-}
-encoding_t;
-
-/* compression */
-typedef enum
-{
-	COMPRESSION_NONE,
-	COMPRESSION_ZLIB,
-	COMPRESSION_GZIP,
-}
-compression_t;
-
 /* load manager */
 struct
 {
@@ -50,9 +26,69 @@ struct
 	compression_t compression;	/* compression */
 	uint32_t* data;				/* map data (rows*cols) */
 	uint32_t numtiles;
+	const char* text;			/* raw content of <data>, decoded when the tag ends */
+	long length;
+	TMXChunk* chunk;			/* chunk being parsed in infinite maps */
 }
 static loader;
 
+/* parses encoding and compression of <data>, false if not supported */
+static bool data_attribute(const char* szAttribute, const char* szValue)
+{
+	if (!strcasecmp(szAttribute, "encoding"))
+	{
+		if (!strcasecmp(szValue, "csv"))
+			loader.encoding = ENCODING_CSV;
+		else if (!strcasecmp(szValue, "base64"))
+			loader.encoding = ENCODING_BASE64;
+		else
+			return false;
+	}
+
+	else if (!strcasecmp(szAttribute, "compression"))
+	{
+		if (!strcasecmp(szValue, "gzip"))
+			loader.compression = COMPRESSION_GZIP;
+		else if (!strcasecmp(szValue, "zlib"))
+			loader.compression = COMPRESSION_ZLIB;
+		else
+			return false;
+	}
+	return true;
+}
+
+/* parses position and size of <chunk> */
+static void chunk_attribute(TMXChunk* chunk, const char* szAttribute, const char* szValue)
+{
+	const int intvalue = atoi(szValue);
+	if (!strcasecmp(szAttribute, "x"))
+		chunk->x = intvalue;
+	else if (!strcasecmp(szAttribute, "y"))
+		chunk->y = intvalue;
+	else if (!strcasecmp(szAttribute, "width"))
+		chunk->width = intvalue;
+	else if (!strcasecmp(szAttribute, "height"))
+		chunk->height = intvalue;
+}
+
+/* keeps a copy of the encoded chunk content, it's decoded when first drawn */
+static void chunk_content(SimpleXmlParser parser, TMXLayer* layer, TMXChunk* chunk)
+{
+	long length;
+	const char* text = simpleXmlTakeRawContent(parser, &length);
+	if (text == NULL)
+		return;
+
+	chunk->text = (char*)malloc(length);
+	if (chunk->text != NULL)
+	{
+		memcpy(chunk->text, text, length);
+		chunk->length = (int)length;
+	}
+	layer->encoding = loader.encoding;
+	layer->compression = loader.compression;
+}
+
 /* XML parser callback */
 static void* handler (SimpleXmlParser parser, SimpleXmlEvent evt, 
 	const char* szName, const char* szAttribute, const char* szValue)
@@ -61,6 +97,8 @@ static void* handler (SimpleXmlParser parser, SimpleXmlEvent evt,
 	switch (evt)
 	{
 	case ADD_SUBTAG:
+		if (!strcasecmp(szName, "chunk") && loader.state == true)
+			loader.chunk = TMXAddChunk(loader.layer);
 		break;
 
 	case ADD_ATTRIBUTE:
@@ -75,79 +113,226 @@ static void* handler (SimpleXmlParser parser, SimpleXmlEvent evt,
 		}
 
 		else if (!strcasecmp(szName, "data") && loader.state == true)
-		{
-			if (!strcasecmp(szAttribute, "encoding"))
-			{
-				if (!strcasecmp(szValue, "csv"))
-					loader.encoding = ENCODING_CSV;
-				else if (!strcasecmp(szValue, "base64"))
-					loader.encoding = ENCODING_BASE64;
-				else
-					loader.state = false;
-			}
+			loader.state = data_attribute(szAttribute, szValue);
 
-			else if (!strcasecmp(szAttribute, "compression"))
-			{
-				if (!strcasecmp(szValue, "gzip"))
-					/* loader.compression = COMPRESSION_GZIP; */
-					loader.state = false;
-				else if (!strcasecmp(szValue, "zlib"))
-					loader.compression = COMPRESSION_ZLIB;
-			}
-		}
+		else if (!strcasecmp(szName, "chunk") && loader.chunk != NULL)
+			chunk_attribute(loader.chunk, szAttribute, szValue);
 		break;
 
 	case FINISH_ATTRIBUTES:
+		/* tile data is decoded in place, other layers are skipped */
+		if (!strcasecmp(szName, "data"))
+			loader.text = simpleXmlTakeRawContent(parser, &loader.length);
+		else if (!strcasecmp(szName, "chunk") && loader.chunk != NULL)
+			chunk_content(parser, loader.layer, loader.chunk);
 		break;
 
 	case ADD_CONTENT:
-		if (!strcasecmp(szName, "data") && loader.state == true)
+		break;
+
+	case FINISH_TAG:
+		/* infinite maps have chunks instead of tile data */
+		if (!strcasecmp(szName, "data"))
 		{
-			int size = loader.numtiles * sizeof(uint32_t);
-			uint32_t* data = (uint32_t*)malloc (size);
-			if (data == NULL)
-				return handler;
-			
-			memset (data, 0, size);
-			if (loader.encoding == ENCODING_CSV)
-				csvdecode (szValue, loader.numtiles, data);
-
-			else if (loader.encoding == ENCODING_BASE64)
-			{
-				if (loader.compression == COMPRESSION_NONE)
-					base64decode ((uint8_t*)szValue, (int)strlen(szValue), (uint8_t*)data, &size);
-				else
-				{
-					uint8_t* deflated = (uint8_t*)malloc (size);
-					int in_size = size;
-					base64decode ((uint8_t*)szValue, (int)strlen(szValue), (uint8_t*)deflated, &in_size);
-					decompress (deflated, in_size, (uint8_t*)data, size);
-					free (deflated);
-				}
-			}
-			loader.data = data;
+			if (loader.text != NULL && loader.state == true && loader.data == NULL && loader.layer->chunks == NULL)
+				loader.data = TMXDecodeData(loader.text, (int)loader.length, loader.encoding, loader.compression, loader.numtiles);
+			loader.text = NULL;
+		}
+		else if (!strcasecmp(szName, "chunk"))
+			loader.chunk = NULL;
+		break;
+	}
+	return handler;
+}
+
+/* XML parser callback for TMXLoadContent(): decodes <data> of every tile layer */
+void* TMXTileContentHandler(SimpleXmlParser parser, SimpleXmlEvent evt,
+	const char* szName, const char* szAttribute, const char* szValue)
+{
+	TMXLayer* layer = TMXGetContentLayer();
+	if (layer == NULL || layer->type != LAYER_TILE)
+		return NULL;
+
+	switch (evt)
+	{
+	case ADD_SUBTAG:
+		if (!strcasecmp(szName, "data"))
+		{
+			loader.state = true;
+			loader.encoding = ENCODING_XML;
+			loader.compression = COMPRESSION_NONE;
 		}
+		else if (!strcasecmp(szName, "chunk") && loader.state == true)
+			loader.chunk = TMXAddChunk(layer);
+		break;
+
+	case ADD_ATTRIBUTE:
+		if (!strcasecmp(szName, "data") && loader.state == true)
+			loader.state = data_attribute(szAttribute, szValue);
+		else if (!strcasecmp(szName, "chunk") && loader.chunk != NULL)
+			chunk_attribute(loader.chunk, szAttribute, szValue);
+		break;
+
+	case FINISH_ATTRIBUTES:
+		if (!strcasecmp(szName, "data"))
+			loader.text = simpleXmlTakeRawContent(parser, &loader.length);
+		else if (!strcasecmp(szName, "chunk") && loader.chunk != NULL)
+			chunk_content(parser, layer, loader.chunk);
 		break;
 
 	case FINISH_TAG:
+		/* infinite maps have chunks instead of tile data */
+		if (!strcasecmp(szName, "data"))
+		{
+			if (loader.text != NULL && loader.state == true && layer->data == NULL && layer->chunks == NULL)
+				layer->data = TMXDecodeData(loader.text, (int)loader.length, loader.encoding, loader.compression, layer->width*layer->height);
+			loader.text = NULL;
+			loader.state = false;
+		}
+		else if (!strcasecmp(szName, "chunk"))
+			loader.chunk = NULL;
+		break;
+
+	default:
 		break;
 	}
-	return handler;
+	return NULL;
 }
 
-static TLN_Tileset load_tileset(TMXInfo* info, const char* filename, int index)
+/* maps raw gids to tileset and index inside it, with tilesets starting at given gids */
+static void remap_tiles(Tile* tile, int count, int num_tilesets, const int* firstgid, TLN_Tileset* tilesets)
 {
-	FileInfo fi = { 0 };
-	char tsxpath[200];
-
-	/* composite tsx filename with relative path of parent tmx */
-	TMXTileset* tmxtileset = &info->tilesets[index];
-	SplitFilename(filename, &fi);
-	if (fi.path[0] != 0)
-		snprintf(tsxpath, sizeof(tsxpath), "%s/%s", fi.path, tmxtileset->source);
+	int c, t;
+	for (c = 0; c < count; c += 1, tile += 1)
+	{
+		if (tile->index > 0)
+		{
+			for (t = 0; t < num_tilesets; t += 1)
+			{
+				if (tilesets[t] != NULL && tile->index >= firstgid[t] && tile->index < firstgid[t] + tilesets[t]->numtiles)
+					break;
+			}
+			if (t < num_tilesets)
+			{
+				tile->tileset = t;
+				tile->index = tile->index - firstgid[t] + 1;
+			}
+			else
+				tile->index = 0;
+		}
+	}
+}
+
+/* decodes source of a chunk loaded by TMXCreateTilemap() */
+Tile* TMXDecodeChunk(TLN_Tilemap tilemap, TileChunk* chunk)
+{
+	TileChunks* chunks = tilemap->chunks;
+	const int numtiles = chunks->width * chunks->height;
+	Tile* tiles = (Tile*)TMXDecodeData(chunk->source, chunk->length, chunks->encoding, chunks->compression, numtiles);
+	int c;
+
+	if (tiles == NULL)
+		return NULL;
+
+	remap_tiles(tiles, numtiles, tilemap->num_tilesets, chunks->firstgid, tilemap->tilesets);
+	for (c = 0; c < tilemap->num_tilesets && tilemap->tilesets[c] != NULL; c += 1)
+	{
+		if (tilemap->tilesets[c]->attributes != NULL)
+			SetTilesPriority(tilemap->tilesets[c], tiles, numtiles);
+	}
+	return tiles;
+}
+
+/* creates chunked tilemap from the chunks of an infinite map, placed at the top-left one. Chunks
+ * are moved to the tilemap and layer offset is moved to the first tile */
+static TLN_Tilemap create_chunked(TMXInfo* info, TMXLayer* layer, int num_tilesets)
+{
+	TLN_Tilemap tilemap;
+	TMXChunk* chunk = layer->chunks;
+	const int width = chunk->width;
+	const int height = chunk->height;
+	int x1 = chunk->x, y1 = chunk->y;
+	int x2 = x1 + width, y2 = y1 + height;
+	int c;
+
+	/* all chunks are the same size and aligned */
+	if (width <= 0 || height <= 0)
+	{
+		TLN_SetLastError(TLN_ERR_WRONG_FORMAT);
+		return NULL;
+	}
+	for (c = 0; c < layer->num_chunks; c += 1, chunk += 1)
+	{
+		if (chunk->width != width || chunk->height != height || chunk->x % width != 0 || chunk->y % height != 0)
+		{
+			TLN_SetLastError(TLN_ERR_WRONG_FORMAT);
+			return NULL;
+		}
+		if (chunk->x < x1)
+			x1 = chunk->x;
+		if (chunk->y < y1)
+			y1 = chunk->y;
+		if (chunk->x + width > x2)
+			x2 = chunk->x + width;
+		if (chunk->y + height > y2)
+			y2 = chunk->y + height;
+	}
+
+	tilemap = CreateChunkedTilemap(y2 - y1, x2 - x1, width, height, info->bgcolor);
+	if (tilemap == NULL)
+		return NULL;
+
+	for (c = 0, chunk = layer->chunks; c < layer->num_chunks; c += 1, chunk += 1)
+	{
+		if (chunk->text == NULL)
+			continue;
+		if (!AddTilemapChunk(tilemap, chunk->y - y1, chunk->x - x1, chunk->text, chunk->length))
+		{
+			TLN_DeleteTilemap(tilemap);
+			TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+			return NULL;
+		}
+		chunk->text = NULL;
+	}
+
+	tilemap->chunks->encoding = layer->encoding;
+	tilemap->chunks->compression = layer->compression;
+	for (c = 0; c < num_tilesets; c += 1)
+		tilemap->chunks->firstgid[c] = info->tilesets[c].firstgid;
+
+	layer->offsetx += x1 * info->tilewidth;
+	layer->offsety += y1 * info->tileheight;
+	return tilemap;
+}
+
+/* creates tilemap from raw gids of a tmx layer, mapped to its tilesets. Data is modified.
+ * Layers of infinite maps have chunks instead of data, they're decoded when drawn */
+TLN_Tilemap TMXCreateTilemap(TMXInfo* info, TMXLayer* layer, uint32_t* data, TLN_Tileset* tilesets)
+{
+	TLN_Tilemap tilemap;
+	const int num_tilesets = info->num_tilesets < MAX_TILESETS ? info->num_tilesets : MAX_TILESETS;
+	int c;
+
+	if (layer->chunks != NULL)
+		tilemap = create_chunked(info, layer, num_tilesets);
 	else
-		strncpy(tsxpath, tmxtileset->source, sizeof(tsxpath));
-	return TLN_LoadTileset(tsxpath);
+	{
+		/* correct with firstgid */
+		int firstgid[MAX_TILESETS];
+		for (c = 0; c < num_tilesets; c += 1)
+			firstgid[c] = info->tilesets[c].firstgid;
+		remap_tiles((Tile*)data, layer->width*layer->height, num_tilesets, firstgid, tilesets);
+		tilemap = TLN_CreateTilemap(layer->height, layer->width, (Tile*)data, info->bgcolor, NULL);
+	}
+
+	/* create */
+	if (tilemap == NULL)
+		return NULL;
+	tilemap->id = layer->id;
+	tilemap->visible = layer->visible;
+	tilemap->num_tilesets = num_tilesets;
+	memcpy(tilemap->tilesets, tilesets, sizeof(TLN_Tileset)*tilemap->num_tilesets);
+	return tilemap;
 }
 
 /*!
@@ -166,16 +351,19 @@ static TLN_Tileset load_tileset(TMXInfo* info, const char* filename, int index)
  * \remarks
  * A tmx map file from Tiled can contain one or more layers, each with its own name. TLN_LoadTilemap()
  * doesn't load a full tmx file, only the specified layer. The associated *external* tileset (TSX file) is
- * also loaded and associated to the tilemap
+ * also loaded and associated to the tilemap.
+ * Layers of infinite maps start at their top-left chunk. Chunks are kept encoded and decoded when
+ * first drawn or accessed, see TLN_SetTilemapMaxChunks()
  */
 TLN_Tilemap TLN_LoadTilemap (const char *filename, const char *layername)
 {
 	SimpleXmlParser parser;
 	ssize_t size;
+	MapMode mode;
 	uint8_t *data;
 	TLN_Tilemap tilemap = NULL;
 	TMXInfo tmxinfo = { 0 };
-	uint32_t c;
+	int c;
 	
 	/* load map info */
 	if (!TMXLoad(filename, &tmxinfo))
@@ -198,7 +386,7 @@ TLN_Tilemap TLN_LoadTilemap (const char *filename, const char *layername)
 
 	/* parse */
 	loader.numtiles = loader.layer->width*loader.layer->height;
-	data = (uint8_t*)LoadFile(filename, &size);
+	data = (uint8_t*)MapFile(filename, &size, &mode);
 	parser = simpleXmlCreateParser((char*)data, (long)size);
 	if (parser != NULL)
 	{
@@ -214,107 +402,31 @@ TLN_Tilemap TLN_LoadTilemap (const char *filename, const char *layername)
 		TLN_SetLastError (TLN_ERR_OUT_OF_MEMORY);
 
 	simpleXmlDestroyParser(parser);
-	free (data);
-
-	/* load referenced tilesets */
-	TLN_Tileset tilesets[TMX_MAX_TILESET] = { 0 };
-	for (c = 0; c < tmxinfo.num_tilesets; c += 1)
-		tilesets[c] = load_tileset(&tmxinfo, filename, c);
+	UnmapFile(data, size, mode);
 
-	if (loader.data != NULL)
+	if (loader.data != NULL || loader.layer->chunks != NULL)
 	{
-		/* correct with firstgid */
-		Tile* tile = (Tile*)loader.data;
-		for (c = 0; c < loader.numtiles; c += 1, tile += 1)
+		/* load referenced tilesets */
+		TLN_Tileset tilesets[TMX_MAX_TILESET] = { 0 };
+		int kept = 0;
+
+		TMXLoadTilesets(&tmxinfo, filename, tilesets);
+		tilemap = TMXCreateTilemap(&tmxinfo, loader.layer, loader.data, tilesets);
+		free(loader.data);
+
+		/* release the ones the tilemap doesn't keep */
+		if (tilemap != NULL)
+			kept = tilemap->num_tilesets;
+		for (c = kept; c < tmxinfo.num_tilesets; c += 1)
 		{
-			if (tile->index > 0)
-			{
-				int suitable = TMXGetSuitableTileset(&tmxinfo, tile->index, tilesets);
-				if (suitable != -1 && suitable < MAX_TILESETS)
-				{
-					tile->tileset = suitable;
-					tile->index = tile->index - tmxinfo.tilesets[suitable].firstgid + 1;
-				}
-				else
-					tile->index = 0;
-			}
+			if (tilesets[c] != NULL)
+				TLN_DeleteTileset(tilesets[c]);
 		}
-
-		/* create */
-		tilemap = TLN_CreateTilemap(loader.layer->height, loader.layer->width, (Tile*)loader.data, tmxinfo.bgcolor, NULL);
-		tilemap->id = loader.layer->id;
-		tilemap->visible = loader.layer->visible;
-		tilemap->num_tilesets = tmxinfo.num_tilesets < MAX_TILESETS ? tmxinfo.num_tilesets : MAX_TILESETS;
-		memcpy(tilemap->tilesets, tilesets, sizeof(TLN_Tileset)*tilemap->num_tilesets);
 	}
 
+	/* chunks not taken by the tilemap */
+	for (c = 0; c < loader.layer->num_chunks; c += 1)
+		free(loader.layer->chunks[c].text);
+	free(loader.layer->chunks);
 	return tilemap;
 }
-
-/* read CSV string */
-static int csvdecode (const char* in, int numtiles, uint32_t *data)
-{
-	int c;
-	char *token = strtok ((char*)in, ",\n");
-
-	c = 0;
-	do
-	{
-		if (token[0] != 0x0D)
-			sscanf (token, "%u", &data[c++]);
-		token = strtok (NULL, ",\n");
-	}
-	while (c < numtiles);
-
-	return 1;
-}
-
-/* decompress a zipped string */
-static int decompress (uint8_t* in, int in_size, uint8_t* out, int out_size)
-{
-	int ret;
-	z_stream strm;
-
-	/* allocate inflate state */
-	strm.zalloc = Z_NULL;
-	strm.zfree = Z_NULL;
-	strm.opaque = Z_NULL;
-	strm.avail_in = 0;
-	strm.next_in = Z_NULL;
-	ret = inflateInit(&strm);
-	if (ret != Z_OK)
-		return ret;
-
-	/* decompress until deflate stream ends or end of file */
-	do
-	{
-		strm.avail_in = in_size;
-		strm.next_in = in;
-
-		/* run inflate() on input until output buffer not full */
-		do
-		{
-			strm.avail_out = out_size;
-			strm.next_out = out;
-			ret = inflate(&strm, Z_NO_FLUSH);
-			assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
-			switch (ret)
-			{
-			case Z_NEED_DICT:
-				ret = Z_DATA_ERROR;     /* and fall through */
-			case Z_DATA_ERROR:
-			case Z_MEM_ERROR:
-				(void)inflateEnd(&strm);
-				return ret;
-			}
-		}
-		while (strm.avail_out == 0);
-
-		/* done when inflate() says it's done */
-	}
-	while (ret != Z_STREAM_END);
-
-	/* clean up and return */
-	(void)inflateEnd(&strm);
-	return ret == Z_STREAM_END ? Z_OK : Z_DATA_ERROR;
-}
@@ -15,6 +15,7 @@
 #include "simplexml.h"
 #include "LoadFile.h"
 #include "Tileset.h"
+#include "Cache.h"
 
 /* properties */
 typedef enum
@@ -49,6 +50,7 @@ struct
 	TLN_SequenceFrame frames[100];
 	TLN_TileImage* images;	/* array of images */
 	TLN_TileImage* image;	/* current image */
+	char (*sources)[64];	/* file of each image, loaded after parsing */
 	int frame_count;
 
 	/* tile-specific values */
@@ -58,7 +60,7 @@ struct
 		int type;			/* type of tile */
 		Property property;	/* property being read */
 		bool priority;		/* value of priority property */
-		TLN_Bitmap bitmap;	/* bitmap of image-based tile */
+		char source[64];	/* image of image-based tile */
 	}
 	tile;
 }
@@ -110,7 +112,7 @@ static void* handler (SimpleXmlParser parser, SimpleXmlEvent evt,
 				/* image for each image-based tileset */
 				if (loader.context == CONTEXT_TILE)
 				{
-					loader.tile.bitmap = TLN_LoadBitmap(loader.source);
+					strcpy(loader.tile.source, loader.source);
 					loader.source[0] = 0;
 				}
 			}
@@ -184,9 +186,13 @@ static void* handler (SimpleXmlParser parser, SimpleXmlEvent evt,
 				attribute->priority = loader.tile.priority;
 				attribute->type = loader.tile.type;
 			}
-			else if (loader.context == CONTEXT_TILE)
+			else if (loader.context == CONTEXT_TILE && loader.image - loader.images < loader.tilecount)
 			{
-				loader.image->bitmap = loader.tile.bitmap;
+				int index = (int)(loader.image - loader.images);
+				if (loader.sources == NULL)
+					loader.sources = (char(*)[64])calloc(loader.tilecount, sizeof(loader.sources[0]));
+				if (loader.sources != NULL)
+					strcpy(loader.sources[index], loader.tile.source);
 				loader.image->id = loader.tile.id;
 				loader.image->type = loader.tile.type;
 				loader.image += 1;
@@ -207,71 +213,41 @@ static void* handler (SimpleXmlParser parser, SimpleXmlEvent evt,
 	return handler;
 }
 
-/* cache section: keeps already loaded tilesets so it doesnt spawn multiple instances of the same */
-#define CACHE_SIZE	16
-static int cache_entries = 0;
-struct
-{
-	char name[200];
-	TLN_Tileset tileset;
-}
-static cache[16];
-
-static TLN_Tileset search_cache(const char* name)
+/* tileset parsed from its tsx file, waiting for its images */
+typedef struct
 {
-	int c;
-	for (c = 0; c < cache_entries; c += 1)
-	{
-		if (!strcmp(cache[c].name, name))
-			return cache[c].tileset;
-	}
-	return NULL;
+	const char* filename;
+	TLN_Error error;
+	char source[200];				/* image of tile based tileset, with path of tsx */
+	int tilecount;
+	int tilewidth;
+	int tileheight;
+	int spacing;
+	int margin;
+	TLN_TileAttributes* attributes;
+	TLN_SequencePack sp;
+	TLN_TileImage* images;			/* images of image based tileset */
+	char (*sources)[64];			/* file of each image */
+	int num_images;
+	int first_bitmap;				/* position of images inside the batch */
 }
+TilesetSource;
 
-static void add_to_cache(const char* name, TLN_Tileset tileset)
-{
-	if (cache_entries < CACHE_SIZE - 1)
-	{
-		strncpy(cache[cache_entries].name, name, sizeof(cache[0].name));
-		cache[cache_entries].tileset = tileset;
-		cache_entries += 1;
-	}
-}
-
-/*!
- * \brief
- * Loads a tileset from a Tiled .tsx file
- * 
- * \param filename
- * TSX file to load
- * 
- * \returns
- * Reference to the newly loaded tileset or NULL if error
- *
- * \remarks
- * An associated palette is also created, it can be obtained calling TLN_GetTilesetPalette()
- */
-TLN_Tileset TLN_LoadTileset (const char* filename)
+/* parses tsx file with the shared loader, images are loaded later */
+static bool parse_tileset(TilesetSource* tsx)
 {
 	SimpleXmlParser parser;
 	ssize_t size = 0;
+	MapMode mode;
 	uint8_t *data = NULL;
-	TLN_Tileset tileset = NULL;
+	bool ok = false;
 
-	/* find in cache */
-	tileset = search_cache(filename);
-	if (tileset)
-		return tileset;
-	
 	/* load file */
-	data = (uint8_t*)LoadFile (filename, &size);
+	data = (uint8_t*)MapFile (tsx->filename, &size, &mode);
 	if (!data)
 	{
-		if (size == 0)
-			TLN_SetLastError (TLN_ERR_FILE_NOT_FOUND);
-		else if (size == -1)
-			TLN_SetLastError (TLN_ERR_OUT_OF_MEMORY);
-		return NULL;
+		tsx->error = size == -1 ? TLN_ERR_OUT_OF_MEMORY : TLN_ERR_FILE_NOT_FOUND;
+		return false;
 	}
 
 	/* parse */
@@ -283,53 +259,76 @@ TLN_Tileset TLN_LoadTileset (const char* filename)
 		{
 			printf("parse error on line %li:\n%s\n", 
 				simpleXmlGetLineNumber(parser), simpleXmlGetErrorDescription(parser));
-			simpleXmlDestroyParser(parser);
-			free (data);
-			TLN_SetLastError (TLN_ERR_WRONG_FORMAT);
-			return NULL;
+			tsx->error = TLN_ERR_WRONG_FORMAT;
 		}
+		else
+			ok = true;
 	}
 	else
-		TLN_SetLastError (TLN_ERR_OUT_OF_MEMORY);
+		tsx->error = TLN_ERR_OUT_OF_MEMORY;
 
 	simpleXmlDestroyParser(parser); 
-	free(data);
+	UnmapFile(data, size, mode);
 
-	/* tile based tileset (classic) */
+	/* keep parsed values, loader is reused by next tsx */
+	tsx->tilecount = loader.tilecount;
+	tsx->tilewidth = loader.tilewidth;
+	tsx->tileheight = loader.tileheight;
+	tsx->spacing = loader.spacing;
+	tsx->margin = loader.margin;
+	tsx->attributes = loader.attributes;
+	tsx->sp = loader.sp;
+	tsx->images = loader.images;
+	tsx->sources = loader.sources;
+	if (loader.images != NULL)
+		tsx->num_images = (int)(loader.image - loader.images);
+
+	/* composite bitmap filename with relative path of parent tsx */
 	if (loader.source[0] != 0)
 	{
-		TLN_Bitmap bitmap;
+		FileInfo fi = { 0 };
+		SplitFilename(tsx->filename, &fi);
+		if (fi.path[0] != 0)
+			snprintf(tsx->source, sizeof(tsx->source), "%s/%s", fi.path, loader.source);
+		else
+			strncpy(tsx->source, loader.source, sizeof(tsx->source));
+		tsx->num_images = 1;
+	}
+	return ok;
+}
+
+/* creates tileset from parsed tsx and its loaded images */
+static TLN_Tileset build_tileset(TilesetSource* tsx, TLN_Bitmap* bitmaps)
+{
+	TLN_Tileset tileset = NULL;
+	int c;
+
+	/* tile based tileset (classic) */
+	if (tsx->source[0] != 0)
+	{
+		TLN_Bitmap bitmap = bitmaps[0];
 		int htiles, vtiles;
 		int x, y, dx, dy;
 		int id;
 		int pitch;
-		FileInfo fi = { 0 };
-		char imagepath[200];
-
-		/* composite bitmap filename with relative path of parent tsx */
-		SplitFilename(filename, &fi);
-		if (fi.path[0] != 0)
-			snprintf(imagepath, sizeof(imagepath), "%s/%s", fi.path, loader.source);
-		else
-			strncpy(imagepath, loader.source, sizeof(imagepath));
+		int tilecount;
 
-		bitmap = TLN_LoadBitmap(imagepath);
 		if (!bitmap)
 		{
-			TLN_SetLastError(TLN_ERR_FILE_NOT_FOUND);
+			tsx->error = TLN_ERR_FILE_NOT_FOUND;
 			return NULL;
 		}
 
 		/* create */
-		dx = loader.tilewidth + loader.spacing;
-		dy = loader.tileheight + loader.spacing;
-		htiles = (TLN_GetBitmapWidth(bitmap) - loader.margin * 2 + loader.spacing) / dx;
-		vtiles = (TLN_GetBitmapHeight(bitmap) - loader.margin * 2 + loader.spacing) / dy;
-		int tilecount = loader.tilecount != 0 ? loader.tilecount : htiles * vtiles;
-		tileset = TLN_CreateTileset(tilecount, loader.tilewidth, loader.tileheight, TLN_ClonePalette(TLN_GetBitmapPalette(bitmap)), loader.sp, loader.attributes);
+		dx = tsx->tilewidth + tsx->spacing;
+		dy = tsx->tileheight + tsx->spacing;
+		htiles = (TLN_GetBitmapWidth(bitmap) - tsx->margin * 2 + tsx->spacing) / dx;
+		vtiles = (TLN_GetBitmapHeight(bitmap) - tsx->margin * 2 + tsx->spacing) / dy;
+		tilecount = tsx->tilecount != 0 ? tsx->tilecount : htiles * vtiles;
+		tileset = TLN_CreateTileset(tilecount, tsx->tilewidth, tsx->tileheight, TLN_ClonePalette(TLN_GetBitmapPalette(bitmap)), tsx->sp, tsx->attributes);
 		if (tileset == NULL)
 		{
-			TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+			tsx->error = TLN_ERR_OUT_OF_MEMORY;
 			return NULL;
 		}
 
@@ -339,32 +338,158 @@ TLN_Tileset TLN_LoadTileset (const char* filename)
 		{
 			for (x = 0; x < htiles; x++, id++)
 			{
-				uint8_t *srcptr = TLN_GetBitmapPtr(bitmap, loader.margin + x * dx, loader.margin + y * dy);
+				uint8_t *srcptr = TLN_GetBitmapPtr(bitmap, tsx->margin + x * dx, tsx->margin + y * dy);
 				if (id < tilecount)
 					TLN_SetTilesetPixels(tileset, id, srcptr, pitch);
 			}
 		}
 		tileset->tiles_per_row = htiles;
-		TLN_DeleteBitmap(bitmap);
 	}
 
 	/* +2.5.0 image-based tileset */
 	else
 	{
-		tileset = TLN_CreateImageTileset(loader.tilecount, loader.images);
+		for (c = 0; c < tsx->num_images; c += 1)
+			tsx->images[c].bitmap = bitmaps[c];
+		tileset = TLN_CreateImageTileset(tsx->tilecount, tsx->images);
 		if (tileset == NULL)
 		{
-			TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+			for (c = 0; c < tsx->num_images; c += 1)
+				TLN_DeleteBitmap(bitmaps[c]);
+			tsx->error = TLN_ERR_OUT_OF_MEMORY;
 			return NULL;
 		}
+		tileset->owns_images = true;
 	}
+	return tileset;
+}
 
-	if (loader.attributes != NULL)
-		free(loader.attributes);
-	if (loader.images != NULL)
-		free(loader.images);
+/* loads several tsx files: parses them one by one, then decodes all their images at once
+ * with LoadBitmaps() and builds the tilesets. Already loaded ones are taken from cache, each
+ * returned tileset holds a reference released by TLN_DeleteTileset() */
+void LoadTilesets(int count, const char* const* filenames, TLN_Tileset* tilesets)
+{
+	TilesetSource* tsx;
+	const char** paths = NULL;
+	TLN_Bitmap* bitmaps = NULL;
+	TLN_Error error = TLN_ERR_OK;
+	int num_bitmaps = 0;
+	int c, i;
+
+	tsx = (TilesetSource*)calloc(count, sizeof(TilesetSource));
+	if (tsx == NULL)
+	{
+		TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+		return;
+	}
 
-	add_to_cache(filename, tileset);
-	TLN_SetLastError (TLN_ERR_OK);
+	/* parse new ones */
+	for (c = 0; c < count; c += 1)
+	{
+		tilesets[c] = (TLN_Tileset)FindCached(CACHE_TILESET, filenames[c]);
+		if (tilesets[c] != NULL)
+			continue;
+		for (i = 0; i < c; i += 1)
+		{
+			if (!strcmp(filenames[i], filenames[c]))
+				break;
+		}
+		if (i < c)
+			continue;
+
+		tsx[c].filename = filenames[c];
+
+		if (parse_tileset(&tsx[c]))
+		{
+			tsx[c].first_bitmap = num_bitmaps;
+			num_bitmaps += tsx[c].num_images;
+		}
+		else
+		{
+			if (tsx[c].sp != NULL)
+				TLN_DeleteSequencePack(tsx[c].sp);
+			tsx[c].filename = NULL;
+		}
+	}
+
+	/* decode all images */
+	if (num_bitmaps > 0)
+	{
+		paths = (const char**)calloc(num_bitmaps, sizeof(const char*));
+		bitmaps = (TLN_Bitmap*)calloc(num_bitmaps, sizeof(TLN_Bitmap));
+	}
+	if (paths != NULL && bitmaps != NULL)
+	{
+		for (c = 0; c < count; c += 1)
+		{
+			if (tsx[c].filename == NULL)
+				continue;
+			if (tsx[c].source[0] != 0)
+				paths[tsx[c].first_bitmap] = tsx[c].source;
+			else
+			{
+				for (i = 0; i < tsx[c].num_images; i += 1)
+					paths[tsx[c].first_bitmap + i] = tsx[c].sources != NULL ? tsx[c].sources[i] : "";
+			}
+		}
+		LoadBitmaps(num_bitmaps, paths, bitmaps);
+	}
+
+	/* build */
+	for (c = 0; c < count; c += 1)
+	{
+		if (tsx[c].filename != NULL)
+		{
+			if (bitmaps != NULL || tsx[c].num_images == 0)
+				tilesets[c] = build_tileset(&tsx[c], bitmaps + tsx[c].first_bitmap);
+			else
+				tsx[c].error = TLN_ERR_OUT_OF_MEMORY;
+
+			/* tile based ones copy pixels */
+			if (tsx[c].source[0] != 0 && bitmaps != NULL && bitmaps[tsx[c].first_bitmap] != NULL)
+				TLN_DeleteBitmap(bitmaps[tsx[c].first_bitmap]);
+			if (tilesets[c] != NULL)
+				tilesets[c] = (TLN_Tileset)AddCached(CACHE_TILESET, filenames[c], tilesets[c]);
+			else if (tsx[c].sp != NULL)
+				TLN_DeleteSequencePack(tsx[c].sp);
+		}
+
+		/* repeated inside the batch, takes its own reference */
+		else if (tilesets[c] == NULL)
+			tilesets[c] = (TLN_Tileset)FindCached(CACHE_TILESET, filenames[c]);
+
+		if (tsx[c].error != TLN_ERR_OK)
+			error = tsx[c].error;
+		free(tsx[c].attributes);
+		free(tsx[c].images);
+		free(tsx[c].sources);
+	}
+
+	free(bitmaps);
+	free(paths);
+	free(tsx);
+	TLN_SetLastError(error);
+}
+
+/*!
+ * \brief
+ * Loads a tileset from a Tiled .tsx file
+ * 
+ * \param filename
+ * TSX file to load
+ * 
+ * \returns
+ * Reference to the newly loaded tileset or NULL if error
+ *
+ * \remarks
+ * An associated palette is also created, it can be obtained calling TLN_GetTilesetPalette().
+ * Images of image-based tilesets are decoded in parallel. Tilesets are cached by absolute
+ * path: loading the same file again returns the same instance until it's evicted with
+ * TLN_EvictCache()
+ */
+TLN_Tileset TLN_LoadTileset (const char* filename)
+{
+	TLN_Tileset tileset = NULL;
+	LoadTilesets(1, &filename, &tileset);
 	return tileset;
 }
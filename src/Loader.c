@@ -0,0 +1,395 @@
+/*
+* Tilengine - The 2D retro graphics engine with raster effects
+* Copyright (C) 2015-2019 Marc Palacios Domenech <mailto:megamarc@hotmail.com>
+* All rights reserved
+*
+* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/.
+* */
+
+#include <string.h>
+#include <stdlib.h>
+#include "SDL2/SDL.h"
+#include "Tilengine.h"
+#include "Object.h"
+#include "Loader.h"
+#include "World.h"
+
+/* type of resource requested */
+typedef enum
+{
+	LOAD_BITMAP,
+	LOAD_TILESET,
+	LOAD_TILEMAP,
+	LOAD_SPRITESET,
+	LOAD_WORLD,
+}
+LoadType;
+
+/* queued load, owned by the caller until committed */
+struct LoadRequest
+{
+	DEFINE_OBJECT;
+	LoadType load_type;
+	TLN_LoadState state;		/* written by loader thread while holding lock */
+	TLN_Error error;			/* last error raised while loading */
+	void* result;				/* loaded object, or WorldContent for worlds */
+	int first_layer;			/* worlds only */
+	const char* layername;		/* tilemaps only, NULL for first layer */
+	struct LoadRequest* next;	/* next request in queue */
+	char filename[];
+};
+
+/* single loader thread shared by all engine contexts. Loaders keep their
+ * parsing state in static variables, so requests are loaded one at a time */
+static SDL_mutex* lock;
+static SDL_cond* finished;		/* signaled each time a request is done */
+static TLN_LoadRequest head;	/* first queued request, the one being loaded */
+static TLN_LoadRequest tail;
+static SDL_TLSID redirect;		/* where errors of the calling thread go, NULL for engine */
+static bool running;
+
+static void load(TLN_LoadRequest request)
+{
+	switch (request->load_type)
+	{
+	case LOAD_BITMAP:
+		request->result = TLN_LoadBitmap(request->filename);
+		break;
+
+	case LOAD_TILESET:
+		request->result = TLN_LoadTileset(request->filename);
+		break;
+
+	case LOAD_TILEMAP:
+		request->result = TLN_LoadTilemap(request->filename, request->layername);
+		break;
+
+	case LOAD_SPRITESET:
+		request->result = TLN_LoadSpriteset(request->filename);
+		break;
+
+	case LOAD_WORLD:
+		request->result = LoadWorldContent(request->filename);
+		break;
+	}
+}
+
+/* loads queued requests until queue is empty, then exits */
+static int LoaderThread(void* data)
+{
+	SDL_LockMutex(lock);
+	while (head != NULL)
+	{
+		TLN_LoadRequest request = head;
+		SDL_UnlockMutex(lock);
+
+		RedirectErrors(&request->error);
+		load(request);
+		RedirectErrors(NULL);
+
+		SDL_LockMutex(lock);
+		request->state = request->result != NULL ? TLN_LOAD_READY : TLN_LOAD_FAILED;
+		head = request->next;
+		if (head == NULL)
+			tail = NULL;
+		SDL_CondBroadcast(finished);
+	}
+	running = false;
+	SDL_UnlockMutex(lock);
+	return 0;
+}
+
+/* creates request and appends it to loader queue, starting thread if idle */
+static TLN_LoadRequest submit(LoadType type, const char* filename, const char* layername)
+{
+	TLN_LoadRequest request;
+	size_t filename_size, layername_size = 0;
+
+	if (filename == NULL)
+	{
+		TLN_SetLastError(TLN_ERR_NULL_POINTER);
+		return NULL;
+	}
+
+	/* names are stored after the request */
+	filename_size = strlen(filename) + 1;
+	if (layername != NULL)
+		layername_size = strlen(layername) + 1;
+	request = (TLN_LoadRequest)CreateBaseObject(OT_LOADREQUEST, (int)(sizeof(struct LoadRequest) + filename_size + layername_size));
+	if (request == NULL)
+		return NULL;
+
+	request->load_type = type;
+	request->state = TLN_LOAD_PENDING;
+	memcpy(request->filename, filename, filename_size);
+	if (layername != NULL)
+	{
+		char* name = request->filename + filename_size;
+		memcpy(name, layername, layername_size);
+		request->layername = name;
+	}
+
+	InitLoader();
+	SDL_LockMutex(lock);
+	if (tail != NULL)
+		tail->next = request;
+	else
+		head = request;
+	tail = request;
+
+	if (!running)
+	{
+		SDL_Thread* thread = SDL_CreateThread(LoaderThread, "LoaderThread", NULL);
+		if (thread == NULL)
+		{
+			head = tail = NULL;
+			SDL_UnlockMutex(lock);
+			DeleteBaseObject(request);
+			TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+			return NULL;
+		}
+		SDL_DetachThread(thread);
+		running = true;
+	}
+	SDL_UnlockMutex(lock);
+
+	TLN_SetLastError(TLN_ERR_OK);
+	return request;
+}
+
+/* creates shared loader state, must be called from engine thread before other threads load */
+void InitLoader(void)
+{
+	if (lock != NULL)
+		return;
+
+	lock = SDL_CreateMutex();
+	finished = SDL_CreateCond();
+	redirect = SDL_TLSCreate();
+}
+
+/* keeps error raised by loader or worker threads where they asked, false on other threads */
+bool SetLoaderError(TLN_Error error)
+{
+	TLN_Error* target;
+
+	if (redirect == 0)
+		return false;
+
+	target = (TLN_Error*)SDL_TLSGet(redirect);
+	if (target == NULL)
+		return false;
+
+	*target = error;
+	return true;
+}
+
+/* errors raised by calling thread go to given variable instead of engine context, NULL to restore.
+ * Returns previous target */
+TLN_Error* RedirectErrors(TLN_Error* error)
+{
+	TLN_Error* previous;
+
+	if (redirect == 0)
+		return NULL;
+
+	previous = (TLN_Error*)SDL_TLSGet(redirect);
+	SDL_TLSSet(redirect, error, NULL);
+	return previous;
+}
+
+/* blocks until all queued requests are loaded */
+void WaitLoader(void)
+{
+	if (lock == NULL)
+		return;
+
+	SDL_LockMutex(lock);
+	while (head != NULL)
+		SDL_CondWait(finished, lock);
+	SDL_UnlockMutex(lock);
+}
+
+/*!
+ * \brief
+ * Starts loading an image file in the background
+ *
+ * \param filename
+ * File name with the image, as in TLN_LoadBitmap()
+ *
+ * \returns
+ * Load request to check with TLN_GetLoadState() and finish with TLN_CommitLoad(), or NULL if error
+ *
+ * \see
+ * TLN_LoadBitmap(), TLN_CommitLoad()
+ */
+TLN_LoadRequest TLN_LoadBitmapAsync(const char* filename)
+{
+	return submit(LOAD_BITMAP, filename, NULL);
+}
+
+/*!
+ * \brief
+ * Starts loading a tileset in the background
+ *
+ * \param filename
+ * TSX file to load, as in TLN_LoadTileset()
+ *
+ * \returns
+ * Load request to check with TLN_GetLoadState() and finish with TLN_CommitLoad(), or NULL if error
+ *
+ * \see
+ * TLN_LoadTileset(), TLN_CommitLoad()
+ */
+TLN_LoadRequest TLN_LoadTilesetAsync(const char* filename)
+{
+	return submit(LOAD_TILESET, filename, NULL);
+}
+
+/*!
+ * \brief
+ * Starts loading a tilemap layer and its tilesets in the background
+ *
+ * \param filename
+ * TMX file to load, as in TLN_LoadTilemap()
+ *
+ * \param layername
+ * Optional name of the layer inside the tmx file, NULL to load the first layer
+ *
+ * \returns
+ * Load request to check with TLN_GetLoadState() and finish with TLN_CommitLoad(), or NULL if error
+ *
+ * \see
+ * TLN_LoadTilemap(), TLN_CommitLoad()
+ */
+TLN_LoadRequest TLN_LoadTilemapAsync(const char* filename, const char* layername)
+{
+	return submit(LOAD_TILEMAP, filename, layername);
+}
+
+/*!
+ * \brief
+ * Starts loading a spriteset in the background
+ *
+ * \param name
+ * Base name of the spriteset files, as in TLN_LoadSpriteset()
+ *
+ * \returns
+ * Load request to check with TLN_GetLoadState() and finish with TLN_CommitLoad(), or NULL if error
+ *
+ * \see
+ * TLN_LoadSpriteset(), TLN_CommitLoad()
+ */
+TLN_LoadRequest TLN_LoadSpritesetAsync(const char* name)
+{
+	return submit(LOAD_SPRITESET, name, NULL);
+}
+
+/*!
+ * \brief
+ * Starts loading all the resources of a world in the background
+ *
+ * \param tmxfile
+ * TMX file to load, as in TLN_LoadWorld()
+ *
+ * \param first_layer
+ * Starting layer number where place the loaded tmx
+ *
+ * \returns
+ * Load request to check with TLN_GetLoadState() and finish with TLN_CommitLoad(), or NULL if error
+ *
+ * \remarks
+ * Layers aren't modified until the request is committed with TLN_CommitLoad(), so the
+ * current world keeps rendering while the next one is loading
+ *
+ * \see
+ * TLN_LoadWorld(), TLN_CommitLoad()
+ */
+TLN_LoadRequest TLN_LoadWorldAsync(const char* tmxfile, int first_layer)
+{
+	TLN_LoadRequest request = submit(LOAD_WORLD, tmxfile, NULL);
+	if (request != NULL)
+		request->first_layer = first_layer;
+	return request;
+}
+
+/*!
+ * \brief
+ * Returns the state of a load request without blocking
+ *
+ * \param request
+ * Load request returned by one of the TLN_Load...Async() functions
+ *
+ * \returns
+ * TLN_LOAD_PENDING while loading, TLN_LOAD_READY or TLN_LOAD_FAILED when finished
+ */
+TLN_LoadState TLN_GetLoadState(TLN_LoadRequest request)
+{
+	TLN_LoadState state;
+
+	if (!CheckBaseObject(request, OT_LOADREQUEST))
+		return TLN_LOAD_FAILED;
+
+	SDL_LockMutex(lock);
+	state = request->state;
+	SDL_UnlockMutex(lock);
+
+	TLN_SetLastError(TLN_ERR_OK);
+	return state;
+}
+
+/*!
+ * \brief
+ * Finishes a load request, waiting for it if still pending, and releases it
+ *
+ * \param request
+ * Load request returned by one of the TLN_Load...Async() functions
+ *
+ * \param object
+ * Pointer to the variable that receives the loaded resource (TLN_Bitmap*, TLN_Tileset*,
+ * TLN_Tilemap* or TLN_Spriteset*). NULL for worlds
+ *
+ * \returns
+ * true if the resource was loaded, false with the error of the load otherwise
+ *
+ * \remarks
+ * Must be called from the thread that uses the engine. Worlds are assigned to their layers
+ * here, the same way as TLN_LoadWorld() does
+ */
+bool TLN_CommitLoad(TLN_LoadRequest request, void* object)
+{
+	LoadType type;
+	int first_layer;
+	void* result;
+	TLN_Error error;
+
+	if (!CheckBaseObject(request, OT_LOADREQUEST))
+		return false;
+
+	SDL_LockMutex(lock);
+	while (request->state == TLN_LOAD_PENDING)
+		SDL_CondWait(finished, lock);
+	SDL_UnlockMutex(lock);
+
+	type = request->load_type;
+	first_layer = request->first_layer;
+	result = request->result;
+	error = request->error;
+	DeleteBaseObject(request);
+
+	if (result == NULL)
+	{
+		TLN_SetLastError(error);
+		return false;
+	}
+
+	if (type == LOAD_WORLD)
+		SetupWorld((WorldContent*)result, first_layer);
+	else if (object != NULL)
+		*(void**)object = result;
+
+	TLN_SetLastError(TLN_ERR_OK);
+	return true;
+}
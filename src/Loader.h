@@ -0,0 +1,21 @@
+/*
+* Tilengine - The 2D retro graphics engine with raster effects
+* Copyright (C) 2015-2019 Marc Palacios Domenech <mailto:megamarc@hotmail.com>
+* All rights reserved
+*
+* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/.
+* */
+
+#ifndef _LOADER_H
+#define _LOADER_H
+
+#include "Tilengine.h"
+
+void InitLoader(void);
+bool SetLoaderError(TLN_Error error);
+TLN_Error* RedirectErrors(TLN_Error* error);
+void WaitLoader(void);
+
+#endif
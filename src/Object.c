@@ -10,11 +10,13 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include "SDL2/SDL.h"
 #include "Object.h"
 #include "Engine.h"
 
-static uint32_t numobjects = 0;
-static uint32_t numbytes = 0;
+/* objects are also created by the loader thread */
+static SDL_atomic_t numobjects;
+static SDL_atomic_t numbytes;
 
 static const char* object_types[] = 
 {
@@ -25,8 +27,11 @@ static const char* object_types[] =
 	"spriteset",
 	"bitmap",
 	"sequence",
-	"sequence pack"
+	"sequence pack",
 	"object list",
+	"sprite group",
+	"palette ramp",
+	"load request",
 };
 
 static const TLN_Error object_errors[] =
@@ -40,6 +45,9 @@ static const TLN_Error object_errors[] =
 	TLN_ERR_REF_SEQUENCE,
 	TLN_ERR_REF_SEQPACK,
 	TLN_ERR_REF_LIST,
+	TLN_ERR_REF_SPRITEGROUP,
+	TLN_ERR_REF_PALETTERAMP,
+	TLN_ERR_REF_LOADREQUEST,
 };
 
 /* crea objecto */
@@ -48,11 +56,11 @@ void* CreateBaseObject (ObjectType type, int size)
 	object_t* object = (object_t*)malloc (size);
 	if (object)
 	{
-		numobjects++;
-		numbytes += size;
+		const int count = SDL_AtomicAdd (&numobjects, 1) + 1;
+		SDL_AtomicAdd (&numbytes, size);
 		memset (object, 0, size);
 		object->type = type;
-		object->guid = numobjects;
+		object->guid = count;
 		object->size = size;
 		object->owner = true;
 		tln_trace(TLN_LOG_VERBOSE, "%s created at %p, %d size", object_types[type], object, size);
@@ -83,8 +91,8 @@ void DeleteBaseObject (void* object)
 {
 	if (object)
 	{
-		numobjects--;
-		numbytes -= ObjectSize(object);
+		SDL_AtomicAdd (&numobjects, -1);
+		SDL_AtomicAdd (&numbytes, -ObjectSize(object));
 		tln_trace(TLN_LOG_VERBOSE, "%s %p deleted", object_types[ObjectType(object)], object);
 		free (object);
 	}
@@ -103,12 +111,12 @@ bool CheckBaseObject (void* object, ObjectType type)
 
 unsigned int GetNumObjects (void)
 {
-	return numobjects;
+	return (unsigned int)SDL_AtomicGet (&numobjects);
 }
 
 unsigned int GetNumBytes (void)
 {
-	return numbytes;
+	return (unsigned int)SDL_AtomicGet (&numbytes);
 }
 
 void CopyBaseObject (void* dstobject, void* srcobject)
@@ -25,6 +25,9 @@ typedef enum
 	OT_SEQUENCE,
 	OT_SEQPACK,
 	OT_OBJECTLIST,
+	OT_SPRITEGROUP,
+	OT_PALETTERAMP,
+	OT_LOADREQUEST,
 }
 ObjectType;
 
@@ -39,11 +39,64 @@ static loader;
 
 static bool CloneObjectToList(TLN_ObjectList list, TLN_Object* data);
 
+/* parses attributes of <object> and its properties into current object */
+static void object_attribute(const char* szName, const char* szAttribute, const char* szValue)
+{
+	const int intvalue = atoi(szValue);
+
+	if (!strcasecmp(szName, "object"))
+	{
+		if (!strcasecmp(szAttribute, "id"))
+			loader.object.id = intvalue;
+		else if (!strcasecmp(szAttribute, "gid"))
+		{
+			Tile tile;
+			tile.value = strtoul(szValue, NULL, 0);
+			loader.object.has_gid = true;
+			loader.object.flags = tile.flags;
+			loader.object.gid = tile.index;
+		}
+		else if (!strcasecmp(szAttribute, "x"))
+			loader.object.x = intvalue;
+		else if (!strcasecmp(szAttribute, "y"))
+			loader.object.y = intvalue;
+		else if (!strcasecmp(szAttribute, "width"))
+			loader.object.width = intvalue;
+		else if (!strcasecmp(szAttribute, "height"))
+			loader.object.height = intvalue;
+		else if (!strcasecmp(szAttribute, "type"))
+			loader.object.type = intvalue;
+		else if (!strcasecmp(szAttribute, "visible"))
+			loader.object.visible = (bool)intvalue;
+		else if (!strcasecmp(szAttribute, "name"))
+			strncpy(loader.object.name, szValue, sizeof(loader.object.name));
+	}
+
+	/* <property name="type" type="int" value="12"/> */
+	else if (!strcasecmp(szName, "property"))
+	{
+		if (!strcasecmp(szAttribute, "name"))
+		{
+			if (!strcasecmp(szValue, "priority"))
+				loader.property = PROPERTY_PRIORITY;
+			else
+				loader.property = PROPERTY_NONE;
+		}
+		else if (!strcasecmp(szAttribute, "value"))
+		{
+			if (loader.property == PROPERTY_PRIORITY)
+			{
+				if (!strcasecmp(szValue, "true"))
+					loader.object.flags += FLAG_PRIORITY;
+			}
+		}
+	}
+}
+
 /* XML parser callback */
 static void* handler(SimpleXmlParser parser, SimpleXmlEvent evt,
 	const char* szName, const char* szAttribute, const char* szValue)
 {
-	int intvalue;
 	switch (evt)
 	{
 	case ADD_SUBTAG:
@@ -55,8 +108,6 @@ static void* handler(SimpleXmlParser parser, SimpleXmlEvent evt,
 		break;
 
 	case ADD_ATTRIBUTE:
-
-		intvalue = atoi(szValue);
 		if (!strcasecmp(szName, "objectgroup") && (!strcasecmp(szAttribute, "name")))
 		{
 			if (!strcasecmp(szValue, loader.layer->name))
@@ -64,54 +115,8 @@ static void* handler(SimpleXmlParser parser, SimpleXmlEvent evt,
 			else
 				loader.state = false;
 		}
-
-		else if (!strcasecmp(szName, "object"))
-		{
-			if (!strcasecmp(szAttribute, "id"))
-				loader.object.id = intvalue;
-			else if (!strcasecmp(szAttribute, "gid"))
-			{
-				Tile tile;
-				tile.value = strtoul(szValue, NULL, 0);
-				loader.object.has_gid = true;
-				loader.object.flags = tile.flags;
-				loader.object.gid = tile.index;
-			}
-			else if (!strcasecmp(szAttribute, "x"))
-				loader.object.x = intvalue;
-			else if (!strcasecmp(szAttribute, "y"))
-				loader.object.y = intvalue;
-			else if (!strcasecmp(szAttribute, "width"))
-				loader.object.width = intvalue;
-			else if (!strcasecmp(szAttribute, "height"))
-				loader.object.height = intvalue;
-			else if (!strcasecmp(szAttribute, "type"))
-				loader.object.type = intvalue;
-			else if (!strcasecmp(szAttribute, "visible"))
-				loader.object.visible = (bool)intvalue;
-			else if (!strcasecmp(szAttribute, "name"))
-				strncpy(loader.object.name, szValue, sizeof(loader.object.name));
-		}
-
-		/* <property name="type" type="int" value="12"/> */
-		else if (!strcasecmp(szName, "property"))
-		{
-			if (!strcasecmp(szAttribute, "name"))
-			{
-				if (!strcasecmp(szValue, "priority"))
-					loader.property = PROPERTY_PRIORITY;
-				else
-					loader.property = PROPERTY_NONE;
-			}
-			else if (!strcasecmp(szAttribute, "value"))
-			{
-				if (loader.property == PROPERTY_PRIORITY)
-				{
-					if (!strcasecmp(szValue, "true"))
-						loader.object.flags += FLAG_PRIORITY;
-				}
-			}
-		}
+		else
+			object_attribute(szName, szAttribute, szValue);
 		break;
 
 	case FINISH_ATTRIBUTES:
@@ -146,6 +151,90 @@ static void* handler(SimpleXmlParser parser, SimpleXmlEvent evt,
 	return handler;
 }
 
+/* XML parser callback for TMXLoadContent(): builds objects of every object layer */
+void* TMXObjectContentHandler(SimpleXmlParser parser, SimpleXmlEvent evt,
+	const char* szName, const char* szAttribute, const char* szValue)
+{
+	TMXLayer* layer = TMXGetContentLayer();
+	if (layer == NULL || layer->type != LAYER_OBJECT)
+		return NULL;
+
+	switch (evt)
+	{
+	case ADD_SUBTAG:
+		if (!strcasecmp(szName, "object"))
+		{
+			memset(&loader.object, 0, sizeof(struct _Object));
+			loader.object.visible = true;
+		}
+		break;
+
+	case ADD_ATTRIBUTE:
+		object_attribute(szName, szAttribute, szValue);
+		break;
+
+	case FINISH_ATTRIBUTES:
+		if (!strcasecmp(szName, "objectgroup") && layer->objects == NULL)
+		{
+			layer->objects = TLN_CreateObjectList();
+			if (layer->objects != NULL)
+			{
+				layer->objects->id = layer->id;
+				layer->objects->visible = layer->visible;
+			}
+		}
+		break;
+
+	case FINISH_TAG:
+		if (!strcasecmp(szName, "object") && layer->objects != NULL)
+		{
+			if (loader.object.has_gid)
+				loader.object.y -= loader.object.height;
+			CloneObjectToList(layer->objects, &loader.object);
+		}
+		break;
+
+	default:
+		break;
+	}
+	return NULL;
+}
+
+/* maps gids of a loaded object list to its tileset, returns index of tileset or -1 if none */
+int TMXSetupObjectList(TMXInfo* info, TLN_ObjectList list, TLN_Tileset* tilesets)
+{
+	struct _Object* item;
+	int gid = 0;
+	int suitable;
+
+	/* find suitable tileset */
+	item = list->list;
+	while (item != NULL && gid == 0)
+	{
+		if (item->gid > 0)
+			gid = item->gid;
+		item = item->next;
+	}
+	suitable = TMXGetSuitableTileset(info, gid, tilesets);
+
+	/* correct with firstgid */
+	if (suitable != -1)
+	{
+		item = list->list;
+		while (item != NULL)
+		{
+			if (item->gid > 0)
+				item->gid = item->gid - info->tilesets[suitable].firstgid;
+			item = item->next;
+		}
+		list->tileset = tilesets[suitable];
+	}
+
+	list->width = info->width*info->tilewidth;
+	list->height = info->height*info->tileheight;
+	return suitable;
+}
+
 static bool intersetcs(rect_t* rect1, rect_t* rect2)
 {
 	return !(rect1->x2 < rect2->x1 || rect1->x1 > rect2->x2 || rect1->y2 < rect2->y1 || rect1->y1 > rect2->y2);
@@ -245,6 +334,7 @@ TLN_ObjectList TLN_LoadObjectList(const char* filename, const char* layername)
 {
 	SimpleXmlParser parser;
 	ssize_t size;
+	MapMode mode;
 	uint8_t *data;
 	TMXInfo tmxinfo = { 0 };
 
@@ -268,7 +358,7 @@ TLN_ObjectList TLN_LoadObjectList(const char* filename, const char* layername)
 	}
 
 	/* parse */
-	data = (uint8_t*)LoadFile(filename, &size);
+	data = (uint8_t*)MapFile(filename, &size, &mode);
 	parser = simpleXmlCreateParser((char*)data, (long)size);
 	if (parser != NULL)
 	{
@@ -285,40 +375,19 @@ TLN_ObjectList TLN_LoadObjectList(const char* filename, const char* layername)
 		TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
 
 	simpleXmlDestroyParser(parser);
-	free(data);
+	UnmapFile(data, size, mode);
 
 	if (loader.objects != NULL)
 	{
-		TMXTileset* tmxtileset;
-		struct _Object* item;
-		int gid = 0;
+		int suitable;
 		int c;
 
-		/* find suitable tileset */
-		item = loader.objects->list;
-		while (item != NULL && gid == 0)
-		{
-			if (item->gid > 0)
-				gid = item->gid;
-			item = item->next;
-		}
-
 		/* load referenced tilesets */
 		TLN_Tileset tilesets[TMX_MAX_TILESET] = { 0 };
 		for (c = 0; c < tmxinfo.num_tilesets; c += 1)
 			tilesets[c] = TLN_LoadTileset(tmxinfo.tilesets[c].source);
 
-		int suitable = TMXGetSuitableTileset(&tmxinfo, gid, tilesets);
-		tmxtileset = &tmxinfo.tilesets[suitable];
-
-		/* correct with firstgid */
-		item = loader.objects->list;
-		while (item != NULL)
-		{
-			if (item->gid > 0)
-				item->gid = item->gid - tmxtileset->firstgid;
-			item = item->next;
-		}
+		suitable = TMXSetupObjectList(&tmxinfo, loader.objects, tilesets);
 
 		/* delete unused tilesets */
 		for (c = 0; c < tmxinfo.num_tilesets; c += 1)
@@ -326,11 +395,6 @@ TLN_ObjectList TLN_LoadObjectList(const char* filename, const char* layername)
 			if (c != suitable)
 				TLN_DeleteTileset(tilesets[c]);
 		}
-
-		TLN_Tileset tileset = tilesets[suitable];
-		loader.objects->tileset = tileset;
-		loader.objects->width = tmxinfo.width*tmxinfo.tilewidth;
-		loader.objects->height = tmxinfo.height*tmxinfo.tileheight;
 	}
 	
 	return loader.objects;
@@ -459,6 +523,10 @@ bool TLN_DeleteObjectList(TLN_ObjectList list)
 		object = next;
 	}
 
+	/* tileset of a loaded list */
+	if (ObjectOwner(list) && list->tileset != NULL)
+		TLN_DeleteTileset(list->tileset);
+
 	DeleteBaseObject(list);
 	return true;
 }
@@ -10,10 +10,162 @@
 
 #include <stdio.h>
 #include <string.h>
+#include "SDL2/SDL.h"
 #include "Engine.h"
 #include "Tilengine.h"
 #include "Palette.h"
 #include "Tables.h"
+#include "Cache.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE2
+#endif
+
+#ifdef USE_SSE2
+static inline __m128i div255_epu16 (__m128i x)
+{
+	return _mm_srli_epi16 (_mm_add_epi16 (_mm_add_epi16 (x, _mm_set1_epi16 (1)), _mm_srli_epi16 (x, 8)), 8);
+}
+#endif
+
+/* palettes are also created by the loader thread */
+static SDL_atomic_t versions;
+
+/* gives new colors a version never used by any palette, so a cache keyed by palette and version
+ * can't take a new palette allocated at the address of a deleted one for the old one */
+void TouchPalette (TLN_Palette palette)
+{
+	palette->version = (uint32_t)SDL_AtomicAdd (&versions, 1) + 1;
+}
+
+/* dst = src0*(255 - factor)/255 + src1*factor/255 for RGB components, keeps alpha of dst */
+void BlendColors (uint32_t* dst, const uint32_t* src0, const uint32_t* src1, int count, uint8_t factor)
+{
+	const int f1 = factor;
+	const int f0 = 255 - factor;
+	int c = 0;
+
+#ifdef USE_SSE2
+	const __m128i zero = _mm_setzero_si128 ();
+	const __m128i vf0 = _mm_set1_epi16 ((short)f0);
+	const __m128i vf1 = _mm_set1_epi16 ((short)f1);
+	const __m128i alpha = _mm_set1_epi32 ((int)0xFF000000);
+	for (; c + 4 <= count; c += 4)
+	{
+		const __m128i a = _mm_loadu_si128 ((const __m128i*)(src0 + c));
+		const __m128i b = _mm_loadu_si128 ((const __m128i*)(src1 + c));
+		const __m128i d = _mm_loadu_si128 ((const __m128i*)(dst + c));
+		__m128i lo = _mm_add_epi16 (
+			div255_epu16 (_mm_mullo_epi16 (_mm_unpacklo_epi8 (a, zero), vf0)),
+			div255_epu16 (_mm_mullo_epi16 (_mm_unpacklo_epi8 (b, zero), vf1)));
+		__m128i hi = _mm_add_epi16 (
+			div255_epu16 (_mm_mullo_epi16 (_mm_unpackhi_epi8 (a, zero), vf0)),
+			div255_epu16 (_mm_mullo_epi16 (_mm_unpackhi_epi8 (b, zero), vf1)));
+		__m128i result = _mm_packus_epi16 (lo, hi);
+		result = _mm_or_si128 (_mm_andnot_si128 (alpha, result), _mm_and_si128 (alpha, d));
+		_mm_storeu_si128 ((__m128i*)(dst + c), result);
+	}
+#endif
+
+	for (; c < count; c++)
+	{
+		const uint8_t* srcptr0 = (const uint8_t*)&src0[c];
+		const uint8_t* srcptr1 = (const uint8_t*)&src1[c];
+		uint8_t* dstptr = (uint8_t*)&dst[c];
+		dstptr[0] = (uint8_t)(div255(srcptr0[0]*f0) + div255(srcptr1[0]*f1));
+		dstptr[1] = (uint8_t)(div255(srcptr0[1]*f0) + div255(srcptr1[1]*f1));
+		dstptr[2] = (uint8_t)(div255(srcptr0[2]*f0) + div255(srcptr1[2]*f1));
+	}
+}
+
+/* dst = src*(255 - factor)/255 + color*factor/255 for RGB components, keeps alpha of src */
+static void FadeColors (uint32_t* dst, const uint32_t* src, uint32_t color, int count, uint8_t factor)
+{
+	const uint8_t* colorptr = (const uint8_t*)&color;
+	const int f0 = 255 - factor;
+	const int b = div255(colorptr[0]*factor);
+	const int g = div255(colorptr[1]*factor);
+	const int r = div255(colorptr[2]*factor);
+	int c = 0;
+
+#ifdef USE_SSE2
+	const __m128i zero = _mm_setzero_si128 ();
+	const __m128i vf0 = _mm_set_epi16 (255,(short)f0,(short)f0,(short)f0, 255,(short)f0,(short)f0,(short)f0);
+	const __m128i term = _mm_set_epi16 (0,(short)r,(short)g,(short)b, 0,(short)r,(short)g,(short)b);
+	for (; c + 4 <= count; c += 4)
+	{
+		const __m128i a = _mm_loadu_si128 ((const __m128i*)(src + c));
+		const __m128i lo = _mm_add_epi16 (div255_epu16 (_mm_mullo_epi16 (_mm_unpacklo_epi8 (a, zero), vf0)), term);
+		const __m128i hi = _mm_add_epi16 (div255_epu16 (_mm_mullo_epi16 (_mm_unpackhi_epi8 (a, zero), vf0)), term);
+		_mm_storeu_si128 ((__m128i*)(dst + c), _mm_packus_epi16 (lo, hi));
+	}
+#endif
+
+	for (; c < count; c++)
+	{
+		const uint8_t* srcptr = (const uint8_t*)&src[c];
+		uint8_t* dstptr = (uint8_t*)&dst[c];
+		dstptr[0] = (uint8_t)(div255(srcptr[0]*f0) + b);
+		dstptr[1] = (uint8_t)(div255(srcptr[1]*f0) + g);
+		dstptr[2] = (uint8_t)(div255(srcptr[2]*f0) + r);
+		dstptr[3] = srcptr[3];
+	}
+}
+
+/* combines RGB components with a color: saturated add or subtract, or normalized product */
+static void EditColors (uint32_t* data, int count, TLN_Blend mode, uint8_t r, uint8_t g, uint8_t b)
+{
+	int c = 0;
+
+#ifdef USE_SSE2
+	const __m128i zero = _mm_setzero_si128 ();
+	const __m128i color = _mm_set1_epi32 ((int)((r << 16) | (g << 8) | b));
+	const __m128i factor = _mm_set_epi16 (255,r,g,b, 255,r,g,b);
+	for (; c + 4 <= count; c += 4)
+	{
+		const __m128i a = _mm_loadu_si128 ((const __m128i*)(data + c));
+		__m128i result;
+		if (mode == BLEND_ADD)
+			result = _mm_adds_epu8 (a, color);
+		else if (mode == BLEND_SUB)
+			result = _mm_subs_epu8 (a, color);
+		else
+		{
+			const __m128i lo = div255_epu16 (_mm_mullo_epi16 (_mm_unpacklo_epi8 (a, zero), factor));
+			const __m128i hi = div255_epu16 (_mm_mullo_epi16 (_mm_unpackhi_epi8 (a, zero), factor));
+			result = _mm_packus_epi16 (lo, hi);
+		}
+		_mm_storeu_si128 ((__m128i*)(data + c), result);
+	}
+#endif
+
+	for (; c < count; c++)
+	{
+		uint8_t* colorptr = (uint8_t*)&data[c];
+		const uint8_t value[3] = { b, g, r };
+		int i;
+		for (i = 0; i < 3; i++)
+		{
+			const int x = colorptr[i];
+			if (mode == BLEND_ADD)
+				colorptr[i] = (uint8_t)(x + value[i] > 255 ? 255 : x + value[i]);
+			else if (mode == BLEND_SUB)
+				colorptr[i] = (uint8_t)(x - value[i] < 0 ? 0 : x - value[i]);
+			else
+				colorptr[i] = (uint8_t)div255(x*value[i]);
+		}
+	}
+}
+
+/* copies colors between palettes, keeping object state of the target */
+void CopyPalette (TLN_Palette dst, TLN_Palette src)
+{
+	int size = ObjectSize(src) < ObjectSize(dst) ? ObjectSize(src) : ObjectSize(dst);
+	dst->entries = src->entries;
+	memcpy (dst->data, src->data, size - sizeof(struct Palette));
+	TouchPalette (dst);
+}
 
 /*!
  * \brief
@@ -28,12 +180,13 @@
 TLN_Palette TLN_CreatePalette (int entries)
 {
 	TLN_Palette palette;
-	int size = sizeof(struct Palette) + 1024;	// always alloc 256 colors, to avoid crash when tileset uses more colors than the palette
+	int size = sizeof(struct Palette) + (entries > 256 ? entries : 256)*sizeof(uint32_t);	// always alloc 256 colors, to avoid crash when tileset uses more colors than the palette
 	
 	palette = (TLN_Palette)CreateBaseObject(OT_PALETTE, size);
 	if (palette)
 	{
 		palette->entries = entries;
+		TouchPalette (palette);
 		TLN_SetLastError (TLN_ERR_OK);
 		return palette;
 	}
@@ -61,9 +214,11 @@ TLN_Palette TLN_ClonePalette (TLN_Palette src)
 	if (!CheckBaseObject (src, OT_PALETTE))
 		return NULL;
 
+	UpdatePaletteCycle (src);
 	palette = (TLN_Palette)CloneBaseObject (src);
 	if (palette)
 	{
+		palette->cycle = NULL;
 		TLN_SetLastError (TLN_ERR_OK);
 		return palette;
 	}
@@ -85,6 +240,15 @@ bool TLN_DeletePalette (TLN_Palette palette)
 {
 	if (CheckBaseObject (palette, OT_PALETTE))
 	{
+		/* loaded ones are kept until evicted */
+		if (ReleaseCached (palette))
+		{
+			TLN_SetLastError (TLN_ERR_OK);
+			return true;
+		}
+
+		if (palette->cycle != NULL && engine->pending_palettes > 0)
+			engine->pending_palettes -= 1;
 		DeleteBaseObject (palette);
 		TLN_SetLastError (TLN_ERR_OK);
 		return true;
@@ -117,6 +281,8 @@ bool TLN_SetPaletteColor (TLN_Palette palette, int index, uint8_t r, uint8_t g,
 	if (CheckBaseObject (palette, OT_PALETTE) && index < palette->entries)
 	{
 		Color* color = (Color*)GetPaletteData (palette, index);
+		UpdatePaletteCycle (palette);
+		TouchPalette (palette);
 		if (index == 0)
 			color->value = 0;
 		else
@@ -145,6 +311,9 @@ bool TLN_SetPaletteColor (TLN_Palette palette, int index, uint8_t r, uint8_t g,
  * 
  * \returns
  * 32-bit integer with the packed color in internal pixel format RGBA
+ *
+ * \remarks
+ * Colors can be modified through the returned pointer, so the palette is considered changed
  */
 uint8_t* TLN_GetPaletteData (TLN_Palette palette, int index)
 {
@@ -157,6 +326,8 @@ uint8_t* TLN_GetPaletteData (TLN_Palette palette, int index)
 	}
 	else
 	{
+		UpdatePaletteCycle (palette);
+		TouchPalette (palette);
 		TLN_SetLastError (TLN_ERR_OK);
 		return (uint8_t*)GetPaletteData (palette, index);
 	}
@@ -180,35 +351,79 @@ uint8_t* TLN_GetPaletteData (TLN_Palette palette, int index)
  */
 bool TLN_MixPalettes (TLN_Palette src1, TLN_Palette src2, TLN_Palette dst, uint8_t factor)
 {
-	int c;
-	const uint8_t invfactor = 255 - factor;
-	const uint8_t* blend_table = engine->blend_table;
-	uint8_t* src1ptr;
-	uint8_t* src2ptr;
-	uint8_t* dstptr;
 	int count;
 
 	if (!CheckBaseObject (src1, OT_PALETTE) || !CheckBaseObject (src2, OT_PALETTE) || !CheckBaseObject (dst, OT_PALETTE))
 		return false;
 
-	src1ptr = TLN_GetPaletteData (src1, 0);
-	src2ptr = TLN_GetPaletteData (src2, 0);
-	dstptr  = TLN_GetPaletteData (dst, 0);
-	blend_table = SelectBlendTable (BLEND_MOD);
+	/* only colors present in all palettes */
+	count = src1->entries < src2->entries ? src1->entries : src2->entries;
+	if (dst->entries < count)
+		count = dst->entries;
 
-	if (src1->entries > src2->entries)
-		count = src1->entries;
-	else
-		count = src2->entries;
+	UpdatePaletteCycle (src1);
+	UpdatePaletteCycle (src2);
+	UpdatePaletteCycle (dst);
+	TouchPalette (dst);
+	BlendColors (dst->data, src1->data, src2->data, count, factor);
+
+	TLN_SetLastError (TLN_ERR_OK);
+	return true;
+}
+
+/*!
+ * \brief
+ * Fades several palettes towards a solid color at once
+ *
+ * \param src
+ * Array of references to the original palettes, that aren't modified
+ *
+ * \param dst
+ * Array of references to the target palettes, can be the same as src
+ *
+ * \param count
+ * Number of items in src and dst arrays
+ *
+ * \param r
+ * Red component of the color (0-255)
+ *
+ * \param g
+ * Green component of the color (0-255)
+ *
+ * \param b
+ * Blue component of the color (0-255)
+ *
+ * \param factor
+ * Integer with fading factor. 0=100% src, 255=100% color, 128=50%/50%
+ *
+ * \remarks
+ * Intended for full-screen transitions, fading from unmodified copies of the palettes in use.
+ * For fades repeated often, see TLN_CreatePaletteRamp()
+ */
+bool TLN_FadePalettes (TLN_Palette* src, TLN_Palette* dst, int count, uint8_t r, uint8_t g, uint8_t b, uint8_t factor)
+{
+	const uint32_t color = PackRGB32 (r,g,b);
+	int c;
+
+	if (src == NULL || dst == NULL)
+	{
+		TLN_SetLastError (TLN_ERR_NULL_POINTER);
+		return false;
+	}
 
-	for (c=0; c<count; c++)
+	for (c = 0; c < count; c++)
 	{
-		dstptr[0] = blendfunc(blend_table,src2ptr[0],factor) + blendfunc(blend_table,src1ptr[0],invfactor);
-		dstptr[1] = blendfunc(blend_table,src2ptr[1],factor) + blendfunc(blend_table,src1ptr[1],invfactor);
-		dstptr[2] = blendfunc(blend_table,src2ptr[2],factor) + blendfunc(blend_table,src1ptr[2],invfactor);
-		src1ptr += sizeof(uint32_t);
-		src2ptr += sizeof(uint32_t);
-		dstptr  += sizeof(uint32_t);
+		if (!CheckBaseObject (src[c], OT_PALETTE) || !CheckBaseObject (dst[c], OT_PALETTE))
+			return false;
+	}
+
+	for (c = 0; c < count; c++)
+	{
+		const int entries = src[c]->entries < dst[c]->entries ? src[c]->entries : dst[c]->entries;
+		UpdatePaletteCycle (src[c]);
+		UpdatePaletteCycle (dst[c]);
+		TouchPalette (dst[c]);
+		FadeColors (dst[c]->data, src[c]->data, color, entries, factor);
 	}
 
 	TLN_SetLastError (TLN_ERR_OK);
@@ -216,11 +431,9 @@ bool TLN_MixPalettes (TLN_Palette src1, TLN_Palette src2, TLN_Palette dst, uint8
 }
 
 /* edita rango de colores segn tabla de mezcla */
-static bool EditPaletteColor (TLN_Palette palette, uint8_t* blend_table, uint8_t r, uint8_t g, uint8_t b, uint8_t start, uint8_t num)
+static bool EditPaletteColor (TLN_Palette palette, TLN_Blend mode, uint8_t r, uint8_t g, uint8_t b, uint8_t start, uint8_t num)
 {
 	int end;
-	int c;
-	uint8_t* color_ptr;
 
 	if (!CheckBaseObject (palette, OT_PALETTE))
 		return false;
@@ -235,14 +448,9 @@ static bool EditPaletteColor (TLN_Palette palette, uint8_t* blend_table, uint8_t
 	if (end >= palette->entries)
 		end = palette->entries - 1;
 
-	color_ptr = TLN_GetPaletteData (palette, start);
-	for (c=start; c<=end; c++)
-	{
-		color_ptr[0] = blendfunc(blend_table, color_ptr[0], r);
-		color_ptr[1] = blendfunc(blend_table, color_ptr[1], g);
-		color_ptr[2] = blendfunc(blend_table, color_ptr[2], b);
-		color_ptr += sizeof(uint32_t);
-	}
+	UpdatePaletteCycle (palette);
+	TouchPalette (palette);
+	EditColors (&palette->data[start], end - start + 1, mode, r,g,b);
 
 	TLN_SetLastError (TLN_ERR_OK);
 	return true;
@@ -272,7 +480,7 @@ static bool EditPaletteColor (TLN_Palette palette, uint8_t* blend_table, uint8_t
  */
 bool TLN_AddPaletteColor (TLN_Palette palette, uint8_t r, uint8_t g, uint8_t b, uint8_t start, uint8_t num)
 {
-	return EditPaletteColor (palette, SelectBlendTable(BLEND_ADD), r,g,b, start,num);
+	return EditPaletteColor (palette, BLEND_ADD, r,g,b, start,num);
 }
 
 /*!
@@ -299,7 +507,7 @@ bool TLN_AddPaletteColor (TLN_Palette palette, uint8_t r, uint8_t g, uint8_t b,
  */
 bool TLN_SubPaletteColor (TLN_Palette palette, uint8_t r, uint8_t g, uint8_t b, uint8_t start, uint8_t num)
 {
-	return EditPaletteColor (palette, SelectBlendTable(BLEND_SUB), r,g,b, start,num);
+	return EditPaletteColor (palette, BLEND_SUB, r,g,b, start,num);
 }
 
 /*!
@@ -326,7 +534,7 @@ bool TLN_SubPaletteColor (TLN_Palette palette, uint8_t r, uint8_t g, uint8_t b,
  */
 bool TLN_ModPaletteColor (TLN_Palette palette, uint8_t r, uint8_t g, uint8_t b, uint8_t start, uint8_t num)
 {
-	return EditPaletteColor (palette, SelectBlendTable(BLEND_MOD), r,g,b, start,num);
+	return EditPaletteColor (palette, BLEND_MOD, r,g,b, start,num);
 }
 
 /*!
@@ -344,3 +552,130 @@ int TLN_GetPaletteNumColors(TLN_Palette palette)
 	TLN_SetLastError(TLN_ERR_OK);
 	return palette->entries;
 }
+
+/*!
+ * \brief
+ * Precomputes the steps of a fade from a palette towards a solid color
+ *
+ * \param src
+ * Reference to the palette with the original colors
+ *
+ * \param r
+ * Red component of the target color (0-255)
+ *
+ * \param g
+ * Green component of the target color (0-255)
+ *
+ * \param b
+ * Blue component of the target color (0-255)
+ *
+ * \param steps
+ * Number of steps, at least 2. First step has the original colors and last one the solid color
+ *
+ * \returns
+ * Reference to the created ramp, or NULL if error
+ *
+ * \remarks
+ * The ramp is built once, and then each step is copied to the palettes in use with
+ * TLN_SetPaletteRampStep(), without any color math during the transition
+ */
+TLN_PaletteRamp TLN_CreatePaletteRamp (TLN_Palette src, uint8_t r, uint8_t g, uint8_t b, int steps)
+{
+	TLN_PaletteRamp ramp;
+	const uint32_t color = PackRGB32 (r,g,b);
+	int size;
+	int c;
+
+	if (!CheckBaseObject (src, OT_PALETTE))
+		return NULL;
+
+	if (steps < 2)
+	{
+		TLN_SetLastError (TLN_ERR_WRONG_SIZE);
+		return NULL;
+	}
+
+	size = sizeof(struct PaletteRamp) + steps*src->entries*sizeof(uint32_t);
+	ramp = (TLN_PaletteRamp)CreateBaseObject (OT_PALETTERAMP, size);
+	if (!ramp)
+		return NULL;
+
+	ramp->entries = src->entries;
+	ramp->steps = steps;
+	UpdatePaletteCycle (src);
+	for (c = 0; c < steps; c++)
+	{
+		const uint8_t factor = (uint8_t)(c*255/(steps - 1));
+		FadeColors (&ramp->data[c*ramp->entries], src->data, color, ramp->entries, factor);
+	}
+
+	TLN_SetLastError (TLN_ERR_OK);
+	return ramp;
+}
+
+/*!
+ * \brief
+ * Copies the colors of a fade step into a palette
+ *
+ * \param ramp
+ * Reference to the ramp created with TLN_CreatePaletteRamp()
+ *
+ * \param dst
+ * Reference to the target palette
+ *
+ * \param step
+ * Index of the step [0, steps - 1]
+ */
+bool TLN_SetPaletteRampStep (TLN_PaletteRamp ramp, TLN_Palette dst, int step)
+{
+	int count;
+
+	if (!CheckBaseObject (ramp, OT_PALETTERAMP) || !CheckBaseObject (dst, OT_PALETTE))
+		return false;
+
+	if (step < 0 || step >= ramp->steps)
+	{
+		TLN_SetLastError (TLN_ERR_IDX_PALETTE);
+		return false;
+	}
+
+	count = ramp->entries < dst->entries ? ramp->entries : dst->entries;
+	UpdatePaletteCycle (dst);
+	TouchPalette (dst);
+	memcpy (dst->data, &ramp->data[step*ramp->entries], count*sizeof(uint32_t));
+	TLN_SetLastError (TLN_ERR_OK);
+	return true;
+}
+
+/*!
+ * \brief
+ * Returns the number of steps of a palette ramp
+ *
+ * \param ramp
+ * Reference to the ramp to query
+ */
+int TLN_GetPaletteRampSteps (TLN_PaletteRamp ramp)
+{
+	if (!CheckBaseObject (ramp, OT_PALETTERAMP))
+		return 0;
+
+	TLN_SetLastError (TLN_ERR_OK);
+	return ramp->steps;
+}
+
+/*!
+ * \brief
+ * Deletes a palette ramp and frees memory
+ *
+ * \param ramp
+ * Reference to the ramp to delete
+ */
+bool TLN_DeletePaletteRamp (TLN_PaletteRamp ramp)
+{
+	if (!CheckBaseObject (ramp, OT_PALETTERAMP))
+		return false;
+
+	DeleteBaseObject (ramp);
+	TLN_SetLastError (TLN_ERR_OK);
+	return true;
+}
@@ -29,9 +29,20 @@ struct Palette
 {
 	DEFINE_OBJECT;
 	int entries;		/* number of colors */
+	uint32_t version;	/* renewed every time colors are modified, unique among all palettes */
+	void* cycle;		/* color cycle animation pending evaluation before use, NULL if up to date */
 	uint32_t data[0];	/* variable size Color array */
 };
 
+/* precomputed fade steps of a palette */
+struct PaletteRamp
+{
+	DEFINE_OBJECT;
+	int entries;		/* number of colors of each step */
+	int steps;			/* number of steps */
+	uint32_t data[];	/* steps*entries colors */
+};
+
 /* returns pointer to specified index color definition */
 #define GetPaletteData(palette,index) \
 	&palette->data[index]
@@ -39,4 +50,12 @@ struct Palette
 #define PackRGB32(r,g,b) \
 	(uint32_t)(0xFF000000 | (r << 16) | (g << 8) | b)
 
+/* exact x/255 for 0 <= x <= 65535, same results as BLEND_MOD table */
+#define div255(x) \
+	(((x) + 1 + ((x) >> 8)) >> 8)
+
+void TouchPalette (TLN_Palette palette);
+void CopyPalette (TLN_Palette dst, TLN_Palette src);
+void BlendColors (uint32_t* dst, const uint32_t* src0, const uint32_t* src1, int count, uint8_t factor);
+
 #endif
@@ -0,0 +1,280 @@
+/*
+* Tilengine - The 2D retro graphics engine with raster effects
+* Copyright (C) 2015-2019 Marc Palacios Domenech <mailto:megamarc@hotmail.com>
+* All rights reserved
+*
+* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/.
+* */
+
+#include <stdlib.h>
+#include <string.h>
+#include "Quantize.h"
+#include "Palette.h"
+
+/* colors are packed as 0xFFRRGGBB */
+#define red(c)		(((c) >> 16) & 0xFF)
+#define green(c)	(((c) >> 8) & 0xFF)
+#define blue(c)		((c) & 0xFF)
+
+/* exact color set ---------------------------------------------------------- */
+
+static inline int hash_slot(uint32_t color)
+{
+	return (int)((color * 2654435761u) >> 22) & (COLORSET_SLOTS - 1);
+}
+
+void ColorSetInit(ColorSet* set)
+{
+	memset(set->keys, 0, sizeof(set->keys));
+	set->count = 0;
+}
+
+/* adds color if not present, returns its index in insertion order or -1 when full */
+int ColorSetAdd(ColorSet* set, uint32_t color)
+{
+	int slot = hash_slot(color);
+	while (set->keys[slot] != 0)
+	{
+		if (set->keys[slot] == color)
+			return set->values[slot];
+		slot = (slot + 1) & (COLORSET_SLOTS - 1);
+	}
+
+	if (set->count == COLORSET_MAX)
+		return -1;
+
+	set->keys[slot] = color;
+	set->values[slot] = (uint8_t)set->count;
+	set->items[set->count] = color;
+	set->count += 1;
+	return set->count - 1;
+}
+
+/* returns index of color in insertion order, or -1 if not found */
+int ColorSetFind(const ColorSet* set, uint32_t color)
+{
+	int slot = hash_slot(color);
+	while (set->keys[slot] != 0)
+	{
+		if (set->keys[slot] == color)
+			return set->values[slot];
+		slot = (slot + 1) & (COLORSET_SLOTS - 1);
+	}
+	return -1;
+}
+
+/* median cut quantizer ----------------------------------------------------- */
+
+#define HIST_BITS	5
+#define HIST_SIDE	(1 << HIST_BITS)
+#define HIST_SIZE	(1 << (3*HIST_BITS))
+
+/* 5 most significant bits of each component */
+#define hist_index(c) \
+	((((c) >> 9) & 0x7C00) | (((c) >> 6) & 0x03E0) | (((c) >> 3) & 0x001F))
+
+#define hist_cell(r,g,b) \
+	(((r) << (2*HIST_BITS)) | ((g) << HIST_BITS) | (b))
+
+struct Quantizer
+{
+	uint32_t count[HIST_SIZE];		/* pixels in each cell */
+	uint64_t sum[HIST_SIZE][3];		/* sum of r,g,b of those pixels */
+	uint8_t index[HIST_SIZE];		/* palette index of each cell after build */
+};
+
+typedef struct
+{
+	int lo[3], hi[3];	/* inclusive cell range for r,g,b */
+	uint32_t count;
+}
+Box;
+
+Quantizer* CreateQuantizer(void)
+{
+	return (Quantizer*)calloc(1, sizeof(Quantizer));
+}
+
+void QuantizerAddColor(Quantizer* quantizer, uint32_t color)
+{
+	const int cell = hist_index(color);
+	quantizer->count[cell] += 1;
+	quantizer->sum[cell][0] += red(color);
+	quantizer->sum[cell][1] += green(color);
+	quantizer->sum[cell][2] += blue(color);
+}
+
+/* shrinks box to its populated cells and updates pixel count */
+static void shrink_box(const Quantizer* quantizer, Box* box)
+{
+	int lo[3] = { HIST_SIDE, HIST_SIDE, HIST_SIDE };
+	int hi[3] = { -1, -1, -1 };
+	int r, g, b;
+
+	box->count = 0;
+	for (r = box->lo[0]; r <= box->hi[0]; r++)
+	{
+		for (g = box->lo[1]; g <= box->hi[1]; g++)
+		{
+			for (b = box->lo[2]; b <= box->hi[2]; b++)
+			{
+				const uint32_t count = quantizer->count[hist_cell(r,g,b)];
+				if (count == 0)
+					continue;
+				box->count += count;
+				if (r < lo[0]) lo[0] = r;
+				if (r > hi[0]) hi[0] = r;
+				if (g < lo[1]) lo[1] = g;
+				if (g > hi[1]) hi[1] = g;
+				if (b < lo[2]) lo[2] = b;
+				if (b > hi[2]) hi[2] = b;
+			}
+		}
+	}
+	if (box->count != 0)
+	{
+		memcpy(box->lo, lo, sizeof(lo));
+		memcpy(box->hi, hi, sizeof(hi));
+	}
+}
+
+/* splits box along its longest axis at the pixel median, new half goes to other */
+static void split_box(const Quantizer* quantizer, Box* box, Box* other)
+{
+	uint32_t slices[HIST_SIDE] = { 0 };
+	uint32_t accum = 0;
+	int axis = 0;
+	int c, cut;
+	int r, g, b;
+
+	for (c = 1; c < 3; c++)
+	{
+		if (box->hi[c] - box->lo[c] > box->hi[axis] - box->lo[axis])
+			axis = c;
+	}
+
+	/* pixel count of each slice along the axis */
+	for (r = box->lo[0]; r <= box->hi[0]; r++)
+	{
+		for (g = box->lo[1]; g <= box->hi[1]; g++)
+		{
+			for (b = box->lo[2]; b <= box->hi[2]; b++)
+			{
+				const int pos[3] = { r, g, b };
+				slices[pos[axis]] += quantizer->count[hist_cell(r,g,b)];
+			}
+		}
+	}
+
+	/* median, leaving at least one slice on each side */
+	for (cut = box->lo[axis]; cut < box->hi[axis] - 1; cut++)
+	{
+		accum += slices[cut];
+		if (accum*2 >= box->count)
+			break;
+	}
+
+	*other = *box;
+	box->hi[axis] = cut;
+	other->lo[axis] = cut + 1;
+	shrink_box(quantizer, box);
+	shrink_box(quantizer, other);
+}
+
+/* builds palette with up to max_colors (max 256), returns number of colors */
+int QuantizerBuild(Quantizer* quantizer, uint32_t* palette, int max_colors)
+{
+	Box boxes[256];
+	int num_boxes = 1;
+	int c, cell;
+
+	if (max_colors > 256)
+		max_colors = 256;
+
+	boxes[0].lo[0] = boxes[0].lo[1] = boxes[0].lo[2] = 0;
+	boxes[0].hi[0] = boxes[0].hi[1] = boxes[0].hi[2] = HIST_SIDE - 1;
+	shrink_box(quantizer, &boxes[0]);
+	if (boxes[0].count == 0)
+		return 0;
+
+	/* split most populated boxes first */
+	while (num_boxes < max_colors)
+	{
+		int best = -1;
+		for (c = 0; c < num_boxes; c++)
+		{
+			const Box* box = &boxes[c];
+			const bool splittable = box->hi[0] > box->lo[0] || box->hi[1] > box->lo[1] || box->hi[2] > box->lo[2];
+			if (splittable && (best == -1 || box->count > boxes[best].count))
+				best = c;
+		}
+		if (best == -1)
+			break;
+		split_box(quantizer, &boxes[best], &boxes[num_boxes]);
+		num_boxes += 1;
+	}
+
+	/* average color of each box */
+	for (c = 0; c < num_boxes; c++)
+	{
+		const Box* box = &boxes[c];
+		uint64_t sum[3] = { 0 };
+		int r, g, b;
+		for (r = box->lo[0]; r <= box->hi[0]; r++)
+		{
+			for (g = box->lo[1]; g <= box->hi[1]; g++)
+			{
+				for (b = box->lo[2]; b <= box->hi[2]; b++)
+				{
+					cell = hist_cell(r,g,b);
+					sum[0] += quantizer->sum[cell][0];
+					sum[1] += quantizer->sum[cell][1];
+					sum[2] += quantizer->sum[cell][2];
+				}
+			}
+		}
+		palette[c] = PackRGB32((uint32_t)(sum[0]/box->count), (uint32_t)(sum[1]/box->count), (uint32_t)(sum[2]/box->count));
+	}
+
+	/* map each populated cell to nearest palette color */
+	for (cell = 0; cell < HIST_SIZE; cell++)
+	{
+		const uint32_t count = quantizer->count[cell];
+		int r, g, b, best = 0;
+		int best_dist = 0x7FFFFFFF;
+
+		if (count == 0)
+			continue;
+		r = (int)(quantizer->sum[cell][0]/count);
+		g = (int)(quantizer->sum[cell][1]/count);
+		b = (int)(quantizer->sum[cell][2]/count);
+		for (c = 0; c < num_boxes; c++)
+		{
+			const int dr = r - (int)red(palette[c]);
+			const int dg = g - (int)green(palette[c]);
+			const int db = b - (int)blue(palette[c]);
+			const int dist = 2*dr*dr + 4*dg*dg + 3*db*db;
+			if (dist < best_dist)
+			{
+				best_dist = dist;
+				best = c;
+			}
+		}
+		quantizer->index[cell] = (uint8_t)best;
+	}
+
+	return num_boxes;
+}
+
+/* returns palette index of a color added before building */
+int QuantizerGetIndex(const Quantizer* quantizer, uint32_t color)
+{
+	return quantizer->index[hist_index(color)];
+}
+
+void DeleteQuantizer(Quantizer* quantizer)
+{
+	free(quantizer);
+}
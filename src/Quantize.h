@@ -0,0 +1,42 @@
+/*
+* Tilengine - The 2D retro graphics engine with raster effects
+* Copyright (C) 2015-2019 Marc Palacios Domenech <mailto:megamarc@hotmail.com>
+* All rights reserved
+*
+* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/.
+* */
+
+#ifndef _QUANTIZE_H
+#define _QUANTIZE_H
+
+#include "Tilengine.h"
+
+/* exact color set with hashed lookup, up to 255 colors */
+#define COLORSET_MAX	255
+#define COLORSET_SLOTS	1024
+
+typedef struct
+{
+	uint32_t keys[COLORSET_SLOTS];		/* packed colors, 0 = empty slot */
+	uint8_t values[COLORSET_SLOTS];		/* index inside items[] */
+	uint32_t items[COLORSET_MAX];		/* colors in insertion order */
+	int count;
+}
+ColorSet;
+
+void ColorSetInit(ColorSet* set);
+int ColorSetAdd(ColorSet* set, uint32_t color);
+int ColorSetFind(const ColorSet* set, uint32_t color);
+
+/* median cut quantizer over a 15-bit color histogram */
+typedef struct Quantizer Quantizer;
+
+Quantizer* CreateQuantizer(void);
+void QuantizerAddColor(Quantizer* quantizer, uint32_t color);
+int QuantizerBuild(Quantizer* quantizer, uint32_t* palette, int max_colors);
+int QuantizerGetIndex(const Quantizer* quantizer, uint32_t color);
+void DeleteQuantizer(Quantizer* quantizer);
+
+#endif
@@ -28,8 +28,14 @@ extern"C" {
 	/* closes an opened resource pack */
 	void ResPack_Close(ResPack rp);
 	
+	/* returns true if the pack contains the asset */
+	bool ResPack_FindAsset(ResPack rp, const char* filename);
+
 	/* loads contents of asset to memory, returns buffer and actual size */
 	void* ResPack_LoadAsset(ResPack rp, const char* filename, uint32_t* size);
+
+	/* returns contents of asset inside an unencrypted pack without copying, NULL if it must be loaded. Valid until pack is closed */
+	const void* ResPack_MapAsset(ResPack rp, const char* filename, uint32_t* size);
 	
 	/* creates a temporal file and opens it, returns asset handler */
 	ResAsset ResPack_OpenAsset(ResPack rp, const char* filename);
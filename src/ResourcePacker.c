@@ -15,29 +15,58 @@
 #include "aes.h"
 #include "crc32.h"
 #include "md5.h"
+#include "zlib.h"
 #include "ResPack.h"
 
+#if defined (_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
 #define KEY_SIZE	128
 #define FILE_ID		"ResPack"
+#define VERSION		2
+#define CHUNK_SIZE	16384	/* streaming block, multiple of AES_BLOCK_SIZE */
+#define ALIGNMENT	16		/* start of assets, so mapped content can be used in place */
+
+/* ResEntry flags */
+#define RES_COMPRESSED	0x01	/* content is deflated with zlib */
 
 static uint8_t iv[AES_BLOCK_SIZE] = { 0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f };
 
-/* asset descriptor register */
+/* asset descriptor register, sorted by id inside the pack */
 typedef struct
 {
 	uint32_t	id;			/* hash identifier derived from original file path */
 	uint32_t	crc;		/* crc of asset content to verify integrity */
 	uint32_t	data_size;	/* actual size of asset */
-	uint32_t	pack_size;	/* size padded to 16-byte boundary, required by AES */
+	uint32_t	pack_size;	/* stored size, compressed and padded to 16-byte boundary if encrypted */
 	uint32_t	offset;		/* start of asset content */
+	uint32_t	flags;		/* RES_COMPRESSED */
 }
 ResEntry;
 
+/* asset descriptor register of version 1 packs, unsorted and uncompressed */
+typedef struct
+{
+	uint32_t	id;
+	uint32_t	crc;
+	uint32_t	data_size;
+	uint32_t	pack_size;
+	uint32_t	offset;
+}
+ResEntryV1;
+
 /* ResPack file header*/
 typedef struct
 {
 	char id[8];				/* file header, must be "ResPack" null-terminated */
-	uint32_t reserved;		/* reserved, for future usage */
+	uint32_t version;		/* format version, 0 in version 1 packs */
 	uint32_t num_regs;		/* number of assets */
 }
 ResHeader;
@@ -45,11 +74,13 @@ ResHeader;
 /* private ResPack memory handler */
 struct _ResPack
 {
-	FILE* pf;				/* file handler */
+	FILE* pf;				/* file handler, NULL when mapped */
+	uint8_t* map;			/* whole file mapped in memory, only unencrypted packs */
+	size_t map_size;		/* size of mapping */
 	uint32_t key[60];		/* scheduled AES key*/
 	uint32_t num_entries;	/* number of assets */
 	bool encrypted;			/* true if pack is encrypted */
-	ResEntry entries[0];	/* array of ResEntry fields */
+	ResEntry* entries;		/* array of ResEntry fields, inside mapping or after this struct */
 };
 
 /* private opened asset memory handler */
@@ -82,12 +113,82 @@ static uint32_t path2_crc32(const char* filename)
 	return _crc32(0, path, strlen(path));
 }
 
-/* finds given entry inside a resource pack */
+/* maps whole pack file read-only in memory, NULL if not possible */
+static uint8_t* map_pack(const char* filename, size_t* map_size)
+{
+	void* data = NULL;
+
+#if defined (_WIN32)
+	HANDLE file, mapping;
+	LARGE_INTEGER size;
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+	{
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping != NULL)
+		{
+			data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+	if (data != NULL)
+		*map_size = (size_t)size.QuadPart;
+#else
+	struct stat info;
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+	if (fstat(fd, &info) == 0 && info.st_size > 0)
+	{
+		data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (data == MAP_FAILED)
+			data = NULL;
+	}
+	close(fd);
+	if (data != NULL)
+		*map_size = (size_t)info.st_size;
+#endif
+
+	return (uint8_t*)data;
+}
+
+/* releases mapping obtained with map_pack() */
+static void unmap_pack(uint8_t* data, size_t map_size)
+{
+#if defined (_WIN32)
+	UnmapViewOfFile(data);
+#else
+	munmap(data, map_size);
+#endif
+}
+
+/* checks that stored content of an entry lies inside the mapping */
+static bool inside_map(ResPack rp, ResEntry* entry, uint32_t size)
+{
+	return (uint64_t)entry->offset + size <= rp->map_size;
+}
+
+/* qsort() callback to sort index by id */
+static int compare_entries(const void* a, const void* b)
+{
+	const ResEntry* entry1 = (const ResEntry*)a;
+	const ResEntry* entry2 = (const ResEntry*)b;
+
+	if (entry1->id < entry2->id)
+		return -1;
+	else if (entry1->id > entry2->id)
+		return 1;
+	return 0;
+}
+
+/* finds given entry inside a resource pack with binary search */
 static ResEntry* find_entry(ResPack rp, const char* filename)
 {
 	uint32_t id;
-	uint32_t c;
-	ResEntry* entry = NULL;
+	uint32_t low, high;
 
 	/* validate params */
 	if (rp == NULL || filename == NULL)
@@ -95,44 +196,127 @@ static ResEntry* find_entry(ResPack rp, const char* filename)
 
 	/* find entry */
 	id = path2_crc32(filename);
-	for (c = 0; c < rp->num_entries; c++)
+	low = 0;
+	high = rp->num_entries;
+	while (low < high)
 	{
-		if (rp->entries[c].id == id)
-			return &rp->entries[c];
+		uint32_t mid = low + (high - low) / 2;
+		ResEntry* entry = &rp->entries[mid];
+		if (entry->id == id)
+			return entry;
+		else if (entry->id < id)
+			low = mid + 1;
+		else
+			high = mid;
 	}
 	return NULL;
 }
 
-/* loads given asset to memory buffer */
+/* loads given asset to memory buffer. Content is read, decrypted, inflated and
+ * crc-checked chunk by chunk straight into the returned buffer */
 static void* load_asset(ResPack rp, ResEntry* entry)
 {
-	uint32_t crc;
-	uint8_t* buffer = (uint8_t*)malloc(entry->data_size + 1);
+	uint8_t input[CHUNK_SIZE];		/* cyphertext or stored content */
+	uint8_t plaintext[CHUNK_SIZE];	/* decrypted chunk that doesn't fit in buffer */
+	uint8_t chain[AES_BLOCK_SIZE];	/* CBC vector of next chunk */
+	z_stream stream = { 0 };
+	bool compressed = (entry->flags & RES_COMPRESSED) != 0;
+	bool ok = true;
+	uint32_t remaining = entry->pack_size;
+	uint32_t written = 0;
+	uint32_t crc = 0;
+	uint8_t* buffer;
+
+	/* stored content must be whole AES blocks */
+	if (rp->encrypted == true && (entry->pack_size % AES_BLOCK_SIZE) != 0)
+		return NULL;
+	if (rp->map != NULL && !inside_map(rp, entry, entry->pack_size))
+		return NULL;
+
+	buffer = (uint8_t*)malloc(entry->data_size + 1);
 	if (buffer == NULL)
 		return NULL;
 
-	fseek(rp->pf, entry->offset, SEEK_SET);
-	if (rp->encrypted == true)
+	if (compressed)
 	{
-		void* cyphertext = malloc(entry->pack_size);
-		void* plaintext = malloc(entry->pack_size);
-		if (cyphertext != NULL && plaintext != NULL)
+		if (inflateInit(&stream) != Z_OK)
 		{
-			fread(cyphertext, entry->pack_size, 1, rp->pf);
-			aes_decrypt_cbc((uint8_t*)cyphertext, entry->pack_size, (uint8_t*)plaintext, rp->key, KEY_SIZE, iv);
-			memcpy(buffer, plaintext, entry->data_size);
+			free(buffer);
+			return NULL;
 		}
-		if (plaintext != NULL)
-			free(plaintext);
-		if (cyphertext != NULL)
-			free(cyphertext);
+		stream.next_out = buffer;
+		stream.avail_out = entry->data_size;
 	}
-	else
-		fread(buffer, entry->data_size, 1, rp->pf);
+
+	memcpy(chain, iv, AES_BLOCK_SIZE);
+	if (rp->pf != NULL)
+		fseek(rp->pf, entry->offset, SEEK_SET);
+	while (ok && remaining > 0 && written < entry->data_size)
+	{
+		uint32_t size = remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE;
+		uint8_t* data = input;
+
+		/* mapped content is used in place, plain content is read straight to buffer */
+		if (rp->map != NULL)
+			data = rp->map + entry->offset + (entry->pack_size - remaining);
+		else
+		{
+			if (!rp->encrypted && !compressed)
+			{
+				if (written + size > entry->data_size)
+					size = entry->data_size - written;
+				data = buffer + written;
+			}
+
+			if (fread(data, size, 1, rp->pf) != 1)
+			{
+				ok = false;
+				break;
+			}
+		}
+		remaining -= size;
+
+		/* decrypt in buffer if the whole chunk fits, PKCS#7 padding of last chunk doesn't */
+		if (rp->encrypted == true)
+		{
+			uint8_t* target = plaintext;
+			if (!compressed && written + size <= entry->data_size)
+				target = buffer + written;
+			aes_decrypt_cbc(input, size, target, rp->key, KEY_SIZE, chain);
+			memcpy(chain, input + size - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+			data = target;
+		}
+
+		/* append to buffer */
+		if (compressed)
+		{
+			int result;
+			stream.next_in = data;
+			stream.avail_in = size;
+			result = inflate(&stream, Z_NO_FLUSH);
+			crc = _crc32(crc, buffer + written, stream.total_out - written);
+			written = (uint32_t)stream.total_out;
+			if (result == Z_STREAM_END)
+				break;
+			if (result != Z_OK)
+				ok = false;
+		}
+		else
+		{
+			if (written + size > entry->data_size)
+				size = entry->data_size - written;
+			if (data != buffer + written)
+				memcpy(buffer + written, data, size);
+			crc = _crc32(crc, buffer + written, size);
+			written += size;
+		}
+	}
+
+	if (compressed)
+		inflateEnd(&stream);
 
 	/* validate integrity */
-	crc = _crc32(0, buffer, entry->data_size);
-	if (crc == entry->crc)
+	if (ok && written == entry->data_size && crc == entry->crc)
 		buffer[entry->data_size] = 0;	// NULL-terminated string
 	else
 	{
@@ -161,6 +345,10 @@ ResPack ResPack_Open(const char* filename, const char* passphrase)
 	ResHeader res_header;
 	FILE* pf;
 	uint32_t size;
+	uint32_t loaded;
+	uint8_t* map = NULL;
+	size_t map_size = 0;
+	bool index_mapped;
 
 	/* open file */
 	pf = fopen(filename, "rb");
@@ -168,24 +356,40 @@ ResPack ResPack_Open(const char* filename, const char* passphrase)
 		return NULL;
 
 	/* check header */
-	fread(&res_header, sizeof(res_header), 1, pf);
-	if (strcmp(res_header.id, FILE_ID))
+	if (fread(&res_header, sizeof(res_header), 1, pf) != 1 || memcmp(res_header.id, FILE_ID, sizeof(FILE_ID)) ||
+		res_header.version > VERSION || res_header.num_regs > (UINT32_MAX - sizeof(struct _ResPack)) / sizeof(ResEntry))
 	{
 		fclose(pf);
 		return NULL;
 	}
 
-	/* create object */
-	size = sizeof(struct _ResPack) + sizeof(ResEntry)*res_header.num_regs;
+	/* unencrypted packs are mapped, their assets can be used in place */
+	if (passphrase == NULL)
+		map = map_pack(filename, &map_size);
+
+	/* create object, version 2 index is used in place when mapped */
+	index_mapped = map != NULL && res_header.version == VERSION &&
+		(uint64_t)sizeof(ResHeader) + (uint64_t)sizeof(ResEntry)*res_header.num_regs <= map_size;
+	size = sizeof(struct _ResPack);
+	if (!index_mapped)
+		size += sizeof(ResEntry)*res_header.num_regs;
 	rp = (ResPack)calloc(size, 1);
 	if (rp == NULL)
 	{
+		if (map != NULL)
+			unmap_pack(map, map_size);
 		fclose(pf);
 		return NULL;
 	}
 
 	rp->num_entries = res_header.num_regs;
 	rp->pf = pf;
+	rp->map = map;
+	rp->map_size = map_size;
+	if (index_mapped)
+		rp->entries = (ResEntry*)(map + sizeof(ResHeader));
+	else
+		rp->entries = (ResEntry*)(rp + 1);
 	
 	/* prepare AES-128 key*/
 	if (passphrase != NULL)
@@ -195,7 +399,35 @@ ResPack ResPack_Open(const char* filename, const char* passphrase)
 	}
 
 	/* load index */
-	fread(rp->entries, sizeof(ResEntry), rp->num_entries, pf);
+	if (index_mapped)
+		loaded = rp->num_entries;
+	else if (res_header.version == VERSION)
+		loaded = (uint32_t)fread(rp->entries, sizeof(ResEntry), rp->num_entries, pf);
+	else
+	{
+		/* version 1: widen entries and sort them for lookup */
+		ResEntryV1 entry;
+		for (loaded = 0; loaded < rp->num_entries; loaded++)
+		{
+			if (fread(&entry, sizeof(entry), 1, pf) != 1)
+				break;
+			memcpy(&rp->entries[loaded], &entry, sizeof(entry));
+		}
+		qsort(rp->entries, rp->num_entries, sizeof(ResEntry), compare_entries);
+	}
+
+	if (loaded != rp->num_entries)
+	{
+		ResPack_Close(rp);
+		return NULL;
+	}
+
+	/* file handler not needed anymore */
+	if (map != NULL)
+	{
+		fclose(pf);
+		rp->pf = NULL;
+	}
 	return rp;
 }
 
@@ -206,10 +438,18 @@ void ResPack_Close(ResPack rp)
 	{
 		if (rp->pf != NULL)
 			fclose(rp->pf);
+		if (rp->map != NULL)
+			unmap_pack(rp->map, rp->map_size);
 		free(rp);
 	}
 }
 
+/* returns true if the pack contains the asset */
+bool ResPack_FindAsset(ResPack rp, const char* filename)
+{
+	return find_entry(rp, filename) != NULL;
+}
+
 /* loads contents of asset to memory, returns actual size*/
 void* ResPack_LoadAsset(ResPack rp, const char* filename, uint32_t* size)
 {
@@ -229,6 +469,27 @@ void* ResPack_LoadAsset(ResPack rp, const char* filename, uint32_t* size)
 	return asset;
 }
 
+/* returns content of asset inside the mapped pack without copying it, returns actual size */
+const void* ResPack_MapAsset(ResPack rp, const char* filename, uint32_t* size)
+{
+	ResEntry* entry = NULL;
+	const uint8_t* data;
+
+	/* only unencrypted packs are mapped, compressed assets must be loaded */
+	entry = find_entry(rp, filename);
+	if (entry == NULL || rp->map == NULL || (entry->flags & RES_COMPRESSED) || !inside_map(rp, entry, entry->data_size))
+		return NULL;
+
+	/* validate integrity */
+	data = rp->map + entry->offset;
+	if (_crc32(0, data, entry->data_size) != entry->crc)
+		return NULL;
+
+	if (size != NULL)
+		*size = entry->data_size;
+	return data;
+}
+
 /* creates a temporal file and opens it */
 ResAsset ResPack_OpenAsset(ResPack rp, const char* filename)
 {
@@ -324,7 +585,7 @@ int ResPack_Build(const char* filelist, const char* passphrase)
 {
 	FILE* pf_list;
 	FILE* pf_output;
-	ResHeader res_header = { FILE_ID, 0 };
+	ResHeader res_header = { FILE_ID, VERSION };
 	ResEntry* res_entries = NULL;
 	char* dot;
 	char filename[100];
@@ -364,8 +625,10 @@ int ResPack_Build(const char* filelist, const char* passphrase)
 	offset = sizeof(ResHeader) + (res_header.num_regs * sizeof(ResEntry));
 	for (c = 0; c < res_header.num_regs; c++)
 	{
-		ResEntry* entry = &res_entries[c];
+		ResEntry* entry = &res_entries[count];
 		void* content;
+		uLongf deflated_size;
+		void* deflated;
 		
 		/* load source content */
 		fgets(line, sizeof(line), pf_list);
@@ -380,26 +643,43 @@ int ResPack_Build(const char* filelist, const char* passphrase)
 		}
 
 		/* update entry header */
+		offset = (offset + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
 		entry->pack_size = entry->data_size;
 		entry->offset = offset;
 		entry->id = path2_crc32(line);
 		entry->crc = _crc32(0, content, entry->data_size);
+		entry->flags = 0;
 		count += 1;
 
+		/* compress only when it saves space, already compressed formats like png usually don't */
+		deflated_size = compressBound(entry->data_size);
+		deflated = malloc(deflated_size);
+		if (deflated != NULL && compress2((Bytef*)deflated, &deflated_size, (const Bytef*)content, entry->data_size, Z_BEST_COMPRESSION) == Z_OK &&
+			deflated_size < entry->data_size)
+		{
+			free(content);
+			content = deflated;
+			entry->pack_size = (uint32_t)deflated_size;
+			entry->flags |= RES_COMPRESSED;
+		}
+		else
+			free(deflated);
+
 		/* optional encryption */
 		if (passphrase != NULL)
 		{
 			/* calc full block size */
-			uint32_t pack_size = (entry->data_size + AES_BLOCK_SIZE - 1) & ~(AES_BLOCK_SIZE - 1);
-			if (pack_size == entry->data_size)
+			uint32_t stored_size = entry->pack_size;
+			uint32_t pack_size = (stored_size + AES_BLOCK_SIZE - 1) & ~(AES_BLOCK_SIZE - 1);
+			if (pack_size == stored_size)
 				pack_size += AES_BLOCK_SIZE;
 			entry->pack_size = pack_size;
 
 			/* allocate & fill with PKCS#7 padding value*/
 			uint8_t* plaintext = (uint8_t*)malloc(pack_size);
-			uint32_t pkcs7_value = pack_size - entry->data_size;
-			memcpy(plaintext, content, entry->data_size);
-			memset(&plaintext[entry->data_size], pkcs7_value, pkcs7_value);
+			uint32_t pkcs7_value = pack_size - stored_size;
+			memcpy(plaintext, content, stored_size);
+			memset(&plaintext[stored_size], pkcs7_value, pkcs7_value);
 			free(content);
 
 			/* encrypt & discard plaintext */
@@ -418,6 +698,15 @@ int ResPack_Build(const char* filelist, const char* passphrase)
 		offset += entry->pack_size;
 	}
 
+	/* sort index for binary search, skipping missing assets */
+	res_header.num_regs = count;
+	qsort(res_entries, count, sizeof(ResEntry), compare_entries);
+	for (c = 1; c < (uint32_t)count; c++)
+	{
+		if (res_entries[c].id == res_entries[c - 1].id)
+			printf("ResPack_Build warning: duplicated asset id %08X, rename one of the files\n", res_entries[c].id);
+	}
+
 	/* write headers */
 	fseek(pf_output, 0, SEEK_SET);
 	fwrite(&res_header, sizeof(ResHeader), 1, pf_output);
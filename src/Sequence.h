@@ -18,8 +18,8 @@
 struct Strip
 {
 	int delay;
-	int timer;
-	int t0;
+	int64_t timer;
+	int64_t t0;
 	uint8_t first;
 	uint8_t count;
 	uint8_t dir;
@@ -93,9 +93,13 @@ bool TLN_SetSpriteSet (int nsprite, TLN_Spriteset spriteset)
 		sprite->ok = TLN_SetSpritePicture(nsprite, 0);
 	}
 
-	/* sprite enabled: add to the end */
+	/* sprite enabled: add to the end, resume pending animation */
 	if (enabled == false && sprite->ok == true)
+	{
 		ListAppendNode(&engine->list_sprites, nsprite);
+		if (sprite->animation.enabled && !sprite->animation.paused)
+			ResumeAnimation(&sprite->animation);
+	}
 	
 	return sprite->ok;
 }
@@ -120,6 +124,7 @@ bool TLN_SetSpriteFlags (int nsprite, uint32_t flags)
 	}
 	
 	engine->sprites[nsprite].flags = flags;
+	UpdateSprite (&engine->sprites[nsprite]);
 	TLN_SetLastError (TLN_ERR_OK);
 	return true;
 }
@@ -142,6 +147,7 @@ bool TLN_EnableSpriteFlag(int nsprite, uint32_t flag, bool enable)
 		engine->sprites[nsprite].flags |= flag;
 	else
 		engine->sprites[nsprite].flags &= ~flag;
+	UpdateSprite(&engine->sprites[nsprite]);
 
 	TLN_SetLastError(TLN_ERR_OK);
 	return true;
@@ -744,8 +750,8 @@ TLNAPI bool TLN_GetSpriteState(int nsprite, TLN_SpriteState* state)
 	state->y = sprite->y;
 	if (sprite->info != NULL)
 	{
-		state->w = sprite->info->w;
-		state->h = sprite->info->h;
+		state->w = sprite->info->frame_w;
+		state->h = sprite->info->frame_h;
 		if (sprite->mode == MODE_SCALING)
 		{
 			state->w = (int)(state->w * sprite->sx);
@@ -897,31 +903,62 @@ void TLN_SetSpritesMaskRegion(int top_line, int bottom_line)
 	engine->sprite_mask_bottom = bottom_line;
 }
 
+/* returns 16.16 source step for a scaled axis. Derived from the scale factor so sampling doesn't
+ * wobble when the target size is rounded, limited so the last pixel never goes past the source */
+static int get_scaling_step (float scale, int srcsize, int dstsize)
+{
+	int step = float2fix(1.0f / scale);
+	if ((dstsize - 1)*step >= int2fix(srcsize))
+		step = int2fix(srcsize) / dstsize;
+	return step;
+}
+
+/* returns first target pixel whose 16.16 source position is at or past pos */
+static int get_first_step (int pos, int step)
+{
+	return (pos + step - 1) / step;
+}
+
 /* updates clipping rect cache */
 void UpdateSprite (Sprite* sprite)
 {
+	const SpriteEntry* info;
 	int w,h;
+	int bx, by;
 
 	if (!sprite->ok)
 		return;
 
-	if (sprite->sx > 1.0)
-		w = 0;
-
-	/* sprite source rectangle */
-	MakeRect(&sprite->srcrect, 0, 0, sprite->info->w, sprite->info->h);
+	/* stored pixels may be trimmed: get their box inside the frame as seen on screen */
+	info = sprite->info;
+	bx = info->xoffset;
+	by = info->yoffset;
+	if (sprite->flags & FLAG_FLIPX)
+		bx = info->frame_w - info->xoffset - info->w;
+	if (sprite->flags & FLAG_FLIPY)
+		by = info->frame_h - info->yoffset - info->h;
 
 	/* standard clipping */
 	if (sprite->mode == MODE_NORMAL)
 	{
-		w = sprite->info->w;
-		h = sprite->info->h;
+		w = info->w;
+		h = info->h;
 
-		int x = sprite->x - (int)(w * sprite->ptx);
-		int y = sprite->y - (int)(h * sprite->pty);
+		int x = sprite->x - (int)(info->frame_w * sprite->ptx);
+		int y = sprite->y - (int)(info->frame_h * sprite->pty);
+
+		/* rotation transposes the box (only square frames can be rotated) */
+		if ((sprite->flags & FLAG_ROTATE) && info->frame_w == info->frame_h)
+		{
+			w = info->h;
+			h = info->w;
+			bx = (sprite->flags & FLAG_FLIPX) ? info->frame_h - info->yoffset - info->h : info->yoffset;
+			by = (sprite->flags & FLAG_FLIPY) ? info->frame_w - info->xoffset - info->w : info->xoffset;
+		}
 
 		/* screen target rectangle */
-		MakeRect(&sprite->dstrect, x, y, w, h);
+		MakeRect(&sprite->srcrect, 0, 0, w, h);
+		MakeRect(&sprite->dstrect, x + bx, y + by, w, h);
 
 		/* vertical clipping */
 		if (sprite->dstrect.y1 < 0)
@@ -951,54 +988,65 @@ void UpdateSprite (Sprite* sprite)
 	/* clipping scaling */
 	else if (sprite->mode == MODE_SCALING)
 	{
-		w = (int)(sprite->info->w * sprite->sx);
-		h = (int)(sprite->info->h * sprite->sy);
+		int x, y, x1, y1, x2, y2;
+
+		w = (int)(info->frame_w * sprite->sx);
+		h = (int)(info->frame_h * sprite->sy);
+		if (w < 1)
+			w = 1;
+		if (h < 1)
+			h = 1;
+
+		/* 16.16 source steps */
+		sprite->dx = get_scaling_step (sprite->sx, info->frame_w, w);
+		sprite->dy = get_scaling_step (sprite->sy, info->frame_h, h);
+
+		/* frame position and target pixels sampling the stored box, same as sampling the whole frame */
+		x = sprite->x - (int)(w * sprite->ptx);
+		y = sprite->y - (int)(h * sprite->pty);
+		x1 = get_first_step (int2fix(bx), sprite->dx);
+		y1 = get_first_step (int2fix(by), sprite->dy);
+		x2 = get_first_step (int2fix(bx + info->w), sprite->dx);
+		y2 = get_first_step (int2fix(by + info->h), sprite->dy);
+		if (x2 > w)
+			x2 = w;
+		if (y2 > h)
+			y2 = h;
 
 		/* screen target rectangle */
-		sprite->dstrect.x1 = sprite->x - (int)(w * sprite->ptx);
-		sprite->dstrect.y1 = sprite->y - (int)(h * sprite->pty);
-		sprite->dstrect.x2 = sprite->dstrect.x1 + w;
-		sprite->dstrect.y2 = sprite->dstrect.y1 + h;
-
-		/* source coords are 16.16 fixed point */
-		sprite->srcrect.x1 = int2fix (sprite->srcrect.x1);
-		sprite->srcrect.y1 = int2fix (sprite->srcrect.y1);
-		sprite->srcrect.x2 = int2fix (sprite->srcrect.x2);
-		sprite->srcrect.y2 = int2fix (sprite->srcrect.y2);
-
-		int srcw = sprite->srcrect.x2 - sprite->srcrect.x1;
-		int srch = sprite->srcrect.y2 - sprite->srcrect.y1;
-		int dstw = sprite->dstrect.x2 - sprite->dstrect.x1;
-		int dsth = sprite->dstrect.y2 - sprite->dstrect.y1;
+		sprite->dstrect.x1 = x + x1;
+		sprite->dstrect.y1 = y + y1;
+		sprite->dstrect.x2 = x + x2;
+		sprite->dstrect.y2 = y + y2;
 
-		sprite->dx = srcw/dstw;
-		sprite->dy = srch/dsth;
-
-		/* TODO */
+		/* source coords are 16.16 fixed point, clipped start is the exact position of the first visible pixel */
+		sprite->srcrect.x1 = x1*sprite->dx - int2fix(bx);
+		sprite->srcrect.y1 = y1*sprite->dy - int2fix(by);
 
 		/* clipping vertical */
 		if (sprite->dstrect.y1 < 0)
 		{
-			sprite->srcrect.y1 -= (sprite->dstrect.y1*sprite->dy);
+			sprite->srcrect.y1 -= sprite->dstrect.y1*sprite->dy;
 			sprite->dstrect.y1 = 0;
 		}
 		if (sprite->dstrect.y2 > engine->framebuffer.height)
-		{
-			sprite->srcrect.y2 -= (sprite->dstrect.y2 - engine->framebuffer.height)*sprite->dy;
 			sprite->dstrect.y2 = engine->framebuffer.height;
-		}
 
 		/* clipping horizontal */
 		if (sprite->dstrect.x1 < 0)
 		{
-			sprite->srcrect.x1 -= (sprite->dstrect.x1*sprite->dx);
+			sprite->srcrect.x1 -= sprite->dstrect.x1*sprite->dx;
 			sprite->dstrect.x1 = 0;
 		}
 		if (sprite->dstrect.x2 > engine->framebuffer.width)
-		{
-			sprite->srcrect.x2 -= (sprite->dstrect.x2 - engine->framebuffer.width)*sprite->dx;
 			sprite->dstrect.x2 = engine->framebuffer.width;
-		}
+
+		sprite->srcrect.x2 = sprite->srcrect.x1 + (sprite->dstrect.x2 - sprite->dstrect.x1)*sprite->dx;
+		sprite->srcrect.y2 = sprite->srcrect.y1 + (sprite->dstrect.y2 - sprite->dstrect.y1)*sprite->dy;
+
+		/* restart incremental line stepping */
+		sprite->srcline = -2;
+		SelectSpriteBlitter (sprite);
 	}
 
 	/*
@@ -1014,7 +1062,10 @@ static void SelectSpriteBlitter (Sprite* sprite)
 	const bool scaling = sprite->mode == MODE_SCALING;
 	const bool blend = sprite->blend != NULL;
 
-	sprite->blitter = SelectBlitter (true, scaling, blend);
+	if (scaling)
+		sprite->blitter = SelectSpriteScalingBlitter (sprite->dx, blend);
+	else
+		sprite->blitter = SelectBlitter (8, true, scaling, blend);
 }
 
 void MakeRect(rect_t* rect, int x, int y, int w, int h)
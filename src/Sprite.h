@@ -38,7 +38,9 @@ typedef struct Sprite
 	int				num;
 	int				index;			/* spriteset picture index */
 	int				x,y;			/* screen space location (TLN_SetSpritePosition) */
-	int				dx,dy;
+	int				dx,dy;			/* 16.16 source steps when scaling */
+	int				srcy;			/* current 16.16 source line when scaling */
+	int				srcline;		/* scanline that srcy belongs to */
 	int				xworld, yworld;	/* world space location (TLN_SetSpriteWorldPosition) */
 	float			sx,sy;
 	float			ptx, pty;		/* normalized pivot position inside sprite (default = 0,0) */
@@ -0,0 +1,402 @@
+/*
+* Tilengine - The 2D retro graphics engine with raster effects
+* Copyright (C) 2015-2019 Marc Palacios Domenech <mailto:megamarc@hotmail.com>
+* All rights reserved
+*
+* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/.
+* */
+
+#include <stdlib.h>
+#include <string.h>
+#include "Tilengine.h"
+#include "SpriteGroup.h"
+#include "Engine.h"
+#include "Tables.h"
+
+/* screen box of the stored (maybe trimmed) pixels of a frame */
+void GetInstanceBox(const SpriteEntry* info, uint16_t flags, int* bx, int* by)
+{
+	*bx = (flags & FLAG_FLIPX) ? info->frame_w - info->xoffset - info->w : info->xoffset;
+	*by = (flags & FLAG_FLIPY) ? info->frame_h - info->yoffset - info->h : info->yoffset;
+}
+
+/* gets vertical span of an instance, false if it has nothing to draw on screen */
+static bool get_instance_lines(TLN_SpriteGroup group, int index, int* y1, int* y2)
+{
+	const TLN_SpriteInstance* instance = &group->instances[index];
+	const SpriteEntry* info;
+	int bx, by, x1;
+
+	if (index >= group->count || instance->index >= group->spriteset->entries)
+		return false;
+
+	info = &group->spriteset->data[instance->index];
+	if (info->w <= 0 || info->h <= 0)
+		return false;
+
+	GetInstanceBox(info, (uint16_t)(group->flags ^ instance->flags), &bx, &by);
+	x1 = instance->x + bx;
+	if (x1 >= engine->framebuffer.width || x1 + info->w <= 0)
+		return false;
+
+	*y1 = instance->y + by;
+	*y2 = *y1 + info->h;
+	return true;
+}
+
+/* distributes visible instances into per-line lists, starting at given scanline */
+static bool build_lines(TLN_SpriteGroup group, int nscan)
+{
+	const int height = engine->framebuffer.height;
+	int c;
+
+	if (group->height != height)
+	{
+		int* line_head = (int*)realloc(group->line_head, height * sizeof(int));
+		if (line_head == NULL)
+			return false;
+		group->line_head = line_head;
+		group->height = height;
+	}
+
+	for (c = nscan; c < height; c++)
+		group->line_head[c] = -1;
+
+	/* backwards, so each list ends up ordered by index */
+	for (c = group->count - 1; c >= 0; c--)
+	{
+		int y1, y2;
+		if (!get_instance_lines(group, c, &y1, &y2) || y2 <= nscan || y1 >= height)
+			continue;
+		if (y1 < nscan)
+			y1 = nscan;
+		group->links[c] = group->line_head[y1];
+		group->line_head[y1] = c;
+	}
+	group->active = -1;
+	return true;
+}
+
+/* updates list of instances covering given scanline, returns first one or -1 */
+int UpdateSpriteGroupLine(TLN_SpriteGroup group, int nscan)
+{
+	int* links = group->links;
+	int head = -1;
+	int* tail = &head;
+	int a, b;
+
+	if (nscan != group->line)
+	{
+		if (!build_lines(group, nscan))
+			return -1;
+	}
+	group->line = nscan + 1;
+
+	/* merge instances starting here into active list keeping index order, drop finished ones */
+	a = group->active;
+	b = group->line_head[nscan];
+	while (a != -1 || b != -1)
+	{
+		int c, y1, y2;
+		if (b == -1 || (a != -1 && a < b))
+		{
+			c = a;
+			a = links[a];
+			if (!get_instance_lines(group, c, &y1, &y2) || nscan >= y2 || nscan < y1)
+				continue;
+		}
+		else
+		{
+			c = b;
+			b = links[b];
+		}
+		*tail = c;
+		tail = &links[c];
+	}
+	*tail = -1;
+	group->active = head;
+	return head;
+}
+
+/*!
+ * \brief
+ * Creates a group of sprite instances sharing the same spriteset, palette, blending and flags
+ *
+ * \param spriteset
+ * Reference to the spriteset with the graphics of all instances
+ *
+ * \param max_instances
+ * Maximum number of instances the group can hold
+ *
+ * \returns
+ * Reference to the created group, or NULL if error
+ *
+ * \remarks
+ * Instances are much lighter than regular sprites and don't support scaling, rotation,
+ * animation or collision detection. They're intended for big amounts of particles or
+ * similar objects
+ *
+ * \see
+ * TLN_GetSpriteGroupInstances(), TLN_EnableSpriteGroup(), TLN_DeleteSpriteGroup()
+ */
+TLN_SpriteGroup TLN_CreateSpriteGroup (TLN_Spriteset spriteset, int max_instances)
+{
+	TLN_SpriteGroup group;
+	int size;
+
+	if (!CheckBaseObject (spriteset, OT_SPRITESET))
+		return NULL;
+
+	if (max_instances <= 0)
+	{
+		TLN_SetLastError (TLN_ERR_WRONG_SIZE);
+		return NULL;
+	}
+
+	/* instances and their links share the same block */
+	size = sizeof(struct SpriteGroup) + max_instances * (sizeof(TLN_SpriteInstance) + sizeof(int));
+	group = (TLN_SpriteGroup)CreateBaseObject (OT_SPRITEGROUP, size);
+	if (!group)
+		return NULL;
+
+	group->spriteset = spriteset;
+	group->max_instances = max_instances;
+	group->links = (int*)&group->instances[max_instances];
+	group->line = -1;
+	group->active = -1;
+
+	TLN_SetLastError (TLN_ERR_OK);
+	return group;
+}
+
+/*!
+ * \brief
+ * Returns the array of instances of a sprite group
+ *
+ * \param group
+ * Reference to the sprite group
+ *
+ * \returns
+ * Pointer to an array of max_instances TLN_SpriteInstance items that can be freely modified
+ *
+ * \remarks
+ * Only the first items set with TLN_SetSpriteGroupCount() are drawn
+ */
+TLN_SpriteInstance* TLN_GetSpriteGroupInstances (TLN_SpriteGroup group)
+{
+	if (!CheckBaseObject (group, OT_SPRITEGROUP))
+		return NULL;
+
+	TLN_SetLastError (TLN_ERR_OK);
+	return group->instances;
+}
+
+/*!
+ * \brief
+ * Sets the number of instances drawn from a sprite group
+ *
+ * \param group
+ * Reference to the sprite group
+ *
+ * \param count
+ * Number of instances to draw [0, max_instances]
+ */
+bool TLN_SetSpriteGroupCount (TLN_SpriteGroup group, int count)
+{
+	if (!CheckBaseObject (group, OT_SPRITEGROUP))
+		return false;
+
+	if (count < 0 || count > group->max_instances)
+	{
+		TLN_SetLastError (TLN_ERR_IDX_SPRITE);
+		return false;
+	}
+
+	group->count = count;
+	group->line = -1;
+	TLN_SetLastError (TLN_ERR_OK);
+	return true;
+}
+
+/*!
+ * \brief
+ * Returns the number of instances drawn from a sprite group
+ *
+ * \param group
+ * Reference to the sprite group
+ */
+int TLN_GetSpriteGroupCount (TLN_SpriteGroup group)
+{
+	if (!CheckBaseObject (group, OT_SPRITEGROUP))
+		return 0;
+
+	TLN_SetLastError (TLN_ERR_OK);
+	return group->count;
+}
+
+/*!
+ * \brief
+ * Sets the spriteset shared by all instances of a sprite group
+ *
+ * \param group
+ * Reference to the sprite group
+ *
+ * \param spriteset
+ * Reference to the spriteset
+ */
+bool TLN_SetSpriteGroupSpriteset (TLN_SpriteGroup group, TLN_Spriteset spriteset)
+{
+	if (!CheckBaseObject (group, OT_SPRITEGROUP))
+		return false;
+	if (!CheckBaseObject (spriteset, OT_SPRITESET))
+		return false;
+
+	group->spriteset = spriteset;
+	group->line = -1;
+	TLN_SetLastError (TLN_ERR_OK);
+	return true;
+}
+
+/*!
+ * \brief
+ * Sets the palette shared by all instances of a sprite group
+ *
+ * \param group
+ * Reference to the sprite group
+ *
+ * \param palette
+ * Reference to the palette, or NULL to use the palette of the spriteset
+ */
+bool TLN_SetSpriteGroupPalette (TLN_SpriteGroup group, TLN_Palette palette)
+{
+	if (!CheckBaseObject (group, OT_SPRITEGROUP))
+		return false;
+	if (palette != NULL && !CheckBaseObject (palette, OT_PALETTE))
+		return false;
+
+	group->palette = palette;
+	TLN_SetLastError (TLN_ERR_OK);
+	return true;
+}
+
+/*!
+ * \brief
+ * Sets the blending mode shared by all instances of a sprite group
+ *
+ * \param group
+ * Reference to the sprite group
+ *
+ * \param mode
+ * Member of the TLN_Blend enumeration
+ *
+ * \param factor
+ * Unused, kept for symmetry with TLN_SetSpriteBlendMode()
+ */
+bool TLN_SetSpriteGroupBlendMode (TLN_SpriteGroup group, TLN_Blend mode, uint8_t factor)
+{
+	if (!CheckBaseObject (group, OT_SPRITEGROUP))
+		return false;
+
+	group->blend = SelectBlendTable (mode);
+	TLN_SetLastError (TLN_ERR_OK);
+	return true;
+}
+
+/*!
+ * \brief
+ * Sets the flags shared by all instances of a sprite group
+ *
+ * \param group
+ * Reference to the sprite group
+ *
+ * \param flags
+ * Combination of FLAG_FLIPX, FLAG_FLIPY, FLAG_PRIORITY and FLAG_MASKED. Flip flags are
+ * combined with the flags of each instance, so a flipped instance in a flipped group isn't flipped
+ */
+bool TLN_SetSpriteGroupFlags (TLN_SpriteGroup group, uint32_t flags)
+{
+	if (!CheckBaseObject (group, OT_SPRITEGROUP))
+		return false;
+
+	group->flags = flags & (FLAG_FLIPX | FLAG_FLIPY | FLAG_PRIORITY | FLAG_MASKED);
+	group->line = -1;
+	TLN_SetLastError (TLN_ERR_OK);
+	return true;
+}
+
+/*!
+ * \brief
+ * Enables or disables drawing of a sprite group in the current engine context
+ *
+ * \param group
+ * Reference to the sprite group
+ *
+ * \param enable
+ * true for drawing the group, false to stop drawing it
+ *
+ * \remarks
+ * Enabled groups are drawn above regular sprites, in the order they were enabled. Each context
+ * keeps its own set of enabled groups
+ */
+bool TLN_EnableSpriteGroup (TLN_SpriteGroup group, bool enable)
+{
+	int c;
+
+	if (!CheckBaseObject (group, OT_SPRITEGROUP))
+		return false;
+
+	/* state is per context: look it up in the current one */
+	c = 0;
+	while (c < engine->num_groups && engine->groups[c] != group)
+		c++;
+
+	if (enable && c == engine->num_groups)
+	{
+		if (engine->num_groups == engine->max_groups)
+		{
+			const int max_groups = engine->max_groups ? engine->max_groups * 2 : 8;
+			TLN_SpriteGroup* groups = (TLN_SpriteGroup*)realloc (engine->groups, max_groups * sizeof(TLN_SpriteGroup));
+			if (groups == NULL)
+			{
+				TLN_SetLastError (TLN_ERR_OUT_OF_MEMORY);
+				return false;
+			}
+			engine->groups = groups;
+			engine->max_groups = max_groups;
+		}
+		engine->groups[engine->num_groups++] = group;
+		group->line = -1;
+	}
+	else if (!enable && c < engine->num_groups)
+	{
+		engine->num_groups -= 1;
+		memmove (&engine->groups[c], &engine->groups[c + 1], (engine->num_groups - c) * sizeof(TLN_SpriteGroup));
+	}
+
+	TLN_SetLastError (TLN_ERR_OK);
+	return true;
+}
+
+/*!
+ * \brief
+ * Deletes a sprite group and frees memory
+ *
+ * \param group
+ * Reference to the sprite group to delete
+ *
+ * \remarks
+ * The group is disabled in the current context. Disable it in other contexts before deleting it
+ */
+bool TLN_DeleteSpriteGroup (TLN_SpriteGroup group)
+{
+	if (!CheckBaseObject (group, OT_SPRITEGROUP))
+		return false;
+
+	TLN_EnableSpriteGroup (group, false);
+	free (group->line_head);
+	DeleteBaseObject (group);
+	TLN_SetLastError (TLN_ERR_OK);
+	return true;
+}
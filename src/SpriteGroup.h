@@ -0,0 +1,39 @@
+/*
+* Tilengine - The 2D retro graphics engine with raster effects
+* Copyright (C) 2015-2019 Marc Palacios Domenech <mailto:megamarc@hotmail.com>
+* All rights reserved
+*
+* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/.
+* */
+
+#ifndef _SPRITEGROUP_H
+#define _SPRITEGROUP_H
+
+#include "Tilengine.h"
+#include "Object.h"
+#include "Spriteset.h"
+
+/* many sprites sharing spriteset, palette, blending and flags */
+struct SpriteGroup
+{
+	DEFINE_OBJECT;
+	TLN_Spriteset spriteset;
+	TLN_Palette palette;		/* optional, spriteset palette if NULL */
+	uint8_t* blend;				/* blend table, NULL if no blending */
+	uint32_t flags;				/* shared flags */
+	int max_instances;
+	int count;					/* instances in use */
+	int line;					/* next scanline expected, other values rebuild line lists */
+	int height;					/* number of entries in line_head[] */
+	int* line_head;				/* first instance starting at each scanline */
+	int active;					/* first instance covering current scanline */
+	int* links;					/* next instance in line or active lists, ordered by index */
+	TLN_SpriteInstance instances[];
+};
+
+void GetInstanceBox(const SpriteEntry* info, uint16_t flags, int* bx, int* by);
+int UpdateSpriteGroupLine(TLN_SpriteGroup group, int nscan);
+
+#endif
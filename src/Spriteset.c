@@ -9,18 +9,23 @@
 * */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "Tilengine.h"
 #include "Spriteset.h"
 #include "Palette.h"
 #include "Bitmap.h"
 #include "crc32.h"
+#include "Cache.h"
 
 static void set_sprite_entry (TLN_Spriteset spriteset, int entry, TLN_SpriteData* data)
 {
 	SpriteEntry* dst_data = &spriteset->data[entry];
-	dst_data->w = data->w;
-	dst_data->h = data->h;
+	dst_data->w = dst_data->frame_w = data->w;
+	dst_data->h = dst_data->frame_h = data->h;
+	dst_data->xoffset = dst_data->yoffset = 0;
+	dst_data->flags = 0;
+	dst_data->shared = false;
 	dst_data->offset = data->y*spriteset->bitmap->pitch + data->x;
 	if (data->name[0] != 0)
 		dst_data->hash = _crc32(0, data->name, strlen(data->name));
@@ -28,6 +33,135 @@ static void set_sprite_entry (TLN_Spriteset spriteset, int entry, TLN_SpriteData
 		dst_data->hash = 0;
 }
 
+/* true if rectangle overlaps stored pixels that the loader shares between identical frames,
+ * other than the given entry, so writing there would change other frames */
+static bool overlaps_shared (TLN_Spriteset spriteset, int entry, int x, int y, int w, int h)
+{
+	const int pitch = spriteset->bitmap->pitch;
+	int c;
+
+	for (c = 0; c < spriteset->entries; c++)
+	{
+		const SpriteEntry* other = &spriteset->data[c];
+		const int x0 = other->offset % pitch;
+		const int y0 = other->offset / pitch;
+		if (c == entry || !other->shared || other->w <= 0 || other->h <= 0)
+			continue;
+		if (x < x0 + other->w && x0 < x + w && y < y0 + other->h && y0 < y + h)
+			return true;
+	}
+	return false;
+}
+
+/* encodes a sprite row as opaque spans, in the given direction. Returns number of words */
+static int encode_row (uint8_t* srcpixel, int width, int dx, uint16_t* dst)
+{
+	int count = 0;
+	int words = 1;
+	int x = 0;
+
+	while (x < width)
+	{
+		int skip = 0;
+		int length = 0;
+		while (x < width && *srcpixel == 0)
+		{
+			skip++;
+			x++;
+			srcpixel += dx;
+		}
+		while (x < width && *srcpixel != 0)
+		{
+			length++;
+			x++;
+			srcpixel += dx;
+		}
+		if (length > 0)
+		{
+			if (dst != NULL)
+			{
+				dst[words + 0] = (uint16_t)skip;
+				dst[words + 1] = (uint16_t)length;
+			}
+			words += 2;
+			count++;
+		}
+	}
+	if (dst != NULL)
+		dst[0] = (uint16_t)count;
+	return words;
+}
+
+/* builds span lists for all the rows of all the entries. Two passes: size, then encode */
+static bool build_spans (TLN_Spriteset spriteset)
+{
+	uint16_t* spans = NULL;
+	int num_rows = 0;
+	int num_words = 0;
+	int pass, c, y;
+
+	if (spriteset->bitmap == NULL)
+	{
+		TLN_SetLastError (TLN_ERR_REF_BITMAP);
+		return false;
+	}
+
+	for (pass = 0; pass < 2; pass++)
+	{
+		int row = 0;
+		int words = 0;
+		for (c = 0; c < spriteset->entries; c++)
+		{
+			SpriteEntry* entry = &spriteset->data[c];
+			uint8_t* srcpixel = spriteset->bitmap->data + entry->offset;
+			entry->span_row = row;
+			for (y = 0; y < entry->h; y++)
+			{
+				if (spans != NULL)
+				{
+					spriteset->span_rows[row] = words;
+					words += encode_row (srcpixel, entry->w, 1, spans + words);
+					words += encode_row (srcpixel + entry->w - 1, entry->w, -1, spans + words);
+				}
+				else
+				{
+					words += encode_row (srcpixel, entry->w, 1, NULL);
+					words += encode_row (srcpixel + entry->w - 1, entry->w, -1, NULL);
+				}
+				srcpixel += spriteset->bitmap->pitch;
+				row++;
+			}
+		}
+
+		if (pass == 0)
+		{
+			num_rows = row;
+			num_words = words;
+			spriteset->span_rows = (uint32_t*)malloc((num_rows + 1) * sizeof(uint32_t));
+			spans = (uint16_t*)malloc((num_words + 1) * sizeof(uint16_t));
+			if (spriteset->span_rows == NULL || spans == NULL)
+			{
+				free (spriteset->span_rows);
+				free (spans);
+				spriteset->span_rows = NULL;
+				TLN_SetLastError (TLN_ERR_OUT_OF_MEMORY);
+				return false;
+			}
+		}
+	}
+	spriteset->spans = spans;
+	return true;
+}
+
+/* releases span lists */
+static void delete_spans (TLN_Spriteset spriteset)
+{
+	free (spriteset->span_rows);
+	free (spriteset->spans);
+	spriteset->span_rows = NULL;
+	spriteset->spans = NULL;
+}
+
 /*!
  * \brief
  * Creates a new spriteset
@@ -53,6 +187,13 @@ TLN_Spriteset TLN_CreateSpriteset (TLN_Bitmap bitmap, TLN_SpriteData* data, int
 	const int size = sizeof(struct Spriteset) + (sizeof(SpriteEntry) * num_entries);
 	int c;
 
+	/* sprites are indexed color only */
+	if (bitmap != NULL && bitmap->bpp != 8)
+	{
+		TLN_SetLastError (TLN_ERR_UNSUPPORTED);
+		return NULL;
+	}
+
 	/* crea */
 	spriteset = (TLN_Spriteset)CreateBaseObject (OT_SPRITESET, size);
 	if (!spriteset)
@@ -94,25 +235,53 @@ TLN_Spriteset TLN_CreateSpriteset (TLN_Bitmap bitmap, TLN_SpriteData* data, int
  * \param pitch
  * Number of bytes per scanline of the source pixel data
  *
+ * \remarks
+ * The rectangle in data is inside the spriteset bitmap. Spritesets loaded with TLN_LoadSpriteset()
+ * are repacked and identical or mirrored frames share their pixels. When pixels are given, the
+ * rectangle can't overlap such shared pixels of other entries, because writing there would change
+ * other frames too. Such writes fail with TLN_ERR_UNSUPPORTED
+ *
  * \see
  * TLN_CreateSpriteset()
  */
 bool TLN_SetSpritesetData (TLN_Spriteset spriteset, int entry, TLN_SpriteData* data, void* pixels, int pitch)
 {
+	TLN_Bitmap bitmap;
+
 	if (!CheckBaseObject (spriteset, OT_SPRITESET))
 		return false;
 
-	if (entry >= spriteset->entries)
+	if (entry < 0 || entry >= spriteset->entries)
 	{
 		TLN_SetLastError (TLN_ERR_IDX_SPRITE);
 		return false;
 	}
 
+	bitmap = spriteset->bitmap;
+	if (data == NULL || bitmap == NULL)
+	{
+		TLN_SetLastError (TLN_ERR_NULL_POINTER);
+		return false;
+	}
+
+	if (data->x < 0 || data->y < 0 || data->w <= 0 || data->h <= 0 ||
+		data->x + data->w > bitmap->width || data->y + data->h > bitmap->height)
+	{
+		TLN_SetLastError (TLN_ERR_WRONG_SIZE);
+		return false;
+	}
+
+	if (pixels != NULL && pitch != 0 && overlaps_shared (spriteset, entry, data->x, data->y, data->w, data->h))
+	{
+		TLN_SetLastError (TLN_ERR_UNSUPPORTED);
+		return false;
+	}
+
 	set_sprite_entry (spriteset, entry, data);
 	if (pixels != NULL && pitch != 0)
 	{
 		uint8_t* src = (uint8_t*)pixels;
-		uint8_t* dst = TLN_GetBitmapPtr (spriteset->bitmap, data->x, data->y);
+		uint8_t* dst = TLN_GetBitmapPtr (bitmap, data->x, data->y);
 		int c;
 		for (c=0; c<data->h; c++)
 		{
@@ -121,6 +290,14 @@ bool TLN_SetSpritesetData (TLN_Spriteset spriteset, int entry, TLN_SpriteData* d
 			dst += spriteset->bitmap->pitch;
 		}
 	}
+
+	/* keep span lists in sync */
+	if (spriteset->spans != NULL)
+	{
+		delete_spans (spriteset);
+		if (!build_spans (spriteset))
+			return false;
+	}
 	TLN_SetLastError (TLN_ERR_OK);
 	return true;
 }
@@ -147,6 +324,13 @@ TLN_Spriteset TLN_CloneSpriteset (TLN_Spriteset src)
 	spriteset = (TLN_Spriteset)CloneBaseObject (src);
 	if (spriteset)
 	{
+		/* span lists aren't shared */
+		if (src->spans != NULL)
+		{
+			spriteset->span_rows = NULL;
+			spriteset->spans = NULL;
+			build_spans (spriteset);
+		}
 		TLN_SetLastError (TLN_ERR_OK);
 		return spriteset;
 	}
@@ -171,8 +355,16 @@ bool TLN_DeleteSpriteset (TLN_Spriteset spriteset)
 {
 	if (CheckBaseObject (spriteset, OT_SPRITESET))
 	{
+		/* loaded ones are kept until evicted */
+		if (ReleaseCached (spriteset))
+		{
+			TLN_SetLastError (TLN_ERR_OK);
+			return true;
+		}
+
 		if (ObjectOwner (spriteset))
 			TLN_DeleteBitmap (spriteset->bitmap);
+		delete_spans (spriteset);
 		DeleteBaseObject (spriteset);
 		TLN_SetLastError (TLN_ERR_OK);
 		return true;
@@ -202,8 +394,8 @@ bool TLN_GetSpriteInfo (TLN_Spriteset spriteset, int entry, TLN_SpriteInfo* info
 	if (CheckBaseObject (spriteset, OT_SPRITESET) && info)
 	{
 		SpriteEntry* sprite = (SpriteEntry*)spriteset->data;
-		info->w = sprite[entry].w;
-		info->h = sprite[entry].h;
+		info->w = sprite[entry].frame_w;
+		info->h = sprite[entry].frame_h;
 		TLN_SetLastError (TLN_ERR_OK);
 		return true;
 	}
@@ -272,3 +464,35 @@ int TLN_FindSpritesetSprite (TLN_Spriteset spriteset, const char* name)
 	}
 	return -1;
 }
+
+/*!
+ * \brief
+ * Enables or disables storage of sprite rows as run-length encoded opaque spans
+ *
+ * \param spriteset
+ * Reference to the spriteset
+ *
+ * \param enable
+ * true to build span lists, false to release them
+ *
+ * \returns
+ * true if success or false if error
+ *
+ * \remarks
+ * Sprites using a spriteset with spans enabled paint whole opaque runs without checking
+ * the color key and skip transparent areas entirely. Recommended for big sprites with large
+ * transparent areas. Doesn't affect scaled or rotated sprites, that use regular pixel data.
+ * Call it after loading the spriteset, as it takes some extra memory and encoding time.
+ */
+bool TLN_EnableSpritesetSpans (TLN_Spriteset spriteset, bool enable)
+{
+	if (!CheckBaseObject (spriteset, OT_SPRITESET))
+		return false;
+
+	delete_spans (spriteset);
+	if (enable && !build_spans (spriteset))
+		return false;
+
+	TLN_SetLastError (TLN_ERR_OK);
+	return true;
+}
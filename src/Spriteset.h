@@ -19,8 +19,15 @@
 typedef struct
 {
 	uint32_t hash;
-	int w,h;
+	int w,h;			/* size of stored pixels (may be trimmed) */
 	int offset;
+	int span_row;		/* first row inside span_rows[] */
+	int frame_w;		/* original frame size */
+	int frame_h;
+	int xoffset;		/* position of stored pixels inside original frame */
+	int yoffset;
+	uint16_t flags;		/* FLAG_FLIPX/FLAG_FLIPY if stored pixels are a mirrored copy of the frame */
+	bool shared;		/* stored pixels are shared with other entries by the loader */
 }
 SpriteEntry;
 
@@ -30,6 +37,8 @@ struct Spriteset
 	int entries;
 	TLN_Bitmap bitmap;
 	TLN_Palette palette;
+	uint32_t* span_rows;	/* offset of each row inside spans[] (optional) */
+	uint16_t* spans;		/* RLE encoded rows: count, (skip, length) pairs left to right, then same right to left */
 	SpriteEntry data[];
 };
 
@@ -0,0 +1,32 @@
+/*
+* Tilengine - The 2D retro graphics engine with raster effects
+* Copyright (C) 2015-2019 Marc Palacios Domenech <mailto:megamarc@hotmail.com>
+* All rights reserved
+*
+* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/.
+* */
+
+#ifndef _TILE_ENCODING_H
+#define _TILE_ENCODING_H
+
+/* encoding of tile layer data */
+typedef enum
+{
+	ENCODING_XML,
+	ENCODING_BASE64,
+	ENCODING_CSV,
+}
+encoding_t;
+
+/* compression of tile layer data */
+typedef enum
+{
+	COMPRESSION_NONE,
+	COMPRESSION_ZLIB,
+	COMPRESSION_GZIP,
+}
+compression_t;
+
+#endif
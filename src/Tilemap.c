@@ -14,8 +14,13 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "Tilengine.h"
 #include "Tilemap.h"
+#include "Cache.h"
+
+#define MIN_CHUNK_BUCKETS	64
+#define DEFAULT_MAX_CHUNKS	256
 
 typedef struct
 {
@@ -23,6 +28,329 @@ typedef struct
 }
 Rect;
 
+static Tile empty_tile;	/* read from cells of chunked tilemaps without chunk */
+
+/* drops the tilemap's hold on one of its tilesets: owned ones are deleted, cached ones released.
+ * Tilesets created by the application and passed in are left to it */
+static void release_tileset(TLN_Tilemap tilemap, int index)
+{
+	TLN_Tileset tileset = tilemap->tilesets[index];
+	if (tileset == NULL)
+		return;
+
+	if (tilemap->owned_tilesets & (1u << index))
+		TLN_DeleteTileset(tileset);
+	else
+		ReleaseCached(tileset);
+	tilemap->owned_tilesets &= ~(1u << index);
+}
+
+static int chunk_slot(const TileChunks* chunks, int row, int col)
+{
+	const unsigned int hash = (unsigned int)row * 0x9E3779B1u ^ (unsigned int)col * 0x85EBCA77u;
+	return (int)((hash ^ (hash >> 15)) & (chunks->num_buckets - 1));
+}
+
+static TileChunk* find_chunk(const TileChunks* chunks, int row, int col)
+{
+	TileChunk* chunk = chunks->buckets[chunk_slot(chunks, row, col)];
+	while (chunk != NULL && (chunk->row != row || chunk->col != col))
+		chunk = chunk->next;
+	return chunk;
+}
+
+/* adds chunk taking its source, NULL if out of memory */
+static TileChunk* add_chunk(TileChunks* chunks, int row, int col, char* source, int length)
+{
+	TileChunk* chunk;
+	int slot;
+
+	/* doubles buckets when there are more chunks than buckets */
+	if (chunks->num_chunks >= chunks->num_buckets)
+	{
+		const int num_buckets = chunks->num_buckets != 0 ? chunks->num_buckets * 2 : MIN_CHUNK_BUCKETS;
+		TileChunk** buckets = (TileChunk**)calloc(num_buckets, sizeof(TileChunk*));
+		TileChunk** old_buckets = chunks->buckets;
+		const int old_num_buckets = chunks->num_buckets;
+		int c;
+
+		if (buckets == NULL)
+			return NULL;
+
+		chunks->buckets = buckets;
+		chunks->num_buckets = num_buckets;
+		for (c = 0; c < old_num_buckets; c += 1)
+		{
+			chunk = old_buckets[c];
+			while (chunk != NULL)
+			{
+				TileChunk* next = chunk->next;
+				slot = chunk_slot(chunks, chunk->row, chunk->col);
+				chunk->next = buckets[slot];
+				buckets[slot] = chunk;
+				chunk = next;
+			}
+		}
+		free(old_buckets);
+	}
+
+	chunk = (TileChunk*)calloc(1, sizeof(TileChunk));
+	if (chunk == NULL)
+		return NULL;
+
+	chunk->row = row;
+	chunk->col = col;
+	chunk->source = source;
+	chunk->length = length;
+	slot = chunk_slot(chunks, row, col);
+	chunk->next = chunks->buckets[slot];
+	chunks->buckets[slot] = chunk;
+	chunks->num_chunks += 1;
+	return chunk;
+}
+
+/* removes decoded chunk from list of evictable ones */
+static void unlink_loaded(TileChunks* chunks, TileChunk* chunk)
+{
+	if (chunk->newer != NULL)
+		chunk->newer->older = chunk->older;
+	else
+		chunks->newest = chunk->older;
+	if (chunk->older != NULL)
+		chunk->older->newer = chunk->newer;
+	else
+		chunks->oldest = chunk->newer;
+	chunk->newer = chunk->older = NULL;
+	chunks->num_loaded -= 1;
+}
+
+/* adds decoded chunk as the most recently used */
+static void link_loaded(TileChunks* chunks, TileChunk* chunk)
+{
+	chunk->newer = NULL;
+	chunk->older = chunks->newest;
+	if (chunks->newest != NULL)
+		chunks->newest->newer = chunk;
+	else
+		chunks->oldest = chunk;
+	chunks->newest = chunk;
+	chunks->num_loaded += 1;
+}
+
+/* frees tiles of least recently used chunks over the limit, except the last accessed one */
+static void evict_chunks(TileChunks* chunks)
+{
+	TileChunk* chunk = chunks->oldest;
+	while (chunks->num_loaded > chunks->max_loaded && chunk != NULL)
+	{
+		TileChunk* newer = chunk->newer;
+		if (chunk != chunks->last)
+		{
+			unlink_loaded(chunks, chunk);
+			free(chunk->tiles);
+			chunk->tiles = NULL;
+		}
+		chunk = newer;
+	}
+}
+
+static void delete_chunks(TileChunks* chunks)
+{
+	int c;
+
+	for (c = 0; c < chunks->num_buckets; c += 1)
+	{
+		TileChunk* chunk = chunks->buckets[c];
+		while (chunk != NULL)
+		{
+			TileChunk* next = chunk->next;
+			free(chunk->tiles);
+			free(chunk->source);
+			free(chunk);
+			chunk = next;
+		}
+	}
+	free(chunks->buckets);
+	free(chunks);
+}
+
+/* copies sources and modified tiles, decoded tiles are decoded again when accessed */
+static TileChunks* clone_chunks(const TileChunks* src)
+{
+	TileChunks* chunks = (TileChunks*)malloc(sizeof(TileChunks));
+	const int size = src->width * src->height * sizeof(Tile);
+	int c;
+
+	if (chunks == NULL)
+		return NULL;
+
+	memcpy(chunks, src, sizeof(TileChunks));
+	chunks->buckets = NULL;
+	chunks->num_buckets = chunks->num_chunks = chunks->num_loaded = 0;
+	chunks->last = chunks->newest = chunks->oldest = NULL;
+
+	for (c = 0; c < src->num_buckets; c += 1)
+	{
+		const TileChunk* chunk = src->buckets[c];
+		while (chunk != NULL)
+		{
+			char* source = NULL;
+			TileChunk* copy;
+
+			if (chunk->source != NULL)
+			{
+				source = (char*)malloc(chunk->length);
+				if (source == NULL)
+					break;
+				memcpy(source, chunk->source, chunk->length);
+			}
+
+			copy = add_chunk(chunks, chunk->row, chunk->col, source, chunk->length);
+			if (copy == NULL)
+			{
+				free(source);
+				break;
+			}
+
+			if (chunk->pinned)
+			{
+				copy->tiles = (Tile*)malloc(size);
+				if (copy->tiles == NULL)
+					break;
+				memcpy(copy->tiles, chunk->tiles, size);
+				copy->pinned = true;
+			}
+			chunk = chunk->next;
+		}
+
+		/* not completed */
+		if (chunk != NULL)
+		{
+			delete_chunks(chunks);
+			return NULL;
+		}
+	}
+	return chunks;
+}
+
+/* creates tilemap with empty chunks of given size, to be filled with AddTilemapChunk() */
+TLN_Tilemap CreateChunkedTilemap(int rows, int cols, int chunk_width, int chunk_height, uint32_t bgcolor)
+{
+	TLN_Tilemap tilemap = (TLN_Tilemap)CreateBaseObject(OT_TILEMAP, sizeof(struct Tilemap));
+	if (tilemap == NULL)
+		return NULL;
+
+	tilemap->chunks = (TileChunks*)calloc(1, sizeof(TileChunks));
+	if (tilemap->chunks == NULL)
+	{
+		DeleteBaseObject(tilemap);
+		TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+		return NULL;
+	}
+
+	tilemap->rows = rows;
+	tilemap->cols = cols;
+	tilemap->bgcolor = bgcolor;
+	tilemap->visible = true;
+	tilemap->chunks->width = chunk_width;
+	tilemap->chunks->height = chunk_height;
+	tilemap->chunks->max_loaded = DEFAULT_MAX_CHUNKS;
+
+	TLN_SetLastError(TLN_ERR_OK);
+	return tilemap;
+}
+
+/* adds encoded chunk starting at given cell, aligned to chunk size. Takes the source unless it fails */
+bool AddTilemapChunk(TLN_Tilemap tilemap, int row, int col, char* source, int length)
+{
+	if (add_chunk(tilemap->chunks, row, col, source, length) != NULL)
+		return true;
+
+	TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+	return false;
+}
+
+/* tile at a cell of a chunked tilemap, decoding its chunk when not loaded. Reading cells
+ * without chunk returns an empty tile, writing creates the chunk. Written chunks are kept */
+Tile* GetChunkTile(TLN_Tilemap tilemap, int row, int col, bool write)
+{
+	TileChunks* chunks = tilemap->chunks;
+	const int row0 = row - row % chunks->height;
+	const int col0 = col - col % chunks->width;
+	TileChunk* chunk = NULL;
+
+	if (chunks->num_buckets != 0)
+		chunk = find_chunk(chunks, row0, col0);
+	if (chunk == NULL)
+	{
+		if (!write)
+			return &empty_tile;
+		chunk = add_chunk(chunks, row0, col0, NULL, 0);
+		if (chunk == NULL)
+			return NULL;
+	}
+
+	if (chunk->tiles == NULL)
+	{
+		if (chunk->source != NULL)
+		{
+			chunk->tiles = TMXDecodeChunk(tilemap, chunk);
+
+			/* source can't be decoded: drop it and keep the chunk empty, instead of
+			 * decoding it again on every access */
+			if (chunk->tiles == NULL)
+			{
+				free(chunk->source);
+				chunk->source = NULL;
+				chunk->length = 0;
+			}
+		}
+		if (chunk->tiles == NULL)
+			chunk->tiles = (Tile*)calloc(chunks->width * chunks->height, sizeof(Tile));
+		if (chunk->tiles == NULL)
+			return write ? NULL : &empty_tile;
+		if (!chunk->pinned)
+			link_loaded(chunks, chunk);
+	}
+	else if (!chunk->pinned && chunk != chunks->newest)
+	{
+		unlink_loaded(chunks, chunk);
+		link_loaded(chunks, chunk);
+	}
+
+	/* application can modify tiles: keep them and drop the source */
+	if (write && !chunk->pinned)
+	{
+		unlink_loaded(chunks, chunk);
+		free(chunk->source);
+		chunk->source = NULL;
+		chunk->length = 0;
+		chunk->pinned = true;
+	}
+
+	chunks->last = chunk;
+	evict_chunks(chunks);
+	return &chunk->tiles[(row - row0)*chunks->width + col - col0];
+}
+
+/* applies priority attribute of tileset to tiles */
+void SetTilesPriority(TLN_Tileset tileset, Tile* tiles, int count)
+{
+	Tile* tile = tiles;
+	int c;
+
+	for (c = 0; c < count; c++, tile++)
+	{
+		if (tile->index != 0 && tile->index < tileset->numtiles)
+		{
+			if (tileset->attributes[tile->index - 1].priority == true)
+				tile->flags |= FLAG_PRIORITY;
+			else
+				tile->flags &= ~FLAG_PRIORITY;
+		}
+	}
+}
+
 /*!
  * \brief
  * Creates a new tilemap
@@ -65,6 +393,7 @@ TLN_Tilemap TLN_CreateTilemap (int rows, int cols, TLN_Tile tiles, uint32_t bgco
 	tilemap->bgcolor = bgcolor;
 	tilemap->tilesets[0] = tileset;
 	tilemap->visible = true;
+	RetainCached (tileset);
 
 	if (tiles)
 		memcpy (tilemap->tiles, tiles, tilemap->size - sizeof(struct Tilemap));
@@ -96,6 +425,23 @@ TLN_Tilemap TLN_CloneTilemap (TLN_Tilemap src)
 	tilemap = (TLN_Tilemap)CloneBaseObject (src);
 	if (tilemap)
 	{
+		int c;
+
+		/* tilesets owned by the source are only borrowed */
+		tilemap->owned_tilesets = 0;
+		for (c = 0; c < MAX_TILESETS; c += 1)
+			RetainCached (tilemap->tilesets[c]);
+
+		if (src->chunks != NULL)
+		{
+			tilemap->chunks = clone_chunks (src->chunks);
+			if (tilemap->chunks == NULL)
+			{
+				TLN_DeleteTilemap (tilemap);
+				TLN_SetLastError (TLN_ERR_OUT_OF_MEMORY);
+				return NULL;
+			}
+		}
 		TLN_SetLastError (TLN_ERR_OK);
 		return tilemap;
 	}
@@ -211,15 +557,21 @@ bool TLN_SetTilemapTileset2(TLN_Tilemap tilemap, TLN_Tileset tileset, int index)
 		return false;
 	}
 
+	RetainCached(tileset);
+	release_tileset(tilemap, index);
 	tilemap->tilesets[index] = tileset;
 	TLN_SetLastError(TLN_ERR_OK);
 	return true;
 }
 
-static TLN_Tile GetTilemapPtr (TLN_Tilemap tilemap, int row, int col)
+static TLN_Tile GetTilemapPtr (TLN_Tilemap tilemap, int row, int col, bool write)
 {
-	if (row<tilemap->rows && col<tilemap->cols)
+	if (row>=0 && col>=0 && row<tilemap->rows && col<tilemap->cols)
+	{
+		if (tilemap->chunks != NULL)
+			return GetChunkTile (tilemap, row, col, write);
 		return &tilemap->tiles[row*tilemap->cols + col];
+	}
 	else
 		return NULL;
 }
@@ -244,7 +596,7 @@ bool TLN_GetTilemapTile (TLN_Tilemap tilemap, int row, int col, TLN_Tile tile)
 {
 	if (CheckBaseObject (tilemap, OT_TILEMAP) && tile)
 	{
-		TLN_Tile srctile = GetTilemapPtr (tilemap, row, col);
+		TLN_Tile srctile = GetTilemapPtr (tilemap, row, col, false);
 		if (srctile)
 		{
 			tile->flags = srctile->flags;
@@ -285,7 +637,7 @@ bool TLN_SetTilemapTile (TLN_Tilemap tilemap, int row, int col, TLN_Tile tile)
 {
 	if (CheckBaseObject (tilemap, OT_TILEMAP) && tile)
 	{
-		TLN_Tile dsttile = GetTilemapPtr (tilemap, row, col);
+		TLN_Tile dsttile = GetTilemapPtr (tilemap, row, col, true);
 		if (dsttile != NULL)
 		{
 			dsttile->value = tile != NULL ? tile->value : 0;
@@ -311,13 +663,55 @@ bool TLN_SetTilemapTile (TLN_Tilemap tilemap, int row, int col, TLN_Tile tile)
  *
  * \remarks Having direct access to internal memory is convenient for performance reasons when lots of tiles 
  * must be updated at runtime, but wrong manipulation can lead to memory corruption or crashes. Use with caution! 
+ * Tilemaps of infinite maps store tiles in chunks, so the pointer is only valid up to the end of the chunk row
  */
 TLN_Tile TLN_GetTilemapTiles(TLN_Tilemap tilemap, int row, int col)
 {
 	if (!CheckBaseObject(tilemap, OT_TILEMAP))
 		return NULL;
 
-	return GetTilemapPtr(tilemap, row, col);
+	return GetTilemapPtr(tilemap, row, col, true);
+}
+
+/*!
+ * \brief
+ * Sets how many decoded chunks of an infinite map are kept in memory
+ *
+ * \param tilemap
+ * Reference to a tilemap loaded from an infinite Tiled map
+ *
+ * \param num_chunks
+ * Maximum number of decoded chunks, at least 1. Default is 256
+ *
+ * \returns
+ * true if success or false if error
+ *
+ * \remarks
+ * Tilemaps loaded from infinite maps keep their chunks encoded and decode each one the first
+ * time it's drawn or accessed. Past this limit the least recently used chunks are freed, to be
+ * decoded again when needed. Chunks modified with TLN_SetTilemapTile(), TLN_GetTilemapTiles()
+ * or TLN_CopyTiles() are always kept and don't count. Other tilemaps return TLN_ERR_UNSUPPORTED
+ */
+bool TLN_SetTilemapMaxChunks(TLN_Tilemap tilemap, int num_chunks)
+{
+	if (!CheckBaseObject(tilemap, OT_TILEMAP))
+		return false;
+
+	if (tilemap->chunks == NULL)
+	{
+		TLN_SetLastError(TLN_ERR_UNSUPPORTED);
+		return false;
+	}
+	if (num_chunks < 1)
+	{
+		TLN_SetLastError(TLN_ERR_WRONG_SIZE);
+		return false;
+	}
+
+	tilemap->chunks->max_loaded = num_chunks;
+	evict_chunks(tilemap->chunks);
+	TLN_SetLastError(TLN_ERR_OK);
+	return true;
 }
 
 /*!
@@ -328,17 +722,22 @@ TLN_Tile TLN_GetTilemapTiles(TLN_Tilemap tilemap, int row, int col)
  * Reference to the tilemap to delete
  * 
  * \remarks
- * Don't delete a tilemap currently attached to a layer!
+ * Don't delete a tilemap currently attached to a layer! Tilesets loaded with the tilemap are
+ * released, tilesets created by the application must be deleted by it
  * 
  * \see
  * TLN_LoadTilemap(), TLN_CloneTilemap()
  */
 bool TLN_DeleteTilemap (TLN_Tilemap tilemap)
 {
+	int c;
+
 	if (CheckBaseObject (tilemap, OT_TILEMAP))
 	{
-		if (ObjectOwner (tilemap))
-			TLN_DeleteTileset (tilemap->tilesets[0]);
+		for (c = 0; c < MAX_TILESETS; c += 1)
+			release_tileset (tilemap, c);
+		if (tilemap->chunks != NULL)
+			delete_chunks (tilemap->chunks);
 		DeleteBaseObject (tilemap);
 		TLN_SetLastError (TLN_ERR_OK);
 		return true;
@@ -406,15 +805,39 @@ bool TLN_CopyTiles (TLN_Tilemap src, int srcrow, int srccol, int rows, int cols,
 		size = tgtrect.w * sizeof(Tile);
 		for (y=0; y<tgtrect.h; y++)
 		{
-			Tile* srctile = GetTilemapPtr (src, y + srcrow, srccol);
-			Tile* dsttile = GetTilemapPtr (dst, y + dstrow, dstcol);
-			if (srctile && dsttile)
-				memcpy (dsttile, srctile, size);
+			/* chunked tilemaps aren't contiguous */
+			if (src->chunks != NULL || dst->chunks != NULL)
+			{
+				int x;
+				for (x=0; x<tgtrect.w; x++)
+				{
+					Tile* srctile = GetTilemapPtr (src, y + srcrow, x + srccol, false);
+					Tile* dsttile;
+					Tile tile;
+
+					if (srctile == NULL)
+						break;
+					tile = *srctile;
+					dsttile = GetTilemapPtr (dst, y + dstrow, x + dstcol, true);
+					if (dsttile == NULL)
+						break;
+					*dsttile = tile;
+				}
+				if (x == tgtrect.w)
+					continue;
+			}
 			else
 			{
-				TLN_SetLastError (TLN_ERR_WRONG_SIZE);
-				return false;
+				Tile* srctile = GetTilemapPtr (src, y + srcrow, srccol, false);
+				Tile* dsttile = GetTilemapPtr (dst, y + dstrow, dstcol, true);
+				if (srctile && dsttile)
+				{
+					memcpy (dsttile, srctile, size);
+					continue;
+				}
 			}
+			TLN_SetLastError (TLN_ERR_WRONG_SIZE);
+			return false;
 		}
 	}
 
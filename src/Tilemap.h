@@ -13,9 +13,42 @@
 
 #include "Object.h"
 #include "Tileset.h"
+#include "TileEncoding.h"
 
 #define MAX_TILESETS	16
 
+/* block of tiles of a chunked tilemap */
+typedef struct TileChunk
+{
+	struct TileChunk* next;		/* next chunk in same bucket */
+	struct TileChunk* newer;	/* neighbours in list of decoded chunks, by last use */
+	struct TileChunk* older;
+	int row, col;				/* position of first tile inside tilemap */
+	bool pinned;				/* tiles modified or exposed, never evicted */
+	Tile* tiles;				/* decoded tiles, NULL when not loaded */
+	int length;					/* size of source */
+	char* source;				/* encoded tiles, NULL for chunks created empty */
+}
+TileChunk;
+
+/* tiles of an infinite map, decoded from their source when accessed and evicted when unused */
+typedef struct
+{
+	TileChunk** buckets;		/* chunks hashed by position */
+	int num_buckets;
+	int num_chunks;
+	int width, height;			/* size of each chunk in tiles */
+	TileChunk* last;			/* last accessed chunk, checked first */
+	TileChunk* newest;			/* decoded chunks that can be evicted, by last use */
+	TileChunk* oldest;
+	int num_loaded;				/* decoded chunks that can be evicted */
+	int max_loaded;				/* decoded chunks kept before evicting */
+	encoding_t encoding;		/* format of sources */
+	compression_t compression;
+	int firstgid[MAX_TILESETS];	/* first gid of each tileset in sources */
+}
+TileChunks;
+
 /* mapa */
 struct Tilemap
 {
@@ -27,7 +60,34 @@ struct Tilemap
 	bool	visible;	/* visible property */
 	struct Tileset* tilesets[MAX_TILESETS]; /* attached tilesets */
 	int		num_tilesets;	/* actual amount of tilesets */
+	uint32_t owned_tilesets;	/* bit per tileset deleted with the tilemap, the others hold a cache reference */
+	TileChunks* chunks;	/* chunked tiles, NULL when all of them are in tiles[] */
 	Tile	tiles[];
 };
 
+TLN_Tilemap CreateChunkedTilemap(int rows, int cols, int chunk_width, int chunk_height, uint32_t bgcolor);
+bool AddTilemapChunk(TLN_Tilemap tilemap, int row, int col, char* source, int length);
+Tile* GetChunkTile(TLN_Tilemap tilemap, int row, int col, bool write);
+void SetTilesPriority(TLN_Tileset tileset, Tile* tiles, int count);
+
+/* decodes source of a chunk, in LoadTilemap.c */
+Tile* TMXDecodeChunk(TLN_Tilemap tilemap, TileChunk* chunk);
+
+/* tile at a cell inside the tilemap, for drawing and queries. Tiles of chunked tilemaps are read only */
+static inline Tile* GetTilemapCell(TLN_Tilemap tilemap, int row, int col)
+{
+	const TileChunks* chunks = tilemap->chunks;
+	if (chunks == NULL)
+		return &tilemap->tiles[row*tilemap->cols + col];
+
+	if (chunks->last != NULL)
+	{
+		const unsigned int y = (unsigned int)(row - chunks->last->row);
+		const unsigned int x = (unsigned int)(col - chunks->last->col);
+		if (y < (unsigned int)chunks->height && x < (unsigned int)chunks->width)
+			return &chunks->last->tiles[y*chunks->width + x];
+	}
+	return GetChunkTile(tilemap, row, col, false);
+}
+
 #endif
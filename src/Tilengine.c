@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <stdarg.h>
+#include <limits.h>
 #include "Tilengine.h"
 #include "Tilemap.h"
 #include "Tileset.h"
@@ -24,6 +25,8 @@
 #include "Sprite.h"
 #include "Tables.h"
 #include "LoadTMX.h"
+#include "Loader.h"
+#include "Cache.h"
 
 /* magic number to recognize context object */
 #define ID_CONTEXT	0x7E5D0AB1
@@ -121,7 +124,7 @@ static TLN_Engine create_context(int hres, int vres, int numlayers, int numsprit
 		{
 			Sprite* sprite = &context->sprites[c];
 			sprite->draw = GetSpriteDraw(MODE_NORMAL);
-			sprite->blitter = SelectBlitter(true, false, false);
+			sprite->blitter = SelectBlitter(8, true, false, false);
 			sprite->sx = sprite->sy = 1.0f;
 		}
 		ListInit(&context->list_sprites, &context->sprites[0].list_node, sizeof(Sprite), context->numsprites);
@@ -144,8 +147,20 @@ static TLN_Engine create_context(int hres, int vres, int numlayers, int numsprit
 		ListInit(&context->list_animations, &context->animations[0].list_node, sizeof(Animation), context->numanimations);
 	}
 
+	/* animation scheduler */
+	if (numsprites + numanimations > 0)
+	{
+		context->schedule = (Animation**)calloc(numsprites + numanimations, sizeof(Animation*));
+		if (!context->schedule)
+		{
+			TLN_DeleteContext(context);
+			TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+			return NULL;
+		}
+	}
+
 	context->bgcolor = PackRGB32(0,0,0);
-	context->blit_fast = SelectBlitter (false, false, false);
+	context->blit_fast = SelectBlitter (8, false, false, false);
 	if (!CreateBlendTables ())
 	{
 		TLN_DeleteContext(context);
@@ -154,6 +169,10 @@ static TLN_Engine create_context(int hres, int vres, int numlayers, int numsprit
 	}
 	context->blend_table = SelectBlendTable (BLEND_MOD);
 
+	/* background and parallel loading, shared by all contexts */
+	InitLoader ();
+	InitCache ();
+
 	/* set as default context if it's the first one */
 	if (engine == NULL)
 		engine = context;
@@ -242,10 +261,21 @@ bool TLN_DeleteContext(TLN_Engine context)
 		return false;
 	}
 
+	/* loader thread may still be tracing through this context */
+	WaitLoader();
+
 	DeleteBlendTables();
 
 	for (c = 0; c < context->numlayers; c++)
+	{
+		int slot;
 		free(context->layers[c].mosaic.buffer);
+		for (slot = 0; slot < PALETTE_SCRATCH_SLOTS; slot++)
+		{
+			if (context->layers[c].palette_table.scratch[slot].palette != NULL)
+				TLN_DeletePalette(context->layers[c].palette_table.scratch[slot].palette);
+		}
+	}
 
 	if (context->sprites)
 		free(context->sprites);
@@ -259,6 +289,11 @@ bool TLN_DeleteContext(TLN_Engine context)
 	if (context->animations)
 		free(context->animations);
 
+	if (context->schedule)
+		free(context->schedule);
+
+	free(context->groups);
+
 	if (context->collision)
 		free(context->collision);
 
@@ -305,7 +340,7 @@ uint32_t TLN_GetVersion (void)
 /*!
  * \brief Set Target fps (default 60)
  * \param fps Target fps
- * \remarks The engine internally runs at 60 fps. Use this function to keep constant animation pacing at other frequencies
+ * \remarks Animation delays are expressed in frames at 60 fps. Use this function to keep constant animation pacing at other frequencies, the animation clock advances 1/fps seconds on each TLN_UpdateFrame()
  * \see TLN_GetTargetFps
  */
 void TLN_SetTargetFps(int fps)
@@ -403,35 +438,41 @@ int TLN_GetRenderTargetPitch (void)
 	return engine->framebuffer.pitch;
 }
 
-/* basic reference list without duplicates */
-typedef struct
+/* tileset animations. once per globally used tileset, and only when some tile is due */
+static void UpdateTilesetAnimations (int64_t time)
 {
 	int index;
-	void* refs[TMX_MAX_TILESET];
-}
-RefList;
 
-/* finds reference in list */
-bool ref_find(RefList* refs, void* item)
-{
-	int c;
-	for (c = 0; c < refs->index; c += 1)
+	for (index = 0; index < engine->numlayers; index += 1)
 	{
-		if (refs->refs[c] == item)
-			return true;
-	}
-	return false;
-}
+		Layer* layer = &engine->layers[index];
+		if (layer->tilemap != NULL)
+		{
+			int ts;
+			for (ts = 0; ts < MAX_TILESETS; ts += 1)
+			{
+				TLN_Tileset tileset = layer->tilemap->tilesets[ts];
+				if (tileset == NULL)
+					break;
 
-/* adds reference to list */
-bool ref_add(RefList* refs, void* item)
-{
-	if (refs->index < TMX_MAX_TILESET - 1 && !ref_find(refs, item))
-	{
-		refs->refs[refs->index++] = item;
-		return true;
+				if (tileset->sp != NULL && time >= tileset->next_animation)
+				{
+					int c;
+					int64_t next = INT64_MAX;
+					for (c = 0; c < tileset->sp->num_sequences; c += 1)
+					{
+						Animation* animation = &tileset->animations[c];
+						UpdateAnimation(animation, time);
+						if (animation->timer < next)
+							next = animation->timer;
+					}
+
+					/* at most once per update */
+					tileset->next_animation = next > time ? next : time + 1;
+				}
+			}
+		}
 	}
-	return false;
 }
 
 /* Starts active rendering of the current frame */
@@ -441,24 +482,12 @@ static void BeginFrame (int frame)
 	List* list;
 	int index;
 
-	/* adjust to target fps */
-	frame = (engine->frame*INTERNAL_FPS) / engine->target_fps;
 	engine->frame += 1;
 
-	/* color cycle animations */
-	if (engine->numanimations > 0)
-	{
-		list = &engine->list_animations;
-		index = list->first;
-		while (index != -1)
-		{
-			Animation* animation = &engine->animations[index];
-			UpdateAnimation(animation, frame);
-			index = animation->list_node.next;
-		}
-	}
+	/* color cycle and sprite animations, only the ones that are due */
+	UpdateAnimations(engine->time);
 
-	/* sprite animations */
+	/* reset sprite collisions */
 	if (engine->numsprites > 0)
 	{
 		list = &engine->list_sprites;
@@ -467,34 +496,18 @@ static void BeginFrame (int frame)
 		{
 			Sprite* sprite = &engine->sprites[index];
 			sprite->collision = false;
-			if (sprite->animation.enabled && !sprite->animation.paused)
-				UpdateAnimation(&sprite->animation, frame);
 			index = sprite->list_node.next;
 		}
 	}
 
-	/* tileset animations. calls just once per globally used tileset, avoids duplicate calls */
-	RefList tilesets = { 0 };
-	for (index = 0; index < engine->numlayers; index += 1)
-	{
-		Layer* layer = &engine->layers[index];
-		if (layer->tilemap != NULL)
-		{
-			int ts;
-			for (ts = 0; ts < MAX_TILESETS; ts += 1)
-			{
-				TLN_Tileset tileset = layer->tilemap->tilesets[ts];
-				if (tileset == NULL)
-					break;
+	UpdateTilesetAnimations(engine->time);
 
-				if (tileset->sp != NULL && ref_add(&tilesets, tileset))
-				{
-					int c;
-					for (c = 0; c < tileset->sp->num_sequences; c += 1)
-						UpdateAnimation(&tileset->animations[c], frame);
-				}
-			}
-		}
+	/* advance clock one frame at target fps, keeping remainder for exact pacing */
+	if (!engine->manual_time && engine->target_fps > 0)
+	{
+		const int step = INTERNAL_FPS*TIME_FRAME + engine->frame_rem;
+		engine->time += step / engine->target_fps;
+		engine->frame_rem = step % engine->target_fps;
 	}
 
 	/* frame callback */
@@ -519,6 +532,79 @@ void TLN_UpdateFrame(int frame)
 	TLN_SetLastError(TLN_ERR_OK);
 }
 
+/*!
+ * \brief
+ * Updates the frame like TLN_UpdateFrame() but without drawing it
+ *
+ * \param frame Optional frame number. Set to 0 to autoincrement from previous value
+ *
+ * \remarks
+ * Advances the animation clock, updates sprite, palette and tileset animations, applies world
+ * positions and calls the frame and raster callbacks as TLN_UpdateFrame() does. Per-pixel sprite
+ * collisions are evaluated only for the sprites that have them enabled, and only on the lines they
+ * cover when there isn't a raster callback. Nothing is written to the render target, that isn't
+ * required. Useful for servers, replays, rollback netcode or fast-forwarding game state.
+ *
+ * \see
+ * TLN_UpdateFrame(), TLN_EnableSpriteCollision()
+ */
+void TLN_SimulateFrame(int frame)
+{
+	BeginFrame(frame);
+	SimulateFrame();
+	TLN_SetLastError(TLN_ERR_OK);
+}
+
+/*!
+ * \brief
+ * Advances the animation clock and updates animations, without drawing
+ *
+ * \param usec
+ * Time to advance, in microseconds
+ *
+ * \remarks
+ * Sprite, palette and tileset animations step all the frames that elapsed, so a simulation can
+ * fast-forward animation state in a single call. By default TLN_UpdateFrame() advances the clock
+ * one frame at the target fps. To drive animations from a custom time source instead, like the
+ * real time elapsed between variable refresh rate frames, enable manual time with
+ * TLN_EnableManualTime() and call this function before each TLN_UpdateFrame()
+ *
+ * \see
+ * TLN_EnableManualTime(), TLN_SetTargetFps()
+ */
+void TLN_AdvanceTime (int usec)
+{
+	int64_t step;
+
+	if (usec > 0)
+	{
+		step = (int64_t)usec*INTERNAL_FPS*TIME_FRAME + engine->usec_rem;
+		engine->time += step / 1000000;
+		engine->usec_rem = step % 1000000;
+	}
+
+	UpdateAnimations(engine->time);
+	UpdateTilesetAnimations(engine->time);
+	TLN_SetLastError(TLN_ERR_OK);
+}
+
+/*!
+ * \brief
+ * Enables or disables manual advance of the animation clock
+ *
+ * \param enable
+ * true so the clock only advances with TLN_AdvanceTime(), false to advance it one frame at
+ * the target fps on each TLN_UpdateFrame() (default)
+ *
+ * \see
+ * TLN_AdvanceTime()
+ */
+void TLN_EnableManualTime (bool enable)
+{
+	engine->manual_time = enable;
+	TLN_SetLastError(TLN_ERR_OK);
+}
+
 /*!
  * \brief
  * Returns the number of layers specified during initialisation
@@ -643,7 +729,8 @@ void TLN_DisableBGColor (void)
  * Reference to bitmap for the background. Set NULL to disable
  * 
  * Sets an optional bitmap instead of a solid color where there is no layer or sprite.
- * Unlike tilemaps or sprites, this bitmap cannot be moved and has no transparency
+ * Unlike tilemaps or sprites, this bitmap cannot be moved and has no transparency.
+ * Direct color (32 bpp) bitmaps don't need a palette
  * 
  * \see
  * TLN_SetBGPalette()
@@ -655,6 +742,7 @@ bool TLN_SetBGBitmap (TLN_Bitmap bitmap)
 		if (!CheckBaseObject(bitmap, OT_BITMAP))
 			return false;
 		engine->bgpalette = bitmap->palette;
+		engine->blit_fast = SelectBlitter (bitmap->bpp, false, false, false);
 	}
 	engine->bgbitmap = bitmap;
 	TLN_SetLastError (TLN_ERR_OK);
@@ -800,7 +888,11 @@ const char* const errornames[] =
 	"Resource file has invalid format",
 	"A width or height parameter is invalid",
 	"Unsupported function",
-	"Invalid ObjectList reference"
+	"Invalid ObjectList reference",
+	"Palette index out of range",
+	"Invalid SpriteGroup reference",
+	"Invalid PaletteRamp reference",
+	"Invalid LoadRequest reference",
 };
 
 /*!
@@ -815,12 +907,16 @@ const char* const errornames[] =
  */
 void TLN_SetLastError (TLN_Error error)
 {
-	if (check_context(engine))
+	/* errors raised while loading in background belong to the load request */
+	if (!SetLoaderError(error))
 	{
+		if (!check_context(engine))
+			return;
 		engine->error = error;
-		if (error != TLN_ERR_OK)
-			tln_trace(TLN_LOG_ERRORS, errornames[error]);
 	}
+
+	if (error != TLN_ERR_OK)
+		tln_trace(TLN_LOG_ERRORS, errornames[error]);
 }
 
 /*!
@@ -20,6 +20,7 @@
 #include "Palette.h"
 #include "simplexml.h"
 #include "Bitmap.h"
+#include "Cache.h"
 
 static bool HasTransparentPixels (uint8_t* src, int width);
 
@@ -121,6 +122,9 @@ TLN_Tileset TLN_CreateTileset (int numtiles, int width, int height, TLN_Palette
  *
  * \returns
  * Reference to the created tileset, or NULL if error
+ *
+ * \remarks
+ * Tiles are indexed color only, bitmaps with other depths fail with TLN_ERR_UNSUPPORTED
   */
 
 TLN_Tileset TLN_CreateImageTileset(int numtiles, TLN_TileImage* images)
@@ -128,6 +132,17 @@ TLN_Tileset TLN_CreateImageTileset(int numtiles, TLN_TileImage* images)
 	TLN_Tileset tileset;
 	const int images_size = numtiles * sizeof(TLN_TileImage);
 	const int size = sizeof(struct Tileset) + images_size;
+	int c;
+
+	/* tiles are indexed color only */
+	for (c = 0; images != NULL && c < numtiles; c++)
+	{
+		if (images[c].bitmap != NULL && images[c].bitmap->bpp != 8)
+		{
+			TLN_SetLastError(TLN_ERR_UNSUPPORTED);
+			return NULL;
+		}
+	}
 
 	tileset = (TLN_Tileset)CreateBaseObject(OT_TILESET, size);
 	if (tileset == NULL)
@@ -192,6 +207,81 @@ bool TLN_SetTilesetPixels (TLN_Tileset tileset, int entry, uint8_t* srcdata, int
 		dstdata += tileset->width;
 	}
 
+	/* expand again with new pixels */
+	if (tileset->cache != NULL)
+	{
+		for (c = 0; c < TILECACHE_SLOTS; c++)
+		{
+			if (tileset->cache[c].valid != NULL)
+				tileset->cache[c].valid[entry] = false;
+		}
+	}
+
+	TLN_SetLastError (TLN_ERR_OK);
+	return true;
+}
+
+/* releases all the slots of the tile cache */
+static void delete_cache (TLN_Tileset tileset)
+{
+	int c;
+
+	if (tileset->cache == NULL)
+		return;
+
+	for (c = 0; c < TILECACHE_SLOTS; c++)
+	{
+		free (tileset->cache[c].data);
+		free (tileset->cache[c].valid);
+	}
+	free (tileset->cache);
+	tileset->cache = NULL;
+}
+
+/*!
+ * \brief
+ * Enables or disables the 32 bpp tile cache of a tileset
+ *
+ * \param tileset
+ * Reference to the tileset
+ *
+ * \param enable
+ * true to enable the cache, false to disable it and free its memory
+ *
+ * \remarks
+ * Regular tiles are converted from palette indexes to colors on every pixel drawn. With the
+ * cache enabled, each tile is converted once the first time it's drawn and then copied
+ * directly, at the cost of 4 bytes per pixel for each palette used with the tileset, up to 4
+ * palettes. Tiles are converted again when their palette or their pixels are modified, so it's
+ * best suited for tilesets drawn with palettes that don't change every frame. Only applies
+ * to unscaled tiled layers without per-scanline palette tables
+ *
+ * \see
+ * TLN_SetTilesetPixels()
+ */
+bool TLN_SetTilesetCache (TLN_Tileset tileset, bool enable)
+{
+	if (!CheckBaseObject (tileset, OT_TILESET))
+		return false;
+
+	if (tileset->tstype != TILESET_TILES)
+	{
+		TLN_SetLastError (TLN_ERR_UNSUPPORTED);
+		return false;
+	}
+
+	if (!enable)
+		delete_cache (tileset);
+	else if (tileset->cache == NULL)
+	{
+		tileset->cache = (TileCache*)calloc (TILECACHE_SLOTS, sizeof(TileCache));
+		if (tileset->cache == NULL)
+		{
+			TLN_SetLastError (TLN_ERR_OUT_OF_MEMORY);
+			return false;
+		}
+	}
+
 	TLN_SetLastError (TLN_ERR_OK);
 	return true;
 }
@@ -219,6 +309,7 @@ TLN_Tileset TLN_CloneTileset (TLN_Tileset src)
 	tileset = (TLN_Tileset)CloneBaseObject (src);
 	if (tileset == NULL)
 		return NULL;
+	tileset->cache = NULL;
 
 	const int size_tiles = src->numtiles * sizeof(uint16_t);
 	const int size_color = src->numtiles * src->height;
@@ -238,6 +329,8 @@ TLN_Tileset TLN_CloneTileset (TLN_Tileset src)
 	memcpy(tileset->tiles, src->tiles, size_tiles);
 	memcpy(tileset->color_key, src->color_key, size_color);
 	memcpy(tileset->attributes, src->attributes, size_attributes);
+	if (src->cache != NULL)
+		TLN_SetTilesetCache(tileset, true);
 	TLN_SetLastError(TLN_ERR_OK);
 	return tileset;
 }
@@ -257,19 +350,33 @@ TLN_Tileset TLN_CloneTileset (TLN_Tileset src)
  */
 bool TLN_DeleteTileset (TLN_Tileset tileset)
 {
-	// TODO: implement refcount on cached tilesets, avoid deleting a cached instance
-	return true;
-
 	if (CheckBaseObject (tileset, OT_TILESET))
 	{
+		/* loaded ones are kept until evicted */
+		if (ReleaseCached (tileset))
+		{
+			TLN_SetLastError (TLN_ERR_OK);
+			return true;
+		}
+
 		if (ObjectOwner (tileset))
 		{
 			TLN_DeletePalette (tileset->palette);
 			TLN_DeleteSequencePack (tileset->sp);
+			if (tileset->owns_images)
+			{
+				int c;
+				for (c = 0; c < tileset->numtiles; c += 1)
+				{
+					if (tileset->images[c].bitmap != NULL)
+						TLN_DeleteBitmap (tileset->images[c].bitmap);
+				}
+			}
 		}
 		free(tileset->tiles);
 		free(tileset->color_key);
 		free(tileset->attributes);
+		delete_cache(tileset);
 		if (tileset->animations)
 			free(tileset->animations);
 
@@ -403,6 +510,75 @@ TLN_Bitmap GetTilesetBitmap(TLN_Tileset tileset, int tileid)
 	return NULL;
 }
 
+/* returns 32 bpp pixels of a tile expanded with given palette, or NULL if not available.
+ * Color 0 becomes transparent (alpha 0), other colors are solid. When all slots are taken,
+ * the least recently used one is replaced, unless it's already used in the current frame */
+uint32_t* GetCachedTile(TLN_Tileset tileset, TLN_Palette palette, int index, int frame)
+{
+	const int size = tileset->width * tileset->height;
+	TileCache* slot = NULL;
+	TileCache* oldest = NULL;
+	uint32_t* dst;
+	int c;
+
+	/* search palette, free slot or least recently used one */
+	for (c = 0; c < TILECACHE_SLOTS; c++)
+	{
+		TileCache* cache = &tileset->cache[c];
+		if (cache->palette == palette)
+		{
+			slot = cache;
+			break;
+		}
+		if (slot == NULL && cache->palette == NULL)
+			slot = cache;
+		if (oldest == NULL || cache->frame < oldest->frame)
+			oldest = cache;
+	}
+	if (slot == NULL && oldest->frame != frame)
+		slot = oldest;
+	if (slot == NULL)
+		return NULL;
+	slot->frame = frame;
+
+	if (slot->palette != palette)
+	{
+		if (slot->data == NULL)
+		{
+			slot->data = (uint32_t*)malloc (tileset->numtiles * size * sizeof(uint32_t));
+			slot->valid = (bool*)malloc (tileset->numtiles * sizeof(bool));
+			if (slot->data == NULL || slot->valid == NULL)
+			{
+				free (slot->data);
+				free (slot->valid);
+				slot->data = NULL;
+				slot->valid = NULL;
+				return NULL;
+			}
+		}
+		slot->palette = palette;
+		slot->version = palette->version - 1;
+	}
+
+	/* palette modified, all tiles are stale */
+	if (slot->version != palette->version)
+	{
+		memset (slot->valid, 0, tileset->numtiles * sizeof(bool));
+		slot->version = palette->version;
+	}
+
+	dst = slot->data + index*size;
+	if (!slot->valid[index])
+	{
+		const uint32_t* colors = (const uint32_t*)palette->data;
+		const uint8_t* src = &tileset->data[index*size];
+		for (c = 0; c < size; c++)
+			dst[c] = src[c] != 0 ? colors[src[c]] | 0xFF000000 : 0;
+		slot->valid[index] = true;
+	}
+	return dst;
+}
+
 /* devuelve si la lnea usa color key */
 static bool HasTransparentPixels (uint8_t* src, int width)
 {
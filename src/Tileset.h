@@ -26,6 +26,19 @@ typedef enum
 }
 TilesetType;
 
+/* tiles expanded to 32 bpp with one palette */
+#define TILECACHE_SLOTS	4
+
+typedef struct
+{
+	TLN_Palette palette;	/* palette used for expansion, NULL if slot is free */
+	uint32_t version;		/* palette version at expansion time, unique so a deleted palette never matches */
+	uint32_t* data;			/* expanded pixels, same layout as tileset pixels */
+	bool* valid;			/* tiles already expanded */
+	int frame;				/* last frame the slot was used, for replacement */
+}
+TileCache;
+
 /* Tileset definition */
 struct Tileset
 {
@@ -43,10 +56,13 @@ struct Tileset
 	TLN_Palette palette;	 /* palette */
 	TLN_SequencePack sp;	 /* associated sequences (if any) */
 	Animation* animations;	 /* active tile animations */
+	int64_t	next_animation;	 /* time when next tile animation is due */
 	TLN_TileImage* images;	/* image tiles array */
+	bool	owns_images;	 /* bitmaps in images[] were loaded with the tileset and are deleted with it */
 	TLN_TileAttributes* attributes;	/* attribute array */
 	bool* color_key;		 /* array telling if each line has color key or is solid */
 	uint16_t* tiles;		/* tile indexes for animation */
+	TileCache* cache;		/* optional 32 bpp tile cache, TILECACHE_SLOTS palettes */
 	uint8_t	data[];			 /* variable size data for images[], attributes[], color_key[] and pixels */
 };
 
@@ -57,5 +73,7 @@ struct Tileset
 	tileset->data[(((index << tileset->vshift) + y) << tileset->hshift) + x]
 
 TLN_Bitmap GetTilesetBitmap(TLN_Tileset tileset, int tileid);
+uint32_t* GetCachedTile(TLN_Tileset tileset, TLN_Palette palette, int index, int frame);
+void LoadTilesets(int count, const char* const* filenames, TLN_Tileset* tilesets);
 
 #endif
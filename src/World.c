@@ -1,9 +1,15 @@
+#include <stdlib.h>
+#include <string.h>
 #include "Tilengine.h"
 #include "Engine.h"
 #include "Layer.h"
 #include "Sprite.h"
 #include "LoadTMX.h"
 #include "Palette.h"
+#include "Bitmap.h"
+#include "Tilemap.h"
+#include "Cache.h"
+#include "World.h"
 
 #define MAX_TMX_ITEM	100
 
@@ -11,26 +17,106 @@
 static TMXInfo tmxinfo;
 static int first;
 
-/*!
- * \brief Loads and assigns complete TMX file
- * \param filename TMX file to load
- * \param first_layer Starting layer number where place the loaded tmx
- */
-bool TLN_LoadWorld(const char* filename, int first_layer)
+/* loads all resources of a tmx file without touching engine state */
+WorldContent* LoadWorldContent(const char* filename)
 {
+	TLN_Tileset tilesets[TMX_MAX_TILESET] = { 0 };
+	const char* images[MAX_TMX_ITEM];
+	TLN_Bitmap bitmaps[MAX_TMX_ITEM];
+	int num_images = 0;
+	WorldContent* world;
 	int c;
 
-	if (!TMXLoad(filename, &tmxinfo))
+	world = (WorldContent*)calloc(1, sizeof(WorldContent));
+	if (world == NULL)
+	{
+		TLN_SetLastError(TLN_ERR_OUT_OF_MEMORY);
+		return NULL;
+	}
+
+	if (!TMXLoadContent(filename, &world->info))
+	{
+		free(world);
 		return NULL;
+	}
+
+	if (world->info.num_layers > MAX_TMX_ITEM)
+		world->info.num_layers = MAX_TMX_ITEM;
+
+	/* tilesets shared by all layers */
+	TMXLoadTilesets(&world->info, filename, tilesets);
+
+	/* images of bitmap layers, decoded in parallel */
+	for (c = 0; c < world->info.num_layers; c += 1)
+	{
+		if (world->info.layers[c].type == LAYER_BITMAP)
+			images[num_images++] = world->info.layers[c].image;
+	}
+	if (num_images > 0)
+		LoadBitmaps(num_images, images, bitmaps);
+	num_images = 0;
+
+	for (c = 0; c < world->info.num_layers; c += 1)
+	{
+		TMXLayer* tmxlayer = &world->info.layers[c];
+		switch (tmxlayer->type)
+		{
+		case LAYER_NONE:
+			break;
+
+		case LAYER_TILE:
+			if (tmxlayer->data != NULL || tmxlayer->chunks != NULL)
+			{
+				TLN_Tilemap tilemap = TMXCreateTilemap(&world->info, tmxlayer, tmxlayer->data, tilesets);
+				int t;
+
+				/* each tilemap releases its tilesets when deleted */
+				for (t = 0; tilemap != NULL && t < tilemap->num_tilesets; t += 1)
+					RetainCached(tilemap->tilesets[t]);
+				world->items[c] = tilemap;
+			}
+			break;
 
-	if (tmxinfo.num_layers > MAX_TMX_ITEM)
-		tmxinfo.num_layers = MAX_TMX_ITEM;
+		case LAYER_OBJECT:
+			if (tmxlayer->objects != NULL)
+			{
+				const int suitable = TMXSetupObjectList(&world->info, tmxlayer->objects, tilesets);
+				if (suitable >= 0)
+					RetainCached(tilesets[suitable]);
+				world->items[c] = tmxlayer->objects;
+				tmxlayer->objects = NULL;
+			}
+			break;
 
-	/* load and assign each layer type */
+		case LAYER_BITMAP:
+			world->items[c] = bitmaps[num_images++];
+			break;
+		}
+	}
+
+	/* layers hold their own references */
+	for (c = 0; c < world->info.num_tilesets; c += 1)
+	{
+		if (tilesets[c] != NULL)
+			TLN_DeleteTileset(tilesets[c]);
+	}
+
+	/* tilemaps keep their own copy of layer data */
+	TMXReleaseContent(&world->info);
+	return world;
+}
+
+/* assigns resources loaded with LoadWorldContent() to layers, and releases world */
+void SetupWorld(WorldContent* world, int first_layer)
+{
+	int c;
+
+	memcpy(&tmxinfo, &world->info, sizeof(TMXInfo));
 	first = first_layer;
 	for (c = 0; c < tmxinfo.num_layers; c += 1)
 	{
 		TMXLayer* tmxlayer = &tmxinfo.layers[c];
+		void* item = world->items[c];
 		const int layerindex = tmxinfo.num_layers - c - 1 + first;
 		switch (tmxlayer->type)
 		{
@@ -38,25 +124,18 @@ bool TLN_LoadWorld(const char* filename, int first_layer)
 			break;
 
 		case LAYER_TILE:
-		{
-			TLN_Tilemap tilemap = TLN_LoadTilemap(filename, tmxlayer->name);
-			TLN_SetLayerTilemap(layerindex, tilemap);
-		}
-		break;
+			if (item != NULL)
+				TLN_SetLayerTilemap(layerindex, (TLN_Tilemap)item);
+			break;
 
 		case LAYER_OBJECT:
-		{
-			TLN_ObjectList objectlist = TLN_LoadObjectList(filename, tmxlayer->name);
-			TLN_SetLayerObjects(layerindex, objectlist, NULL);
-		}
-		break;
+			if (item != NULL)
+				TLN_SetLayerObjects(layerindex, (TLN_ObjectList)item, NULL);
+			break;
 
 		case LAYER_BITMAP:
-		{
-			TLN_Bitmap bitmap = TLN_LoadBitmap(tmxlayer->image);
-			TLN_SetLayerBitmap(layerindex, bitmap);
-		}
-		break;
+			TLN_SetLayerBitmap(layerindex, (TLN_Bitmap)item);
+			break;
 		}
 
 		/* direct set of layer properties */
@@ -92,6 +171,25 @@ bool TLN_LoadWorld(const char* filename, int first_layer)
 	}
 	else
 		TLN_DisableBGColor();
+
+	free(world);
+}
+
+/*!
+ * \brief Loads and assigns complete TMX file
+ * \param filename TMX file to load
+ * \param first_layer Starting layer number where place the loaded tmx
+ * \remarks The file is read and parsed once for all its layers, and each referenced tileset is
+ * loaded once and shared by all the layers that use it
+ * \sa TLN_LoadWorldAsync
+ */
+bool TLN_LoadWorld(const char* filename, int first_layer)
+{
+	WorldContent* world = LoadWorldContent(filename);
+	if (world == NULL)
+		return false;
+
+	SetupWorld(world, first_layer);
 	return true;
 }
 
@@ -0,0 +1,27 @@
+/*
+* Tilengine - The 2D retro graphics engine with raster effects
+* Copyright (C) 2015-2019 Marc Palacios Domenech <mailto:megamarc@hotmail.com>
+* All rights reserved
+*
+* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/.
+* */
+
+#ifndef _WORLD_H
+#define _WORLD_H
+
+#include "LoadTMX.h"
+
+/* resources of a world, loaded but not assigned to layers yet */
+typedef struct
+{
+	TMXInfo info;
+	void* items[TMX_MAX_LAYER];	/* tilemap, object list or bitmap of each layer */
+}
+WorldContent;
+
+WorldContent* LoadWorldContent(const char* filename);
+void SetupWorld(WorldContent* world, int first_layer);
+
+#endif
@@ -213,6 +213,33 @@ long simpleXmlGetLineNumber (SimpleXmlParser parser) {
 	return ((SimpleXmlParserState) parser)->nInputLineNumber + 1;
 }
 
+const char* simpleXmlTakeRawContent (SimpleXmlParser parser, long* nLength) {
+	SimpleXmlParserState state= (SimpleXmlParserState) parser;
+	const char *sStart, *sEnd, *sLine;
+	*nLength= 0;
+	if (
+		state == NULL ||
+		state->nNextToken != TAG_BEGIN_CLOSING ||
+		state->nInputDataPos >= state->nInputDataSize
+	) {
+		return NULL;
+	}
+	sStart= state->sInputData + state->nInputDataPos;
+	sEnd= (const char*) memchr(sStart, '<', state->nInputDataSize - state->nInputDataPos);
+	if (sEnd == NULL) {
+		sEnd= state->sInputData + state->nInputDataSize;
+	}
+	/* keep line number for error descriptions */
+	sLine= (const char*) memchr(sStart, LF, sEnd - sStart);
+	while (sLine != NULL) {
+		state->nInputLineNumber++;
+		sLine= (const char*) memchr(sLine + 1, LF, sEnd - sLine - 1);
+	}
+	state->nInputDataPos+= (long) (sEnd - sStart);
+	*nLength= (long) (sEnd - sStart);
+	return sStart;
+}
+
 void simpleXmlParseAbort (SimpleXmlParser parser, int nErrorCode) {
 	if (parser == NULL || nErrorCode < SIMPLE_XML_USER_ERROR) {
 		return;
@@ -154,6 +154,22 @@ const char* simpleXmlGetErrorDescription (SimpleXmlParser parser);
  */
 long simpleXmlGetLineNumber (SimpleXmlParser parser);
 
+/**
+ * Takes the raw content of the tag being parsed, up to the next markup.
+ *
+ * This method may only be called from a tag handler on FINISH_ATTRIBUTES.
+ *
+ * The content isn't copied nor sent with ADD_CONTENT, the parser
+ * continues after it. Entities (&amp;...) aren't replaced, so it's
+ * meant for bulk data like base64 or comma separated values.
+ *
+ * @param parser the parser from which to take the content.
+ * @param nLength receives the length of the content in characters.
+ * @return pointer to the content inside the input data, not zero
+ * terminated, or NULL if the tag has no content.
+ */
+const char* simpleXmlTakeRawContent (SimpleXmlParser parser, long* nLength);
+
 /**
  * Minimum value for a user abort.
  * @see #simpleXmlParseAbort
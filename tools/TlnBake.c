@@ -0,0 +1,55 @@
+/*
+* Tilengine - The 2D retro graphics engine with raster effects
+* Copyright (C) 2015-2019 Marc Palacios Domenech <mailto:megamarc@hotmail.com>
+* All rights reserved
+*
+* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/.
+* */
+
+/* Offline converter from source assets to baked binary files:
+ *   TlnBake map.tmx map.tlb [layer]	tilemap layer with its tilesets
+ *   TlnBake sprites sprites.tlb		spriteset with its bitmap
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "Tilengine.h"
+
+static bool is_tmx (const char* filename)
+{
+	const size_t len = strlen (filename);
+	return len > 4 && !strcmp (filename + len - 4, ".tmx");
+}
+
+int main (int argc, char* argv[])
+{
+	bool ok;
+
+	if (argc < 3)
+	{
+		printf ("usage: TlnBake <file.tmx> <output> [layer]\n");
+		printf ("       TlnBake <spriteset> <output>\n");
+		return 1;
+	}
+
+	TLN_Init (16, 16, 1, 1, 0);
+	TLN_SetLogLevel (TLN_LOG_ERRORS);
+
+	if (is_tmx (argv[1]))
+	{
+		TLN_Tilemap tilemap = TLN_LoadTilemap (argv[1], argc > 3 ? argv[3] : NULL);
+		ok = tilemap != NULL && TLN_SaveBakedTilemap (tilemap, argv[2]);
+	}
+	else
+	{
+		TLN_Spriteset spriteset = TLN_LoadSpriteset (argv[1]);
+		ok = spriteset != NULL && TLN_SaveBakedSpriteset (spriteset, argv[2]);
+	}
+
+	if (!ok)
+		printf ("TlnBake: %s: %s\n", argv[1], TLN_GetErrorString (TLN_GetLastError ()));
+	TLN_Deinit ();
+	return ok ? 0 : 1;
+}